@@ -0,0 +1,58 @@
+#include "Autosave.h"
+using namespace std;
+
+void Autosave::Start(const wstring& file, int seconds) {
+    Stop();
+    path = file;
+    interval = seconds;
+    last = Clock::now();
+    quit = false;
+    if (interval > 0)
+        thread = std::thread(&Autosave::Run, this);
+}
+
+void Autosave::Tick(const TileHistory& history, const DocumentInfo& state) {
+    if (interval <= 0 || history.Version() == version)
+        return;
+    Clock::time_point now = Clock::now();
+    if (now - last < chrono::seconds(interval))
+        return;
+    {
+        lock_guard<std::mutex> lock(mutex);
+        if (busy)
+            return;
+        pending = history.Snapshot();
+        info = state;
+        busy = true;
+    }
+    version = history.Version();
+    last = now;
+    wake.notify_one();
+}
+
+void Autosave::Stop() {
+    {
+        lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wake.notify_one();
+    if (thread.joinable())
+        thread.join();
+}
+
+void Autosave::Run() {
+    unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        wake.wait(lock, [this] { return pending || quit; });
+        if (!pending)
+            return;
+        shared_ptr<const TileSource> tiles = std::move(pending);
+        pending = nullptr;
+        DocumentInfo state = info;
+        lock.unlock();
+        CanvasDocument::Export(path.c_str(), *tiles, state);
+        tiles = nullptr;
+        lock.lock();
+        busy = false;
+    }
+}
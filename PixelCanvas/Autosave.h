@@ -0,0 +1,49 @@
+#ifndef AUTOSAVE_H
+#define AUTOSAVE_H
+
+#include <windows.h>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "Document.h"
+#include "History.h"
+
+// Keeps a recovery document of the canvas without holding up drawing. Tick,
+// called on the render thread after each job, takes a snapshot of the undo
+// history once the interval has passed and the canvas has changed; that
+// copies a pointer per stored tile. A worker thread then packs the snapshot
+// and replaces the file through a rename, so a crash mid-write leaves the
+// previous autosave intact. A snapshot is not taken while the last one is
+// still being written.
+class Autosave {
+public:
+    Autosave() : interval(0), version(0), busy(false), quit(false) {}
+    ~Autosave() { Stop(); }
+
+    // Zero seconds turns autosave off.
+    void Start(const std::wstring& path, int seconds);
+    void Tick(const TileHistory& history, const DocumentInfo& info);
+    // Lets a write in progress finish and ends the worker.
+    void Stop();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    void Run();
+
+    std::wstring path;
+    int interval;
+    Clock::time_point last;
+    unsigned version;
+    std::shared_ptr<const TileSource> pending;
+    DocumentInfo info;
+    bool busy, quit;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::thread thread;
+};
+
+#endif
@@ -0,0 +1,90 @@
+#include "Blend.h"
+#include <cmath>
+#include <emmintrin.h>
+
+static WORD toLinear[256];
+static BYTE toSrgb[4096];
+
+static struct GammaTables {
+    GammaTables() {
+        for (int i = 0; i < 256; ++i) {
+            double c = i / 255.0;
+            double l = c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+            toLinear[i] = (WORD)(l * 4095.0 + 0.5);
+        }
+        for (int i = 0; i < 4096; ++i) {
+            double l = i / 4095.0;
+            double c = l <= 0.0031308 ? l * 12.92 : 1.055 * pow(l, 1.0 / 2.4) - 0.055;
+            toSrgb[i] = (BYTE)(c * 255.0 + 0.5);
+        }
+    }
+} gammaTables;
+
+static inline int CoverageWeight(int coverage) {
+    return coverage + (coverage >> 7);
+}
+
+// A pixel that is not opaque, on a layer above the bottom one, is
+// premultiplied; it gets the plain weighted sum, which keeps it so.
+void BlendPixel(BYTE* pixel, COLORREF c, int coverage) {
+    int w = CoverageWeight(coverage);
+    BYTE src[3] = { GetBValue(c), GetGValue(c), GetRValue(c) };
+    if (pixel[3] != 255) {
+        for (int ch = 0; ch < 3; ++ch)
+            pixel[ch] = (BYTE)((src[ch] * w + pixel[ch] * (256 - w)) >> 8);
+        pixel[3] = (BYTE)((255 * w + pixel[3] * (256 - w)) >> 8);
+        return;
+    }
+    for (int ch = 0; ch < 3; ++ch) {
+        int d = toLinear[pixel[ch]];
+        int s = toLinear[src[ch]];
+        pixel[ch] = toSrgb[(d * (256 - w) + s * w) >> 8];
+    }
+    pixel[3] = 255;
+}
+
+BlendBatch::BlendBatch(COLORREF c) : count(0), color(c) {
+    srcLinear[0] = toLinear[GetBValue(c)];
+    srcLinear[1] = toLinear[GetGValue(c)];
+    srcLinear[2] = toLinear[GetRValue(c)];
+}
+
+// Each madd lane pairs a destination value with the source value and their
+// weights, so one instruction produces the blended channel for four pixels.
+void BlendBatch::Flush() {
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        BYTE* p0 = pixels[i];
+        BYTE* p1 = pixels[i + 1];
+        BYTE* p2 = pixels[i + 2];
+        BYTE* p3 = pixels[i + 3];
+        if ((p0[3] & p1[3] & p2[3] & p3[3]) != 255) {
+            for (int k = i; k < i + 4; ++k)
+                BlendPixel(pixels[k], color, coverages[k]);
+            continue;
+        }
+        int w0 = CoverageWeight(coverages[i]);
+        int w1 = CoverageWeight(coverages[i + 1]);
+        int w2 = CoverageWeight(coverages[i + 2]);
+        int w3 = CoverageWeight(coverages[i + 3]);
+        __m128i weights = _mm_setr_epi16((short)(256 - w0), (short)w0, (short)(256 - w1), (short)w1,
+                                         (short)(256 - w2), (short)w2, (short)(256 - w3), (short)w3);
+        for (int ch = 0; ch < 3; ++ch) {
+            short s = (short)srcLinear[ch];
+            __m128i v = _mm_setr_epi16((short)toLinear[p0[ch]], s, (short)toLinear[p1[ch]], s,
+                                       (short)toLinear[p2[ch]], s, (short)toLinear[p3[ch]], s);
+            __m128i blended = _mm_srli_epi32(_mm_madd_epi16(v, weights), 8);
+            int out[4];
+            _mm_storeu_si128((__m128i*)out, blended);
+            p0[ch] = toSrgb[out[0]];
+            p1[ch] = toSrgb[out[1]];
+            p2[ch] = toSrgb[out[2]];
+            p3[ch] = toSrgb[out[3]];
+        }
+        p0[3] = p1[3] = p2[3] = p3[3] = 255;
+    }
+    for (; i < count; ++i) {
+        BlendPixel(pixels[i], color, coverages[i]);
+    }
+    count = 0;
+}
@@ -0,0 +1,37 @@
+#ifndef BLEND_H
+#define BLEND_H
+
+#include <windows.h>
+
+// Gamma-correct coverage blending of a solid color into BGRA pixels.
+// Coverage is 0..255; blending happens on 12-bit linear-light values
+// looked up from precomputed sRGB tables. Pixels that are not opaque are
+// taken as premultiplied and blended linearly.
+void BlendPixel(BYTE* pixel, COLORREF c, int coverage);
+
+// Queues coverage writes and blends them four pixels per SSE2 operation.
+// Pixels queued between flushes must be distinct.
+class BlendBatch {
+public:
+    explicit BlendBatch(COLORREF c);
+    ~BlendBatch() { Flush(); }
+
+    void Add(BYTE* pixel, int coverage) {
+        if (count == Capacity) Flush();
+        pixels[count] = pixel;
+        coverages[count] = coverage;
+        count++;
+    }
+    void Flush();
+    COLORREF Color() const { return color; }
+
+private:
+    static const int Capacity = 64;
+    BYTE* pixels[Capacity];
+    int coverages[Capacity];
+    int count;
+    COLORREF color;
+    int srcLinear[3];
+};
+
+#endif
@@ -0,0 +1,145 @@
+#include "BmpReader.h"
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <emmintrin.h>
+#include <thread>
+#include <vector>
+#include "Dirty.h"
+using namespace std;
+
+static const int BandRows = SparseSurface::TileSize;
+
+static DWORD Read16(const BYTE* p) { return p[0] | (p[1] << 8); }
+static DWORD Read32(const BYTE* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((DWORD)p[3] << 24); }
+
+// Fields are read bytewise since nothing after the 14-byte file header is
+// guaranteed to be aligned.
+bool ParseBmp(const BYTE* data, size_t size, BmpImage& image) {
+    const size_t fileHeader = 14;
+    if (!data || size < fileHeader + 40 || data[0] != 'B' || data[1] != 'M')
+        return false;
+    const BYTE* info = data + fileHeader;
+    DWORD infoSize = Read32(info);
+    if (infoSize < 40 || infoSize > size - fileHeader)
+        return false;
+    int width = (int)Read32(info + 4), height = (int)Read32(info + 8);
+    int bitCount = (int)Read16(info + 14);
+    DWORD compression = Read32(info + 16);
+    if (Read16(info + 12) != 1 || (bitCount != 24 && bitCount != 32))
+        return false;
+    if (compression == BI_BITFIELDS) {
+        // The masks follow a 40-byte header and sit inside the later ones.
+        if (bitCount != 32 || fileHeader + 40 + 12 > size)
+            return false;
+        const BYTE* masks = info + 40;
+        if (Read32(masks) != 0x00FF0000 || Read32(masks + 4) != 0x0000FF00 || Read32(masks + 8) != 0x000000FF)
+            return false;
+    }
+    else if (compression != BI_RGB)
+        return false;
+    if (width <= 0 || height == 0 || height == INT_MIN)
+        return false;
+
+    // The last row may leave out its padding.
+    unsigned long long rows = (unsigned long long)abs(height);
+    unsigned long long rowBytes = (unsigned long long)width * (bitCount / 8);
+    unsigned long long stride = (rowBytes + 3) & ~3ULL;
+    DWORD offset = Read32(data + 10);
+    if (offset > size || (rows - 1) * stride + rowBytes > size - offset)
+        return false;
+
+    image.bits = data + offset;
+    image.width = width;
+    image.height = (int)rows;
+    image.bitCount = bitCount;
+    image.topDown = height < 0;
+    image.stride = (size_t)stride;
+    return true;
+}
+
+void ConvertBmpRow(const BmpImage& image, int y, int x, DWORD* out, int n) {
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    int i = 0;
+    if (image.bitCount == 32) {
+        const BYTE* src = image.Row(y) + (size_t)x * 4;
+        for (; i + 4 <= n; i += 4)
+            _mm_storeu_si128((__m128i*)(out + i), _mm_or_si128(_mm_loadu_si128((const __m128i*)(src + i * 4)), alpha));
+        for (; i < n; i++)
+            out[i] = Read32(src + i * 4) | 0xFF000000;
+        return;
+    }
+
+    // Four pixels at a time from a 16-byte load: pixel k moves up k bytes to
+    // start its own lane, and the fourth byte of each lane becomes alpha. The
+    // load reads into the next two pixels, so the last pixels of the run are
+    // done one by one and never touch bytes past the row.
+    const BYTE* src = image.Row(y) + (size_t)x * 3;
+    const __m128i lane0 = _mm_setr_epi32(0x00FFFFFF, 0, 0, 0);
+    const __m128i lane1 = _mm_setr_epi32(0, 0x00FFFFFF, 0, 0);
+    const __m128i lane2 = _mm_setr_epi32(0, 0, 0x00FFFFFF, 0);
+    const __m128i lane3 = _mm_setr_epi32(0, 0, 0, 0x00FFFFFF);
+    for (; i + 6 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i * 3));
+        __m128i p = _mm_or_si128(_mm_and_si128(v, lane0), _mm_and_si128(_mm_slli_si128(v, 1), lane1));
+        p = _mm_or_si128(p, _mm_and_si128(_mm_slli_si128(v, 2), lane2));
+        p = _mm_or_si128(p, _mm_and_si128(_mm_slli_si128(v, 3), lane3));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_or_si128(p, alpha));
+    }
+    for (; i < n; i++) {
+        const BYTE* p = src + i * 3;
+        out[i] = p[0] | (p[1] << 8) | (p[2] << 16) | 0xFF000000;
+    }
+}
+
+// Bands are one tile row high, so no two workers touch the same tile of a
+// tiled, palette or sparse canvas.
+void DrawBmp(const BmpImage& image, const RenderTarget& target, DirtyTracker& dirty, int threads) {
+    int width = min(image.width, target.Width()), height = min(image.height, target.Height());
+    if (!image.bits || width <= 0 || height <= 0)
+        return;
+    int bands = (height + BandRows - 1) / BandRows;
+    if (threads <= 0)
+        threads = (int)thread::hardware_concurrency();
+    threads = max(1, min(threads, bands));
+
+    atomic<int> next(0);
+    auto work = [&] {
+        vector<DWORD> row;
+        for (;;) {
+            int band = next++;
+            if (band >= bands)
+                break;
+            int y0 = band * BandRows, y1 = min(height, y0 + BandRows);
+            if (target.layout == TARGET_LINEAR && target.format == FORMAT_BGRA32) {
+                for (int y = y0; y < y1; y++)
+                    ConvertBmpRow(image, y, 0, (DWORD*)target.linear.Row(y), width);
+            }
+            else if (target.layout == TARGET_SPARSE) {
+                const int mask = SparseSurface::TileSize - 1;
+                for (int x = 0; x < width; x += SparseSurface::TileSize) {
+                    int n = min(SparseSurface::TileSize, width - x);
+                    DWORD* tile = target.sparse->TileForWrite(x >> SparseSurface::TileShift, band);
+                    for (int y = y0; y < y1; y++)
+                        ConvertBmpRow(image, y, x, tile + ((y & mask) << SparseSurface::TileShift), n);
+                }
+            }
+            else {
+                row.resize(width);
+                WithTarget(target, [&](auto& t) {
+                    for (int y = y0; y < y1; y++) {
+                        ConvertBmpRow(image, y, 0, row.data(), width);
+                        t.StoreBgra(0, y, row.data(), width);
+                    }
+                });
+            }
+        }
+    };
+    vector<thread> workers;
+    for (int i = 0; i < threads; i++)
+        workers.emplace_back(work);
+    for (thread& t : workers)
+        t.join();
+    dirty.Mark(0, 0, width - 1, height - 1);
+}
@@ -0,0 +1,38 @@
+#ifndef BMPREADER_H
+#define BMPREADER_H
+
+#include <windows.h>
+#include "Dirty.h"
+#include "Target.h"
+
+// View of the pixel rows inside a BMP file held in memory (normally a mapped
+// file). Nothing is copied; rows point straight into the file data.
+struct BmpImage {
+    const BYTE* bits;
+    int width, height;
+    int bitCount;
+    bool topDown;
+    size_t stride;
+
+    BmpImage() : bits(nullptr), width(0), height(0), bitCount(0), topDown(false), stride(0) {}
+
+    const BYTE* Row(int y) const { return bits + (size_t)(topDown ? y : height - 1 - y) * stride; }
+};
+
+// Accepts uncompressed 24 and 32-bit files of any size, bottom-up or
+// top-down, with any info header version (32-bit bitfields only in the plain
+// BGRA layout). Fails without touching image if the file is anything else or
+// is too short for the rows it declares.
+bool ParseBmp(const BYTE* data, size_t size, BmpImage& image);
+
+// Converts n pixels of row y, starting at column x, to opaque BGRA.
+void ConvertBmpRow(const BmpImage& image, int y, int x, DWORD* out, int n);
+
+// Draws the image with its top-left corner at the target origin, clipped to
+// the target, and marks the covered tiles in dirty. Bands of 64 rows are
+// converted in parallel straight into BGRA canvas rows or sparse tiles; other
+// layouts and formats take each row through a small buffer. threads <= 0
+// uses every core.
+void DrawBmp(const BmpImage& image, const RenderTarget& target, DirtyTracker& dirty, int threads = 0);
+
+#endif
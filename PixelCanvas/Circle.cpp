@@ -1,124 +1,194 @@
 #include "Circle.h"
 #include <cmath>
-#include <cstdlib>
 #include "PixelCanvas.h"
+#include "RenderContext.h"
 
-extern bool clipWindowSet;
-extern int clipMinX, clipMaxX, clipMinY, clipMaxY;
+Circle::Circle(RenderContext& ctx) : ctx(ctx), line(ctx), clipPixels(false) {}
 
-Circle::Circle(HDC hdc) : hdc(hdc), line(hdc) {}
+// A window wholly inside or outside the ring the outline is drawn in, such as
+// a tile of the circle's interior, is skipped.
+bool Circle::BeginCircle(int xc, int yc, int R) {
+    ClipResult r = ClassifyClip(ctx, xc - R, yc - R, xc + R, yc + R);
+    clipPixels = (r == CLIP_PARTIAL);
+    if (r == CLIP_OUTSIDE || MissesOutline(ctx.ClipWindow(), xc, yc, R, R, 2)) return false;
+    MarkDrawn(ctx, xc - R, yc - R, xc + R, yc + R);
+    return true;
+}
 
-void Circle::Draw8Points(int xc, int yc, int x, int y, COLORREF c) {
-    if (!clipWindowSet || (xc + x >= clipMinX && xc + x <= clipMaxX && yc + y >= clipMinY && yc + y <= clipMaxY)) SetPixel(hdc, xc + x, yc + y, c);
-    if (!clipWindowSet || (xc - x >= clipMinX && xc - x <= clipMaxX && yc + y >= clipMinY && yc + y <= clipMaxY)) SetPixel(hdc, xc - x, yc + y, c);
-    if (!clipWindowSet || (xc + x >= clipMinX && xc + x <= clipMaxX && yc - y >= clipMinY && yc - y <= clipMaxY)) SetPixel(hdc, xc + x, yc - y, c);
-    if (!clipWindowSet || (xc - x >= clipMinX && xc - x <= clipMaxX && yc - y >= clipMinY && yc - y <= clipMaxY)) SetPixel(hdc, xc - x, yc - y, c);
-    if (!clipWindowSet || (xc + y >= clipMinX && xc + y <= clipMaxX && yc + x >= clipMinY && yc + x <= clipMaxY)) SetPixel(hdc, xc + y, yc + x, c);
-    if (!clipWindowSet || (xc - y >= clipMinX && xc - y <= clipMaxX && yc + x >= clipMinY && yc + x <= clipMaxY)) SetPixel(hdc, xc - y, yc + x, c);
-    if (!clipWindowSet || (xc + y >= clipMinX && xc + y <= clipMaxX && yc - x >= clipMinY && yc - x <= clipMaxY)) SetPixel(hdc, xc + y, yc - x, c);
-    if (!clipWindowSet || (xc - y >= clipMinX && xc - y <= clipMaxX && yc - x >= clipMinY && yc - x <= clipMaxY)) SetPixel(hdc, xc - y, yc - x, c);
+template <class Plot>
+static void Draw8Points(const Plot& plot, int xc, int yc, int x, int y) {
+    plot(xc + x, yc + y);
+    plot(xc - x, yc + y);
+    plot(xc + x, yc - y);
+    plot(xc - x, yc - y);
+    plot(xc + y, yc + x);
+    plot(xc - y, yc + x);
+    plot(xc + y, yc - x);
+    plot(xc - y, yc - x);
 }
-void Circle::Draw2Points(int xc, int yc, int x, int y, COLORREF c, int quarter) {
-    switch (quarter) {
-        case 1:  
-            if (!clipWindowSet || (xc + x >= clipMinX && xc + x <= clipMaxX && yc - y >= clipMinY && yc - y <= clipMaxY)) SetPixel(hdc, xc + x, yc - y, c);
-            if (!clipWindowSet || (xc + y >= clipMinX && xc + y <= clipMaxX && yc - x >= clipMinY && yc - x <= clipMaxY)) SetPixel(hdc, xc + y, yc - x, c);
-            break;
-        case 2:  
-            if (!clipWindowSet || (xc - x >= clipMinX && xc - x <= clipMaxX && yc - y >= clipMinY && yc - y <= clipMaxY)) SetPixel(hdc, xc - x, yc - y, c);
-            if (!clipWindowSet || (xc - y >= clipMinX && xc - y <= clipMaxX && yc - x >= clipMinY && yc - x <= clipMaxY)) SetPixel(hdc, xc - y, yc - x, c);
-            break;
-        case 3:  
-            if (!clipWindowSet || (xc - x >= clipMinX && xc - x <= clipMaxX && yc + y >= clipMinY && yc + y <= clipMaxY)) SetPixel(hdc, xc - x, yc + y, c);
-            if (!clipWindowSet || (xc - y >= clipMinX && xc - y <= clipMaxX && yc + x >= clipMinY && yc + x <= clipMaxY)) SetPixel(hdc, xc - y, yc + x, c);
-            break;
-        case 4:  
-            if (!clipWindowSet || (xc + x >= clipMinX && xc + x <= clipMaxX && yc + y >= clipMinY && yc + y <= clipMaxY)) SetPixel(hdc, xc + x, yc + y, c);
-            if (!clipWindowSet || (xc + y >= clipMinX && xc + y <= clipMaxX && yc + x >= clipMinY && yc + x <= clipMaxY)) SetPixel(hdc, xc + y, yc + x, c);
-            break;
+// One reflection of the octant the loops walk: (x, y) lands at
+// (xc + sx * x, yc + sy * y), or with x and y swapped.
+struct Octant {
+    int sx, sy;
+    bool swapped;
+
+    template <class Plot>
+    void Draw(const Plot& plot, int xc, int yc, int x, int y) const {
+        if (swapped) plot(xc + sx * y, yc + sy * x);
+        else plot(xc + sx * x, yc + sy * y);
     }
-}
+};
 
-void Circle::DrawCircleDirect(int xc, int yc, int R, COLORREF c) {
-    for (int x = 0; x <= R / sqrt(2); ++x) {
-        int y = static_cast<int>(round(sqrt(R * R - x * x)));
-        Draw8Points(xc, yc, x, y, c);
+static const Octant AllOctants[8] = {
+    { 1, 1, false }, { -1, 1, false }, { 1, -1, false }, { -1, -1, false },
+    { 1, 1, true }, { -1, 1, true }, { 1, -1, true }, { -1, -1, true },
+};
+
+static const Octant QuarterOctants[4][2] = {
+    { { 1, -1, false }, { 1, -1, true } },
+    { { -1, -1, false }, { -1, -1, true } },
+    { { -1, 1, false }, { -1, 1, true } },
+    { { 1, 1, false }, { 1, 1, true } },
+};
+
+// Calls walk(octant, first, last) with the columns 0..end of each octant that
+// can land in the window. x maps to one axis of every reflection, so under a
+// tile scissor each walk is at most a tile long.
+template <class Walk>
+static void WalkOctants(const ClipRect& window, int xc, int yc, const Octant* octants, int count, int end, const Walk& walk) {
+    for (int i = 0; i < count; ++i) {
+        const Octant& o = octants[i];
+        int first = 0, last = end;
+        if (ClipReflected(window, o.swapped, o.swapped ? yc : xc, o.swapped ? o.sy : o.sx, first, last))
+            walk(o, first, last);
     }
 }
 
-void Circle::DrawCirclePolar(int xc, int yc, int R, COLORREF c) {
-    double theta = 0;
-    double inc = 1.0 / R;
-    while (theta <= 3.14 / 4) {
-        int x = static_cast<int>(round(R * cos(theta)));
-        int y = static_cast<int>(round(R * sin(theta)));
-        Draw8Points(xc, yc, x, y, c);
-        theta += inc;
+static int CeilSqrt(unsigned long long v) {
+    unsigned long long s = (unsigned long long)sqrt((double)v);
+    if (s > 0xFFFFFFFFull) s = 0xFFFFFFFFull;
+    while (s && (s - 1) * (s - 1) >= v) s--;
+    while (s * s < v) s++;
+    return (int)s;
+}
+
+// y and the decision value of the midpoint walk at column x. Each column keeps
+// the lowest y whose midpoint y - 1/2 is still inside the circle, so the
+// previous column follows from a square root and one step of the walk gives
+// this one. The squares are summed modulo 2^64; the decision value itself
+// stays small.
+static void MidpointAt(int R, int x, int& y, int& d) {
+    if (x == 0) {
+        y = R;
+        d = 1 - R;
+        return;
+    }
+    int u = x - 1;
+    unsigned long long r2 = (unsigned long long)R * R, u2 = (unsigned long long)u * u;
+    y = r2 > u2 ? CeilSqrt(4 * (r2 - u2)) / 2 : 0;
+    d = (int)(long long)(u2 + 2ull * u + 1 + (unsigned long long)y * y - y - r2);
+    if (d < 0) {
+        d += 2 * u + 3;
+    } else {
+        d += 2 * (u - y) + 5;
+        y--;
     }
 }
 
-void Circle::DrawCircleIterativePolar(int xc, int yc, int R, COLORREF c) {
-    double theta = 0;
-    double cosInc = cos(1.0 / R);
-    double sinInc = sin(1.0 / R);
-    double x = R, y = 0;
-
-    while (x >= y) {
-        Draw8Points(xc, yc, static_cast<int>(round(x)), static_cast<int>(round(y)), c);
-        double xx = x * cosInc - y * sinInc;
-        y = x * sinInc + y * cosInc;
-        x = xx;
+// The column the midpoint walk stops at, the first where x reaches y.
+static int MidpointEnd(int R) {
+    int lo = 0, hi = max(R, 0);
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        int y, d;
+        MidpointAt(R, mid, y, d);
+        if (mid >= y) hi = mid;
+        else lo = mid + 1;
     }
+    return lo;
 }
 
-void Circle::DrawCircleMidpoint(int xc, int yc, int R, COLORREF c) {
-    int x = 0, y = R;
-    int d = 1 - R;
+void Circle::DrawCircleDirect(int xc, int yc, int R, COLORREF c) {
+    if (!BeginCircle(xc, yc, R)) return;
+    WithTarget(ctx, [&](auto& target) {
+        auto plot = MakePlotter(ctx, target, c, clipPixels);
+        int end = static_cast<int>(floor(R / sqrt(2)));
+        WalkOctants(ctx.ClipWindow(), xc, yc, AllOctants, 8, end, [&](const Octant& o, int first, int last) {
+            for (int x = first; x <= last; ++x) {
+                int y = static_cast<int>(round(sqrt((double)R * R - (double)x * x)));
+                o.Draw(plot, xc, yc, x, y);
+            }
+        });
+    });
+}
 
-    Draw8Points(xc, yc, x, y, c);
-    while (x < y) {
-        if (d < 0) {
-            d += 2 * x + 3;
-        } else {
-            d += 2 * (x - y) + 5;
-            y--;
+void Circle::DrawCirclePolar(int xc, int yc, int R, COLORREF c) {
+    if (!BeginCircle(xc, yc, R)) return;
+    WithTarget(ctx, [&](auto& target) {
+        auto plot = MakePlotter(ctx, target, c, clipPixels);
+        double theta = 0;
+        double inc = 1.0 / R;
+        while (theta <= 3.14 / 4) {
+            int x = static_cast<int>(round(R * cos(theta)));
+            int y = static_cast<int>(round(R * sin(theta)));
+            Draw8Points(plot, xc, yc, x, y);
+            theta += inc;
         }
-        x++;
-        Draw8Points(xc, yc, x, y, c);
-    }
+    });
 }
 
-void Circle::DrawCircleModifiedMidpoint(int xc, int yc, int R, COLORREF c) {
-   int x = 0, y = R;
-    int d = 1 - R;
-    int d1 = 3, d2 = 5 - 2 * R;
-
-    Draw8Points(xc, yc, x, y, c);
+void Circle::DrawCircleIterativePolar(int xc, int yc, int R, COLORREF c) {
+    if (!BeginCircle(xc, yc, R)) return;
+    WithTarget(ctx, [&](auto& target) {
+        auto plot = MakePlotter(ctx, target, c, clipPixels);
+        double theta = 0;
+        double cosInc = cos(1.0 / R);
+        double sinInc = sin(1.0 / R);
+        double x = R, y = 0;
 
-    while (x < y) {
-        if (d < 0) {
-            d += d1;
-            d1 += 2;
-            d2 += 2;
-            x++;
-        } else {
-            d += d2;
-            d1 += 2;
-            d2 += 4;
-            x++;
-            y--;
+        while (x >= y) {
+            Draw8Points(plot, xc, yc, static_cast<int>(round(x)), static_cast<int>(round(y)));
+            double xx = x * cosInc - y * sinInc;
+            y = x * sinInc + y * cosInc;
+            x = xx;
         }
-        Draw8Points(xc, yc, x, y, c);
-    }
+    });
 }
-void Circle::DrawQuarterCircleModifiedMidpoint(int xc, int yc, int R, COLORREF c,int quarter) {
-    int x = 0, y = R;
-    int d = 1 - R;
-    int d1 = 3, d2 = 5 - 2 * R;
 
-    Draw2Points(xc, yc, x, y, c,quarter);
+void Circle::DrawCircleMidpoint(int xc, int yc, int R, COLORREF c) {
+    if (!BeginCircle(xc, yc, R)) return;
+    WithTarget(ctx, [&](auto& target) {
+        auto plot = MakePlotter(ctx, target, c, clipPixels);
+        WalkOctants(ctx.ClipWindow(), xc, yc, AllOctants, 8, MidpointEnd(R), [&](const Octant& o, int x, int last) {
+            int y, d;
+            MidpointAt(R, x, y, d);
 
-    while (x < y) {
+            o.Draw(plot, xc, yc, x, y);
+            while (x < last) {
+                if (d < 0) {
+                    d += 2 * x + 3;
+                } else {
+                    d += 2 * (x - y) + 5;
+                    y--;
+                }
+                x++;
+                o.Draw(plot, xc, yc, x, y);
+            }
+        });
+    });
+}
+
+// The midpoint walk with its increments carried along. It visits the same
+// points, so it starts part way from MidpointAt too.
+template <class Plot>
+static void WalkModifiedMidpoint(const Plot& plot, const Octant& o, int xc, int yc, int R, int x, int last) {
+    int y, d;
+    MidpointAt(R, x, y, d);
+    int d1 = 2 * x + 3, d2 = 2 * (x - y) + 5;
+
+    o.Draw(plot, xc, yc, x, y);
+
+    while (x < last) {
         if (d < 0) {
             d += d1;
             d1 += 2;
@@ -131,24 +201,43 @@ void Circle::DrawQuarterCircleModifiedMidpoint(int xc, int yc, int R, COLORREF c
             x++;
             y--;
         }
-        Draw2Points(xc, yc, x, y, c,quarter);
+        o.Draw(plot, xc, yc, x, y);
     }
 }
+
+void Circle::DrawCircleModifiedMidpoint(int xc, int yc, int R, COLORREF c) {
+    if (!BeginCircle(xc, yc, R)) return;
+    WithTarget(ctx, [&](auto& target) {
+        auto plot = MakePlotter(ctx, target, c, clipPixels);
+        WalkOctants(ctx.ClipWindow(), xc, yc, AllOctants, 8, MidpointEnd(R), [&](const Octant& o, int first, int last) {
+            WalkModifiedMidpoint(plot, o, xc, yc, R, first, last);
+        });
+    });
+}
+void Circle::DrawQuarterCircleModifiedMidpoint(int xc, int yc, int R, COLORREF c,int quarter) {
+    if (quarter < 1 || quarter > 4 || !BeginCircle(xc, yc, R)) return;
+    WithTarget(ctx, [&](auto& target) {
+        auto plot = MakePlotter(ctx, target, c, clipPixels);
+        WalkOctants(ctx.ClipWindow(), xc, yc, QuarterOctants[quarter - 1], 2, MidpointEnd(R), [&](const Octant& o, int first, int last) {
+            WalkModifiedMidpoint(plot, o, xc, yc, R, first, last);
+        });
+    });
+}
 void Circle::FillQuarterWithCircles(int xc, int yc, int R, int quarter) {
     int dec = R / 100;
     if (dec == 0) dec = 1;
-    while (R > 0) {
+    while (R > 0 && !ctx.Cancelled()) {
         R -= dec;
-        COLORREF randomColor = RGB(rand() % 256, rand() % 256, rand() % 256);
+        COLORREF randomColor = RGB(ctx.Random() % 256, ctx.Random() % 256, ctx.Random() % 256);
         DrawQuarterCircleModifiedMidpoint( xc, yc,  R, randomColor, quarter);
     }
 }
 void Circle::FillWithCircles(int xc, int yc, int R) {
     int dec = R / 100;
     if (dec == 0) dec = 1;
-    while (R > 0) {
+    while (R > 0 && !ctx.Cancelled()) {
         R -= dec;
-        COLORREF randomColor = RGB(rand() % 256, rand() % 256, rand() % 256);
+        COLORREF randomColor = RGB(ctx.Random() % 256, ctx.Random() % 256, ctx.Random() % 256);
         DrawCircleModifiedMidpoint(xc, yc, R, randomColor);
     }
 }
@@ -174,14 +263,14 @@ void Circle::Draw2Lines(int xc, int yc, int x, int y, COLORREF c, int quarter) {
     }
 }
 void Circle::Draw8Lines(int xc, int yc, int x, int y, COLORREF c) {
-    line.DrawLineDDA(max(clipWindowSet ? clipMinX : INT_MIN, min(xc, xc + x)), max(clipWindowSet ? clipMinY : INT_MIN, min(yc, yc - y)), min(clipWindowSet ? clipMaxX : INT_MAX, max(xc, xc + x)), min(clipWindowSet ? clipMaxY : INT_MAX, max(yc, yc - y)), c);
-    line.DrawLineDDA(max(clipWindowSet ? clipMinX : INT_MIN, min(xc, xc + y)), max(clipWindowSet ? clipMinY : INT_MIN, min(yc, yc - x)), min(clipWindowSet ? clipMaxX : INT_MAX, max(xc, xc + y)), min(clipWindowSet ? clipMaxY : INT_MAX, max(yc, yc - x)), c);
-    line.DrawLineDDA(max(clipWindowSet ? clipMinX : INT_MIN, min(xc, xc - x)), max(clipWindowSet ? clipMinY : INT_MIN, min(yc, yc - y)), min(clipWindowSet ? clipMaxX : INT_MAX, max(xc, xc - x)), min(clipWindowSet ? clipMaxY : INT_MAX, max(yc, yc - y)), c);
-    line.DrawLineDDA(max(clipWindowSet ? clipMinX : INT_MIN, min(xc, xc - y)), max(clipWindowSet ? clipMinY : INT_MIN, min(yc, yc - x)), min(clipWindowSet ? clipMaxX : INT_MAX, max(xc, xc - y)), min(clipWindowSet ? clipMaxY : INT_MAX, max(yc, yc - x)), c);
-    line.DrawLineDDA(max(clipWindowSet ? clipMinX : INT_MIN, min(xc, xc - x)), max(clipWindowSet ? clipMinY : INT_MIN, min(yc, yc + y)), min(clipWindowSet ? clipMaxX : INT_MAX, max(xc, xc - x)), min(clipWindowSet ? clipMaxY : INT_MAX, max(yc, yc + y)), c);
-    line.DrawLineDDA(max(clipWindowSet ? clipMinX : INT_MIN, min(xc, xc - y)), max(clipWindowSet ? clipMinY : INT_MIN, min(yc, yc + x)), min(clipWindowSet ? clipMaxX : INT_MAX, max(xc, xc - y)), min(clipWindowSet ? clipMaxY : INT_MAX, max(yc, yc + x)), c);
-    line.DrawLineDDA(max(clipWindowSet ? clipMinX : INT_MIN, min(xc, xc + x)), max(clipWindowSet ? clipMinY : INT_MIN, min(yc, yc + y)), min(clipWindowSet ? clipMaxX : INT_MAX, max(xc, xc + x)), min(clipWindowSet ? clipMaxY : INT_MAX, max(yc, yc + y)), c);
-    line.DrawLineDDA(max(clipWindowSet ? clipMinX : INT_MIN, min(xc, xc + y)), max(clipWindowSet ? clipMinY : INT_MIN, min(yc, yc + x)), min(clipWindowSet ? clipMaxX : INT_MAX, max(xc, xc + y)), min(clipWindowSet ? clipMaxY : INT_MAX, max(yc, yc + x)), c);
+    line.DrawLineDDA(min(xc, xc + x), min(yc, yc - y), max(xc, xc + x), max(yc, yc - y), c);
+    line.DrawLineDDA(min(xc, xc + y), min(yc, yc - x), max(xc, xc + y), max(yc, yc - x), c);
+    line.DrawLineDDA(min(xc, xc - x), min(yc, yc - y), max(xc, xc - x), max(yc, yc - y), c);
+    line.DrawLineDDA(min(xc, xc - y), min(yc, yc - x), max(xc, xc - y), max(yc, yc - x), c);
+    line.DrawLineDDA(min(xc, xc - x), min(yc, yc + y), max(xc, xc - x), max(yc, yc + y), c);
+    line.DrawLineDDA(min(xc, xc - y), min(yc, yc + x), max(xc, xc - y), max(yc, yc + x), c);
+    line.DrawLineDDA(min(xc, xc + x), min(yc, yc + y), max(xc, xc + x), max(yc, yc + y), c);
+    line.DrawLineDDA(min(xc, xc + y), min(yc, yc + x), max(xc, xc + y), max(yc, yc + x), c);
 }
 void Circle::FillQuarterWithLines(int xc, int yc, int R, COLORREF c, int quarter) {
     int x = 0, y = R;
@@ -214,4 +303,12 @@ void Circle::FillWithLines(int xc, int yc, int R, COLORREF c) {
         int y = static_cast<int>(round(yc + R * sin(theta)));
         line.DrawLineDDA(xc, yc, x, y, c);
     }
-} 
\ No newline at end of file
+} 
+void CircleSpans(int xc, int yc, int R, SpanSink& sink) {
+    int x = R;
+    for (int y = 0; y <= R; ++y) {
+        while (x > 0 && (long long)x * x + (long long)y * y > (long long)R * R + R) x--;
+        sink.AddSpan(yc - y, xc - x, xc + x);
+        if (y != 0) sink.AddSpan(yc + y, xc - x, xc + x);
+    }
+}
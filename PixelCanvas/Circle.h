@@ -3,10 +3,12 @@
 
 #include <windows.h>
 #include "Line.h"
+#include "ClipRegion.h"
+#include "RenderContext.h"
 
 class Circle {
 public:
-    Circle(HDC hdc);
+    Circle(RenderContext& ctx);
     void DrawCircleDirect(int xc, int yc, int R, COLORREF c);
     void DrawCirclePolar(int xc, int yc, int R, COLORREF c);
     void DrawCircleIterativePolar(int xc, int yc, int R, COLORREF c);
@@ -16,16 +18,18 @@ public:
     void FillWithCircles(int xc, int yc, int R);
     void FillQuarterWithLines(int xc, int yc, int R, COLORREF c, int quarter);
     void FillWithLines(int xc, int yc, int R, COLORREF c);
+    void DrawQuarterCircleModifiedMidpoint(int xc, int yc, int R, COLORREF c, int quarter);
 
 private:
-    void Draw8Points(int xc, int yc, int x, int y, COLORREF c);
-    void Draw2Points(int xc, int yc, int x, int y, COLORREF c, int quarter);
+    bool BeginCircle(int xc, int yc, int R);
     void Draw2Lines(int xc, int yc, int x, int y, COLORREF c, int quarter);
     void Draw8Lines(int xc, int yc, int x, int y, COLORREF c);
-    void DrawQuarterCircleModifiedMidpoint(int xc, int yc, int R, COLORREF c,int quarter);
 
-    HDC hdc;
+    RenderContext& ctx;
     Line line;
+    bool clipPixels;
 };
 
+void CircleSpans(int xc, int yc, int R, SpanSink& sink);
+
 #endif 
\ No newline at end of file
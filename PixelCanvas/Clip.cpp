@@ -0,0 +1,130 @@
+#include "Clip.h"
+#include <cmath>
+#include <emmintrin.h>
+
+int ClipRect::OutCode(int x, int y) const {
+    int code = OUTCODE_INSIDE;
+    if (!enabled) return code;
+    if (x < minX) code |= OUTCODE_LEFT;
+    else if (x > maxX) code |= OUTCODE_RIGHT;
+    if (y < minY) code |= OUTCODE_BOTTOM;
+    else if (y > maxY) code |= OUTCODE_TOP;
+    return code;
+}
+
+ClipResult ClipRect::Classify(int left, int top, int right, int bottom) const {
+    if (!enabled) return CLIP_INSIDE;
+    if (right < minX || left > maxX || bottom < minY || top > maxY) return CLIP_OUTSIDE;
+    if (left >= minX && right <= maxX && top >= minY && bottom <= maxY) return CLIP_INSIDE;
+    return CLIP_PARTIAL;
+}
+
+ClipRect ClipRect::Intersect(const ClipRect& other) const {
+    if (!enabled) return other;
+    if (!other.enabled) return *this;
+    return ClipRect(max(minX, other.minX), max(minY, other.minY), min(maxX, other.maxX), min(maxY, other.maxY));
+}
+
+static long long RoundDiv(long long n, long long d) {
+    return n >= 0 ? (2 * n + d) / (2 * d) : -((2 * -n + d) / (2 * d));
+}
+
+// Liang-Barsky with the entry/exit parameters kept as exact fractions, so the
+// clipped endpoints land exactly on the boundary they were clipped against.
+bool ClipLine(const ClipRect& clip, int& x0, int& y0, int& x1, int& y1) {
+    if (!clip.enabled) return true;
+    long long dx = (long long)x1 - x0;
+    long long dy = (long long)y1 - y0;
+    long long p[4] = { -dx, dx, -dy, dy };
+    long long q[4] = { (long long)x0 - clip.minX, (long long)clip.maxX - x0, (long long)y0 - clip.minY, (long long)clip.maxY - y0 };
+    long long n0 = 0, d0 = 1;
+    long long n1 = 1, d1 = 1;
+    for (int i = 0; i < 4; ++i) {
+        if (p[i] == 0) {
+            if (q[i] < 0) return false;
+        } else if (p[i] < 0) {
+            long long n = -q[i], d = -p[i];
+            if (n * d1 > n1 * d) return false;
+            if (n * d0 > n0 * d) { n0 = n; d0 = d; }
+        } else {
+            long long n = q[i], d = p[i];
+            if (n * d0 < n0 * d) return false;
+            if (n * d1 < n1 * d) { n1 = n; d1 = d; }
+        }
+    }
+    int sx = x0, sy = y0;
+    if (n1 != d1) {
+        x1 = sx + (int)RoundDiv(dx * n1, d1);
+        y1 = sy + (int)RoundDiv(dy * n1, d1);
+    }
+    if (n0 != 0) {
+        x0 = sx + (int)RoundDiv(dx * n0, d0);
+        y0 = sy + (int)RoundDiv(dy * n0, d0);
+    }
+    return true;
+}
+
+bool ClipReflected(const ClipRect& clip, bool vertical, int origin, int sign, int& first, int& last) {
+    long long from = first, to = last;
+    if (clip.enabled) {
+        long long lo = (long long)(vertical ? clip.minY : clip.minX) - origin;
+        long long hi = (long long)(vertical ? clip.maxY : clip.maxX) - origin;
+        from = max(from, sign > 0 ? lo : -hi);
+        to = min(to, sign > 0 ? hi : -lo);
+    }
+    if (from > to) return false;
+    first = (int)from;
+    last = (int)to;
+    return true;
+}
+
+// The rectangle grown by margin misses the outline exactly when it lies wholly
+// outside the ellipse or wholly inside it.
+bool MissesOutline(const ClipRect& clip, int xc, int yc, int a, int b, int margin) {
+    if (!clip.enabled || a <= 0 || b <= 0) return false;
+    double left = (double)clip.minX - margin - xc, right = (double)clip.maxX + margin - xc;
+    double top = (double)clip.minY - margin - yc, bottom = (double)clip.maxY + margin - yc;
+    double nearX = left > 0 ? left : right < 0 ? -right : 0;
+    double nearY = top > 0 ? top : bottom < 0 ? -bottom : 0;
+    double farX = max(fabs(left), fabs(right)), farY = max(fabs(top), fabs(bottom));
+    double a2 = (double)a * a, b2 = (double)b * b;
+    return nearX * nearX / a2 + nearY * nearY / b2 > 1 || farX * farX / a2 + farY * farY / b2 < 1;
+}
+
+// Outcodes for two points per SSE2 register. Returns the trivial accept/reject
+// classification of the whole set; codes may be null when only that is needed.
+ClipResult ComputeOutCodes(const ClipRect& clip, const POINT* pts, int n, BYTE* codes) {
+    if (!clip.enabled || n <= 0) {
+        if (codes) memset(codes, 0, n > 0 ? n : 0);
+        return CLIP_INSIDE;
+    }
+    const __m128i lo = _mm_setr_epi32(clip.minX, clip.minY, clip.minX, clip.minY);
+    const __m128i hi = _mm_setr_epi32(clip.maxX, clip.maxY, clip.maxX, clip.maxY);
+    const __m128i loBits = _mm_setr_epi32(OUTCODE_LEFT, OUTCODE_BOTTOM, OUTCODE_LEFT, OUTCODE_BOTTOM);
+    const __m128i hiBits = _mm_setr_epi32(OUTCODE_RIGHT, OUTCODE_TOP, OUTCODE_RIGHT, OUTCODE_TOP);
+    int orCodes = 0, andCodes = 0xF;
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(pts + i));
+        __m128i c = _mm_or_si128(_mm_and_si128(_mm_cmplt_epi32(v, lo), loBits),
+                                 _mm_and_si128(_mm_cmpgt_epi32(v, hi), hiBits));
+        c = _mm_or_si128(c, _mm_srli_epi64(c, 32));
+        int c0 = _mm_cvtsi128_si32(c);
+        int c1 = _mm_cvtsi128_si32(_mm_srli_si128(c, 8));
+        if (codes) {
+            codes[i] = (BYTE)c0;
+            codes[i + 1] = (BYTE)c1;
+        }
+        orCodes |= c0 | c1;
+        andCodes &= c0 & c1;
+    }
+    for (; i < n; ++i) {
+        int c = clip.OutCode(pts[i].x, pts[i].y);
+        if (codes) codes[i] = (BYTE)c;
+        orCodes |= c;
+        andCodes &= c;
+    }
+    if (orCodes == 0) return CLIP_INSIDE;
+    if (andCodes != 0) return CLIP_OUTSIDE;
+    return CLIP_PARTIAL;
+}
@@ -0,0 +1,45 @@
+#ifndef CLIP_H
+#define CLIP_H
+
+#include <windows.h>
+
+const int OUTCODE_INSIDE = 0;
+const int OUTCODE_LEFT = 1;
+const int OUTCODE_RIGHT = 2;
+const int OUTCODE_BOTTOM = 4;
+const int OUTCODE_TOP = 8;
+
+enum ClipResult { CLIP_INSIDE, CLIP_PARTIAL, CLIP_OUTSIDE };
+
+// Inclusive clip rectangle. A disabled rectangle accepts everything.
+struct ClipRect {
+    bool enabled;
+    int minX, minY, maxX, maxY;
+
+    ClipRect() : enabled(false), minX(0), minY(0), maxX(0), maxY(0) {}
+    ClipRect(int minX, int minY, int maxX, int maxY)
+        : enabled(true), minX(minX), minY(minY), maxX(maxX), maxY(maxY) {}
+
+    bool Contains(int x, int y) const {
+        return !enabled || (x >= minX && x <= maxX && y >= minY && y <= maxY);
+    }
+    bool IsEmpty() const { return enabled && (minX > maxX || minY > maxY); }
+    int OutCode(int x, int y) const;
+    // Called once per primitive with its bounding box before the inner loop:
+    // CLIP_INSIDE means no per-pixel tests are needed, CLIP_OUTSIDE means skip it.
+    ClipResult Classify(int left, int top, int right, int bottom) const;
+    ClipRect Intersect(const ClipRect& other) const;
+};
+
+bool ClipLine(const ClipRect& clip, int& x0, int& y0, int& x1, int& y1);
+ClipResult ComputeOutCodes(const ClipRect& clip, const POINT* pts, int n, BYTE* codes);
+// Narrows [first, last] to the t for which origin + sign * t lies within the
+// clip rectangle's columns, or its rows when vertical. Returns false when no t
+// is left.
+bool ClipReflected(const ClipRect& clip, bool vertical, int origin, int sign, int& first, int& last);
+// True when the clip rectangle holds no point within margin of the outline of
+// the ellipse with radii a and b, so no pixel drawn that close to it lands
+// inside.
+bool MissesOutline(const ClipRect& clip, int xc, int yc, int a, int b, int margin);
+
+#endif
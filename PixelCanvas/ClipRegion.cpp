@@ -0,0 +1,218 @@
+#include "ClipRegion.h"
+#include <algorithm>
+
+ClipRegion ClipRegion::FromRect(int left, int top, int right, int bottom) {
+    ClipRegionBuilder builder;
+    for (int y = top; y <= bottom; ++y) {
+        builder.AddSpan(y, left, right);
+    }
+    return builder.Finish();
+}
+
+bool ClipRegion::Row(int y, const Span*& begin, const Span*& end) const {
+    int row = y - top;
+    if (row < 0 || row + 1 >= (int)rowStart.size()) return false;
+    begin = spans.data() + rowStart[row];
+    end = spans.data() + rowStart[row + 1];
+    return begin != end;
+}
+
+const Span* ClipRegion::FirstEndingAtOrAfter(const Span* begin, const Span* end, int x) {
+    return std::lower_bound(begin, end, x, [](const Span& s, int v) { return s.x1 < v; });
+}
+
+bool ClipRegion::Contains(int x, int y) const {
+    if (!enabled) return true;
+    const Span* s;
+    const Span* end;
+    bool in = Row(y, s, end) && (s = FirstEndingAtOrAfter(s, end, x)) != end && s->x0 <= x;
+    return in != inverted;
+}
+
+RECT ClipRegion::Bounds() const {
+    RECT r = { INT_MIN, INT_MIN, INT_MAX, INT_MAX };
+    if (!enabled || inverted) return r;
+    return bounds;
+}
+
+void ClipRegion::CacheBounds() {
+    RECT r = { INT_MAX, INT_MAX, INT_MIN, INT_MIN };
+    for (int row = 0; row + 1 < (int)rowStart.size(); ++row) {
+        if (rowStart[row] == rowStart[row + 1]) continue;
+        r.left = min(r.left, spans[rowStart[row]].x0);
+        r.right = max(r.right, spans[rowStart[row + 1] - 1].x1);
+        r.top = min(r.top, (LONG)(top + row));
+        r.bottom = top + row;
+    }
+    bounds = r;
+}
+
+ClipResult ClipRegion::Classify(int left, int top, int right, int bottom) const {
+    if (!enabled) return CLIP_INSIDE;
+    ClipResult in = inverted ? CLIP_OUTSIDE : CLIP_INSIDE;
+    ClipResult out = inverted ? CLIP_INSIDE : CLIP_OUTSIDE;
+    if (spans.empty() || right < bounds.left || left > bounds.right || bottom < bounds.top || top > bounds.bottom) return out;
+    bool covered = top >= bounds.top && bottom <= bounds.bottom;
+    bool touched = false;
+    int last = min(bottom, (int)bounds.bottom);
+    for (int y = max(top, (int)bounds.top); y <= last && (covered || !touched); ++y) {
+        const Span* s;
+        const Span* end;
+        if (Row(y, s, end) && (s = FirstEndingAtOrAfter(s, end, left)) != end && s->x0 <= right) {
+            touched = true;
+            covered = covered && s->x0 <= left && s->x1 >= right;
+        }
+        else {
+            covered = false;
+        }
+    }
+    if (covered) return in;
+    return touched ? CLIP_PARTIAL : out;
+}
+
+template <class Op>
+ClipRegion ClipRegion::Combine(const ClipRegion& other, Op op) const {
+    int rowsA = (int)rowStart.size() - 1;
+    int rowsB = (int)other.rowStart.size() - 1;
+    ClipRegion out;
+    out.enabled = true;
+    if (rowsA <= 0 && rowsB <= 0) return out;
+    int y0, y1;
+    if (rowsA <= 0) { y0 = other.top; y1 = other.top + rowsB - 1; }
+    else if (rowsB <= 0) { y0 = top; y1 = top + rowsA - 1; }
+    else {
+        y0 = min(top, other.top);
+        y1 = max(top + rowsA - 1, other.top + rowsB - 1);
+    }
+    out.top = y0;
+    out.rowStart.reserve(y1 - y0 + 2);
+    out.spans.reserve(spans.size() + other.spans.size());
+    out.rowStart.push_back(0);
+    for (int y = y0; y <= y1; ++y) {
+        const Span* a = nullptr;
+        const Span* aEnd = nullptr;
+        const Span* b = nullptr;
+        const Span* bEnd = nullptr;
+        Row(y, a, aEnd);
+        other.Row(y, b, bEnd);
+        op(a, aEnd, b, bEnd, out.spans);
+        out.rowStart.push_back((int)out.spans.size());
+    }
+    out.CacheBounds();
+    return out;
+}
+
+static void AppendMerged(std::vector<Span>& out, size_t rowBegin, Span s) {
+    if (out.size() > rowBegin && out.back().x1 + 1 >= s.x0) {
+        out.back().x1 = max(out.back().x1, s.x1);
+    }
+    else {
+        out.push_back(s);
+    }
+}
+
+ClipRegion ClipRegion::Inverse() const {
+    ClipRegion r = *this;
+    r.inverted = !inverted;
+    return r;
+}
+
+// Inverted operands are folded into the span operations by De Morgan's laws.
+ClipRegion ClipRegion::Union(const ClipRegion& other) const {
+    if (!enabled || !other.enabled) return ClipRegion();
+    if (inverted && other.inverted) return Overlap(other).Inverse();
+    if (inverted) return Cut(other).Inverse();
+    if (other.inverted) return other.Cut(*this).Inverse();
+    return Merge(other);
+}
+
+ClipRegion ClipRegion::Intersect(const ClipRegion& other) const {
+    if (!enabled) return other;
+    if (!other.enabled) return *this;
+    if (inverted && other.inverted) return Merge(other).Inverse();
+    if (inverted) return other.Cut(*this);
+    if (other.inverted) return Cut(other);
+    return Overlap(other);
+}
+
+ClipRegion ClipRegion::Subtract(const ClipRegion& other) const {
+    if (!other.enabled) {
+        ClipRegion empty;
+        empty.enabled = true;
+        return empty;
+    }
+    if (!enabled) return other.Inverse();
+    if (inverted && other.inverted) return other.Cut(*this);
+    if (inverted) return Merge(other).Inverse();
+    if (other.inverted) return Overlap(other);
+    return Cut(other);
+}
+
+ClipRegion ClipRegion::Merge(const ClipRegion& other) const {
+    return Combine(other, [](const Span* a, const Span* aEnd, const Span* b, const Span* bEnd, std::vector<Span>& out) {
+        size_t rowBegin = out.size();
+        while (a != aEnd || b != bEnd) {
+            if (b == bEnd || (a != aEnd && a->x0 <= b->x0)) AppendMerged(out, rowBegin, *a++);
+            else AppendMerged(out, rowBegin, *b++);
+        }
+    });
+}
+
+ClipRegion ClipRegion::Overlap(const ClipRegion& other) const {
+    return Combine(other, [](const Span* a, const Span* aEnd, const Span* b, const Span* bEnd, std::vector<Span>& out) {
+        while (a != aEnd && b != bEnd) {
+            int x0 = max(a->x0, b->x0);
+            int x1 = min(a->x1, b->x1);
+            if (x0 <= x1) out.push_back(Span{ x0, x1 });
+            if (a->x1 < b->x1) ++a;
+            else ++b;
+        }
+    });
+}
+
+ClipRegion ClipRegion::Cut(const ClipRegion& other) const {
+    return Combine(other, [](const Span* a, const Span* aEnd, const Span* b, const Span* bEnd, std::vector<Span>& out) {
+        for (; a != aEnd; ++a) {
+            int x0 = a->x0;
+            while (b != bEnd && b->x1 < x0) ++b;
+            const Span* cut = b;
+            while (cut != bEnd && cut->x0 <= a->x1) {
+                if (cut->x0 > x0) out.push_back(Span{ x0, cut->x0 - 1 });
+                x0 = max(x0, cut->x1 + 1);
+                if (cut->x1 > a->x1) break;
+                ++cut;
+            }
+            if (x0 <= a->x1) out.push_back(Span{ x0, a->x1 });
+        }
+    });
+}
+
+void ClipRegionBuilder::AddSpan(int y, int x0, int x1) {
+    if (x0 > x1) std::swap(x0, x1);
+    pending.push_back(RowSpan{ y, x0, x1 });
+}
+
+ClipRegion ClipRegionBuilder::Finish() {
+    ClipRegion region;
+    region.enabled = true;
+    if (pending.empty()) return region;
+    std::sort(pending.begin(), pending.end(), [](const RowSpan& a, const RowSpan& b) {
+        return a.y != b.y ? a.y < b.y : a.x0 < b.x0;
+    });
+    region.top = pending.front().y;
+    int bottom = pending.back().y;
+    region.rowStart.assign(bottom - region.top + 2, 0);
+    region.spans.reserve(pending.size());
+    size_t i = 0;
+    for (int y = region.top; y <= bottom; ++y) {
+        size_t rowBegin = region.spans.size();
+        region.rowStart[y - region.top] = (int)rowBegin;
+        for (; i < pending.size() && pending[i].y == y; ++i) {
+            AppendMerged(region.spans, rowBegin, Span{ pending[i].x0, pending[i].x1 });
+        }
+    }
+    region.rowStart[bottom - region.top + 1] = (int)region.spans.size();
+    region.CacheBounds();
+    pending.clear();
+    return region;
+}
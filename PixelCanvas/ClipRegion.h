@@ -0,0 +1,108 @@
+#ifndef CLIPREGION_H
+#define CLIPREGION_H
+
+#include <windows.h>
+#include <vector>
+#include "Clip.h"
+
+struct Span {
+    int x0, x1;
+};
+
+// Receives the horizontal runs produced by the scanline fillers, inclusive in x.
+class SpanSink {
+public:
+    virtual ~SpanSink() {}
+    virtual void AddSpan(int y, int x0, int x1) = 0;
+};
+
+// How a clip mask shape edits the current clip region (DrawRecord::algo).
+enum MaskOp { MASK_INTERSECT, MASK_UNION, MASK_EXCLUDE };
+
+// Arbitrary-shape clip region stored as sorted, disjoint spans per row.
+// A disabled region places no restriction on drawing, like a disabled ClipRect.
+// An inverted region is everything outside its spans, however far the
+// document reaches.
+class ClipRegion {
+public:
+    ClipRegion() : enabled(false), inverted(false), top(0), bounds() {}
+
+    static ClipRegion FromRect(int left, int top, int right, int bottom);
+
+    bool enabled;
+
+    bool IsEmpty() const { return enabled && !inverted && spans.empty(); }
+    bool Contains(int x, int y) const;
+    RECT Bounds() const;
+    // CLIP_INSIDE needs a single span to cover each row of the box, or for an
+    // inverted region no span to touch it.
+    ClipResult Classify(int left, int top, int right, int bottom) const;
+
+    ClipRegion Union(const ClipRegion& other) const;
+    ClipRegion Intersect(const ClipRegion& other) const;
+    ClipRegion Subtract(const ClipRegion& other) const;
+    ClipRegion Inverse() const;
+
+    // Calls emit(y, x0, x1) for each piece of the span that lies inside the region.
+    template <class Emit>
+    void ClipSpan(int y, int x0, int x1, Emit emit) const {
+        if (!enabled) {
+            emit(y, x0, x1);
+            return;
+        }
+        const Span* s;
+        const Span* end;
+        if (inverted) {
+            int x = x0;
+            if (Row(y, s, end)) {
+                for (s = FirstEndingAtOrAfter(s, end, x0); s != end && s->x0 <= x1; ++s) {
+                    if (s->x0 > x) emit(y, x, s->x0 - 1);
+                    x = max(x, s->x1 + 1);
+                }
+            }
+            if (x <= x1) emit(y, x, x1);
+            return;
+        }
+        if (!Row(y, s, end)) return;
+        s = FirstEndingAtOrAfter(s, end, x0);
+        for (; s != end && s->x0 <= x1; ++s) {
+            emit(y, max(x0, s->x0), min(x1, s->x1));
+        }
+    }
+
+private:
+    friend class ClipRegionBuilder;
+
+    bool Row(int y, const Span*& begin, const Span*& end) const;
+    static const Span* FirstEndingAtOrAfter(const Span* begin, const Span* end, int x);
+    // Called once a region's spans are final.
+    void CacheBounds();
+    template <class Op>
+    ClipRegion Combine(const ClipRegion& other, Op op) const;
+    // The span operations, which ignore inversion.
+    ClipRegion Merge(const ClipRegion& other) const;
+    ClipRegion Overlap(const ClipRegion& other) const;
+    ClipRegion Cut(const ClipRegion& other) const;
+
+    bool inverted;
+    int top;
+    std::vector<int> rowStart;
+    std::vector<Span> spans;
+    // Of the spans, inclusive.
+    RECT bounds;
+};
+
+// Collects spans in any order and produces a normalized region.
+class ClipRegionBuilder : public SpanSink {
+public:
+    void AddSpan(int y, int x0, int x1) override;
+    ClipRegion Finish();
+
+private:
+    struct RowSpan {
+        int y, x0, x1;
+    };
+    std::vector<RowSpan> pending;
+};
+
+#endif
@@ -5,8 +5,7 @@
 #include "PixelCanvas.h"
 using namespace std;
 
-extern bool clipWindowSet;
-extern int clipMinX, clipMaxX, clipMinY, clipMaxY;
+#include "RenderContext.h"
 
 struct Point {
     double x, y;
@@ -15,9 +14,27 @@ struct Derivative {
     double u, v;
 };
 
-Curve::Curve(HDC hdc) : hdc(hdc) {}
+Curve::Curve(RenderContext& ctx) : ctx(ctx), clipPixels(false) {}
+
+// A cubic segment never leaves the bounding box of its Bezier control points.
+// The box is padded by a pixel because evaluation error can truncate a point
+// lying on the box edge to the pixel beyond it.
+bool Curve::BeginSegment(double x0, double y0, double x1, double y1, double x2, double y2, double x3, double y3) {
+    int left = (int)floor(min(min(x0, x1), min(x2, x3))) - 1;
+    int right = (int)ceil(max(max(x0, x1), max(x2, x3))) + 1;
+    int top = (int)floor(min(min(y0, y1), min(y2, y3))) - 1;
+    int bottom = (int)ceil(max(max(y0, y1), max(y2, y3))) + 1;
+    ClipResult r = ClassifyClip(ctx, left, top, right, bottom);
+    clipPixels = (r == CLIP_PARTIAL);
+    if (r == CLIP_OUTSIDE) return false;
+    MarkDrawn(ctx, left, top, right, bottom);
+    return true;
+}
 
 void Curve::DrawHermite(int x0, int y0, int x1, int y1, int t0, int t1, COLORREF color) {
+    if (!BeginSegment(x0, y0, x0 + t0 / 3.0, y0, x1 - t1 / 3.0, y1, x1, y1)) return;
+    WithTarget(ctx, [&](auto& target) {
+        auto plot = MakePlotter(ctx, target, color, clipPixels);
         for (double t = 0; t <= 1; t += 0.001) {
             double h1 = 2 * pow(t, 3) - 3 * pow(t, 2) + 1;
             double h2 = -2 * pow(t, 3) + 3 * pow(t, 2);
@@ -27,31 +44,35 @@ void Curve::DrawHermite(int x0, int y0, int x1, int y1, int t0, int t1, COLORREF
             int x = (int)(h1 * x0 + h2 * x1 + h3 * t0 + h4 * t1);
             int y = (int)(h1 * y0 + h2 * y1);
 
-            SetPixel(hdc, x, y, color);
+            plot(x, y);
         }
+    });
 }
 void Curve::FillWithHermite(int x1, int y1, int x2, int y2, COLORREF color) {
     int left = min(x1, x2);
     int right = max(x1, x2);
     int top = min(y1, y2);
     int bottom = max(y1, y2);
-    for (int x = left; x <= right; x++) {
+    for (int x = left; x <= right && !ctx.Cancelled(); x++) {
         DrawHermite2((double)x, (double)top, (double)x, (double)bottom, 0.0, 1.0, 0.0, -1.0, color);
     }
 }
 
 void Curve::DrawHermite2(double x0, double y0, double x1, double y1, double t0x, double t0y, double t1x, double t1y, COLORREF color) {
-    double h00, h10, h01, h11;
-    for (double t = 0; t <= 1; t += 0.001) {
-        h00 = 2 * t * t * t - 3 * t * t + 1;
-        h10 = t * t * t - 2 * t * t + t;
-        h01 = -2 * t * t * t + 3 * t * t;
-        h11 = t * t * t - t * t;
-        double x = h00 * x0 + h10 * t0x + h01 * x1 + h11 * t1x;
-        double y = h00 * y0 + h10 * t0y + h01 * y1 + h11 * t1y;
-        if (!clipWindowSet || (x >= clipMinX && x <= clipMaxX && y >= clipMinY && y <= clipMaxY))
-            SetPixel(hdc, round(x), round(y), color);
-    }
+    if (!BeginSegment(x0, y0, x0 + t0x / 3, y0 + t0y / 3, x1 - t1x / 3, y1 - t1y / 3, x1, y1)) return;
+    WithTarget(ctx, [&](auto& target) {
+        auto plot = MakePlotter(ctx, target, color, clipPixels);
+        double h00, h10, h01, h11;
+        for (double t = 0; t <= 1; t += 0.001) {
+            h00 = 2 * t * t * t - 3 * t * t + 1;
+            h10 = t * t * t - 2 * t * t + t;
+            h01 = -2 * t * t * t + 3 * t * t;
+            h11 = t * t * t - t * t;
+            double x = h00 * x0 + h10 * t0x + h01 * x1 + h11 * t1x;
+            double y = h00 * y0 + h10 * t0y + h01 * y1 + h11 * t1y;
+            plot((int)round(x), (int)round(y));
+        }
+    });
 }
 void Curve::DrawCardinalSpline(POINT* pts, int n, double c, COLORREF color) {
     if (n < 4) return;
@@ -71,17 +92,66 @@ void Curve::DrawCardinalSpline(POINT* pts, int n, double c, COLORREF color) {
     }
 }
 
+RECT Curve::CardinalSplineBounds(const POINT* pts, int n, double c) {
+    RECT r = { 0, 0, -1, -1 };
+    if (n < 4) return r;
+    double c1 = 1 - c;
+    double left = pts[1].x, right = pts[1].x, top = pts[1].y, bottom = pts[1].y;
+    for (int i = 1; i < n - 1; i++) {
+        double tx = c1 * (pts[i + 1].x - pts[i - 1].x) / 3;
+        double ty = c1 * (pts[i + 1].y - pts[i - 1].y) / 3;
+        left = min(left, pts[i].x - fabs(tx));
+        right = max(right, pts[i].x + fabs(tx));
+        top = min(top, pts[i].y - fabs(ty));
+        bottom = max(bottom, pts[i].y + fabs(ty));
+    }
+    r.left = (LONG)floor(left);
+    r.top = (LONG)floor(top);
+    r.right = (LONG)ceil(right);
+    r.bottom = (LONG)ceil(bottom);
+    return r;
+}
+
+// Each Hermite segment is converted to its Bezier form; the second differences
+// of the control points bound the chord error, which fixes the step count.
+void Curve::FlattenCardinalSpline(const POINT* pts, int n, double c, std::vector<point>& out) {
+    if (n < 4) return;
+    double c1 = 1 - c;
+    double t0x = c1 * (pts[2].x - pts[0].x);
+    double t0y = c1 * (pts[2].y - pts[0].y);
+    out.push_back(point(pts[1].x, pts[1].y));
+    for (int i = 2; i < n - 1; i++) {
+        double t1x = c1 * (pts[i + 1].x - pts[i - 1].x);
+        double t1y = c1 * (pts[i + 1].y - pts[i - 1].y);
+        double x0 = pts[i - 1].x, y0 = pts[i - 1].y;
+        double x3 = pts[i].x, y3 = pts[i].y;
+        double x1 = x0 + t0x / 3, y1 = y0 + t0y / 3;
+        double x2 = x3 - t1x / 3, y2 = y3 - t1y / 3;
+        double dd = max(hypot(x0 - 2 * x1 + x2, y0 - 2 * y1 + y2), hypot(x1 - 2 * x2 + x3, y1 - 2 * y2 + y3));
+        int steps = max(1, (int)ceil(sqrt(0.75 * dd / 0.25)));
+        for (int k = 1; k <= steps; k++) {
+            double t = (double)k / steps, mt = 1 - t;
+            double b0 = mt * mt * mt, b1 = 3 * mt * mt * t, b2 = 3 * mt * t * t, b3 = t * t * t;
+            out.push_back(point(b0 * x0 + b1 * x1 + b2 * x2 + b3 * x3, b0 * y0 + b1 * y1 + b2 * y2 + b3 * y3));
+        }
+        t0x = t1x;
+        t0y = t1y;
+    }
+}
 
 void Curve::DrawBezier(int x0, int y0, int x1, int y1, int x2, int y2, int x3, int y3, COLORREF color) {
+    if (!BeginSegment(x0, y0, x1, y1, x2, y2, x3, y3)) return;
+    WithTarget(ctx, [&](auto& target) {
+        auto plot = MakePlotter(ctx, target, color, clipPixels);
         for (double t = 0; t <= 1; t += 0.001) {
             double mt = 1 - t;
             int x = (int)(pow(mt, 3) * x0 + 3 * pow(mt, 2) * t * x1 +
                 3 * mt * pow(t, 2) * x2 + pow(t, 3) * x3);
             int y = (int)(pow(mt, 3) * y0 + 3 * pow(mt, 2) * t * y1 +
                 3 * mt * pow(t, 2) * y2 + pow(t, 3) * y3);
-            if (!clipWindowSet || (x >= clipMinX && x <= clipMaxX && y >= clipMinY && y <= clipMaxY))
-            SetPixel(hdc, x, y, color);
+            plot(x, y);
         }
+    });
 }
 
 void Curve::FillWithBezier(int x1, int y1, int x2, int y2, COLORREF color) {
@@ -89,7 +159,7 @@ void Curve::FillWithBezier(int x1, int y1, int x2, int y2, COLORREF color) {
     int right = max(x1, x2);
     int top = min(y1, y2);
     int bottom = max(y1, y2);
-    for (int y = top; y <= bottom; y++) {
+    for (int y = top; y <= bottom && !ctx.Cancelled(); y++) {
         DrawBezier(left, y,
                    left + (right - left) / 3, y,
                    right - (right - left) / 3, y,
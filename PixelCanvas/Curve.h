@@ -2,19 +2,30 @@
 #define CURVE_H
 
 #include <windows.h>
+#include <vector>
+#include "PolygonFill.h"
+#include "RenderContext.h"
 
 class Curve {
 public:
-    Curve(HDC hdc);
+    Curve(RenderContext& ctx);
     void FillWithHermite(int x1, int y1, int x2, int y2, COLORREF color);
     void DrawBezier(int x0, int y0, int x1, int y1, int x2, int y2, int x3, int y3, COLORREF color);
     void FillWithBezier(int x1, int y1, int x2, int y2, COLORREF color);
     void DrawCardinalSpline(POINT* pts, int n, double c, COLORREF color);
     void DrawHermite(int x0, int y0, int x1, int y1, int t0, int t1, COLORREF color);
     void DrawHermite2(double x0, double y0, double x1, double y1, double t0x, double t0y, double t1x, double t1y, COLORREF color);
+    // Appends the spline as a polyline whose chords stay within a quarter
+    // pixel of the curve, for stroking.
+    static void FlattenCardinalSpline(const POINT* pts, int n, double c, std::vector<point>& out);
+    // Bounding box of the segments' Bezier control points, which contains the spline.
+    static RECT CardinalSplineBounds(const POINT* pts, int n, double c);
 
 private:
-    HDC hdc;
+    bool BeginSegment(double x0, double y0, double x1, double y1, double x2, double y2, double x3, double y3);
+
+    RenderContext& ctx;
+    bool clipPixels;
 };
 
 #endif 
\ No newline at end of file
@@ -0,0 +1,146 @@
+#include "Dirty.h"
+#include <algorithm>
+#include <atomic>
+
+static const int PageMask = DirtyTracker::PageSize - 1;
+static const int PageTiles = DirtyTracker::PageSize * DirtyTracker::PageSize;
+
+// Workers mark many rows of the same page in a row, so each thread remembers
+// the last page it touched. Pages are freed by Reset or with the tracker, so
+// every tracker and every Reset takes a generation no other has had, and a
+// tracker made where an old one was never matches its cached pages.
+struct PageCache {
+    const DirtyTracker* owner;
+    unsigned generation;
+    unsigned long long key;
+    unsigned* page;
+};
+static thread_local PageCache pageCache = { nullptr, 0, 0, nullptr };
+static std::atomic<unsigned> generations(0);
+
+DirtyTracker::DirtyTracker() : width(0), height(0), tilesX(0), tilesY(0), stamp(1), generation(++generations) {}
+
+void DirtyTracker::Reset(int w, int h) {
+    std::lock_guard<std::mutex> lock(mutex);
+    width = w;
+    height = h;
+    tilesX = (int)(((long long)w + TileSize - 1) >> TileShift);
+    tilesY = (int)(((long long)h + TileSize - 1) >> TileShift);
+    stamp = 1;
+    generation = ++generations;
+    pages.clear();
+    int pagesX = (tilesX + PageSize - 1) >> PageShift, pagesY = (tilesY + PageSize - 1) >> PageShift;
+    if ((long long)pagesX * pagesY <= 256) {
+        for (int py = 0; py < pagesY; py++) {
+            for (int px = 0; px < pagesX; px++)
+                pages[Key(px, py)].reset(new unsigned[PageTiles]());
+        }
+    }
+}
+
+unsigned* DirtyTracker::Page(int px, int py) {
+    unsigned long long key = Key(px, py);
+    PageCache& cache = pageCache;
+    if (cache.owner == this && cache.generation == generation && cache.key == key)
+        return cache.page;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unique_ptr<unsigned[]>& page = pages[key];
+    if (!page)
+        page.reset(new unsigned[PageTiles]());
+    cache.owner = this;
+    cache.generation = generation;
+    cache.key = key;
+    cache.page = page.get();
+    return page.get();
+}
+
+const unsigned* DirtyTracker::FindPage(int px, int py) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = pages.find(Key(px, py));
+    return it == pages.end() ? nullptr : it->second.get();
+}
+
+void DirtyTracker::Mark(int left, int top, int right, int bottom) {
+    left = max(left, 0);
+    top = max(top, 0);
+    right = min(right, width - 1);
+    bottom = min(bottom, height - 1);
+    if (left > right || top > bottom)
+        return;
+    int tx0 = left >> TileShift, tx1 = right >> TileShift;
+    for (int ty = top >> TileShift; ty <= bottom >> TileShift; ty++) {
+        for (int tx = tx0; tx <= tx1;) {
+            int end = min(tx1, tx | PageMask);
+            unsigned* row = Page(tx >> PageShift, ty >> PageShift) + ((ty & PageMask) << PageShift);
+            for (; tx <= end; tx++)
+                row[tx & PageMask] = stamp;
+        }
+    }
+}
+
+void DirtyTracker::MarkAll() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& page : pages)
+        std::fill(page.second.get(), page.second.get() + PageTiles, stamp);
+}
+
+bool DirtyTracker::TileDirtySince(int tx, int ty, unsigned since) const {
+    const unsigned* page = FindPage(tx >> PageShift, ty >> PageShift);
+    return page && page[((ty & PageMask) << PageShift) | (tx & PageMask)] >= since;
+}
+
+void DirtyTracker::RectsSince(unsigned since, std::vector<RECT>& out) const {
+    std::vector<unsigned long long> keys;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        keys.reserve(pages.size());
+        for (auto& page : pages)
+            keys.push_back(page.first);
+    }
+    // Keys order pages by row, then column.
+    std::sort(keys.begin(), keys.end());
+    for (unsigned long long key : keys) {
+        int px = (int)(unsigned)key, py = (int)(key >> 32);
+        PageRects(px, py, FindPage(px, py), since, out);
+    }
+}
+
+void DirtyTracker::PageRects(int px, int py, const unsigned* page, unsigned since, std::vector<RECT>& out) const {
+    int baseX = px << PageShift, baseY = py << PageShift;
+    int columns = min(PageSize, tilesX - baseX), rows = min(PageSize, tilesY - baseY);
+    size_t open = out.size();
+    for (int row = 0; row < rows; row++) {
+        const unsigned* stamps = page + (row << PageShift);
+        int ty = baseY + row;
+        int rowTop = ty << TileShift, rowBottom = (int)min((long long)(ty + 1) << TileShift, (long long)height);
+        size_t rowFirst = out.size();
+        for (int col = 0; col < columns;) {
+            if (stamps[col] < since) {
+                col++;
+                continue;
+            }
+            int start = col;
+            while (col < columns && stamps[col] >= since)
+                col++;
+            RECT r = { (baseX + start) << TileShift, rowTop, (int)min((long long)(baseX + col) << TileShift, (long long)width), rowBottom };
+            // Extend a rectangle from the previous tile row with the same extent.
+            bool merged = false;
+            for (size_t i = open; i < rowFirst; i++) {
+                RECT& prev = out[i];
+                if (prev.bottom == r.top && prev.left == r.left && prev.right == r.right) {
+                    prev.bottom = r.bottom;
+                    merged = true;
+                    break;
+                }
+            }
+            if (!merged)
+                out.push_back(r);
+        }
+        // Only rectangles reaching this row can be extended by the next one;
+        // the rest are moved in front of `open` and left alone.
+        for (size_t i = open; i < out.size(); i++) {
+            if (out[i].bottom != rowBottom)
+                std::swap(out[open++], out[i]);
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef DIRTY_H
+#define DIRTY_H
+
+#include <windows.h>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Records which 64x64 tiles of the canvas have been drawn to. Every tile keeps
+// the stamp current when it was last marked; each consumer (window paint,
+// exporters, a headless caller) remembers the stamp it last synced at and asks
+// for the tiles marked since, so consumers never reset each other's view.
+//
+// Stamps live in pages of 64x64 tiles. Small canvases get every page up
+// front; on very large ones a page is created the first time a tile in it is
+// marked, so tracking costs follow the drawn area.
+class DirtyTracker {
+public:
+    static const int TileShift = 6;
+    static const int TileSize = 1 << TileShift;
+    static const int PageShift = 6;
+    static const int PageSize = 1 << PageShift;
+
+    DirtyTracker();
+
+    void Reset(int width, int height);
+    // Inclusive pixel bounds; anything off the canvas is ignored.
+    void Mark(int left, int top, int right, int bottom);
+    // Marks every existing page, which is the whole canvas unless pages are
+    // created on demand.
+    void MarkAll();
+
+    // Ends the current stamp and returns the one to sync against next time.
+    unsigned Advance() { return ++stamp; }
+    bool TileDirtySince(int tx, int ty, unsigned since) const;
+    // Dirty tiles coalesced into pixel rectangles (right/bottom exclusive):
+    // runs along each tile row, merged downwards while the runs line up.
+    // Rectangles do not extend across pages.
+    void RectsSince(unsigned since, std::vector<RECT>& out) const;
+
+    int TilesX() const { return tilesX; }
+    int TilesY() const { return tilesY; }
+
+private:
+    static unsigned long long Key(int px, int py) { return ((unsigned long long)(unsigned)py << 32) | (unsigned)px; }
+    unsigned* Page(int px, int py);
+    const unsigned* FindPage(int px, int py) const;
+    void PageRects(int px, int py, const unsigned* page, unsigned since, std::vector<RECT>& out) const;
+
+    int width, height;
+    int tilesX, tilesY;
+    unsigned stamp;
+    unsigned generation;
+    std::unordered_map<unsigned long long, std::unique_ptr<unsigned[]>> pages;
+    mutable std::mutex mutex;
+};
+
+#endif
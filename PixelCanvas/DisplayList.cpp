@@ -0,0 +1,63 @@
+#include "DisplayList.h"
+#include <cstring>
+using namespace std;
+
+const DrawRecord& DisplayList::Append(const DrawRecord& record, const POINT* points) {
+    size_t size = record.Size();
+    while (current < chunks.size() && chunks[current].used + size > chunks[current].size)
+        current++;
+    if (current == chunks.size()) {
+        // A record too big for a chunk gets one of its own.
+        size_t bytes = size > ChunkSize ? size : ChunkSize;
+        chunks.push_back(Chunk{ unique_ptr<BYTE[]>(new BYTE[bytes]), bytes, 0 });
+    }
+    Chunk& chunk = chunks[current];
+    BYTE* p = chunk.data.get() + chunk.used;
+    memcpy(p, &record, sizeof(DrawRecord));
+    if (record.count)
+        memcpy(p + sizeof(DrawRecord), points, record.count * sizeof(POINT));
+    chunk.used += size;
+    count++;
+    return *(const DrawRecord*)p;
+}
+
+void DisplayList::Clear() {
+    if (chunks.size() > 1)
+        chunks.resize(1);
+    if (!chunks.empty())
+        chunks[0].used = 0;
+    current = 0;
+    count = 0;
+    kept = 0;
+}
+
+void DisplayList::Truncate(size_t keep) {
+    if (keep >= count)
+        return;
+    size_t seen = 0;
+    for (size_t i = 0; i <= current && i < chunks.size(); i++) {
+        Chunk& chunk = chunks[i];
+        size_t offset = 0;
+        while (offset < chunk.used && seen < keep) {
+            offset += ((const DrawRecord*)(chunk.data.get() + offset))->Size();
+            seen++;
+        }
+        if (seen == keep) {
+            chunk.used = offset;
+            for (size_t j = i + 1; j < chunks.size(); j++)
+                chunks[j].used = 0;
+            current = i;
+            break;
+        }
+    }
+    count = keep;
+    if (kept > keep)
+        kept = keep;
+}
+
+size_t DisplayList::MemoryUsage() const {
+    size_t total = 0;
+    for (const Chunk& chunk : chunks)
+        total += chunk.size;
+    return total;
+}
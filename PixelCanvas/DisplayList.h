@@ -0,0 +1,91 @@
+#ifndef DISPLAYLIST_H
+#define DISPLAYLIST_H
+
+#include <windows.h>
+#include <memory>
+#include <vector>
+
+enum DrawOpcode {
+    DL_LINE,            // 2 points
+    DL_CIRCLE,          // center, param = radius
+    DL_CIRCLE_QUARTER,  // center, param = radius, seed for ring colors
+    DL_SQUARE,          // (left, bottom), (right, top)
+    DL_RECTANGLE,       // two corners
+    DL_FLOOD_FILL,      // seed point, color = boundary
+    DL_SPLINE,          // control points, param = stroke width in 1/256 pixel
+    DL_POLYGON,         // vertices; algo 2..4 edit the clip mask
+    DL_CLIP_WINDOW,     // two corners of the rectangle to narrow to
+    DL_CLIP_CIRCLE,     // center, param = radius, algo = mask op
+    DL_ELLIPSE,         // center, (a, b)
+    DL_CLEAR,           // no points
+    DL_LAYER            // no points, algo = layer drawn on from here,
+                        // param = its opacity, seed = its LayerMode
+};
+
+// One recorded operation, followed in memory by count POINTs. algo is the
+// index picked in the algorithm box for the shape.
+struct DrawRecord {
+    BYTE op;
+    BYTE algo;
+    WORD count;
+    COLORREF color, fill;
+    int param;
+    unsigned seed;
+
+    const POINT* Points() const { return (const POINT*)(this + 1); }
+    size_t Size() const { return sizeof(DrawRecord) + count * sizeof(POINT); }
+};
+
+// Every drawing operation in the order it was made, packed back to back in
+// 64 KB chunks so recording allocates once per chunk and replay walks memory
+// linearly without decoding. Records never move once appended; Clear keeps
+// the first chunk for reuse.
+class DisplayList {
+public:
+    static const size_t ChunkSize = 64 * 1024;
+
+    DisplayList() : current(0), count(0), kept(0) {}
+
+    // Returns the stored copy of the record and its points.
+    const DrawRecord& Append(const DrawRecord& record, const POINT* points);
+    void Clear();
+    // Drops every record after the first count.
+    void Truncate(size_t count);
+
+    size_t Count() const { return count; }
+    // How many of the records there were at the last Mark are still there
+    // unchanged, so a save can store just the ones added since.
+    size_t Kept() const { return kept; }
+    void Mark() { kept = count; }
+    size_t MemoryUsage() const;
+
+    // Calls f(record) in order until it returns false; returns false if it
+    // stopped early.
+    template <class F>
+    bool ForEach(F f) const {
+        for (size_t i = 0; i <= current && i < chunks.size(); i++) {
+            const BYTE* p = chunks[i].data.get();
+            const BYTE* end = p + chunks[i].used;
+            while (p < end) {
+                const DrawRecord& record = *(const DrawRecord*)p;
+                if (!f(record))
+                    return false;
+                p += record.Size();
+            }
+        }
+        return true;
+    }
+
+private:
+    struct Chunk {
+        std::unique_ptr<BYTE[]> data;
+        size_t size, used;
+    };
+
+    std::vector<Chunk> chunks;
+    size_t current;
+    size_t count;
+    size_t kept;
+};
+
+#endif
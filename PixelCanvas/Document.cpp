@@ -0,0 +1,554 @@
+#include "Document.h"
+#include <algorithm>
+#include <cstring>
+#include <unordered_set>
+#include "Dirty.h"
+#include "PngWriter.h"
+using namespace std;
+
+// Layout, all little-endian:
+//   header   "PXCDOC\r\n", version, tile shift, offset of the current index
+//   list     segments of records, each after the offset, record bytes and
+//            record count of the segment before it (offset 0 for none)
+//   index    "PXIX", byte size, clip window, line and fill colors, newest
+//            list segment offset, its record bytes and count, tile count,
+//            then per tile its position, offset and size; a CRC-32 of the
+//            index ends it
+// Version 1 stored the whole list as one run of records with no link.
+static const BYTE Magic[8] = { 'P', 'X', 'C', 'D', 'O', 'C', '\r', '\n' };
+static const BYTE IndexMagic[4] = { 'P', 'X', 'I', 'X' };
+static const DWORD Version = 2;
+static const size_t HeaderSize = 24;
+static const size_t SegmentHeaderSize = 16;
+static const size_t IndexOffsetAt = 16;
+static const size_t EntrySize = 20;
+static const DWORD Background = 0xFFFFFFFF;
+static const int TileMask = CanvasDocument::TileSize - 1;
+static const int TilePixels = CanvasDocument::TileSize * CanvasDocument::TileSize;
+
+static void Put32(vector<BYTE>& out, DWORD v) {
+    BYTE b[4] = { (BYTE)v, (BYTE)(v >> 8), (BYTE)(v >> 16), (BYTE)(v >> 24) };
+    out.insert(out.end(), b, b + 4);
+}
+
+static void Put64(vector<BYTE>& out, unsigned long long v) {
+    Put32(out, (DWORD)v);
+    Put32(out, (DWORD)(v >> 32));
+}
+
+static DWORD Read32(const BYTE* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((DWORD)p[3] << 24); }
+static unsigned long long Read64(const BYTE* p) { return Read32(p) | ((unsigned long long)Read32(p + 4) << 32); }
+
+static void PutPixel(vector<BYTE>& out, DWORD bgra) {
+    BYTE b[3] = { (BYTE)bgra, (BYTE)(bgra >> 8), (BYTE)(bgra >> 16) };
+    out.insert(out.end(), b, b + 3);
+}
+
+static DWORD ReadPixel(const BYTE* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | 0xFF000000; }
+
+// Tokens of up to 128 pixels stored as BGR: a byte of 128 or more repeats
+// the pixel after it (byte - 127) times, a smaller one is followed by that
+// many plus one literal pixels. Drawings pack to a few bytes per tile and
+// photographs cost about three bytes a pixel.
+static void PackTile(const DWORD* p, vector<BYTE>& out) {
+    for (int i = 0; i < TilePixels;) {
+        int run = 1;
+        while (i + run < TilePixels && run < 128 && p[i + run] == p[i])
+            run++;
+        if (run > 1) {
+            out.push_back((BYTE)(127 + run));
+            PutPixel(out, p[i]);
+            i += run;
+            continue;
+        }
+        int start = i++;
+        while (i < TilePixels && i - start < 128 && !(i + 1 < TilePixels && p[i] == p[i + 1]))
+            i++;
+        out.push_back((BYTE)(i - start - 1));
+        for (int j = start; j < i; j++)
+            PutPixel(out, p[j]);
+    }
+}
+
+static bool UnpackTile(const BYTE* in, size_t size, DWORD* out) {
+    const BYTE* end = in + size;
+    for (int i = 0; i < TilePixels;) {
+        if (in == end)
+            return false;
+        int b = *in++;
+        int n = b >= 128 ? b - 127 : b + 1;
+        size_t bytes = b >= 128 ? 3 : (size_t)n * 3;
+        if ((size_t)(end - in) < bytes || i + n > TilePixels)
+            return false;
+        if (b >= 128)
+            std::fill(out + i, out + i + n, ReadPixel(in));
+        else {
+            for (int k = 0; k < n; k++)
+                out[i + k] = ReadPixel(in + k * 3);
+        }
+        in += bytes;
+        i += n;
+    }
+    return in == end;
+}
+
+// Reads a tile of the target as BGRA, pixels off the target as
+// background. False if the whole tile is background.
+static bool ReadTarget(const RenderTarget& target, int tx, int ty, DWORD* out) {
+    if (target.layout == TARGET_SPARSE) {
+        const DWORD* tile = target.sparse->TileForRead(tx, ty);
+        if (target.sparse->IsSentinel(tile))
+            return false;
+        memcpy(out, tile, TilePixels * sizeof(DWORD));
+    }
+    else {
+        int x0 = tx << CanvasDocument::TileShift, y0 = ty << CanvasDocument::TileShift;
+        int w = min(CanvasDocument::TileSize, target.Width() - x0), h = min(CanvasDocument::TileSize, target.Height() - y0);
+        std::fill(out, out + TilePixels, Background);
+        WithTarget(target, [&](auto& t) {
+            for (int y = 0; y < h; y++) {
+                for (int x = 0; x < w; x++) {
+                    COLORREF c = t.Get(x0 + x, y0 + y);
+                    out[(y << CanvasDocument::TileShift) + x] = 0xFF000000 | (GetRValue(c) << 16) | (GetGValue(c) << 8) | GetBValue(c);
+                }
+            }
+        });
+    }
+    for (int i = 0; i < TilePixels; i++) {
+        if (out[i] != Background)
+            return true;
+    }
+    return false;
+}
+
+namespace {
+
+// Decodes tiles straight out of the mapped file.
+class DocumentTiles : public TileSource {
+public:
+    typedef unordered_map<unsigned long long, pair<unsigned long long, DWORD>> Map;
+
+    DocumentTiles(shared_ptr<MappedFile> file, Map tiles) : file(std::move(file)), tiles(std::move(tiles)) {}
+
+    bool ReadTile(int tx, int ty, DWORD* out) const override {
+        auto it = tiles.find(((unsigned long long)(unsigned)ty << 32) | (unsigned)tx);
+        if (it == tiles.end())
+            return false;
+        if (!UnpackTile(file->Data() + it->second.first, it->second.second, out))
+            std::fill(out, out + TilePixels, Background);
+        return true;
+    }
+
+    void TileList(vector<POINT>& out) const override {
+        out.clear();
+        for (const auto& tile : tiles) {
+            POINT p = { (LONG)(unsigned)tile.first, (LONG)(unsigned)(tile.first >> 32) };
+            out.push_back(p);
+        }
+    }
+
+private:
+    shared_ptr<MappedFile> file;
+    Map tiles;
+};
+
+}
+
+static void PutHeader(vector<BYTE>& out) {
+    out.insert(out.end(), Magic, Magic + 8);
+    Put32(out, Version);
+    Put32(out, CanvasDocument::TileShift);
+    Put64(out, 0);
+}
+
+static void PointHeader(vector<BYTE>& out, unsigned long long indexOffset) {
+    for (int i = 0; i < 8; i++)
+        out[IndexOffsetAt + i] = (BYTE)(indexOffset >> (8 * i));
+}
+
+static bool WriteAll(HANDLE h, const vector<BYTE>& out) {
+    bool ok = true;
+    for (size_t done = 0; ok && done < out.size();) {
+        DWORD chunk = (DWORD)min(out.size() - done, (size_t)1 << 30), written = 0;
+        ok = WriteFile(h, out.data() + done, chunk, &written, NULL) && written == chunk;
+        done += chunk;
+    }
+    return ok && FlushFileBuffers(h);
+}
+
+// Moves a fully written temporary file over the target, or removes it.
+static bool Replace(const wstring& temp, const wchar_t* name, bool ok) {
+    if (ok)
+        ok = MoveFileExW(temp.c_str(), name, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+    if (!ok)
+        DeleteFileW(temp.c_str());
+    return ok;
+}
+
+void CanvasDocument::PutIndex(vector<BYTE>& out, const Index& entries, const DocumentInfo& info, unsigned long long listOffset, DWORD listBytes, DWORD listCount) {
+    size_t start = out.size();
+    out.insert(out.end(), IndexMagic, IndexMagic + 4);
+    Put32(out, (DWORD)(8 + 4 * 5 + 4 * 2 + 8 + 4 + 4 + 4 + entries.size() * EntrySize + 4));
+    Put32(out, info.clip.enabled ? 1 : 0);
+    Put32(out, info.clip.minX);
+    Put32(out, info.clip.minY);
+    Put32(out, info.clip.maxX);
+    Put32(out, info.clip.maxY);
+    Put32(out, info.lineColor);
+    Put32(out, info.fillColor);
+    Put64(out, listOffset);
+    Put32(out, listBytes);
+    Put32(out, listCount);
+    Put32(out, (DWORD)entries.size());
+    for (const auto& e : entries) {
+        Put32(out, (DWORD)e.first);
+        Put32(out, (DWORD)(e.first >> 32));
+        Put64(out, e.second.offset);
+        Put32(out, e.second.size);
+    }
+    Put32(out, Crc32(0, out.data() + start, out.size() - start));
+}
+
+bool CanvasDocument::Export(const wchar_t* name, const TileSource& tiles, const DocumentInfo& info) {
+    vector<POINT> list;
+    tiles.TileList(list);
+    vector<BYTE> out;
+    PutHeader(out);
+    Index entries;
+    vector<DWORD> pixels(TilePixels);
+    for (const POINT& p : list) {
+        if (!tiles.ReadTile(p.x, p.y, pixels.data()))
+            continue;
+        bool blank = true;
+        for (int i = 0; i < TilePixels && blank; i++)
+            blank = pixels[i] == Background;
+        if (blank)
+            continue;
+        Entry entry = { out.size(), 0 };
+        PackTile(pixels.data(), out);
+        entry.size = (DWORD)(out.size() - entry.offset);
+        entries[Key(p.x, p.y)] = entry;
+    }
+    unsigned long long indexOffset = out.size();
+    PutIndex(out, entries, info, 0, 0, 0);
+    PointHeader(out, indexOffset);
+
+    wstring temp = wstring(name) + L".tmp";
+    HANDLE h = CreateFileW(temp.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE)
+        return false;
+    bool ok = WriteAll(h, out);
+    CloseHandle(h);
+    return Replace(temp, name, ok);
+}
+
+bool CanvasDocument::Open(const wchar_t* name, const RenderTarget& target, DirtyTracker& dirty, DocumentInfo& info, DisplayList& list) {
+    shared_ptr<MappedFile> mapped = make_shared<MappedFile>(name);
+    const BYTE* data = mapped->Data();
+    size_t size = mapped->Size();
+    if (!data || size < HeaderSize || memcmp(data, Magic, 8) != 0 || Read32(data + 12) != TileShift)
+        return false;
+    DWORD version = Read32(data + 8);
+    if (version < 1 || version > Version)
+        return false;
+
+    // The index is checked whole before anything is taken from it.
+    unsigned long long at = Read64(data + IndexOffsetAt);
+    const size_t fixed = 8 + 4 * 5 + 4 * 2 + 8 + 4 + 4 + 4;
+    if (at > size || size - at < fixed + 4)
+        return false;
+    const BYTE* p = data + at;
+    DWORD bytes = Read32(p + 4);
+    if (memcmp(p, IndexMagic, 4) != 0 || bytes < fixed + 4 || bytes > size - at || Crc32(0, p, bytes - 4) != Read32(p + bytes - 4))
+        return false;
+    DWORD tileCount = Read32(p + fixed - 4);
+    if ((unsigned long long)tileCount * EntrySize != bytes - fixed - 4)
+        return false;
+    unsigned long long listOffset = Read64(p + 36);
+    DWORD listBytes = Read32(p + 44), listCount = Read32(p + 48);
+    // Segments are found newest first and read oldest first. Each links only
+    // to an earlier offset, so a damaged file cannot make the walk loop.
+    struct Segment {
+        unsigned long long records;
+        DWORD bytes, count;
+    };
+    vector<Segment> segments;
+    size_t linkSize = version == 1 ? 0 : SegmentHeaderSize;
+    unsigned long long stored = 0, storedCount = 0;
+    for (unsigned long long seg = listCount ? listOffset : 0; seg;) {
+        if (seg < HeaderSize || seg > size || size - seg < linkSize || listBytes > size - seg - linkSize)
+            return false;
+        Segment segment = { seg + linkSize, listBytes, listCount };
+        segments.push_back(segment);
+        stored += linkSize + listBytes;
+        storedCount += listCount;
+        if (!linkSize)
+            break;
+        unsigned long long previous = Read64(data + seg);
+        if (previous >= seg)
+            return false;
+        listBytes = Read32(data + seg + 8);
+        listCount = Read32(data + seg + 12);
+        seg = previous;
+    }
+    DocumentTiles::Map tiles;
+    Index entries;
+    unsigned long long tileBytes = 0;
+    for (DWORD i = 0; i < tileCount; i++) {
+        const BYTE* e = p + fixed + i * EntrySize;
+        Entry entry = { Read64(e + 8), Read32(e + 16) };
+        if (entry.offset > size || entry.size > size - entry.offset)
+            return false;
+        unsigned long long key = Key((int)Read32(e), (int)Read32(e + 4));
+        entries[key] = entry;
+        tiles[key] = make_pair(entry.offset, entry.size);
+        tileBytes += entry.size;
+    }
+
+    info.clip.enabled = Read32(p + 8) != 0;
+    info.clip.minX = (int)Read32(p + 12);
+    info.clip.minY = (int)Read32(p + 16);
+    info.clip.maxX = (int)Read32(p + 20);
+    info.clip.maxY = (int)Read32(p + 24);
+    info.lineColor = Read32(p + 28);
+    info.fillColor = Read32(p + 32);
+
+    // Records are copied out since the file gives no alignment.
+    list.Clear();
+    vector<POINT> points;
+    for (auto s = segments.rbegin(); s != segments.rend(); ++s) {
+        const BYTE* r = data + s->records;
+        const BYTE* listEnd = r + s->bytes;
+        for (DWORD i = 0; i < s->count && (size_t)(listEnd - r) >= sizeof(DrawRecord); i++) {
+            DrawRecord record;
+            memcpy(&record, r, sizeof(record));
+            if (record.Size() > (size_t)(listEnd - r))
+                break;
+            points.resize(record.count);
+            if (record.count)
+                memcpy(points.data(), r + sizeof(record), record.count * sizeof(POINT));
+            list.Append(record, points.data());
+            r += record.Size();
+        }
+    }
+    list.Mark();
+
+    shared_ptr<DocumentTiles> decoded = make_shared<DocumentTiles>(mapped, std::move(tiles));
+    if (target.layout == TARGET_SPARSE)
+        target.sparse->SetSource(decoded);
+    else {
+        vector<DWORD> pixels(TilePixels);
+        for (const auto& e : entries) {
+            int tx = (int)(unsigned)e.first, ty = (int)(unsigned)(e.first >> 32);
+            int x0 = tx << TileShift, y0 = ty << TileShift;
+            if (tx < 0 || ty < 0 || x0 >= target.Width() || y0 >= target.Height())
+                continue;
+            decoded->ReadTile(tx, ty, pixels.data());
+            int w = min(TileSize, target.Width() - x0), h = min(TileSize, target.Height() - y0);
+            WithTarget(target, [&](auto& t) {
+                for (int y = 0; y < h; y++)
+                    t.StoreBgra(x0, y0 + y, pixels.data() + (y << TileShift), w);
+            });
+        }
+    }
+    // Marking costs nothing per pixel, so a sparse canvas still decodes only
+    // what is presented.
+    for (const auto& e : entries) {
+        long long x0 = (long long)(unsigned)e.first << TileShift, y0 = (long long)(unsigned)(e.first >> 32) << TileShift;
+        if (x0 < target.Width() && y0 < target.Height())
+            dirty.Mark((int)x0, (int)y0, (int)min(x0 + TileMask, (long long)target.Width() - 1), (int)min(y0 + TileMask, (long long)target.Height() - 1));
+    }
+
+    path = name;
+    // A version 1 file is rewritten whole by the next save rather than
+    // appended to, since its list cannot be linked to.
+    end = version == Version ? size : 0;
+    live = HeaderSize + tileBytes + stored + bytes;
+    file = mapped;
+    index.swap(entries);
+    source = decoded;
+    // Records that did not all read back are stored again from the first.
+    bool whole = storedCount == list.Count();
+    listHead = whole && !segments.empty() ? segments.front().records - linkSize : 0;
+    listStored = whole ? stored : 0;
+    listSaved = whole ? list.Count() : 0;
+    headBytes = listHead ? segments.front().bytes : 0;
+    headCount = listHead ? segments.front().count : 0;
+    saved = dirty.Advance();
+    valid = true;
+    return true;
+}
+
+// Tiles drawn since the index was current, or every tile holding anything
+// once it no longer is.
+void CanvasDocument::ChangedTiles(const RenderTarget& target, const DirtyTracker& dirty, vector<POINT>& out) const {
+    out.clear();
+    if (!valid) {
+        if (target.layout == TARGET_SPARSE) {
+            target.sparse->TileList(out);
+            return;
+        }
+        for (int ty = 0; ty << TileShift < target.Height(); ty++) {
+            for (int tx = 0; tx << TileShift < target.Width(); tx++) {
+                POINT p = { tx, ty };
+                out.push_back(p);
+            }
+        }
+        return;
+    }
+    vector<RECT> rects;
+    dirty.RectsSince(saved, rects);
+    unordered_set<unsigned long long> seen;
+    for (const RECT& r : rects) {
+        for (int ty = r.top >> TileShift; ty <= (r.bottom - 1) >> TileShift; ty++) {
+            for (int tx = r.left >> TileShift; tx <= (r.right - 1) >> TileShift; tx++) {
+                POINT p = { tx, ty };
+                if (seen.insert(Key(tx, ty)).second)
+                    out.push_back(p);
+            }
+        }
+    }
+}
+
+bool CanvasDocument::Save(const wchar_t* name, const RenderTarget& target, DirtyTracker& dirty, const DocumentInfo& info, DisplayList& list) {
+    if (!target.IsValid())
+        return false;
+
+    // Appending needs the file to be exactly as the last save left it, and is
+    // given up once more of it is dead than live, so the save compacts it.
+    bool append = false;
+    HANDLE h = INVALID_HANDLE_VALUE;
+    if (!path.empty() && _wcsicmp(name, path.c_str()) == 0) {
+        h = CreateFileW(name, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        LARGE_INTEGER length;
+        append = h != INVALID_HANDLE_VALUE && GetFileSizeEx(h, &length) && (unsigned long long)length.QuadPart == end && end - live <= live;
+        if (!append && h != INVALID_HANDLE_VALUE) {
+            CloseHandle(h);
+            h = INVALID_HANDLE_VALUE;
+        }
+    }
+    wstring temp = wstring(name) + L".tmp";
+    if (!append) {
+        h = CreateFileW(temp.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (h == INVALID_HANDLE_VALUE)
+            return false;
+    }
+    // Tiles are copied out of the file only if it could be mapped.
+    if (!append && !(file && file->Data()))
+        valid = false;
+    vector<POINT> changed;
+    ChangedTiles(target, dirty, changed);
+    unsigned stamp = dirty.Advance();
+    unsigned long long base = append ? end : 0;
+    vector<BYTE> out;
+    if (!append)
+        PutHeader(out);
+
+    // Unchanged tiles keep their entries when appending and are copied over
+    // still packed into a new file.
+    Index entries;
+    if (valid) {
+        unordered_set<unsigned long long> skip;
+        for (const POINT& p : changed)
+            skip.insert(Key(p.x, p.y));
+        for (const auto& e : index) {
+            if (skip.count(e.first))
+                continue;
+            if (append)
+                entries[e.first] = e.second;
+            else {
+                Entry moved = { base + out.size(), e.second.size };
+                const BYTE* blob = file->Data() + e.second.offset;
+                out.insert(out.end(), blob, blob + e.second.size);
+                entries[e.first] = moved;
+            }
+        }
+    }
+    vector<DWORD> pixels(TilePixels);
+    for (const POINT& p : changed) {
+        if (!ReadTarget(target, p.x, p.y, pixels.data()))
+            continue;
+        Entry entry = { base + out.size(), 0 };
+        PackTile(pixels.data(), out);
+        entry.size = (DWORD)(base + out.size() - entry.offset);
+        entries[Key(p.x, p.y)] = entry;
+    }
+
+    // Records stored before and still in the list stay where they are; the
+    // rest go in a new segment linked to the newest stored one.
+    size_t from = append && list.Kept() >= listSaved ? listSaved : 0;
+    unsigned long long head = from ? listHead : 0, stored = from ? listStored : 0;
+    DWORD listBytes = from ? headBytes : 0, listCount = from ? headCount : 0;
+    if (list.Count() > from) {
+        unsigned long long segment = base + out.size();
+        Put64(out, head);
+        Put32(out, listBytes);
+        Put32(out, listCount);
+        size_t start = out.size(), i = 0;
+        listCount = 0;
+        list.ForEach([&](const DrawRecord& record) {
+            if (i++ < from)
+                return true;
+            const BYTE* r = (const BYTE*)&record;
+            out.insert(out.end(), r, r + record.Size());
+            listCount++;
+            return true;
+        });
+        listBytes = (DWORD)(out.size() - start);
+        head = segment;
+        stored += SegmentHeaderSize + listBytes;
+    }
+
+    unsigned long long indexOffset = base + out.size();
+    size_t indexStart = out.size();
+    PutIndex(out, entries, info, head, listBytes, listCount);
+    unsigned long long tileBytes = 0;
+    for (const auto& e : entries)
+        tileBytes += e.second.size;
+
+    // The header is pointed at the new index only once everything else is on
+    // disk.
+    bool ok = true;
+    if (!append) {
+        PointHeader(out, indexOffset);
+    }
+    else {
+        LARGE_INTEGER at;
+        at.QuadPart = (LONGLONG)base;
+        ok = SetFilePointerEx(h, at, NULL, FILE_BEGIN) != 0;
+    }
+    ok = ok && WriteAll(h, out);
+    if (ok && append) {
+        BYTE pointer[8];
+        for (int i = 0; i < 8; i++)
+            pointer[i] = (BYTE)(indexOffset >> (8 * i));
+        LARGE_INTEGER at;
+        at.QuadPart = IndexOffsetAt;
+        DWORD written = 0;
+        ok = SetFilePointerEx(h, at, NULL, FILE_BEGIN) && WriteFile(h, pointer, 8, &written, NULL) && written == 8 && FlushFileBuffers(h);
+    }
+    CloseHandle(h);
+    if (!append) {
+        // Unchanged tiles have been copied out, so the old file need not stay
+        // mapped while it is replaced.
+        file.reset();
+        ok = Replace(temp, name, ok);
+    }
+    if (!ok)
+        return false;
+
+    path = name;
+    end = base + out.size();
+    live = HeaderSize + tileBytes + stored + (out.size() - indexStart);
+    file = make_shared<MappedFile>(name);
+    index.swap(entries);
+    listHead = head;
+    listStored = stored;
+    listSaved = list.Count();
+    headBytes = listBytes;
+    headCount = listCount;
+    list.Mark();
+    saved = stamp;
+    valid = true;
+    return true;
+}
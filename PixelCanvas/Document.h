@@ -0,0 +1,88 @@
+#ifndef DOCUMENT_H
+#define DOCUMENT_H
+
+#include <windows.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Clip.h"
+#include "DisplayList.h"
+#include "Dirty.h"
+#include "MappedFile.h"
+#include "Target.h"
+
+// What a document keeps besides its pixels.
+struct DocumentInfo {
+    ClipRect clip;
+    COLORREF lineColor, fillColor;
+};
+
+// The native .pxc document: the canvas as 64x64 tiles, each packed on its
+// own, plus the clip window, drawing colors and display list. The file is a
+// journal. A save appends the tiles dirtied since the previous one, then the
+// records added to the display list since, and a new index of every stored
+// tile, and only then points the header at that index, so a save cut short
+// leaves the last complete one in place. Once most of the file is dead
+// (replaced tiles, old indexes, records undone) the save rewrites it instead.
+// Tiles missing from the index are white.
+//
+// Open maps the file. A sparse canvas decodes each tile the first time it is
+// read; fixed-size canvases are decoded at once. Must be used from the thread
+// that draws on the target, or while it is idle.
+class CanvasDocument {
+public:
+    static const int TileShift = 6;
+    static const int TileSize = 1 << TileShift;
+
+    CanvasDocument() : end(0), live(0), listHead(0), listStored(0), listSaved(0), headBytes(0), headCount(0), saved(0), valid(false) {}
+
+    // The target must have just been cleared. Replaces the contents of list.
+    // dirty is the target's canvas tracker, which tells saves what changed.
+    bool Open(const wchar_t* path, const RenderTarget& target, DirtyTracker& dirty, DocumentInfo& info, DisplayList& list);
+    // Appends to the file if it is the document's own, otherwise writes a
+    // whole new one (through a temporary file) and makes it the document's.
+    bool Save(const wchar_t* path, const RenderTarget& target, DirtyTracker& dirty, const DocumentInfo& info, DisplayList& list);
+    // Call when the canvas is cleared or replaced, so the next save stores
+    // every tile again instead of reusing the ones in the file.
+    void Forget() { valid = false; }
+
+    // Writes the tiles as a new document with no display list, through a
+    // temporary file and a rename. Touches no canvas state, so it can run on
+    // any thread.
+    static bool Export(const wchar_t* path, const TileSource& tiles, const DocumentInfo& info);
+
+    // Tiles of the file as opened, for undo to fall back on.
+    std::shared_ptr<const TileSource> Tiles() const { return source; }
+
+private:
+    struct Entry {
+        unsigned long long offset;
+        DWORD size;
+    };
+    typedef std::unordered_map<unsigned long long, Entry> Index;
+
+    static unsigned long long Key(int tx, int ty) { return ((unsigned long long)(unsigned)ty << 32) | (unsigned)tx; }
+    static void PutIndex(std::vector<BYTE>& out, const Index& entries, const DocumentInfo& info, unsigned long long listOffset, DWORD listBytes, DWORD listCount);
+    void ChangedTiles(const RenderTarget& target, const DirtyTracker& dirty, std::vector<POINT>& out) const;
+
+    std::wstring path;
+    // File size after the last save, where the next one appends, and how
+    // much of it the index still refers to.
+    unsigned long long end, live;
+    // The stored display list: its newest segment, the bytes of every
+    // segment, how many records they hold, and the newest one's record bytes
+    // and count for the next segment to link back to.
+    unsigned long long listHead, listStored;
+    size_t listSaved;
+    DWORD headBytes, headCount;
+    // The whole file as of the last save or open.
+    std::shared_ptr<MappedFile> file;
+    Index index;
+    std::shared_ptr<const TileSource> source;
+    // Dirty stamp the index is current to, when valid.
+    unsigned saved;
+    bool valid;
+};
+
+#endif
@@ -1,75 +1,225 @@
 #include "Ellipse.h"
 #include <cmath>
 #include "PixelCanvas.h"
+#include "RenderContext.h"
 
-extern bool clipWindowSet;
-extern int clipMinX, clipMaxX, clipMinY, clipMaxY;
+// The signs each quarter's (x, y) is drawn with.
+struct Quarter {
+    int sx, sy;
+};
 
-static void Draw4Points(HDC hdc, int xc, int yc, int x, int y, COLORREF color) {
-    if (!clipWindowSet || (xc + x >= clipMinX && xc + x <= clipMaxX && yc + y >= clipMinY && yc + y <= clipMaxY)) SetPixel(hdc, xc + x, yc + y, color);
-    if (!clipWindowSet || (xc - x >= clipMinX && xc - x <= clipMaxX && yc + y >= clipMinY && yc + y <= clipMaxY)) SetPixel(hdc, xc - x, yc + y, color);
-    if (!clipWindowSet || (xc + x >= clipMinX && xc + x <= clipMaxX && yc - y >= clipMinY && yc - y <= clipMaxY)) SetPixel(hdc, xc + x, yc - y, color);
-    if (!clipWindowSet || (xc - x >= clipMinX && xc - x <= clipMaxX && yc - y >= clipMinY && yc - y <= clipMaxY)) SetPixel(hdc, xc - x, yc - y, color);
+static const Quarter Quarters[4] = { { 1, 1 }, { -1, 1 }, { 1, -1 }, { -1, -1 } };
+
+// Evaluates the midpoint algorithm's fractional start values, whole + q / 4
+// truncated toward zero, in 64-bit integers. The products that make up
+// `whole` can exceed 64 bits for radii in the tens of thousands while their
+// sum stays small, so they are accumulated modulo 2^64.
+static long long TruncQuarters(unsigned long long whole, long long q) {
+    long long t = (long long)whole + q / 4;
+    return (q % 4 && t < 0) ? t + 1 : t;
+}
+
+static long long FloorSqrt(unsigned long long v) {
+    unsigned long long s = (unsigned long long)sqrt((double)v);
+    if (s > 0xFFFFFFFFull) s = 0xFFFFFFFFull;
+    while (s * s > v) s--;
+    while ((s + 1) * (s + 1) <= v) s++;
+    return (long long)s;
 }
 
-void DrawEllipseDirect(HDC hdc, int xc, int yc, int a, int b, COLORREF color) {
-    int a2 = a * a;
-    int b2 = b * b;
-    for (int x = 0; x <= a; ++x) {
-        double y = b * sqrt(1.0 - (double)x * x / a2);
-        Draw4Points(hdc, xc, yc, x, round(y), color);
+// The midpoint walk of a quarter, in two regions: region 1 moves a column at a
+// time while the outline is flatter than 45 degrees, region 2 a row at a time
+// after. The start values' truncation only shifts the decision variable by a
+// constant, so within a region the point at a column (or row) is the one the
+// previous column's (or row's) midpoint test picks, and follows in closed form.
+// A tile starts each walk where it enters the tile instead of at the axis.
+// The closed forms need 4a^2b^2 to fit 64 bits; past that the walk is stepped
+// from its start.
+class MidpointEllipse {
+public:
+    MidpointEllipse(int a, int b)
+        : a2((long long)a * a), b2((long long)b * b), b(b), closed(abs(a) < 32768 && abs(b) < 32768) {
+        d1 = TruncQuarters(b2 - a2 * b, a2);
+        e1 = closed ? 4 * (b2 - a2 * b) + a2 - 4 * d1 : 0;
+        int lo = 0, hi = abs(a);
+        if (closed) {
+            while (lo < hi) {
+                int mid = lo + (hi - lo) / 2;
+                int y;
+                long long d;
+                Region1At(mid, y, d);
+                if (b2 * mid >= a2 * y) hi = mid;
+                else lo = mid + 1;
+            }
+            x2 = lo;
+            Region1At(x2, y2, d2);
+        }
+        else {
+            x2 = 0;
+            y2 = b;
+            d2 = d1;
+            while (2 * b2 * x2 < 2 * a2 * y2)
+                Step1(x2, y2, d2);
+        }
+        d2 = TruncQuarters((unsigned long long)b2 * ((long long)x2 * x2 + x2) + (unsigned long long)a2 * ((long long)(y2 - 1) * (y2 - 1)) - (unsigned long long)a2 * b2, b2);
+        e2 = closed ? (long long)((unsigned long long)b2 * (2ll * x2 + 1) * (2ll * x2 + 1) + 4ull * a2 * ((long long)(y2 - 1) * (y2 - 1)) - 4ull * a2 * b2 - 4ull * d2) : 0;
     }
-    for (int y = 0; y <= b; ++y) {
-        double x = a * sqrt(1.0 - (double)y * y / b2);
-        Draw4Points(hdc, xc, yc, round(x), y, color);
+
+    // Region 1 covers columns 0 to Region2Column() - 1, region 2 rows
+    // Region2Row() down to 0.
+    int Region2Column() const { return x2; }
+    int Region2Row() const { return y2; }
+
+    void Region1At(int x, int& y, long long& d) const {
+        y = b;
+        d = d1;
+        if (x == 0)
+            return;
+        if (closed) {
+            int u = x - 1;
+            long long n = e1 + 4 * a2 * b2 - 4 * b2 * u * u;
+            long long m = n > 0 ? FloorSqrt((n + a2 - 1) / a2 - 1) : -1;
+            y = (int)min((m + 1) / 2, (long long)b);
+            d = (long long)(4ull * b2 * x * x + (unsigned long long)a2 * (2ll * y - 1) * (2ll * y - 1) - 4ull * a2 * b2 - e1) / 4;
+            x = u;
+            Step1(x, y, d);
+            return;
+        }
+        for (int i = 0; i < x;)
+            Step1(i, y, d);
     }
-}
 
-void DrawEllipsePolar(HDC hdc, int xc, int yc, int a, int b, COLORREF color) {
-    double PI = 3.14159265358979323846;
-    for (double theta = 0; theta < 2 * PI; theta += 0.0005) {
-        int x = round(a * cos(theta));
-        int y = round(b * sin(theta));
-        if (!clipWindowSet || (xc + x >= clipMinX && xc + x <= clipMaxX && yc + y >= clipMinY && yc + y <= clipMaxY))
-            SetPixel(hdc, xc + x, yc + y, color);
+    void Region2At(int y, int& x, long long& d) const {
+        x = x2;
+        d = d2;
+        if (y == y2)
+            return;
+        if (closed) {
+            int v = y + 1;
+            long long k = 4 * a2 * b2 - 4 * a2 * v * v + e2;
+            if (k >= b2)
+                x = max(x, (int)((FloorSqrt(k / b2) + 1) / 2));
+            d = (long long)((unsigned long long)b2 * (2ll * x + 1) * (2ll * x + 1) + 4ull * a2 * y * y - 4ull * a2 * b2 - e2) / 4;
+            Step2(x, v, d);
+            return;
+        }
+        for (int i = y2; i > y;)
+            Step2(x, i, d);
     }
-}
 
-void DrawEllipseMidpoint(HDC hdc, int xc, int yc, int a, int b, COLORREF color) {
-    int x = 0, y = b;
-    int a2 = a * a, b2 = b * b;
-    int d = b2 - a2 * b + 0.25 * a2;
-    int dx = 2 * b2 * x;
-    int dy = 2 * a2 * y;
-    // Region 1
-    while (dx < dy) {
-        Draw4Points(hdc, xc, yc, x, y, color);
+    void Step1(int& x, int& y, long long& d) const {
         if (d < 0) {
             x++;
-            dx += 2 * b2;
-            d += dx + b2;
+            d += 2 * b2 * x + b2;
         } else {
             x++;
             y--;
-            dx += 2 * b2;
-            dy -= 2 * a2;
-            d += dx - dy + b2;
+            d += 2 * b2 * x - 2 * a2 * y + b2;
         }
     }
-    // Region 2
-    d = b2 * (x + 0.5) * (x + 0.5) + a2 * (y - 1) * (y - 1) - a2 * b2;
-    while (y >= 0) {
-        Draw4Points(hdc, xc, yc, x, y, color);
+
+    void Step2(int& x, int& y, long long& d) const {
         if (d > 0) {
             y--;
-            dy -= 2 * a2;
-            d += a2 - dy;
+            d += a2 - 2 * a2 * y;
         } else {
             x++;
             y--;
-            dx += 2 * b2;
-            dy -= 2 * a2;
-            d += dx - dy + a2;
+            d += 2 * b2 * x - 2 * a2 * y + a2;
         }
     }
+
+private:
+    long long a2, b2;
+    int b;
+    bool closed;
+    long long d1, e1;
+    int x2, y2;
+    long long d2, e2;
+};
+
+// A window wholly inside or outside the band the outline is drawn in, such as
+// a tile of the ellipse's interior, is skipped.
+static bool BeginEllipse(const RenderContext& ctx, int xc, int yc, int a, int b, bool& clipPixels) {
+    ClipResult r = ClassifyClip(ctx, xc - a, yc - b, xc + a, yc + b);
+    clipPixels = (r == CLIP_PARTIAL);
+    if (r == CLIP_OUTSIDE || MissesOutline(ctx.ClipWindow(), xc, yc, a, b, 2)) return false;
+    MarkDrawn(ctx, xc - a, yc - b, xc + a, yc + b);
+    return true;
+}
+
+void DrawEllipseDirect(RenderContext& ctx, int xc, int yc, int a, int b, COLORREF color) {
+    bool clipPixels;
+    if (!BeginEllipse(ctx, xc, yc, a, b, clipPixels)) return;
+    WithTarget(ctx, [&](auto& target) {
+        auto plot = MakePlotter(ctx, target, color, clipPixels);
+        const ClipRect& window = ctx.ClipWindow();
+        double a2 = (double)a * a;
+        double b2 = (double)b * b;
+        for (const Quarter& q : Quarters) {
+            int first = 0, last = a;
+            if (!ClipReflected(window, false, xc, q.sx, first, last)) continue;
+            for (int x = first; x <= last; ++x) {
+                double y = b * sqrt(1.0 - (double)x * x / a2);
+                plot(xc + q.sx * x, yc + q.sy * (int)round(y));
+            }
+        }
+        for (const Quarter& q : Quarters) {
+            int first = 0, last = b;
+            if (!ClipReflected(window, true, yc, q.sy, first, last)) continue;
+            for (int y = first; y <= last; ++y) {
+                double x = a * sqrt(1.0 - (double)y * y / b2);
+                plot(xc + q.sx * (int)round(x), yc + q.sy * y);
+            }
+        }
+    });
+}
+
+void DrawEllipsePolar(RenderContext& ctx, int xc, int yc, int a, int b, COLORREF color) {
+    bool clipPixels;
+    if (!BeginEllipse(ctx, xc, yc, a, b, clipPixels)) return;
+    WithTarget(ctx, [&](auto& target) {
+        auto plot = MakePlotter(ctx, target, color, clipPixels);
+        double PI = 3.14159265358979323846;
+        for (double theta = 0; theta < 2 * PI; theta += 0.0005) {
+            int x = round(a * cos(theta));
+            int y = round(b * sin(theta));
+            plot(xc + x, yc + y);
+        }
+    });
+}
+
+void DrawEllipseMidpoint(RenderContext& ctx, int xc, int yc, int a, int b, COLORREF color) {
+    bool clipPixels;
+    if (!BeginEllipse(ctx, xc, yc, a, b, clipPixels)) return;
+    WithTarget(ctx, [&](auto& target) {
+        auto plot = MakePlotter(ctx, target, color, clipPixels);
+        const ClipRect& window = ctx.ClipWindow();
+        MidpointEllipse walk(a, b);
+        for (const Quarter& q : Quarters) {
+            // Region 1
+            int x = 0, last = walk.Region2Column() - 1;
+            if (ClipReflected(window, false, xc, q.sx, x, last)) {
+                int y;
+                long long d;
+                walk.Region1At(x, y, d);
+                plot(xc + q.sx * x, yc + q.sy * y);
+                while (x < last) {
+                    walk.Step1(x, y, d);
+                    plot(xc + q.sx * x, yc + q.sy * y);
+                }
+            }
+            // Region 2
+            int first = 0, y = walk.Region2Row();
+            if (ClipReflected(window, true, yc, q.sy, first, y)) {
+                long long d;
+                walk.Region2At(y, x, d);
+                plot(xc + q.sx * x, yc + q.sy * y);
+                while (y > first) {
+                    walk.Step2(x, y, d);
+                    plot(xc + q.sx * x, yc + q.sy * y);
+                }
+            }
+        }
+    });
 } 
\ No newline at end of file
@@ -2,9 +2,10 @@
 #define ELLIPSE_H
 
 #include <windows.h>
+#include "RenderContext.h"
 
-void DrawEllipseDirect(HDC hdc, int xc, int yc, int a, int b, COLORREF color);
-void DrawEllipsePolar(HDC hdc, int xc, int yc, int a, int b, COLORREF color);
-void DrawEllipseMidpoint(HDC hdc, int xc, int yc, int a, int b, COLORREF color);
+void DrawEllipseDirect(RenderContext& ctx, int xc, int yc, int a, int b, COLORREF color);
+void DrawEllipsePolar(RenderContext& ctx, int xc, int yc, int a, int b, COLORREF color);
+void DrawEllipseMidpoint(RenderContext& ctx, int xc, int yc, int a, int b, COLORREF color);
 
 #endif 
\ No newline at end of file
@@ -0,0 +1,41 @@
+#include "Gradient.h"
+#include <emmintrin.h>
+
+ColorRamp::ColorRamp(COLORREF c0, COLORREF c1, int steps)
+    : b(Fixed(GetBValue(c0))), g(Fixed(GetGValue(c0))), r(Fixed(GetRValue(c0))), db(0), dg(0), dr(0) {
+    if (steps > 0) {
+        db = ((GetBValue(c1) - GetBValue(c0)) << 16) / steps;
+        dg = ((GetGValue(c1) - GetGValue(c0)) << 16) / steps;
+        dr = ((GetRValue(c1) - GetRValue(c0)) << 16) / steps;
+    }
+}
+
+// Channels live in bits 16..23 of each accumulator, so packing is a shift and
+// two masks per channel rather than a per-pixel repack.
+void ColorRamp::Generate(DWORD* out, int count) {
+    int i = 0;
+    if (count >= 4) {
+        __m128i vb = _mm_setr_epi32(b, b + db, b + 2 * db, b + 3 * db);
+        __m128i vg = _mm_setr_epi32(g, g + dg, g + 2 * dg, g + 3 * dg);
+        __m128i vr = _mm_setr_epi32(r, r + dr, r + 2 * dr, r + 3 * dr);
+        const __m128i sb = _mm_set1_epi32(4 * db);
+        const __m128i sg = _mm_set1_epi32(4 * dg);
+        const __m128i sr = _mm_set1_epi32(4 * dr);
+        const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+        const __m128i maskG = _mm_set1_epi32(0x0000FF00);
+        const __m128i maskR = _mm_set1_epi32(0x00FF0000);
+        for (; i + 4 <= count; i += 4) {
+            __m128i px = _mm_or_si128(_mm_srli_epi32(vb, 16), _mm_and_si128(_mm_srli_epi32(vg, 8), maskG));
+            px = _mm_or_si128(px, _mm_or_si128(_mm_and_si128(vr, maskR), alpha));
+            _mm_storeu_si128((__m128i*)(out + i), px);
+            vb = _mm_add_epi32(vb, sb);
+            vg = _mm_add_epi32(vg, sg);
+            vr = _mm_add_epi32(vr, sr);
+        }
+        Advance(i);
+    }
+    for (; i < count; ++i) {
+        out[i] = 0xFF000000 | (r & 0x00FF0000) | ((g >> 8) & 0x0000FF00) | ((DWORD)b >> 16);
+        Advance(1);
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef GRADIENT_H
+#define GRADIENT_H
+
+#include <windows.h>
+
+// Linear color interpolation in 16.16 fixed point per channel. Generate
+// produces packed BGRA pixels four at a time with SSE2.
+class ColorRamp {
+public:
+    ColorRamp() : b(0), g(0), r(0), db(0), dg(0), dr(0) {}
+    // Color c0 at step 0 and c1 at step `steps`.
+    ColorRamp(COLORREF c0, COLORREF c1, int steps);
+    // Starts from 16.16 channel values with explicit per-step deltas.
+    ColorRamp(int b, int g, int r, int db, int dg, int dr) : b(b), g(g), r(r), db(db), dg(dg), dr(dr) {}
+
+    static int Fixed(BYTE channel) { return (channel << 16) | 0x8000; }
+    static DWORD ToBGRA(COLORREF c) { return 0xFF000000 | (GetRValue(c) << 16) | (GetGValue(c) << 8) | GetBValue(c); }
+    static COLORREF ToColorRef(DWORD bgra) { return RGB((bgra >> 16) & 0xFF, (bgra >> 8) & 0xFF, bgra & 0xFF); }
+
+    void Advance(int n) {
+        b += db * n;
+        g += dg * n;
+        r += dr * n;
+    }
+    // Writes `count` consecutive colors and advances past them.
+    void Generate(DWORD* out, int count);
+
+    int b, g, r;
+    int db, dg, dr;
+};
+
+#endif
@@ -0,0 +1,353 @@
+#include "History.h"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include "Dirty.h"
+using namespace std;
+
+static const int TilePixels = TileHistory::TileSize * TileHistory::TileSize;
+
+// Packing swaps a copy's pixels for runs in place, which snapshot readers on
+// other threads must not see half done.
+static mutex packLock;
+
+class TileHistory::SnapshotTiles : public TileSource {
+public:
+    SnapshotTiles(const unordered_map<unsigned long long, TilePtr>& tiles, shared_ptr<const TileSource> base, const vector<Layer>& layers)
+        : tiles(tiles), base(std::move(base)), background(layers[0].background) {
+        for (const Layer& layer : layers)
+            blends.push_back(layer.blend);
+    }
+
+    // Layers above the bottom one are composited over it as LayerStack does.
+    bool ReadTile(int tx, int ty, DWORD* out) const override {
+        bool drawn = ReadBottom(tx, ty, out);
+        if (blends.size() == 1 && blends[0] == OpaqueLayer)
+            return drawn;
+        if (!drawn)
+            fill(out, out + TilePixels, background);
+        vector<DWORD> pixels(TilePixels);
+        if (blends[0] != OpaqueLayer) {
+            pixels.assign(out, out + TilePixels);
+            fill(out, out + TilePixels, background);
+            CompositeSpan(out, pixels.data(), TilePixels, blends[0]);
+        }
+        for (size_t i = 1; i < blends.size(); i++) {
+            auto it = tiles.find(Key(tx, ty, (int)i));
+            if (it == tiles.end() || !it->second)
+                continue;
+            {
+                lock_guard<mutex> lock(packLock);
+                Unpack(*it->second, pixels.data());
+            }
+            CompositeSpan(out, pixels.data(), TilePixels, blends[i]);
+            drawn = true;
+        }
+        return drawn;
+    }
+
+    void TileList(vector<POINT>& out) const override {
+        out.clear();
+        if (base)
+            base->TileList(out);
+        out.erase(remove_if(out.begin(), out.end(), [&](const POINT& p) { return tiles.count(Key(p.x, p.y)) != 0; }), out.end());
+        for (const auto& tile : tiles) {
+            if (tile.second) {
+                POINT p = { (LONG)(unsigned)tile.first, (LONG)((unsigned)(tile.first >> 32) & 0xFFFFFF) };
+                out.push_back(p);
+            }
+        }
+        if (blends.size() > 1) {
+            auto before = [](const POINT& a, const POINT& b) { return a.y != b.y ? a.y < b.y : a.x < b.x; };
+            sort(out.begin(), out.end(), before);
+            out.erase(unique(out.begin(), out.end(), [](const POINT& a, const POINT& b) { return a.x == b.x && a.y == b.y; }), out.end());
+        }
+    }
+
+private:
+    bool ReadBottom(int tx, int ty, DWORD* out) const {
+        auto it = tiles.find(Key(tx, ty));
+        if (it == tiles.end())
+            return base && base->ReadTile(tx, ty, out);
+        if (!it->second)
+            return false;
+        lock_guard<mutex> lock(packLock);
+        Unpack(*it->second, out);
+        return true;
+    }
+
+    unordered_map<unsigned long long, TilePtr> tiles;
+    shared_ptr<const TileSource> base;
+    DWORD background;
+    vector<LayerBlend> blends;
+};
+
+void TileHistory::Attach(const RenderTarget& t, DirtyTracker& marks, DWORD bgra, std::shared_ptr<const TileSource> tiles) {
+    layers.assign(1, Layer{ t, bgra, OpaqueLayer });
+    dirty = &marks;
+    base = std::move(tiles);
+    current.clear();
+    steps.clear();
+    position = 0;
+    used = 0;
+    baseTag = 0;
+    version++;
+    since = dirty->Advance();
+}
+
+int TileHistory::AddLayer(const RenderTarget& t, DWORD bgra) {
+    layers.push_back(Layer{ t, bgra, OpaqueLayer });
+    return (int)layers.size() - 1;
+}
+
+void TileHistory::SetBlend(int layer, const LayerBlend& blend) {
+    if (layer >= (int)layers.size() || layers[layer].blend == blend)
+        return;
+    layers[layer].blend = blend;
+    version++;
+}
+
+shared_ptr<const TileSource> TileHistory::Snapshot() const {
+    return make_shared<SnapshotTiles>(current, base, layers);
+}
+
+size_t TileHistory::Bytes(const TilePtr& tile) {
+    if (!tile)
+        return 0;
+    return sizeof(TileCopy) + (tile->pixels.capacity() + tile->runs.capacity()) * sizeof(DWORD);
+}
+
+size_t TileHistory::StepBytes(const Step& step) {
+    size_t total = step.changes.capacity() * sizeof(Change);
+    for (const Change& c : step.changes)
+        total += Bytes(c.before) + Bytes(c.after);
+    return total;
+}
+
+void TileHistory::Unpack(const TileCopy& tile, DWORD* out) {
+    if (tile.runs.empty()) {
+        memcpy(out, tile.pixels.data(), TilePixels * sizeof(DWORD));
+        return;
+    }
+    for (size_t i = 0; i < tile.runs.size(); i += 2) {
+        for (DWORD n = tile.runs[i]; n > 0; n--)
+            *out++ = tile.runs[i + 1];
+    }
+}
+
+// Kept only if the runs are smaller than the pixels.
+void TileHistory::Pack(TileCopy& tile) {
+    if (tile.pixels.empty())
+        return;
+    vector<DWORD> runs;
+    const DWORD* p = tile.pixels.data();
+    for (int i = 0; i < TilePixels && runs.size() < TilePixels;) {
+        int start = i;
+        while (i < TilePixels && p[i] == p[start])
+            i++;
+        runs.push_back((DWORD)(i - start));
+        runs.push_back(p[start]);
+    }
+    if (runs.size() >= TilePixels)
+        return;
+    runs.shrink_to_fit();
+    vector<DWORD> pixels;
+    lock_guard<mutex> lock(packLock);
+    tile.runs.swap(runs);
+    tile.pixels.swap(pixels);
+}
+
+// Tiles that are entirely background are not stored. Layer pixels are copied
+// with their alpha; other targets hold opaque colors.
+TileHistory::TilePtr TileHistory::Capture(int layer, int tx, int ty) const {
+    const RenderTarget& target = layers[layer].target;
+    DWORD background = layers[layer].background;
+    if (target.layout == TARGET_SPARSE && target.sparse->IsSentinel(target.sparse->TileForRead(tx, ty)))
+        return nullptr;
+    int x0 = tx << TileShift, y0 = ty << TileShift;
+    int w = min(TileSize, target.Width() - x0), h = min(TileSize, target.Height() - y0);
+    TilePtr tile = make_shared<TileCopy>();
+    tile->pixels.assign(TilePixels, background);
+    DWORD* out = tile->pixels.data();
+    if (target.layout == TARGET_LINEAR && target.format == FORMAT_BGRA32) {
+        for (int y = 0; y < h; y++)
+            memcpy(out + (y << TileShift), target.linear.Pixel(x0, y0 + y), w * sizeof(DWORD));
+    }
+    else {
+        WithTarget(target, [&](auto& t) {
+            for (int y = 0; y < h; y++) {
+                for (int x = 0; x < w; x++) {
+                    COLORREF c = t.Get(x0 + x, y0 + y);
+                    out[(y << TileShift) + x] = 0xFF000000 | (GetRValue(c) << 16) | (GetGValue(c) << 8) | GetBValue(c);
+                }
+            }
+        });
+    }
+    bool blank = all_of(out, out + TilePixels, [background](DWORD v) { return v == background; });
+    return blank ? nullptr : tile;
+}
+
+// A tile not captured yet still holds what the base gave it, which covers
+// only the bottom layer.
+TileHistory::TilePtr TileHistory::Previous(int layer, int tx, int ty) const {
+    auto it = current.find(Key(tx, ty, layer));
+    if (it != current.end())
+        return it->second;
+    if (!base || layer)
+        return nullptr;
+    TilePtr tile = make_shared<TileCopy>();
+    tile->pixels.resize(TilePixels);
+    if (!base->ReadTile(tx, ty, tile->pixels.data()))
+        return nullptr;
+    return tile;
+}
+
+bool TileHistory::Same(const TilePtr& a, const TilePtr& b) const {
+    if (!a || !b)
+        return a == b;
+    if (a->runs.empty() && b->runs.empty())
+        return a->pixels == b->pixels;
+    vector<DWORD> pa(TilePixels), pb(TilePixels);
+    Unpack(*a, pa.data());
+    Unpack(*b, pb.data());
+    return pa == pb;
+}
+
+void TileHistory::Restore(int layer, int tx, int ty, const TilePtr& tile) {
+    const RenderTarget& target = layers[layer].target;
+    int x0 = tx << TileShift, y0 = ty << TileShift;
+    int w = min(TileSize, target.Width() - x0), h = min(TileSize, target.Height() - y0);
+    vector<DWORD> pixels(TilePixels, layers[layer].background);
+    if (tile)
+        Unpack(*tile, pixels.data());
+    WithTarget(target, [&](auto& t) {
+        for (int y = 0; y < h; y++)
+            t.StoreBgra(x0, y0 + y, pixels.data() + (y << TileShift), w);
+    });
+    dirty->Mark(x0, y0, x0 + w - 1, y0 + h - 1);
+    Remember(layer, tx, ty, tile);
+}
+
+// With a base, a background tile is kept as an empty copy so it is not read
+// from the base again.
+void TileHistory::Remember(int layer, int tx, int ty, const TilePtr& tile) {
+    if (tile || (base && !layer))
+        current[Key(tx, ty, layer)] = tile;
+    else
+        current.erase(Key(tx, ty, layer));
+}
+
+void TileHistory::Commit(size_t tag) {
+    if (!Attached())
+        return;
+    vector<RECT> rects;
+    dirty->RectsSince(since, rects);
+    since = dirty->Advance();
+    for (size_t i = position; i < steps.size(); i++)
+        used -= steps[i].bytes;
+    steps.erase(steps.begin() + position, steps.end());
+    Step step = { vector<Change>(), tag, false, 0 };
+    for (const RECT& r : rects) {
+        for (int ty = r.top >> TileShift; ty <= (r.bottom - 1) >> TileShift; ty++) {
+            for (int tx = r.left >> TileShift; tx <= (r.right - 1) >> TileShift; tx++) {
+                for (int layer = 0; layer < (int)layers.size(); layer++) {
+                    TilePtr before = Previous(layer, tx, ty);
+                    TilePtr after = Capture(layer, tx, ty);
+                    if (Same(before, after))
+                        continue;
+                    step.changes.push_back(Change{ layer, tx, ty, before, after });
+                    Remember(layer, tx, ty, after);
+                }
+            }
+        }
+    }
+    if (step.changes.empty()) {
+        if (position)
+            steps[position - 1].tag = tag;
+        else
+            baseTag = tag;
+        Trim();
+        return;
+    }
+    step.bytes = StepBytes(step);
+    used += step.bytes;
+    steps.push_back(std::move(step));
+    position++;
+    version++;
+    if (compressAfter > 0 && position > (size_t)compressAfter) {
+        Step& old = steps[position - 1 - compressAfter];
+        if (!old.packed) {
+            for (Change& c : old.changes) {
+                if (c.before)
+                    Pack(*c.before);
+                if (c.after)
+                    Pack(*c.after);
+            }
+            old.packed = true;
+            used -= old.bytes;
+            old.bytes = StepBytes(old);
+            used += old.bytes;
+            MeasureUnpacked();
+        }
+    }
+    Trim();
+}
+
+// Packing a tile also shrinks the later steps sharing it. Only the newest
+// steps are not packed yet, so only they need measuring again.
+void TileHistory::MeasureUnpacked() {
+    for (size_t i = steps.size(); i-- > 0 && !steps[i].packed;) {
+        used -= steps[i].bytes;
+        steps[i].bytes = StepBytes(steps[i]);
+        used += steps[i].bytes;
+    }
+}
+
+// Tiles shared by neighbouring steps count towards both, so the budget is an
+// upper bound. Undoable steps go oldest first, then redoable ones newest
+// first. The after copies of a dropped undoable step may still be the
+// current ones, so they are packed on the way out.
+void TileHistory::Trim() {
+    while (used > budget && !steps.empty()) {
+        if (position > 0) {
+            used -= steps.front().bytes;
+            if (compressAfter > 0) {
+                for (Change& c : steps.front().changes) {
+                    if (c.after)
+                        Pack(*c.after);
+                }
+            }
+            baseTag = steps.front().tag;
+            steps.pop_front();
+            position--;
+            if (compressAfter > 0)
+                MeasureUnpacked();
+        }
+        else {
+            used -= steps.back().bytes;
+            steps.pop_back();
+        }
+    }
+}
+
+bool TileHistory::Undo() {
+    if (!position || !Attached())
+        return false;
+    const Step& step = steps[--position];
+    for (const Change& c : step.changes)
+        Restore(c.layer, c.tx, c.ty, c.before);
+    since = dirty->Advance();
+    version++;
+    return true;
+}
+
+bool TileHistory::Redo() {
+    if (position == steps.size() || !Attached())
+        return false;
+    const Step& step = steps[position++];
+    for (const Change& c : step.changes)
+        Restore(c.layer, c.tx, c.ty, c.after);
+    since = dirty->Advance();
+    version++;
+    return true;
+}
@@ -0,0 +1,127 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <windows.h>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "Dirty.h"
+#include "Layers.h"
+#include "Target.h"
+
+// Undo and redo over 64x64 canvas tiles. History keeps one immutable copy of
+// every tile that differs from the background; a step records, for just the
+// tiles an operation dirtied, the copy from before and the one after. Copies
+// are shared between neighbouring steps rather than duplicated, so a step
+// costs the tiles it touched and undoing it rewrites only those.
+//
+// Steps are dropped oldest first once the tiles they hold exceed the memory
+// budget. Tiles of steps further back than CompressAfter are run-length
+// packed in place. Must be used from the thread that draws on the target.
+//
+// Layers drawn over the target are tracked alongside it: a commit compares
+// each dirtied tile on every layer, and a step holds the copies of whichever
+// layers changed.
+class TileHistory {
+public:
+    static const int TileShift = 6;
+    static const int TileSize = 1 << TileShift;
+
+    TileHistory() : dirty(nullptr), budget(64 << 20), compressAfter(8), position(0), used(0), since(0), baseTag(0), version(0) {}
+
+    // Forgets all steps and starts tracking the target from its current
+    // contents, which must be the background except for the tiles the base
+    // holds (those of a document just opened). Steps are made of the
+    // tiles that drawing on the target marks in dirty.
+    void Attach(const RenderTarget& target, DirtyTracker& dirty, DWORD background, std::shared_ptr<const TileSource> base = nullptr);
+    // Tracks a further layer, the next one up, from its current contents,
+    // which must be all background. Returns its index; the target is 0.
+    int AddLayer(const RenderTarget& target, DWORD background);
+    // How snapshots combine the layer with those below; ignored for layers
+    // not tracked.
+    void SetBlend(int layer, const LayerBlend& blend);
+    void SetBudget(size_t bytes) { budget = bytes; }
+    // Zero turns packing off.
+    void SetCompressAfter(int steps) { compressAfter = steps; }
+
+    // Makes every tile dirtied since the last commit, undo or redo one step.
+    // tag is the caller's label for the state after it (the display list
+    // length). An operation that changed no pixels only updates the tag.
+    void Commit(size_t tag);
+    bool Undo();
+    bool Redo();
+    // Tag of the state currently on the canvas.
+    size_t Tag() const { return position ? steps[position - 1].tag : baseTag; }
+
+    // The canvas as of the last commit, undo or redo, with the layers
+    // flattened. Tile copies are never modified once made, so the snapshot
+    // shares them and costs a pointer per stored tile; it stays as it was
+    // while drawing goes on and can be read from any thread.
+    std::shared_ptr<const TileSource> Snapshot() const;
+    // Changes whenever the canvas the history tracks does.
+    unsigned Version() const { return version; }
+
+    size_t StepCount() const { return steps.size(); }
+    size_t MemoryUsage() const { return used; }
+
+private:
+    // A tile's pixels, or runs of (count, pixel) once packed.
+    struct TileCopy {
+        std::vector<DWORD> pixels;
+        std::vector<DWORD> runs;
+    };
+    typedef std::shared_ptr<TileCopy> TilePtr;
+    class SnapshotTiles;
+
+    struct Change {
+        int layer, tx, ty;
+        TilePtr before, after;
+    };
+    struct Step {
+        std::vector<Change> changes;
+        size_t tag;
+        bool packed;
+        // StepBytes as of the last Measure.
+        size_t bytes;
+    };
+    struct Layer {
+        RenderTarget target;
+        DWORD background;
+        LayerBlend blend;
+    };
+
+    // Tile rows fit in 24 bits even on a sparse canvas; the layer goes above.
+    static unsigned long long Key(int tx, int ty, int layer = 0) {
+        return ((unsigned long long)layer << 56) | ((unsigned long long)(unsigned)ty << 32) | (unsigned)tx;
+    }
+    static size_t Bytes(const TilePtr& tile);
+    static size_t StepBytes(const Step& step);
+    static void Unpack(const TileCopy& tile, DWORD* out);
+    static void Pack(TileCopy& tile);
+
+    bool Attached() const { return !layers.empty() && layers[0].target.IsValid(); }
+    TilePtr Previous(int layer, int tx, int ty) const;
+    TilePtr Capture(int layer, int tx, int ty) const;
+    bool Same(const TilePtr& a, const TilePtr& b) const;
+    void Restore(int layer, int tx, int ty, const TilePtr& tile);
+    void Remember(int layer, int tx, int ty, const TilePtr& tile);
+    void MeasureUnpacked();
+    void Trim();
+
+    std::vector<Layer> layers;
+    DirtyTracker* dirty;
+    std::shared_ptr<const TileSource> base;
+    size_t budget;
+    int compressAfter;
+    std::unordered_map<unsigned long long, TilePtr> current;
+    // Steps before position are undoable, the rest redoable.
+    std::deque<Step> steps;
+    size_t position;
+    size_t used;
+    unsigned since;
+    size_t baseTag;
+    unsigned version;
+};
+
+#endif
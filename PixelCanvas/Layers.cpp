@@ -0,0 +1,130 @@
+#include "Layers.h"
+#include <algorithm>
+#include <cstring>
+#include <emmintrin.h>
+using namespace std;
+
+// x * y / 255, rounded, for 8-bit x and y.
+static inline int Mul255(int x, int y) {
+    int t = x * y + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+static inline __m128i Mul255(__m128i x, __m128i y) {
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(x, y), _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+static inline __m128i Alphas(__m128i v) {
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+// Two pixels widened to 16 bits per channel. Every mode treats alpha like a
+// color channel, which keeps the result premultiplied.
+static inline __m128i Combine(__m128i s, __m128i d, int mode) {
+    const __m128i full = _mm_set1_epi16(255);
+    switch (mode) {
+    case LAYER_MULTIPLY:
+        return _mm_add_epi16(_mm_add_epi16(Mul255(s, d), Mul255(s, _mm_sub_epi16(full, Alphas(d)))),
+                             Mul255(d, _mm_sub_epi16(full, Alphas(s))));
+    case LAYER_SCREEN:
+        return _mm_sub_epi16(_mm_add_epi16(s, d), Mul255(s, d));
+    case LAYER_ADD:
+        return _mm_add_epi16(s, d);
+    default:
+        return _mm_add_epi16(s, Mul255(d, _mm_sub_epi16(full, Alphas(s))));
+    }
+}
+
+static inline int Combine(int s, int d, int sa, int da, int mode) {
+    switch (mode) {
+    case LAYER_MULTIPLY:
+        return Mul255(s, d) + Mul255(s, 255 - da) + Mul255(d, 255 - sa);
+    case LAYER_SCREEN:
+        return s + d - Mul255(s, d);
+    case LAYER_ADD:
+        return s + d;
+    default:
+        return s + Mul255(d, 255 - sa);
+    }
+}
+
+void CompositeSpan(DWORD* dst, const DWORD* src, int n, const LayerBlend& blend) {
+    if (!blend.opacity)
+        return;
+    int opacity = blend.opacity, mode = blend.mode;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i scale = _mm_set1_epi16((short)opacity);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(s, zero)) == 0xFFFF)
+            continue;
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i slo = _mm_unpacklo_epi8(s, zero), shi = _mm_unpackhi_epi8(s, zero);
+        if (opacity < 255) {
+            slo = Mul255(slo, scale);
+            shi = Mul255(shi, scale);
+        }
+        __m128i lo = Combine(slo, _mm_unpacklo_epi8(d, zero), mode);
+        __m128i hi = Combine(shi, _mm_unpackhi_epi8(d, zero), mode);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+    for (; i < n; i++) {
+        if (!src[i])
+            continue;
+        BYTE* d = (BYTE*)(dst + i);
+        BYTE s[4];
+        memcpy(s, src + i, 4);
+        if (opacity < 255) {
+            for (int ch = 0; ch < 4; ch++)
+                s[ch] = (BYTE)Mul255(s[ch], opacity);
+        }
+        int da = d[3];
+        for (int ch = 0; ch < 4; ch++)
+            d[ch] = (BYTE)min(Combine(s[ch], d[ch], s[3], da, mode), 255);
+    }
+}
+
+void LayerStack::Reset(int w, int h, int count, DWORD bgra) {
+    width = w;
+    height = h;
+    background = bgra;
+    layers.resize(max(count, 1));
+    for (Layer& layer : layers) {
+        layer.pixels.assign((size_t)width * height, 0);
+        layer.surface = Surface((BYTE*)layer.pixels.data(), width, height, width * 4);
+    }
+    Clear();
+}
+
+void LayerStack::Clear() {
+    for (size_t i = 0; i < layers.size(); i++) {
+        fill(layers[i].pixels.begin(), layers[i].pixels.end(), i ? 0 : background);
+        layers[i].blend = OpaqueLayer;
+    }
+}
+
+// An opaque normal bottom layer is copied; otherwise it too is composited,
+// over the background.
+void LayerStack::Composite(const Surface& out, const RECT& r) const {
+    int left = max((int)r.left, 0), right = min((int)r.right, min(width, out.width));
+    int top = max((int)r.top, 0), bottom = min((int)r.bottom, min(height, out.height));
+    if (left >= right || top >= bottom)
+        return;
+    int n = right - left;
+    bool copy = layers[0].blend == OpaqueLayer;
+    for (int y = top; y < bottom; y++) {
+        DWORD* row = (DWORD*)out.Row(y) + left;
+        size_t at = (size_t)y * width + left;
+        if (copy) {
+            memcpy(row, layers[0].pixels.data() + at, n * 4);
+        }
+        else {
+            fill(row, row + n, background);
+            CompositeSpan(row, layers[0].pixels.data() + at, n, layers[0].blend);
+        }
+        for (size_t i = 1; i < layers.size(); i++)
+            CompositeSpan(row, layers[i].pixels.data() + at, n, layers[i].blend);
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef LAYERS_H
+#define LAYERS_H
+
+#include <windows.h>
+#include <vector>
+#include "Surface.h"
+#include "Target.h"
+
+enum LayerMode { LAYER_NORMAL, LAYER_MULTIPLY, LAYER_SCREEN, LAYER_ADD, LAYER_MODES };
+
+// How a layer is combined with what is below it. Opacity 0 hides it.
+struct LayerBlend {
+    BYTE opacity;
+    BYTE mode;
+
+    bool operator==(const LayerBlend& o) const { return opacity == o.opacity && mode == o.mode; }
+    bool operator!=(const LayerBlend& o) const { return !(*this == o); }
+};
+
+const LayerBlend OpaqueLayer = { 255, LAYER_NORMAL };
+
+// Combines n premultiplied BGRA pixels of src into dst, four per SSE2
+// operation. Runs of four fully transparent source pixels are skipped.
+void CompositeSpan(DWORD* dst, const DWORD* src, int n, const LayerBlend& blend);
+
+// Layers the size of the canvas, bottom first, each a premultiplied BGRA
+// surface rasterizers can draw into. The bottom one starts as the background
+// and the rest as transparent. Composite redoes only the rectangle asked
+// for, a row at a time through every layer so the row being built stays in
+// cache however many layers there are.
+class LayerStack {
+public:
+    LayerStack() : width(0), height(0), background(0xFFFFFFFF) {}
+
+    void Reset(int width, int height, int count, DWORD background);
+    // Back to the state Reset left: cleared pixels, every layer opaque and
+    // normal.
+    void Clear();
+
+    int Count() const { return (int)layers.size(); }
+    RenderTarget Target(int layer) const { return RenderTarget(layers[layer].surface); }
+    const LayerBlend& Blend(int layer) const { return layers[layer].blend; }
+    void SetBlend(int layer, const LayerBlend& blend) { layers[layer].blend = blend; }
+
+    // Flattens r (right/bottom exclusive) of every layer into out.
+    void Composite(const Surface& out, const RECT& r) const;
+
+private:
+    struct Layer {
+        std::vector<DWORD> pixels;
+        Surface surface;
+        LayerBlend blend;
+    };
+
+    std::vector<Layer> layers;
+    int width, height;
+    DWORD background;
+};
+
+#endif
@@ -1,159 +1,248 @@
 #include "Line.h"
 #include "PixelCanvas.h"
+#include "RenderContext.h"
+#include "Blend.h"
+#include "Gradient.h"
 #include <algorithm>
 using namespace std;
 
-extern bool clipWindowSet;
-extern int clipMinX, clipMaxX, clipMinY, clipMaxY;
+Line::Line(RenderContext& ctx) : ctx(ctx), clipPixels(false) {}
 
-const int INSIDE = 0; 
-const int LEFT = 1;   
-const int RIGHT = 2;  
-const int BOTTOM = 4; 
-const int TOP = 8;    
+// First step in [first, last + 1] at which reached(step) holds; reached must
+// go from false to true only once along the steps.
+template <class Pred>
+static int FirstStep(int first, int last, Pred reached) {
+    while (first <= last) {
+        int mid = first + (last - first) / 2;
+        if (reached(mid)) last = mid - 1;
+        else first = mid + 1;
+    }
+    return first;
+}
 
-int ComputeOutCode(int x, int y) {
-    int code = INSIDE;
-    if (x < clipMinX) code |= LEFT;
-    else if (x > clipMaxX) code |= RIGHT;
-    if (y < clipMinY) code |= BOTTOM;
-    else if (y > clipMaxY) code |= TOP;
-    return code;
+// Narrows [first, last] to the steps whose coordinate, monotonic in the step,
+// lies in [lo, hi].
+template <class F>
+static void NarrowSteps(int& first, int& last, int lo, int hi, F at) {
+    if (first > last) return;
+    int from = first, to = last;
+    if (at(from) <= at(to)) {
+        first = FirstStep(from, to, [&](int i) { return at(i) >= lo; });
+        last = FirstStep(from, to, [&](int i) { return at(i) > hi; }) - 1;
+    }
+    else {
+        first = FirstStep(from, to, [&](int i) { return at(i) <= hi; });
+        last = FirstStep(from, to, [&](int i) { return at(i) < lo; }) - 1;
+    }
 }
 
-bool CohenSutherlandClip(int& x0, int& y0, int& x1, int& y1) {
-    if (!clipWindowSet) return true;
-    int outcode0 = ComputeOutCode(x0, y0);
-    int outcode1 = ComputeOutCode(x1, y1);
-    bool accept = false;
-    while (true) {
-        if (!(outcode0 | outcode1)) {
-            accept = true;
-            break;
-        } else if (outcode0 & outcode1) {
-            break;
-        } else {
-            int outcodeOut = outcode0 ? outcode0 : outcode1;
-            int x, y;
-            if (outcodeOut & TOP) {
-                x = x0 + (x1 - x0) * (clipMaxY - y0) / (y1 - y0);
-                y = clipMaxY;
-            } else if (outcodeOut & BOTTOM) {
-                x = x0 + (x1 - x0) * (clipMinY - y0) / (y1 - y0);
-                y = clipMinY;
-            } else if (outcodeOut & RIGHT) {
-                y = y0 + (y1 - y0) * (clipMaxX - x0) / (x1 - x0);
-                x = clipMaxX;
-            } else {
-                y = y0 + (y1 - y0) * (clipMinX - x0) / (x1 - x0);
-                x = clipMinX;
-            }
-            if (outcodeOut == outcode0) {
-                x0 = x; y0 = y;
-                outcode0 = ComputeOutCode(x0, y0);
-            } else {
-                x1 = x; y1 = y;
-                outcode1 = ComputeOutCode(x1, y1);
-            }
-        }
+// The steps 0..steps whose pixel (xAt(i), yAt(i)) can fall in the window.
+// Under a tile scissor this is the tile's share of the line, found without
+// walking the rest; the loops then start there with the state a whole walk
+// would have, so tiles meet without seams.
+template <class X, class Y>
+static bool WindowSteps(const ClipRect& window, int steps, X xAt, Y yAt, int& first, int& last) {
+    first = 0;
+    last = steps;
+    if (window.enabled) {
+        NarrowSteps(first, last, window.minX, window.maxX, xAt);
+        NarrowSteps(first, last, window.minY, window.maxY, yAt);
     }
-    return accept;
+    return first <= last;
+}
+
+// The window as seen by a loop that swaps x and y for steep lines.
+static ClipRect Transposed(const ClipRect& window, bool swapped) {
+    if (!swapped || !window.enabled) return window;
+    return ClipRect(window.minY, window.minX, window.maxY, window.maxX);
+}
+
+// Minor-axis steps a Bresenham walk of major by minor (minor <= major) has
+// taken after k major steps.
+static int MinorSteps(int major, int minor, int k) {
+    return major ? (int)((2LL * minor * k + major - 1) / (2LL * major)) : 0;
 }
 
-Line::Line(HDC hdc) : hdc(hdc) {}
+// Endpoints are clipped against the clip window only, because moving them
+// would shift the rasterized path. A tile scissor instead limits the steps
+// each loop takes.
+bool Line::BeginLine(int& x1, int& y1, int& x2, int& y2) {
+    if (!ClipLine(ctx.canvas->clipWindow, x1, y1, x2, y2)) return false;
+    ClipResult r = ClassifyClip(ctx, min(x1, x2), min(y1, y2), max(x1, x2), max(y1, y2));
+    clipPixels = (r == CLIP_PARTIAL);
+    if (r == CLIP_OUTSIDE) return false;
+    MarkDrawn(ctx, min(x1, x2), min(y1, y2), max(x1, x2), max(y1, y2));
+    return true;
+}
 
 void Line::DrawLineDDA(int x1, int y1, int x2, int y2, COLORREF c) {
     int cx1 = x1, cy1 = y1, cx2 = x2, cy2 = y2;
-    if (!CohenSutherlandClip(cx1, cy1, cx2, cy2)) return;
-    int dx = cx2 - cx1;
-    int dy = cy2 - cy1;
-    int steps = max(abs(dx), abs(dy));
-    float xInc = dx / (float)steps;
-    float yInc = dy / (float)steps;
-    float x = cx1;
-    float y = cy1;
-    for (int i = 0; i <= steps; ++i) {
-        SetPixel(hdc, round(x), round(y), c);
-        x += xInc;
-        y += yInc;
-    }
+    if (!BeginLine(cx1, cy1, cx2, cy2)) return;
+    WithTarget(ctx, [&](auto& target) {
+        auto plot = MakePlotter(ctx, target, c, clipPixels);
+        int dx = cx2 - cx1;
+        int dy = cy2 - cy1;
+        int steps = max(abs(dx), abs(dy));
+        float xInc = steps ? dx / (float)steps : 0;
+        float yInc = steps ? dy / (float)steps : 0;
+        // Offsets from the start point rather than absolute positions, which a
+        // float cannot hold exactly far from the origin. Each is worked out
+        // from the step, so a tile can start part way along.
+        auto xAt = [&](int i) { return cx1 + (int)floor(i * xInc + 0.5f); };
+        auto yAt = [&](int i) { return cy1 + (int)floor(i * yInc + 0.5f); };
+        int first, last;
+        if (!WindowSteps(ctx.ClipWindow(), steps, xAt, yAt, first, last)) return;
+        for (int i = first; i <= last; ++i)
+            plot(xAt(i), yAt(i));
+    });
 }
 
 void Line::DrawLineMidpoint(int x1, int y1, int x2, int y2, COLORREF c) {
     int cx1 = x1, cy1 = y1, cx2 = x2, cy2 = y2;
-    if (!CohenSutherlandClip(cx1, cy1, cx2, cy2)) return;
-    bool steep = abs(cy2 - cy1) > abs(cx2 - cx1);
-    if (steep) {
-        std::swap(cx1, cy1);
-        std::swap(cx2, cy2);
-    }
-    if (cx1 > cx2) {
-        std::swap(cx1, cx2);
-        std::swap(cy1, cy2);
-    }
-    int dx = cx2 - cx1;
-    int dy = abs(cy2 - cy1);
-    int d = 2 * dy - dx;
-    int yInc = (cy1 < cy2) ? 1 : -1;
-    int y = cy1;
-    for (int x = cx1; x <= cx2; ++x) {
-        if (steep) SetPixel(hdc, y, x, c);
-        else SetPixel(hdc, x, y, c);
-        if (d > 0) {
-            y += yInc;
-            d -= 2 * dx;
+    if (!BeginLine(cx1, cy1, cx2, cy2)) return;
+    WithTarget(ctx, [&](auto& target) {
+        auto plot = MakePlotter(ctx, target, c, clipPixels);
+        bool steep = abs(cy2 - cy1) > abs(cx2 - cx1);
+        if (steep) {
+            std::swap(cx1, cy1);
+            std::swap(cx2, cy2);
         }
-        d += 2 * dy;
-    }
+        if (cx1 > cx2) {
+            std::swap(cx1, cx2);
+            std::swap(cy1, cy2);
+        }
+        int dx = cx2 - cx1;
+        int dy = abs(cy2 - cy1);
+        int yInc = (cy1 < cy2) ? 1 : -1;
+        int first, last;
+        if (!WindowSteps(Transposed(ctx.ClipWindow(), steep), dx,
+                         [&](int i) { return cx1 + i; },
+                         [&](int i) { return cy1 + yInc * MinorSteps(dx, dy, i); }, first, last)) return;
+        int m = MinorSteps(dx, dy, first);
+        long long d = 2LL * dy * (first + 1) - dx - 2LL * dx * m;
+        int y = cy1 + yInc * m;
+        for (int x = cx1 + first; x <= cx1 + last; ++x) {
+            if (steep) plot(y, x);
+            else plot(x, y);
+            if (d > 0) {
+                y += yInc;
+                d -= 2LL * dx;
+            }
+            d += 2LL * dy;
+        }
+    });
 }
 
 void Line::DrawLineParametric(int x1, int y1, int x2, int y2, COLORREF c) {
     int cx1 = x1, cy1 = y1, cx2 = x2, cy2 = y2;
-    if (!CohenSutherlandClip(cx1, cy1, cx2, cy2)) return;
+    if (!BeginLine(cx1, cy1, cx2, cy2)) return;
+    WithTarget(ctx, [&](auto& target) {
+        auto plot = MakePlotter(ctx, target, c, clipPixels);
+        int dx = cx2 - cx1;
+        int dy = cy2 - cy1;
+        int steps = max(abs(dx), abs(dy));
+        auto xAt = [&](int i) { return cx1 + (int)floor(dx * (steps ? i / (float)steps : 0) + 0.5f); };
+        auto yAt = [&](int i) { return cy1 + (int)floor(dy * (steps ? i / (float)steps : 0) + 0.5f); };
+        int first, last;
+        if (!WindowSteps(ctx.ClipWindow(), steps, xAt, yAt, first, last)) return;
+        for (int i = first; i <= last; ++i)
+            plot(xAt(i), yAt(i));
+    });
+}
+
+// Xiaolin Wu's line: the minor-axis position is carried in 16.16 fixed point and
+// its fraction splits coverage between the two straddled pixels, which are
+// blended into the target through the gamma tables.
+void Line::DrawLineWu(int x1, int y1, int x2, int y2, COLORREF c) {
+    int cx1 = x1, cy1 = y1, cx2 = x2, cy2 = y2;
+    if (!ClipLine(ctx.canvas->clipWindow, cx1, cy1, cx2, cy2)) return;
+    bool steep = abs(cy2 - cy1) > abs(cx2 - cx1);
+    if (steep) {
+        swap(cx1, cy1);
+        swap(cx2, cy2);
+    }
+    if (cx1 > cx2) {
+        swap(cx1, cx2);
+        swap(cy1, cy2);
+    }
     int dx = cx2 - cx1;
     int dy = cy2 - cy1;
-    int steps = max(abs(dx), abs(dy));
-    for (int i = 0; i <= steps; ++i) {
-        float t = i / (float)steps;
-        int x = round(cx1 + dx * t);
-        int y = round(cy1 + dy * t);
-        SetPixel(hdc, x, y, c);
-    }
+    int minor0 = min(cy1, cy2), minor1 = max(cy1, cy2) + 1;
+    int left = steep ? minor0 : cx1, right = steep ? minor1 : cx2;
+    int top = steep ? cx1 : minor0, bottom = steep ? cx2 : minor1;
+    ClipResult r = ClassifyClip(ctx, left, top, right, bottom);
+    if (r == CLIP_OUTSIDE) return;
+    MarkDrawn(ctx, left, top, right, bottom);
+    clipPixels = (r == CLIP_PARTIAL);
+
+    WithTarget(ctx, [&](auto& target) {
+            BlendBatch batch(c);
+            auto cover = [&](int px, int py, int coverage) {
+                if (steep) swap(px, py);
+                if (clipPixels && !ClipContains(ctx, px, py)) return;
+                target.Blend(batch, px, py, coverage);
+            };
+            long long gradient = dx == 0 ? 0 : ((long long)dy << 16) / dx;
+            // Each column also covers the pixel below its minor position.
+            ClipRect window = Transposed(ctx.ClipWindow(), steep);
+            if (window.enabled) window.minY--;
+            int first, last;
+            if (!WindowSteps(window, dx,
+                             [&](int i) { return cx1 + i; },
+                             [&](int i) { return (int)((((long long)cy1 << 16) + gradient * i) >> 16); }, first, last)) return;
+            long long intery = ((long long)cy1 << 16) + gradient * first;
+            for (int x = cx1 + first; x <= cx1 + last; ++x) {
+                int y = (int)(intery >> 16);
+                int frac = (int)(intery >> 8) & 0xFF;
+                cover(x, y, 255 - frac);
+                if (frac) cover(x, y + 1, frac);
+                intery += gradient;
+            }
+    });
 }
 
+// Colors are stepped along the unclipped line's major axis, so a clipped
+// gradient matches the visible part of the full one; pixels come from an
+// integer midpoint walk and colors from the fixed-point ramp in batches. The
+// walk follows the same axis, so the clipped deltas, which rounding can leave
+// a step off the diagonal, have their minor one capped at the major.
 void Line::DrawLineInterpolated(int x1, int y1, int x2, int y2, COLORREF c1, COLORREF c2) {
-    int dx = x2 - x1;
-    int dy = y2 - y1;
-    if (abs(dx) >= abs(dy)) {
-        if (x1 > x2) {
-            swap(x1, x2);
-            swap(y1, y2);
-        }
-        float m = (float)dy / dx;
-        float y = y1;
-        for (int x = x1; x <= x2; ++x) {
-            float t = (float)(x - x1) / (x2 - x1);
-            SetPixel(hdc, x, round(y), Mix(c1, c2, t));
-            y += m;
-        }
-    } else {
-        if (y1 > y2) {
-            swap(x1, x2);
-            swap(y1, y2);
-        }
-        float m = (float)dx / dy;
-        float x = x1;
-        for (int y = y1; y <= y2; ++y) {
-            float t = (float)(y - y1) / (y2 - y1);
-            SetPixel(hdc, round(x), y, Mix(c1, c2, t));
-            x += m;
-        }
-    }
+    int cx1 = x1, cy1 = y1, cx2 = x2, cy2 = y2;
+    if (!BeginLine(cx1, cy1, cx2, cy2)) return;
+    int dx = abs(cx2 - cx1), dy = abs(cy2 - cy1);
+    int sx = (cx1 < cx2) ? 1 : -1;
+    int sy = (cy1 < cy2) ? 1 : -1;
+    bool steep = abs(y2 - y1) > abs(x2 - x1);
+    int n = steep ? dy : dx;
+    ColorRamp ramp(c1, c2, steep ? abs(y2 - y1) : abs(x2 - x1));
+    ramp.Advance(steep ? abs(cy1 - y1) : abs(cx1 - x1));
+    int major = n, minor = min(steep ? dx : dy, major);
+    auto xAt = [&](int i) { return cx1 + sx * (steep ? MinorSteps(major, minor, i) : i); };
+    auto yAt = [&](int i) { return cy1 + sy * (steep ? i : MinorSteps(major, minor, i)); };
+    int first, last;
+    if (!WindowSteps(ctx.ClipWindow(), n, xAt, yAt, first, last)) return;
+    ramp.Advance(first);
+    WithTarget(ctx, [&](auto& target) {
+            int m = MinorSteps(major, minor, first);
+            long long d = 2LL * minor * (first + 1) - major - 2LL * major * m;
+            int x = xAt(first), y = yAt(first);
+            int width = target.Width(), height = target.Height();
+            DWORD colors[64];
+            for (int i = first; i <= last;) {
+                int chunk = min(64, last + 1 - i);
+                ramp.Generate(colors, chunk);
+                for (int k = 0; k < chunk; ++k, ++i) {
+                    if ((!clipPixels || ClipContains(ctx, x, y)) && (unsigned)x < (unsigned)width && (unsigned)y < (unsigned)height)
+                        target.StoreBgra(x, y, colors + k, 1);
+                    if (d > 0) {
+                        if (steep) x += sx;
+                        else y += sy;
+                        d -= 2LL * major;
+                    }
+                    d += 2LL * minor;
+                    if (steep) y += sy;
+                    else x += sx;
+                }
+            }
+    });
 }
-
-COLORREF Line::Mix(COLORREF c1, COLORREF c2, float t) {
-    int r = GetRValue(c1) + t * (GetRValue(c2) - GetRValue(c1));
-    int g = GetGValue(c1) + t * (GetGValue(c2) - GetGValue(c1));
-    int b = GetBValue(c1) + t * (GetBValue(c2) - GetBValue(c1));
-    return RGB(r, g, b);
-}
\ No newline at end of file
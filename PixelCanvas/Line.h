@@ -4,19 +4,22 @@
 #include <windows.h>
 #include <cmath>
 #include <algorithm>
+#include "RenderContext.h"
 
 class Line {
 public:
-    Line(HDC hdc);
+    Line(RenderContext& ctx);
 
     void DrawLineDDA(int x1, int y1, int x2, int y2, COLORREF c);
     void DrawLineMidpoint(int x1, int y1, int x2, int y2, COLORREF c);
     void DrawLineParametric(int x1, int y1, int x2, int y2, COLORREF c);
+    void DrawLineWu(int x1, int y1, int x2, int y2, COLORREF c);
     void DrawLineInterpolated(int x1, int y1, int x2, int y2, COLORREF c1, COLORREF c2);
 
 private:
-    COLORREF Mix(COLORREF c1, COLORREF c2, float t);
-    HDC hdc;
+    bool BeginLine(int& x1, int& y1, int& x2, int& y2);
+    RenderContext& ctx;
+    bool clipPixels;
 };
 
 #endif 
\ No newline at end of file
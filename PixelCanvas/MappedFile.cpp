@@ -0,0 +1,25 @@
+#include "MappedFile.h"
+
+MappedFile::MappedFile(const wchar_t* path) : file(INVALID_HANDLE_VALUE), mapping(NULL), view(nullptr), size(0) {
+    file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return;
+    LARGE_INTEGER length;
+    if (!GetFileSizeEx(file, &length) || length.QuadPart <= 0 || (ULONGLONG)length.QuadPart > (SIZE_T)-1)
+        return;
+    mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping)
+        return;
+    view = (const BYTE*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (view)
+        size = (size_t)length.QuadPart;
+}
+
+MappedFile::~MappedFile() {
+    if (view)
+        UnmapViewOfFile(view);
+    if (mapping)
+        CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE)
+        CloseHandle(file);
+}
@@ -0,0 +1,28 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <windows.h>
+
+// Read-only view of a whole file. Data() is null if the file could not be
+// opened or mapped; empty files cannot be mapped and also come back null.
+// Others may still write to the file, so a document can be appended to while
+// the tiles it already holds are mapped, and may delete or replace it, so a
+// save can move a rewritten document over one that is still being read.
+class MappedFile {
+public:
+    explicit MappedFile(const wchar_t* path);
+    ~MappedFile();
+
+    const BYTE* Data() const { return view; }
+    size_t Size() const { return size; }
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    HANDLE file, mapping;
+    const BYTE* view;
+    size_t size;
+};
+
+#endif
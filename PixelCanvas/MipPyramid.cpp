@@ -0,0 +1,200 @@
+#include "MipPyramid.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <emmintrin.h>
+using namespace std;
+
+static const int TileShift = SparseSurface::TileShift;
+static const int TileSize = SparseSurface::TileSize;
+static const int TileMask = TileSize - 1;
+
+static unsigned long long TileKey(int tx, int ty) { return ((unsigned long long)(unsigned)ty << 32) | (unsigned)tx; }
+
+// Averages each 2x2 block of two source rows into n output pixels, rounding
+// to nearest. Channels are summed in 16 bits, four outputs per iteration.
+static void Downsample(const DWORD* row0, const DWORD* row1, DWORD* out, int n) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi16(2);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i a0 = _mm_loadu_si128((const __m128i*)(row0 + 2 * i));
+        __m128i a1 = _mm_loadu_si128((const __m128i*)(row0 + 2 * i + 4));
+        __m128i b0 = _mm_loadu_si128((const __m128i*)(row1 + 2 * i));
+        __m128i b1 = _mm_loadu_si128((const __m128i*)(row1 + 2 * i + 4));
+        __m128i v0 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+        __m128i v1 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+        __m128i v2 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+        __m128i v3 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+        // Each register holds two horizontally adjacent column sums.
+        v0 = _mm_add_epi16(v0, _mm_srli_si128(v0, 8));
+        v1 = _mm_add_epi16(v1, _mm_srli_si128(v1, 8));
+        v2 = _mm_add_epi16(v2, _mm_srli_si128(v2, 8));
+        v3 = _mm_add_epi16(v3, _mm_srli_si128(v3, 8));
+        __m128i lo = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(v0, v1), two), 2);
+        __m128i hi = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(v2, v3), two), 2);
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(lo, hi));
+    }
+    for (; i < n; i++) {
+        DWORD p[4] = { row0[2 * i], row0[2 * i + 1], row1[2 * i], row1[2 * i + 1] };
+        DWORD v = 0;
+        for (int shift = 0; shift < 32; shift += 8) {
+            DWORD sum = 2;
+            for (DWORD q : p)
+                sum += (q >> shift) & 0xFF;
+            v |= (sum >> 2) << shift;
+        }
+        out[i] = v;
+    }
+}
+
+void MipPyramid::Attach(const Surface& surface, DWORD bgra) {
+    canvas = surface;
+    sparseCanvas = nullptr;
+    width = surface.width;
+    height = surface.height;
+    background = bgra;
+    Build();
+}
+
+void MipPyramid::Attach(const SparseSurface* sparse) {
+    canvas = Surface();
+    sparseCanvas = sparse;
+    width = sparse->Width();
+    height = sparse->Height();
+    background = sparse->Background();
+    Build();
+}
+
+void MipPyramid::Build() {
+    levels.clear();
+    long long w = width, h = height;
+    while (max(w, h) > TileSize) {
+        w = (w + 1) >> 1;
+        h = (h + 1) >> 1;
+        levels.emplace_back(new SparseSurface((int)w, (int)h, background));
+    }
+}
+
+// Level tiles cover 2x2 tiles of the level below, so the dirty tiles of each
+// level are the parents of the ones refiltered below it.
+void MipPyramid::Update(const std::vector<RECT>& dirty) {
+    std::vector<unsigned long long> keys;
+    const int shift = TileShift + 1;
+    for (const RECT& r : dirty) {
+        int left = max((int)r.left, 0), right = min((int)r.right, width);
+        int top = max((int)r.top, 0), bottom = min((int)r.bottom, height);
+        if (left >= right || top >= bottom)
+            continue;
+        for (int ty = top >> shift; ty <= (bottom - 1) >> shift; ty++) {
+            for (int tx = left >> shift; tx <= (right - 1) >> shift; tx++)
+                keys.push_back(TileKey(tx, ty));
+        }
+    }
+    for (int level = 1; level < Levels() && !keys.empty(); level++) {
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        for (unsigned long long& key : keys) {
+            int tx = (int)(unsigned)key, ty = (int)(key >> 32);
+            Refilter(level, tx, ty);
+            key = TileKey(tx >> 1, ty >> 1);
+        }
+    }
+}
+
+void MipPyramid::Refilter(int level, int tx, int ty) {
+    SparseSurface& target = *levels[level - 1];
+    const SparseSurface* source = Source(level - 1);
+    if (source) {
+        const DWORD* quad[4];
+        bool blank = true;
+        for (int i = 0; i < 4; i++) {
+            quad[i] = source->TileForRead(2 * tx + (i & 1), 2 * ty + (i >> 1));
+            blank = blank && source->IsSentinel(quad[i]);
+        }
+        if (blank && target.IsSentinel(target.TileForRead(tx, ty)))
+            return;
+        DWORD* out = target.TileForWrite(tx, ty);
+        const int half = TileSize / 2;
+        for (int y = 0; y < TileSize; y++) {
+            const DWORD* left = quad[(y / half) * 2];
+            const DWORD* right = quad[(y / half) * 2 + 1];
+            int row = (2 * y) & TileMask;
+            Downsample(left + (row << TileShift), left + ((row + 1) << TileShift), out + (y << TileShift), half);
+            Downsample(right + (row << TileShift), right + ((row + 1) << TileShift), out + (y << TileShift) + half, half);
+        }
+        return;
+    }
+    // The linear canvas is copied into a block padded with the background
+    // where it ends inside the tile.
+    const int block = 2 * TileSize;
+    scratch.assign(block * block, background);
+    int x0 = tx * block, y0 = ty * block;
+    int columns = min(block, width - x0), rows = min(block, height - y0);
+    for (int y = 0; y < rows; y++)
+        memcpy(&scratch[y * block], canvas.Pixel(x0, y0 + y), columns * sizeof(DWORD));
+    DWORD* out = target.TileForWrite(tx, ty);
+    for (int y = 0; y < TileSize; y++)
+        Downsample(&scratch[2 * y * block], &scratch[(2 * y + 1) * block], out + (y << TileShift), TileSize);
+}
+
+void MipPyramid::Render(const Surface& view, const RECT& r, const Viewport& viewport, DWORD outside) const {
+    if (r.left >= r.right || r.top >= r.bottom)
+        return;
+    int level = viewport.Level(Levels());
+    const SparseSurface* source = Source(level);
+    int levelWidth = level ? source->Width() : width, levelHeight = level ? source->Height() : height;
+    double size = (double)(1LL << level);
+    // Level columns sampled by each window column, or -1 off the canvas.
+    std::vector<int> columns(r.right - r.left);
+    int first = INT_MAX, last = -1;
+    for (int x = r.left; x < r.right; x++) {
+        double sx = floor((viewport.originX + (x + 0.5) / viewport.scale) / size);
+        int c = sx < 0 || sx >= levelWidth ? -1 : (int)sx;
+        columns[x - r.left] = c;
+        if (c >= 0) {
+            first = min(first, c);
+            last = max(last, c);
+        }
+    }
+    // Tiles of the current tile row, fetched once per row of tiles.
+    std::vector<const DWORD*> tiles;
+    int tileRow = -1;
+    int firstTile = last >= 0 ? first >> TileShift : 0;
+    for (int y = r.top; y < r.bottom; y++) {
+        DWORD* out = (DWORD*)view.Row(y);
+        double sy = floor((viewport.originY + (y + 0.5) / viewport.scale) / size);
+        if (last < 0 || sy < 0 || sy >= levelHeight) {
+            std::fill(out + r.left, out + r.right, outside);
+            continue;
+        }
+        int row = (int)sy;
+        if (!source) {
+            const DWORD* in = (const DWORD*)canvas.Row(row);
+            for (int x = r.left; x < r.right; x++) {
+                int c = columns[x - r.left];
+                out[x] = c < 0 ? outside : in[c];
+            }
+            continue;
+        }
+        if (row >> TileShift != tileRow) {
+            tileRow = row >> TileShift;
+            tiles.clear();
+            for (int tx = firstTile; tx <= last >> TileShift; tx++)
+                tiles.push_back(source->TileForRead(tx, tileRow));
+        }
+        int offset = (row & TileMask) << TileShift;
+        for (int x = r.left; x < r.right; x++) {
+            int c = columns[x - r.left];
+            out[x] = c < 0 ? outside : tiles[(c >> TileShift) - firstTile][offset | (c & TileMask)];
+        }
+    }
+}
+
+size_t MipPyramid::MemoryUsage() const {
+    size_t total = 0;
+    for (const auto& level : levels)
+        total += level->MemoryUsage();
+    return total;
+}
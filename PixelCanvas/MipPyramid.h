@@ -0,0 +1,50 @@
+#ifndef MIPPYRAMID_H
+#define MIPPYRAMID_H
+
+#include <windows.h>
+#include <memory>
+#include <vector>
+#include "Surface.h"
+#include "SparseSurface.h"
+#include "Viewport.h"
+
+// Half, quarter, ... resolution copies of the canvas for zoomed-out views.
+// Level 0 is the canvas itself; each level above is a SparseSurface a 2x2 box
+// filter of the one below, ending with the first that fits in one tile.
+// Update refilters only the tiles above changed canvas rectangles, so parts
+// of a sparse canvas never drawn on cost nothing at any level, and Render
+// reads only as many pixels as the window shows.
+class MipPyramid {
+public:
+    MipPyramid() : width(0), height(0), background(0xFFFFFFFF), sparseCanvas(nullptr) {}
+
+    // Level 0 is either a BGRA surface (which must outlive the pyramid) or a
+    // sparse canvas. Attaching drops every level.
+    void Attach(const Surface& canvas, DWORD background);
+    void Attach(const SparseSurface* canvas);
+
+    // Levels counting the canvas.
+    int Levels() const { return (int)levels.size() + 1; }
+    void Update(const std::vector<RECT>& dirty);
+    // Fills the window rectangle r of view (right/bottom exclusive) with the
+    // nearest pixels of the level the viewport calls for; window pixels off
+    // the canvas get the outside color.
+    void Render(const Surface& view, const RECT& r, const Viewport& viewport, DWORD outside) const;
+
+    size_t MemoryUsage() const;
+
+private:
+    void Build();
+    const SparseSurface* Source(int level) const { return level ? levels[level - 1].get() : sparseCanvas; }
+    void Refilter(int level, int tx, int ty);
+
+    int width, height;
+    DWORD background;
+    Surface canvas;
+    const SparseSurface* sparseCanvas;
+    // levels[i] holds level i + 1.
+    std::vector<std::unique_ptr<SparseSurface>> levels;
+    std::vector<DWORD> scratch;
+};
+
+#endif
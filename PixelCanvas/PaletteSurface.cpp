@@ -0,0 +1,181 @@
+#include "PaletteSurface.h"
+#include <algorithm>
+#include <cstring>
+using namespace std;
+
+static const int TileMask = PaletteSurface::TileSize - 1;
+static const int TilePixels = PaletteSurface::TileSize * PaletteSurface::TileSize;
+
+static int ReadIndex(int bits, const BYTE* data, int offset) {
+    int bit = offset * bits;
+    return (data[bit >> 3] >> (bit & 7)) & ((1 << bits) - 1);
+}
+
+static void WriteIndex(int bits, BYTE* data, int offset, int index) {
+    int bit = offset * bits;
+    int mask = ((1 << bits) - 1) << (bit & 7);
+    data[bit >> 3] = (BYTE)((data[bit >> 3] & ~mask) | (index << (bit & 7)));
+}
+
+PaletteSurface::PaletteSurface(int width, int height, DWORD background)
+    : width(width), height(height) {
+    tilesX = (width + TileSize - 1) >> TileShift;
+    tilesY = (height + TileSize - 1) >> TileShift;
+    tiles.resize((size_t)tilesX * tilesY);
+    Clear(background);
+}
+
+void PaletteSurface::Clear(DWORD bgra) {
+    for (Tile& tile : tiles) {
+        tile.bits = 0;
+        tile.palette.assign(1, bgra);
+        tile.palette.shrink_to_fit();
+        tile.data.clear();
+        tile.data.shrink_to_fit();
+        tile.lastColor = bgra;
+        tile.lastIndex = 0;
+    }
+}
+
+// Returns the palette index for the color, adding it and widening the
+// indices as needed, or -1 once the tile has gone to full color.
+int PaletteSurface::IndexOf(Tile& tile, DWORD bgra) {
+    if (tile.bits == 32)
+        return -1;
+    if (bgra == tile.lastColor)
+        return tile.lastIndex;
+    int n = (int)tile.palette.size();
+    int index = 0;
+    while (index < n && tile.palette[index] != bgra)
+        index++;
+    if (index == n) {
+        if (n == 256) {
+            Promote(tile, 32);
+            return -1;
+        }
+        int bits = n < 2 ? 1 : n < 4 ? 2 : n < 16 ? 4 : 8;
+        if (bits > tile.bits)
+            Promote(tile, bits);
+        tile.palette.push_back(bgra);
+    }
+    tile.lastColor = bgra;
+    tile.lastIndex = index;
+    return index;
+}
+
+void PaletteSurface::Promote(Tile& tile, int bits) {
+    std::vector<BYTE> data;
+    if (bits == 32) {
+        data.resize(TilePixels * 4);
+        DWORD* out = (DWORD*)data.data();
+        for (int i = 0; i < TilePixels; i++)
+            out[i] = Read(tile, i);
+        tile.palette.clear();
+        tile.palette.shrink_to_fit();
+    }
+    else {
+        data.assign(TilePixels * bits / 8, 0);
+        if (tile.bits > 0) {
+            for (int i = 0; i < TilePixels; i++)
+                WriteIndex(bits, data.data(), i, ReadIndex(tile.bits, tile.data.data(), i));
+        }
+    }
+    tile.data.swap(data);
+    tile.bits = bits;
+}
+
+DWORD PaletteSurface::Read(const Tile& tile, int offset) {
+    if (tile.bits == 32)
+        return ((const DWORD*)tile.data.data())[offset];
+    if (tile.bits == 0)
+        return tile.palette[0];
+    return tile.palette[ReadIndex(tile.bits, tile.data.data(), offset)];
+}
+
+void PaletteSurface::Write(Tile& tile, int offset, int index, DWORD bgra) {
+    if (tile.bits == 32)
+        ((DWORD*)tile.data.data())[offset] = bgra;
+    else if (tile.bits > 0)
+        WriteIndex(tile.bits, tile.data.data(), offset, index);
+}
+
+DWORD PaletteSurface::Get(int x, int y) const {
+    return Read(TileAt(x, y), ((y & TileMask) << TileShift) | (x & TileMask));
+}
+
+void PaletteSurface::Put(int x, int y, DWORD bgra) {
+    if ((unsigned)x >= (unsigned)width || (unsigned)y >= (unsigned)height)
+        return;
+    Tile& tile = TileAt(x, y);
+    Write(tile, ((y & TileMask) << TileShift) | (x & TileMask), IndexOf(tile, bgra), bgra);
+}
+
+// The index is looked up once per tile; whole bytes of packed indices inside
+// the run are stored with a replicated pattern.
+void PaletteSurface::Fill(int y, int x0, int x1, DWORD bgra) {
+    while (x0 <= x1) {
+        int end = min(x1, x0 | TileMask);
+        Tile& tile = TileAt(x0, y);
+        int index = IndexOf(tile, bgra);
+        int o = ((y & TileMask) << TileShift) | (x0 & TileMask);
+        int last = o + (end - x0);
+        if (tile.bits == 32) {
+            DWORD* p = (DWORD*)tile.data.data();
+            for (; o <= last; o++)
+                p[o] = bgra;
+        }
+        else if (tile.bits > 0) {
+            int bits = tile.bits, perByte = 8 / bits;
+            BYTE* data = tile.data.data();
+            BYTE pattern = (BYTE)index;
+            for (int s = bits; s < 8; s *= 2)
+                pattern |= (BYTE)(pattern << s);
+            for (; o <= last && o % perByte; o++)
+                WriteIndex(bits, data, o, index);
+            int whole = (last + 1 - o) / perByte;
+            memset(data + o / perByte, pattern, whole);
+            o += whole * perByte;
+            for (; o <= last; o++)
+                WriteIndex(bits, data, o, index);
+        }
+        x0 = end + 1;
+    }
+}
+
+void PaletteSurface::CopyTo(const Surface& dst, const RECT& r) const {
+    for (int y = max((int)r.top, 0); y < min((int)r.bottom, height); y++) {
+        DWORD* out = (DWORD*)dst.Row(y);
+        for (int x = max((int)r.left, 0); x < min((int)r.right, width);) {
+            int end = min(min((x | TileMask) + 1, (int)r.right), width);
+            const Tile& tile = TileAt(x, y);
+            int o = ((y & TileMask) << TileShift) | (x & TileMask);
+            if (tile.bits == 0) {
+                for (; x < end; x++)
+                    out[x] = tile.palette[0];
+            }
+            else if (tile.bits == 32) {
+                memcpy(out + x, (const DWORD*)tile.data.data() + o, (end - x) * 4);
+                x = end;
+            }
+            else {
+                for (; x < end; x++, o++)
+                    out[x] = tile.palette[ReadIndex(tile.bits, tile.data.data(), o)];
+            }
+        }
+    }
+}
+
+void PaletteSurface::CopyFrom(const Surface& src, const RECT& r) {
+    for (int y = max((int)r.top, 0); y < min((int)r.bottom, height); y++) {
+        const DWORD* in = (const DWORD*)src.Row(y);
+        for (int x = max((int)r.left, 0); x < min((int)r.right, width); x++)
+            Put(x, y, in[x] | 0xFF000000);
+    }
+}
+
+size_t PaletteSurface::MemoryUsage() const {
+    size_t total = tiles.size() * sizeof(Tile);
+    for (const Tile& tile : tiles)
+        total += tile.palette.capacity() * sizeof(DWORD) + tile.data.capacity();
+    return total;
+}
@@ -0,0 +1,63 @@
+#ifndef PALETTESURFACE_H
+#define PALETTESURFACE_H
+
+#include <windows.h>
+#include <vector>
+#include "Surface.h"
+
+// Canvas storage for drawings with few colors. Each 64x64 tile keeps its own
+// palette and stores pixels as 1, 2, 4 or 8-bit indices; a tile that has only
+// ever held one color stores no pixels at all. Writing a color the palette
+// has no room for widens the indices, and past 256 colors the tile switches
+// to plain BGRA. Colors are expanded to BGRA only by CopyTo, at present or
+// export time.
+//
+// Tiles line up with the tile renderer's bins, so concurrent workers never
+// write the same tile.
+class PaletteSurface {
+public:
+    static const int TileShift = 6;
+    static const int TileSize = 1 << TileShift;
+
+    PaletteSurface(int width, int height, DWORD background = 0xFFFFFFFF);
+
+    int Width() const { return width; }
+    int Height() const { return height; }
+
+    DWORD Get(int x, int y) const;
+    void Put(int x, int y, DWORD bgra);
+    // Span clipped to the surface.
+    void Fill(int y, int x0, int x1, DWORD bgra);
+
+    void Clear(DWORD bgra);
+    // Rectangles are right/bottom exclusive; the other surface is BGRA and
+    // the same size.
+    void CopyTo(const Surface& dst, const RECT& r) const;
+    void CopyFrom(const Surface& src, const RECT& r);
+
+    size_t MemoryUsage() const;
+
+private:
+    // bits is 0 for a solid tile, 1..8 for indexed tiles and 32 once the
+    // tile holds raw BGRA.
+    struct Tile {
+        int bits;
+        std::vector<DWORD> palette;
+        std::vector<BYTE> data;
+        DWORD lastColor;
+        int lastIndex;
+    };
+
+    Tile& TileAt(int x, int y) { return tiles[(size_t)(y >> TileShift) * tilesX + (x >> TileShift)]; }
+    const Tile& TileAt(int x, int y) const { return tiles[(size_t)(y >> TileShift) * tilesX + (x >> TileShift)]; }
+    static int IndexOf(Tile& tile, DWORD bgra);
+    static void Promote(Tile& tile, int bits);
+    static DWORD Read(const Tile& tile, int offset);
+    static void Write(Tile& tile, int offset, int index, DWORD bgra);
+
+    int width, height;
+    int tilesX, tilesY;
+    std::vector<Tile> tiles;
+};
+
+#endif
@@ -7,8 +7,33 @@
 #include <commdlg.h>
 #include "Ellipse.h"
 #include "PolygonFill.h"
+#include "ClipRegion.h"
+#include "Stroke.h"
+#include "Dirty.h"
+#include "TileRenderer.h"
+#include "Target.h"
+#include "RenderContext.h"
+#include "MipPyramid.h"
+#include "RenderQueue.h"
+#include "Progressive.h"
+#include "DisplayList.h"
+#include "History.h"
+#include "PngWriter.h"
+#include "BmpReader.h"
+#include "MappedFile.h"
+#include "Document.h"
+#include "Autosave.h"
+#include "Script.h"
+#include "Replay.h"
+#include "RenderServer.h"
+#include "Layers.h"
+#include <chrono>
+#include <mutex>
 
 #define MAX_LOADSTRING 100
+#define WM_APP_PRESENT (WM_APP + 1)
+// Drawing colors a loaded document carries: wParam line, lParam fill.
+#define WM_APP_COLORS (WM_APP + 2)
 
 HINSTANCE hInst;                                
 WCHAR szTitle[MAX_LOADSTRING];                  
@@ -57,11 +82,51 @@ HWND hBtnFinishSpline = NULL;
 
 POINT polygonPoints[100];
 int polygonPointCount = 0;
+double g_StrokeWidth = 5.0;
+unsigned presentedStamp = 0;
+std::vector<RECT> dirtyRects;
+TileRenderer renderer;
+ReplayCanvas replayCanvas;
+int g_TileShift = 0;
+bool g_Morton = false;
+PixelFormat g_Format = FORMAT_BGRA32;
+Surface dibSurface;
+TiledSurface* tiledCanvas = NULL;
+PaletteSurface* paletteCanvas = NULL;
+bool g_Palette = false;
+SparseSurface* sparseCanvas = NULL;
+bool g_Sparse = false;
+std::vector<BYTE> formatPixels;
+LayerStack layers;
+int g_LayerCount = 1;
+// The layer drawn on and every layer's blend as last sent to the render
+// thread.
+int g_Layer = 0;
+std::vector<LayerBlend> g_LayerBlends;
+RenderTarget canvasTarget;
+int documentWidth = canvasWidth;
+int documentHeight = canvasHeight;
+Viewport view;
+MipPyramid mips;
+HDC hViewDC = NULL;
+HBITMAP hViewBitmap = NULL;
+Surface viewSurface;
+bool panning = false;
+POINT panFrom;
+HWND hMainWnd = NULL;
+RenderQueue renderQueue;
+std::mutex presentLock;
+std::vector<RECT> publishedRects;
+DisplayList displayList;
+TileHistory history;
+CanvasDocument document;
+Autosave autosave;
 HWND hBtnFinishPolygon = NULL;
 
 POINT clipWindowPoints[4];
-bool clipWindowSet = false;
-int clipMinX, clipMaxX, clipMinY, clipMaxY;
+CanvasState canvasState;
+// Used by the render thread, which owns the canvas once it is created.
+RenderContext canvasContext(NULL, nullptr, &canvasState, &renderQueue);
 
 int splinePointTarget = 0;
 
@@ -75,6 +140,10 @@ INT_PTR CALLBACK    About(HWND, UINT, WPARAM, LPARAM);
 void DrawPixel(int x, int y, COLORREF color);
 void DrawLineOnBitmap(POINT start, POINT end, COLORREF color);
 void DrawPreviewLine(HWND hWnd, HDC hdc, POINT start, POINT end);
+std::wstring SwitchValue(const wchar_t* cmdLine, const wchar_t* name);
+int RunBatch(const std::wstring& script, const std::wstring& out);
+int RunServer(const std::wstring& socketPath, int workers);
+int SubmitJob(const std::wstring& script, const std::wstring& socketPath, const std::wstring& out);
 
 int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
     _In_opt_ HINSTANCE hPrevInstance,
@@ -82,7 +151,79 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
     _In_ int       nCmdShow)
 {
     UNREFERENCED_PARAMETER(hPrevInstance);
-    UNREFERENCED_PARAMETER(lpCmdLine);
+
+    // /tiled and /tiled8 keep the canvas in 32x32 or 8x8 tiles, /morton
+    // additionally orders pixels inside each tile along a Z curve.
+    if (wcsstr(lpCmdLine, L"/tiled8"))
+        g_TileShift = 3;
+    else if (wcsstr(lpCmdLine, L"/tiled"))
+        g_TileShift = 5;
+    if (wcsstr(lpCmdLine, L"/morton")) {
+        g_Morton = true;
+        if (!g_TileShift)
+            g_TileShift = 5;
+    }
+    // /palette stores the canvas as per-tile palette indices.
+    if (wcsstr(lpCmdLine, L"/palette"))
+        g_Palette = true;
+    // /sparse draws into a 2^30 x 2^30 canvas whose tiles exist only once
+    // drawn on.
+    if (wcsstr(lpCmdLine, L"/sparse"))
+        g_Sparse = true;
+    // A linear canvas can be stored in another pixel format and converted to
+    // the DIB when presented.
+    if (wcsstr(lpCmdLine, L"/rgb565"))
+        g_Format = FORMAT_RGB565;
+    else if (wcsstr(lpCmdLine, L"/a8"))
+        g_Format = FORMAT_A8;
+    else if (wcsstr(lpCmdLine, L"/rgba16"))
+        g_Format = FORMAT_RGBA16;
+    else if (wcsstr(lpCmdLine, L"/rgba32"))
+        g_Format = FORMAT_RGBA32;
+    // /layers:N draws a linear BGRA canvas on N layers composited into the
+    // DIB. PageUp and PageDown pick the layer drawn on, [ and ] change its
+    // opacity and B its blend mode.
+    if (const wchar_t* stack = wcsstr(lpCmdLine, L"/layers:"))
+        g_LayerCount = min(max(_wtoi(stack + 8), 1), 32);
+    // /stroke:N draws thick splines N pixels wide (default 5, fractions
+    // allowed).
+    if (const wchar_t* stroke = wcsstr(lpCmdLine, L"/stroke:"))
+        g_StrokeWidth = min(max(_wtof(stroke + 8), 0.5), 255.0);
+    // /undo:N caps undo history at N MB; /undoraw keeps old steps unpacked.
+    if (const wchar_t* undo = wcsstr(lpCmdLine, L"/undo:"))
+        history.SetBudget((size_t)max(_wtoi(undo + 6), 0) << 20);
+    if (wcsstr(lpCmdLine, L"/undoraw"))
+        history.SetCompressAfter(0);
+    // /batch SCRIPT draws a command script (see Script.h, - for standard
+    // input) without opening a window, writes the canvas to /out FILE as
+    // .png, .bmp or .pxc (- for a PNG on standard output) and reports
+    // throughput on standard error.
+    std::wstring script = SwitchValue(lpCmdLine, L"/batch");
+    if (!script.empty())
+        return RunBatch(script, SwitchValue(lpCmdLine, L"/out"));
+    // /serve SOCKET renders jobs sent by other processes (RenderServer.h) on
+    // /workers:N threads, one per core by default, until the process ends.
+    // /submit SCRIPT /socket SOCKET sends a script to one and writes the
+    // frame to /out FILE like /batch.
+    std::wstring serve = SwitchValue(lpCmdLine, L"/serve");
+    if (!serve.empty()) {
+        const wchar_t* workers = wcsstr(lpCmdLine, L"/workers:");
+        return RunServer(serve, workers ? _wtoi(workers + 9) : 0);
+    }
+    std::wstring submit = SwitchValue(lpCmdLine, L"/submit");
+    if (!submit.empty())
+        return SubmitJob(submit, SwitchValue(lpCmdLine, L"/socket"), SwitchValue(lpCmdLine, L"/out"));
+    // /autosave:N writes a recovery document to the temp folder every N
+    // seconds while the canvas changes (default 60, 0 turns it off).
+    int autosaveSeconds = 60;
+    if (const wchar_t* every = wcsstr(lpCmdLine, L"/autosave:"))
+        autosaveSeconds = max(_wtoi(every + 10), 0);
+    WCHAR autosavePath[MAX_PATH];
+    DWORD folder = GetTempPathW(MAX_PATH, autosavePath);
+    if (folder > 0 && folder < MAX_PATH - 32) {
+        wcscat_s(autosavePath, MAX_PATH, L"PixelCanvas-autosave.pxc");
+        autosave.Start(autosavePath, autosaveSeconds);
+    }
 
     LoadStringW(hInstance, IDS_APP_TITLE, szTitle, MAX_LOADSTRING);
     LoadStringW(hInstance, IDC_PIXELCANVAS, szWindowClass, MAX_LOADSTRING);
@@ -134,7 +275,7 @@ BOOL InitInstance(HINSTANCE hInstance, int nCmdShow)
 {
     hInst = hInstance;
 
-    HWND hWnd = CreateWindowW(szWindowClass, szTitle, WS_OVERLAPPED | WS_CAPTION | WS_SYSMENU | WS_MINIMIZEBOX,
+    HWND hWnd = CreateWindowW(szWindowClass, szTitle, WS_OVERLAPPEDWINDOW,
         CW_USEDEFAULT, CW_USEDEFAULT, canvasWidth + 16, canvasHeight + 39, nullptr, nullptr, hInstance, nullptr);
 
     if (!hWnd)
@@ -153,11 +294,8 @@ void DrawPixel(int x, int y, COLORREF color)
     if (x < 0 || x >= canvasWidth || y < 0 || y >= canvasHeight || pPixels == nullptr)
         return;
 
-    BYTE* pixel = pPixels + (y * canvasWidth + x) * 4;
-    pixel[0] = GetBValue(color);
-    pixel[1] = GetGValue(color);
-    pixel[2] = GetRValue(color);
-    pixel[3] = 255;
+    WithTarget(canvasContext, [&](auto& target) { target.Put(x, y, target.Convert(color)); });
+    canvasState.dirty.Mark(x, y, x, y);
 }
 
 void DrawLineOnBitmap(POINT start, POINT end, COLORREF color)
@@ -205,6 +343,476 @@ void DrawPreviewLine(HWND hWnd, HDC hdc, POINT start, POINT end)
     DeleteObject(hPen);
 }
 
+// Runs on the render thread after every job. Rasterizes what the job queued,
+// then, for just the tiles drawn since the last publish, converts a canvas
+// that is not the DIB itself into it (a sparse canvas only where it overlaps
+// the DIB, layers by compositing them; a change of blend recomposites it all)
+// and refilters the mip levels above them. The rectangles are handed to the
+// UI thread, which invalidates what they cover in the view; WM_PAINT then
+// renders just the update region. WM_PAINT holds presentLock while it
+// reads the DIB and mip levels, so it never sees them half updated, though it
+// can show a job's drawing on the canvas itself before it is published.
+void PublishDirty()
+{
+    renderer.Flush();
+    dirtyRects.clear();
+    canvasState.dirty.RectsSince(presentedStamp, dirtyRects);
+    presentedStamp = canvasState.dirty.Advance();
+    if (dirtyRects.empty())
+        return;
+    std::lock_guard<std::mutex> lock(presentLock);
+    RECT dib = { 0, 0, canvasWidth, canvasHeight };
+    for (const RECT& r : dirtyRects) {
+        RECT shown;
+        if (tiledCanvas)
+            tiledCanvas->CopyTo(dibSurface, r);
+        else if (paletteCanvas)
+            paletteCanvas->CopyTo(dibSurface, r);
+        else if (sparseCanvas && IntersectRect(&shown, &r, &dib))
+            sparseCanvas->CopyTo(dibSurface, shown, shown.left, shown.top);
+        else if (!formatPixels.empty())
+            ConvertPixels(canvasTarget.linear, canvasTarget.format, dibSurface, FORMAT_BGRA32, r);
+        else if (layers.Count())
+            layers.Composite(dibSurface, r);
+    }
+    // A batch run has no window to present to.
+    if (!hMainWnd)
+        return;
+    mips.Update(dirtyRects);
+    bool idle = publishedRects.empty();
+    publishedRects.insert(publishedRects.end(), dirtyRects.begin(), dirtyRects.end());
+    if (idle)
+        PostMessageW(hMainWnd, WM_APP_PRESENT, 0, 0);
+}
+
+void PresentPublished(HWND hWnd)
+{
+    std::lock_guard<std::mutex> lock(presentLock);
+    int level = view.Level(mips.Levels());
+    for (const RECT& r : publishedRects) {
+        RECT area = view.ToWindow(r, level);
+        OffsetRect(&area, 0, topOffset);
+        InvalidateRect(hWnd, &area, FALSE);
+    }
+    publishedRects.clear();
+}
+
+void InvalidateView(HWND hWnd)
+{
+    RECT area;
+    GetClientRect(hWnd, &area);
+    area.top = topOffset;
+    InvalidateRect(hWnd, &area, FALSE);
+}
+
+// The canvas area is composed into a DIB of the window's size from the
+// canvas or one of its mip levels, then blitted.
+void ResizeView(HWND hWnd)
+{
+    RECT client;
+    GetClientRect(hWnd, &client);
+    int w = max((int)client.right, 1), h = max((int)client.bottom - topOffset, 1);
+    BITMAPINFO info = bmi;
+    info.bmiHeader.biWidth = w;
+    info.bmiHeader.biHeight = -h;
+    BYTE* bits = NULL;
+    HBITMAP bitmap = CreateDIBSection(hViewDC, &info, DIB_RGB_COLORS, (void**)&bits, NULL, 0);
+    if (!bitmap)
+        return;
+    SelectObject(hViewDC, bitmap);
+    if (hViewBitmap)
+        DeleteObject(hViewBitmap);
+    hViewBitmap = bitmap;
+    viewSurface = Surface(bits, w, h, w * 4);
+}
+
+// Runs on the render thread for DL_LAYER: later records draw on the layer.
+void SelectLayer(int layer, const LayerBlend& blend)
+{
+    if (layer >= layers.Count())
+        return;
+    if (layers.Blend(layer) != blend) {
+        layers.SetBlend(layer, blend);
+        history.SetBlend(layer, blend);
+        // Every pixel may look different now, so every tile is redrawn and
+        // saved again.
+        canvasState.dirty.MarkAll();
+    }
+    canvasTarget = layers.Target(layer);
+    renderer.Attach(canvasContext);
+}
+
+// Clearing a layered canvas also starts over with every layer opaque and
+// normal and the bottom one drawn on.
+void ClearCanvas()
+{
+    memset(pPixels, 255, canvasWidth * canvasHeight * 4); 
+    if (tiledCanvas)
+        tiledCanvas->Clear(0xFFFFFFFF);
+    if (paletteCanvas)
+        paletteCanvas->Clear(0xFFFFFFFF);
+    if (sparseCanvas)
+        sparseCanvas->Clear(0xFFFFFFFF);
+    std::fill(formatPixels.begin(), formatPixels.end(), (BYTE)0xFF);
+    if (layers.Count()) {
+        layers.Clear();
+        for (int i = 0; i < layers.Count(); i++)
+            history.SetBlend(i, OpaqueLayer);
+        SelectLayer(0, OpaqueLayer);
+    }
+    canvasState.clipWindow = ClipRect(); 
+    canvasState.clipRegion = ClipRegion();
+    document.Forget();
+    canvasState.dirty.MarkAll();
+}
+
+// Records the operation on the render thread, which owns the display list
+// and the undo history, draws it from there and makes it one undo step.
+// Records undone before it are dropped.
+void SubmitRecord(const DrawRecord& record, const POINT* points = NULL)
+{
+    std::vector<POINT> copy(points, points + record.count);
+    renderQueue.Submit([record, copy] {
+        displayList.Truncate(history.Tag());
+        DrawRecorded(replayCanvas, displayList.Append(record, copy.data()));
+        renderer.Flush();
+        history.Commit(displayList.Count());
+    });
+}
+
+// Redraws the records up to the current undo position on a blank canvas,
+// publishing every few thousand so the tile renderer's queue stays short
+// and progress shows. A loaded image is not part of the list. The replay is
+// itself a step that can be undone.
+void ReplayDisplayList()
+{
+    ClearCanvas();
+    size_t n = 0, limit = history.Tag();
+    displayList.ForEach([&](const DrawRecord& r) {
+        if (n == limit)
+            return false;
+        DrawRecorded(replayCanvas, r);
+        if (++n % 4096 == 0)
+            PublishDirty();
+        return !renderQueue.Cancelled();
+    });
+    renderer.Flush();
+    history.Commit(limit);
+}
+
+// Starts undo over from what is on the canvas, with every layer tracked.
+void AttachHistory(std::shared_ptr<const TileSource> base = nullptr)
+{
+    if (!layers.Count()) {
+        history.Attach(canvasTarget, canvasState.dirty, 0xFFFFFFFF, base);
+        return;
+    }
+    history.Attach(layers.Target(0), canvasState.dirty, 0xFFFFFFFF, base);
+    for (int i = 1; i < layers.Count(); i++)
+        history.AddLayer(layers.Target(i), 0);
+    for (int i = 0; i < layers.Count(); i++)
+        history.SetBlend(i, layers.Blend(i));
+}
+
+// The canvas as documents store it, layers flattened.
+RenderTarget SavedTarget()
+{
+    return layers.Count() ? RenderTarget(dibSurface) : canvasTarget;
+}
+
+// Shows the layer drawn on and its blend in the title bar.
+void ShowLayer(HWND hWnd)
+{
+    static const wchar_t* modes[LAYER_MODES] = { L"normal", L"multiply", L"screen", L"add" };
+    if (g_LayerCount < 2)
+        return;
+    const LayerBlend& blend = g_LayerBlends[g_Layer];
+    WCHAR title[MAX_LOADSTRING + 64];
+    swprintf_s(title, L"%s - layer %d of %d, %s %d%%", szTitle, g_Layer + 1, g_LayerCount, modes[blend.mode], (blend.opacity * 100 + 127) / 255);
+    SetWindowTextW(hWnd, title);
+}
+
+void SubmitLayer(HWND hWnd)
+{
+    const LayerBlend& blend = g_LayerBlends[g_Layer];
+    DrawRecord record = { DL_LAYER, (BYTE)g_Layer, 0, g_LineColor, g_FillColor, blend.opacity, blend.mode };
+    SubmitRecord(record);
+    ShowLayer(hWnd);
+}
+
+// Creating, clearing and opening the canvas leave the bottom layer drawn on
+// and every layer opaque and normal.
+void ResetLayers(HWND hWnd)
+{
+    g_Layer = 0;
+    g_LayerBlends.assign(g_LayerCount, OpaqueLayer);
+    ShowLayer(hWnd);
+}
+
+// Creates the DIB and the canvas the command line asked for, compatible with
+// reference (NULL for the screen).
+void CreateCanvas(HDC reference)
+{
+    hMemDC = CreateCompatibleDC(reference);
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = canvasWidth;
+    bmi.bmiHeader.biHeight = -canvasHeight; 
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+    hBitmap = CreateDIBSection(hMemDC, &bmi, DIB_RGB_COLORS, (void**)&pPixels, NULL, 0);
+    SelectObject(hMemDC, hBitmap);
+    if (pPixels)
+        memset(pPixels, 255, canvasWidth * canvasHeight * 4); 
+    if (SurfaceFromDC(hMemDC, dibSurface)) {
+        if (g_Sparse) {
+            sparseCanvas = new SparseSurface(1 << 30, 1 << 30);
+            canvasTarget = RenderTarget(sparseCanvas);
+            documentWidth = sparseCanvas->Width();
+            documentHeight = sparseCanvas->Height();
+            mips.Attach(sparseCanvas);
+        }
+        else if (g_Palette) {
+            paletteCanvas = new PaletteSurface(canvasWidth, canvasHeight);
+            canvasTarget = RenderTarget(paletteCanvas);
+        }
+        else if (g_TileShift) {
+            tiledCanvas = new TiledSurface(canvasWidth, canvasHeight, g_TileShift, g_Morton);
+            canvasTarget = RenderTarget(tiledCanvas);
+        }
+        else if (g_Format != FORMAT_BGRA32) {
+            int bytes = PixelFormatBytes(g_Format);
+            formatPixels.assign((size_t)canvasWidth * canvasHeight * bytes, 0xFF);
+            canvasTarget = RenderTarget(Surface(formatPixels.data(), canvasWidth, canvasHeight, canvasWidth * bytes), g_Format);
+        }
+        else if (g_LayerCount > 1) {
+            layers.Reset(canvasWidth, canvasHeight, g_LayerCount, 0xFFFFFFFF);
+            canvasTarget = layers.Target(0);
+        }
+        else {
+            canvasTarget = RenderTarget(dibSurface);
+        }
+        if (!sparseCanvas)
+            mips.Attach(dibSurface, 0xFFFFFFFF);
+    }
+    canvasContext.hdc = hMemDC;
+    canvasContext.target = canvasTarget.IsValid() ? &canvasTarget : nullptr;
+    renderer.Attach(canvasContext);
+    canvasState.dirty.Reset(documentWidth, documentHeight);
+    replayCanvas.context = &canvasContext;
+    replayCanvas.renderer = &renderer;
+    replayCanvas.publish = PublishDirty;
+    replayCanvas.clear = ClearCanvas;
+    if (layers.Count())
+        replayCanvas.layer = SelectLayer;
+}
+
+// Writes packed BGRA rows as a PNG, compressed on every core and written as
+// each strip is done, or as a BMP.
+bool WriteImage(HANDLE hFile, const Surface& src, bool png)
+{
+    if (png) {
+        return WritePng(src, [hFile](const void* data, size_t size) {
+            DWORD dwWritten;
+            return WriteFile(hFile, data, (DWORD)size, &dwWritten, NULL) && dwWritten == size;
+        });
+    }
+    BITMAPFILEHEADER bfh = { 0 };
+    BITMAPINFOHEADER bih = bmi.bmiHeader;
+    bih.biWidth = src.width;
+    bih.biHeight = -src.height;
+    DWORD dwBmpSize = src.width * src.height * 4;
+    bfh.bfType = 0x4D42; 
+    bfh.bfOffBits = sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER);
+    bfh.bfSize = bfh.bfOffBits + dwBmpSize;
+    DWORD dwWritten;
+    return WriteFile(hFile, &bfh, sizeof(bfh), &dwWritten, NULL) && WriteFile(hFile, &bih, sizeof(bih), &dwWritten, NULL)
+        && WriteFile(hFile, src.bits, dwBmpSize, &dwWritten, NULL) && dwWritten == dwBmpSize;
+}
+
+// Writes to a .bmp file, any other name as a PNG, or - as a PNG on standard
+// output.
+bool WriteOutput(const std::wstring& out, const Surface& src)
+{
+    if (out == L"-")
+        return WriteImage(GetStdHandle(STD_OUTPUT_HANDLE), src, true);
+    HANDLE hFile = CreateFileW(out.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return false;
+    const WCHAR* ext = wcsrchr(out.c_str(), L'.');
+    bool ok = WriteImage(hFile, src, !ext || _wcsicmp(ext, L".bmp") != 0);
+    CloseHandle(hFile);
+    return ok;
+}
+
+// Command line modes have no window; their messages go to standard error, or
+// to the console of whoever started them.
+void Report(const std::string& text)
+{
+    static HANDLE report = NULL;
+    if (!report) {
+        report = GetStdHandle(STD_ERROR_HANDLE);
+        if ((!report || report == INVALID_HANDLE_VALUE) && AttachConsole(ATTACH_PARENT_PROCESS))
+            report = CreateFileW(L"CONOUT$", GENERIC_WRITE, FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+    }
+    DWORD written;
+    if (report && report != INVALID_HANDLE_VALUE)
+        WriteFile(report, text.data(), (DWORD)text.size(), &written, NULL);
+}
+
+std::string Utf8(const std::wstring& text)
+{
+    int n = WideCharToMultiByte(CP_UTF8, 0, text.c_str(), -1, NULL, 0, NULL, NULL);
+    std::string out(max(n, 1), '\0');
+    WideCharToMultiByte(CP_UTF8, 0, text.c_str(), -1, &out[0], n, NULL, NULL);
+    out.resize(max(n, 1) - 1);
+    return out;
+}
+
+// The value after a switch such as /batch, either /batch:value or
+// /batch value, in quotes if it has spaces.
+std::wstring SwitchValue(const wchar_t* cmdLine, const wchar_t* name)
+{
+    const wchar_t* at = wcsstr(cmdLine, name);
+    if (!at)
+        return std::wstring();
+    at += wcslen(name);
+    if (*at == L':')
+        at++;
+    while (*at == L' ')
+        at++;
+    if (*at == L'"') {
+        const wchar_t* close = wcschr(++at, L'"');
+        return std::wstring(at, close ? close : at + wcslen(at));
+    }
+    const wchar_t* stop = at;
+    while (*stop && *stop != L' ')
+        stop++;
+    return std::wstring(at, stop);
+}
+
+// Draws a script on the render thread while this thread reads ahead, in
+// jobs of about 16 KB of records; the queue's ring bounds how far reading
+// gets ahead, so memory stays flat however long the script is. Nothing is
+// recorded for undo, and a .pxc output holds only the pixels.
+int RunBatch(const std::wstring& script, const std::wstring& out)
+{
+    bool fromStdin = script == L"-";
+    HANDLE input = fromStdin ? GetStdHandle(STD_INPUT_HANDLE)
+        : CreateFileW(script.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (!input || input == INVALID_HANDLE_VALUE) {
+        Report("cannot open the script\n");
+        return 1;
+    }
+    CreateCanvas(NULL);
+    if (!canvasTarget.IsValid()) {
+        Report("cannot create the canvas\n");
+        return 1;
+    }
+    renderQueue.SetPublish(PublishDirty);
+
+    auto start = std::chrono::steady_clock::now();
+    ScriptReader reader(input);
+    std::vector<BYTE> batch;
+    size_t commands = 0;
+    int errors = 0;
+    auto submit = [&batch] {
+        renderQueue.Submit([records = std::move(batch)] {
+            for (size_t at = 0; at < records.size();) {
+                const DrawRecord& r = *(const DrawRecord*)&records[at];
+                DrawRecorded(replayCanvas, r);
+                at += r.Size();
+            }
+            renderer.Flush();
+        });
+        batch.clear();
+    };
+    const DrawRecord* record;
+    for (bool more = true; more;) {
+        more = reader.Next(record);
+        if (reader.Errors() != errors) {
+            errors = reader.Errors();
+            Report(reader.LastError() + "\n");
+        }
+        if (more) {
+            batch.insert(batch.end(), (const BYTE*)record, (const BYTE*)record + record->Size());
+            commands++;
+        }
+        if (batch.size() >= 16 * 1024 || (!more && !batch.empty()))
+            submit();
+    }
+    renderQueue.Finish();
+    auto drawn = std::chrono::steady_clock::now();
+
+    bool ok = true;
+    const WCHAR* ext = wcsrchr(out.c_str(), L'.');
+    if (ext && _wcsicmp(ext, L".pxc") == 0) {
+        DisplayList none;
+        DocumentInfo info = { canvasState.clipWindow, g_LineColor, g_FillColor };
+        ok = document.Save(out.c_str(), SavedTarget(), canvasState.dirty, info, none);
+    }
+    else if (!out.empty()) {
+        ok = WriteOutput(out, dibSurface);
+    }
+    auto written = std::chrono::steady_clock::now();
+    renderQueue.Stop();
+    if (!fromStdin)
+        CloseHandle(input);
+
+    double drawMs = std::chrono::duration<double, std::milli>(drawn - start).count();
+    double writeMs = std::chrono::duration<double, std::milli>(written - drawn).count();
+    double seconds = max(drawMs, 0.001) / 1000;
+    char line[256];
+    snprintf(line, sizeof(line), "%llu commands (%d skipped), %llu bytes in %.1f ms: %.0f commands/s, %.1f MB/s; output %.1f ms\n",
+        (unsigned long long)commands, errors, reader.BytesRead(), drawMs, commands / seconds,
+        reader.BytesRead() / seconds / (1 << 20), writeMs);
+    Report(line);
+    if (!ok)
+        Report("cannot write the output\n");
+    return ok ? 0 : 1;
+}
+
+int RunServer(const std::wstring& socketPath, int workers)
+{
+    RenderServer server(workers);
+    if (!server.Start(Utf8(socketPath).c_str(), [](const std::string& line) { Report(line + "\n"); })) {
+        Report("cannot listen on the socket\n");
+        return 1;
+    }
+    Sleep(INFINITE);
+    return 0;
+}
+
+int SubmitJob(const std::wstring& script, const std::wstring& socketPath, const std::wstring& out)
+{
+    MappedFile file(script.c_str());
+    if (!file.Data()) {
+        Report("cannot read the script\n");
+        return 1;
+    }
+    RenderClient client;
+    if (!client.Connect(Utf8(socketPath).c_str())) {
+        Report("cannot connect to the server\n");
+        return 1;
+    }
+    JobRequest request = { JobRequestMagic, canvasWidth, canvasHeight, 0xFFFFFFFF, file.Size() };
+    JobReply reply;
+    auto start = std::chrono::steady_clock::now();
+    if (!client.Render(request, file.Data(), reply) || reply.status != JOB_DONE) {
+        Report("the job failed\n");
+        return 1;
+    }
+    double roundTrip = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    bool ok = out.empty() || WriteOutput(out, client.Frame());
+    char line[256];
+    snprintf(line, sizeof(line), "%llu commands (%d skipped), waited %.2f ms, rendered %.2f ms, queue depth %u; round trip %.2f ms\n",
+        reply.commands, reply.errors, reply.waitMs, reply.renderMs, reply.queueDepth, roundTrip);
+    Report(line);
+    if (!ok)
+        Report("cannot write the output\n");
+    return ok ? 0 : 1;
+}
+
 LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 {
     switch (message)
@@ -212,18 +820,22 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
     case WM_CREATE:
     {
         HDC hdc = GetDC(hWnd);
-        hMemDC = CreateCompatibleDC(hdc);
-        bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
-        bmi.bmiHeader.biWidth = canvasWidth;
-        bmi.bmiHeader.biHeight = -canvasHeight; 
-        bmi.bmiHeader.biPlanes = 1;
-        bmi.bmiHeader.biBitCount = 32;
-        bmi.bmiHeader.biCompression = BI_RGB;
-        hBitmap = CreateDIBSection(hMemDC, &bmi, DIB_RGB_COLORS, (void**)&pPixels, NULL, 0);
-        SelectObject(hMemDC, hBitmap);
-        if (pPixels)
-            memset(pPixels, 255, canvasWidth * canvasHeight * 4); 
+        CreateCanvas(hdc);
+        hViewDC = CreateCompatibleDC(hdc);
+        hMainWnd = hWnd;
+        renderQueue.SetPublish([] {
+            PublishDirty();
+            DocumentInfo info = { canvasState.clipWindow, g_LineColor, g_FillColor };
+            autosave.Tick(history, info);
+        });
+        // Attached before anything can cancel it; the render thread owns the
+        // canvas from here on.
+        if (canvasTarget.IsValid())
+            renderQueue.Wait(renderQueue.Submit([] { AttachHistory(); }));
         ReleaseDC(hWnd, hdc);
+        // Only the linear BGRA canvas has layers.
+        g_LayerCount = max(layers.Count(), 1);
+        ResetLayers(hWnd);
 
         hComboShape = CreateWindowW(L"COMBOBOX", NULL, CBS_DROPDOWNLIST | WS_CHILD | WS_VISIBLE | WS_VSCROLL | WS_TABSTOP,
             10, 10, 120, 200, hWnd, (HMENU)IDC_COMBO_SHAPE, hInst, NULL);
@@ -244,6 +856,8 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
         SendMessageW(hComboAlgo, CB_ADDSTRING, 0, (LPARAM)L"DDA");
         SendMessageW(hComboAlgo, CB_ADDSTRING, 0, (LPARAM)L"Midpoint");
         SendMessageW(hComboAlgo, CB_ADDSTRING, 0, (LPARAM)L"Parametric");
+        SendMessageW(hComboAlgo, CB_ADDSTRING, 0, (LPARAM)L"Anti-aliased (Wu)");
+        SendMessageW(hComboAlgo, CB_ADDSTRING, 0, (LPARAM)L"Gradient");
         SendMessageW(hComboAlgo, CB_SETCURSEL, 0, 0);
 
         int buttonStartX = 310; 
@@ -300,6 +914,8 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
                 SendMessageW(hComboAlgo, CB_ADDSTRING, 0, (LPARAM)L"DDA");
                 SendMessageW(hComboAlgo, CB_ADDSTRING, 0, (LPARAM)L"Midpoint");
                 SendMessageW(hComboAlgo, CB_ADDSTRING, 0, (LPARAM)L"Parametric");
+                SendMessageW(hComboAlgo, CB_ADDSTRING, 0, (LPARAM)L"Anti-aliased (Wu)");
+                SendMessageW(hComboAlgo, CB_ADDSTRING, 0, (LPARAM)L"Gradient");
             } else if (currentShape == SHAPE_CIRCLE) {
                 SendMessageW(hComboAlgo, CB_ADDSTRING, 0, (LPARAM)L"Direct");
                 SendMessageW(hComboAlgo, CB_ADDSTRING, 0, (LPARAM)L"Polar");
@@ -322,16 +938,25 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
             } else if (currentShape == SHAPE_FLOODFILL) {
                 SendMessageW(hComboAlgo, CB_ADDSTRING, 0, (LPARAM)L"Recursive");
                 SendMessageW(hComboAlgo, CB_ADDSTRING, 0, (LPARAM)L"Non-Recursive");
+                SendMessageW(hComboAlgo, CB_ADDSTRING, 0, (LPARAM)L"Scanline");
             } else if (currentShape == SHAPE_CARDINAL_SPLINE) {
                 SendMessageW(hComboAlgo, CB_ADDSTRING, 0, (LPARAM)L"Cardinal Spline");
+                SendMessageW(hComboAlgo, CB_ADDSTRING, 0, (LPARAM)L"Thick Stroke");
                 splinePointCount = 0;
             } else if (currentShape == SHAPE_POLYGON) {
                 SendMessageW(hComboAlgo, CB_ADDSTRING, 0, (LPARAM)L"Convex Fill");
                 SendMessageW(hComboAlgo, CB_ADDSTRING, 0, (LPARAM)L"General Fill");
+                SendMessageW(hComboAlgo, CB_ADDSTRING, 0, (LPARAM)L"Clip Mask");
+                SendMessageW(hComboAlgo, CB_ADDSTRING, 0, (LPARAM)L"Add to Mask");
+                SendMessageW(hComboAlgo, CB_ADDSTRING, 0, (LPARAM)L"Exclude from Mask");
+                SendMessageW(hComboAlgo, CB_ADDSTRING, 0, (LPARAM)L"Gouraud Fill");
                 polygonPointCount = 0;
             } else if (currentShape == SHAPE_CLIP_WINDOW) {
                 SendMessageW(hComboAlgo, CB_ADDSTRING, 0, (LPARAM)L"Rectangle");
                 SendMessageW(hComboAlgo, CB_ADDSTRING, 0, (LPARAM)L"Square");
+                SendMessageW(hComboAlgo, CB_ADDSTRING, 0, (LPARAM)L"Circle Mask");
+                SendMessageW(hComboAlgo, CB_ADDSTRING, 0, (LPARAM)L"Add Circle to Mask");
+                SendMessageW(hComboAlgo, CB_ADDSTRING, 0, (LPARAM)L"Exclude Circle");
                 SendMessageW(hComboAlgo, CB_SETCURSEL, 0, 0);
             } else if (currentShape == SHAPE_ELLIPSE) {
                 SendMessageW(hComboAlgo, CB_ADDSTRING, 0, (LPARAM)L"Direct");
@@ -342,6 +967,9 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
             bool showFill = false;
             if (currentShape == SHAPE_POLYGON || currentShape == SHAPE_FLOODFILL || currentShape == SHAPE_SQUARE || currentShape == SHAPE_RECTANGLE || currentShape == SHAPE_CIRCLE_QUARTER || currentShape == SHAPE_ELLIPSE) {
                 showFill = true;
+            } else if (currentShape == SHAPE_LINE) {
+                int selAlgo = (int)SendMessageW(hComboAlgo, CB_GETCURSEL, 0, 0);
+                if (selAlgo == 4) showFill = true;
             } else if (currentShape == SHAPE_CIRCLE) {
                 int algoCount = (int)SendMessageW(hComboAlgo, CB_GETCOUNT, 0, 0);
                 int selAlgo = (int)SendMessageW(hComboAlgo, CB_GETCURSEL, 0, 0);
@@ -379,16 +1007,8 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
         if (wmId == 4002) {
             if (polygonPointCount >= 3) {
                 int algoSel = (int)SendMessageW(hComboAlgo, CB_GETCURSEL, 0, 0);
-                point pts[100];
-                for (int i = 0; i < polygonPointCount; ++i) {
-                    pts[i] = point(polygonPoints[i].x, polygonPoints[i].y);
-                }
-                if (algoSel == 0) {
-                    convexfill(hMemDC, pts, polygonPointCount, g_FillColor);
-                } else {
-                    fillGeneralPolygon(hMemDC, pts, polygonPointCount, g_FillColor);
-                }
-                InvalidateRect(hWnd, NULL, FALSE);
+                DrawRecord record = { DL_POLYGON, (BYTE)algoSel, (WORD)polygonPointCount, g_LineColor, g_FillColor, 0, 0 };
+                SubmitRecord(record, polygonPoints);
             }
             polygonPointCount = 0;
             ShowWindow(hBtnFinishPolygon, SW_HIDE);
@@ -411,17 +1031,22 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
             bool showFill = false;
             if (currentShape == SHAPE_POLYGON || currentShape == SHAPE_FLOODFILL || currentShape == SHAPE_SQUARE || currentShape == SHAPE_RECTANGLE || currentShape == SHAPE_CIRCLE_QUARTER || currentShape == SHAPE_ELLIPSE) {
                 showFill = true;
+            } else if (currentShape == SHAPE_LINE) {
+                int selAlgo = (int)SendMessageW(hComboAlgo, CB_GETCURSEL, 0, 0);
+                if (selAlgo == 4) showFill = true;
             } else if (currentShape == SHAPE_CIRCLE) {
                 int selAlgo = (int)SendMessageW(hComboAlgo, CB_GETCURSEL, 0, 0);
                 if (selAlgo >= 5) showFill = true;
             }
             ShowWindow(GetDlgItem(hWnd, IDC_BTN_FILL_COLOR), showFill ? SW_SHOW : SW_HIDE);
         }
+        // Clearing and loading supersede whatever is still queued or drawing.
         if (wmId == 4003) { 
             if (pPixels) {
-                memset(pPixels, 255, canvasWidth * canvasHeight * 4); 
-                clipWindowSet = false; 
-                InvalidateRect(hWnd, NULL, FALSE);
+                renderQueue.Cancel();
+                DrawRecord record = { DL_CLEAR, 0, 0, g_LineColor, g_FillColor, 0, 0 };
+                SubmitRecord(record);
+                ResetLayers(hWnd);
             }
             return 0;
         }
@@ -429,26 +1054,32 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
             OPENFILENAME ofn = { sizeof(OPENFILENAME) };
             WCHAR szFile[MAX_PATH] = L"";
             ofn.hwndOwner = hWnd;
-            ofn.lpstrFilter = L"Bitmap Files (*.bmp)\0*.bmp\0All Files (*.*)\0*.*\0";
+            ofn.lpstrFilter = L"PixelCanvas Documents (*.pxc)\0*.pxc\0PNG Images (*.png)\0*.png\0Bitmap Files (*.bmp)\0*.bmp\0All Files (*.*)\0*.*\0";
             ofn.lpstrFile = szFile;
             ofn.nMaxFile = MAX_PATH;
             ofn.Flags = OFN_OVERWRITEPROMPT | OFN_PATHMUSTEXIST;
-            ofn.lpstrDefExt = L"bmp";
+            ofn.lpstrDefExt = L"pxc";
             if (GetSaveFileName(&ofn)) {
-                BITMAPFILEHEADER bfh = { 0 };
-                BITMAPINFOHEADER bih = bmi.bmiHeader;
-                DWORD dwBmpSize = canvasWidth * canvasHeight * 4;
-                bfh.bfType = 0x4D42; 
-                bfh.bfOffBits = sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER);
-                bfh.bfSize = bfh.bfOffBits + dwBmpSize;
+                renderQueue.Finish();
+                const WCHAR* native = wcsrchr(szFile, L'.');
+                if (native && _wcsicmp(native, L".pxc") == 0) {
+                    // Saving again to the same document appends only what
+                    // changed since.
+                    DocumentInfo info = { canvasState.clipWindow, g_LineColor, g_FillColor };
+                    if (!document.Save(szFile, SavedTarget(), canvasState.dirty, info, displayList))
+                        MessageBoxW(hWnd, L"The document could not be saved.", szTitle, MB_OK | MB_ICONERROR);
+                    return 0;
+                }
                 HANDLE hFile = CreateFile(ofn.lpstrFile, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+                bool saved = false;
                 if (hFile != INVALID_HANDLE_VALUE) {
-                    DWORD dwWritten;
-                    WriteFile(hFile, &bfh, sizeof(bfh), &dwWritten, NULL);
-                    WriteFile(hFile, &bih, sizeof(bih), &dwWritten, NULL);
-                    WriteFile(hFile, pPixels, dwBmpSize, &dwWritten, NULL);
+                    saved = WriteImage(hFile, dibSurface, native && _wcsicmp(native, L".png") == 0);
                     CloseHandle(hFile);
                 }
+                if (!saved) {
+                    MessageBoxW(hWnd, L"The document could not be saved.", szTitle, MB_OK | MB_ICONERROR);
+                    return 0;
+                }
                 WCHAR txtFile[MAX_PATH];
                 wcscpy_s(txtFile, szFile);
                 WCHAR* dot = wcsrchr(txtFile, L'.');
@@ -456,7 +1087,8 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
                 else wcscat_s(txtFile, MAX_PATH, L".txt");
                 FILE* f = nullptr;
                 if (_wfopen_s(&f, txtFile, L"w") == 0 && f) {
-                    fprintf(f, "%d %d %d %d %d\n", clipWindowSet ? 1 : 0, clipMinX, clipMinY, clipMaxX, clipMaxY);
+                    const ClipRect& clip = canvasState.clipWindow;
+                    fprintf(f, "%d %d %d %d %d\n", clip.enabled ? 1 : 0, clip.minX, clip.minY, clip.maxX, clip.maxY);
                     fclose(f);
                 }
             }
@@ -466,40 +1098,67 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
             OPENFILENAME ofn = { sizeof(OPENFILENAME) };
             WCHAR szFile[MAX_PATH] = L"";
             ofn.hwndOwner = hWnd;
-            ofn.lpstrFilter = L"Bitmap Files (*.bmp)\0*.bmp\0All Files (*.*)\0*.*\0";
+            ofn.lpstrFilter = L"Images (*.pxc;*.bmp)\0*.pxc;*.bmp\0PixelCanvas Documents (*.pxc)\0*.pxc\0Bitmap Files (*.bmp)\0*.bmp\0All Files (*.*)\0*.*\0";
             ofn.lpstrFile = szFile;
             ofn.nMaxFile = MAX_PATH;
             ofn.Flags = OFN_FILEMUSTEXIST | OFN_PATHMUSTEXIST;
-            ofn.lpstrDefExt = L"bmp";
+            ofn.lpstrDefExt = L"pxc";
             if (GetOpenFileName(&ofn)) {
-                HANDLE hFile = CreateFile(ofn.lpstrFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-                if (hFile != INVALID_HANDLE_VALUE) {
-                    BITMAPFILEHEADER bfh;
-                    BITMAPINFOHEADER bih;
-                    DWORD dwRead;
-                    ReadFile(hFile, &bfh, sizeof(bfh), &dwRead, NULL);
-                    ReadFile(hFile, &bih, sizeof(bih), &dwRead, NULL);
-                    if (bfh.bfType == 0x4D42 && bih.biWidth == canvasWidth && abs(bih.biHeight) == canvasHeight && bih.biBitCount == 32) {
-                        ReadFile(hFile, pPixels, canvasWidth * canvasHeight * 4, &dwRead, NULL);
-                        InvalidateRect(hWnd, NULL, FALSE);
-                    }
-                    CloseHandle(hFile);
+                std::wstring path = szFile;
+                const WCHAR* ext = wcsrchr(szFile, L'.');
+                renderQueue.Cancel();
+                ResetLayers(hWnd);
+                if (ext && _wcsicmp(ext, L".pxc") == 0) {
+                    renderQueue.Submit([path] {
+                        // The document carries its own clip window and display
+                        // list; undo starts over from what was opened.
+                        ClearCanvas();
+                        DocumentInfo info;
+                        if (document.Open(path.c_str(), canvasTarget, canvasState.dirty, info, displayList)) {
+                            canvasState.clipWindow = info.clip;
+                            PostMessageW(hMainWnd, WM_APP_COLORS, info.lineColor, info.fillColor);
+                            AttachHistory(document.Tiles());
+                            history.Commit(displayList.Count());
+                        }
+                        else {
+                            displayList.Clear();
+                            AttachHistory();
+                        }
+                    });
+                    return 0;
                 }
-                WCHAR txtFile[MAX_PATH];
-                wcscpy_s(txtFile, szFile);
-                WCHAR* dot = wcsrchr(txtFile, L'.');
-                if (dot) wcscpy_s(dot, MAX_PATH - (dot - txtFile), L".txt");
-                else wcscat_s(txtFile, MAX_PATH, L".txt");
-                FILE* f = nullptr;
-                if (_wfopen_s(&f, txtFile, L"r") == 0 && f) {
-                    int set = 0;
-                    if (fscanf_s(f, "%d %d %d %d %d", &set, &clipMinX, &clipMinY, &clipMaxX, &clipMaxY) >= 5) {
-                        clipWindowSet = (set != 0);
-                    } else {
-                        clipWindowSet = false;
+                renderQueue.Submit([path] {
+                    {
+                        MappedFile file(path.c_str());
+                        BmpImage image;
+                        if (ParseBmp(file.Data(), file.Size(), image)) {
+                            // Undo starts over from the image, which is
+                            // tracked as a step and then made the base the
+                            // history falls back on, like an opened document.
+                            ClearCanvas();
+                            displayList.Clear();
+                            AttachHistory();
+                            DrawBmp(image, canvasTarget, canvasState.dirty);
+                            history.Commit(0);
+                            AttachHistory(history.Snapshot());
+                        }
                     }
-                    fclose(f);
-                }
+                    WCHAR txtFile[MAX_PATH];
+                    wcscpy_s(txtFile, path.c_str());
+                    WCHAR* dot = wcsrchr(txtFile, L'.');
+                    if (dot) wcscpy_s(dot, MAX_PATH - (dot - txtFile), L".txt");
+                    else wcscat_s(txtFile, MAX_PATH, L".txt");
+                    FILE* f = nullptr;
+                    if (_wfopen_s(&f, txtFile, L"r") == 0 && f) {
+                        int set = 0;
+                        ClipRect loaded;
+                        if (fscanf_s(f, "%d %d %d %d %d", &set, &loaded.minX, &loaded.minY, &loaded.maxX, &loaded.maxY) >= 5) {
+                            loaded.enabled = (set != 0);
+                        }
+                        canvasState.clipWindow = loaded;
+                        fclose(f);
+                    }
+                });
             }
             return 0;
         }
@@ -521,9 +1180,12 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 
     case WM_LBUTTONDOWN:
     {
-        int x = LOWORD(lParam);
-        int y = HIWORD(lParam) - topOffset;
-        if (y < 0 || x < 0 || x >= canvasWidth || y >= canvasHeight)
+        if (HIWORD(lParam) < topOffset)
+            break;
+        POINT at = view.ToCanvas(LOWORD(lParam), HIWORD(lParam) - topOffset);
+        int x = at.x;
+        int y = at.y;
+        if (y < 0 || x < 0 || x >= documentWidth || y >= documentHeight)
             break;
         if (currentShape == SHAPE_SQUARE || currentShape == SHAPE_RECTANGLE) {
             shapePoints[shapeClickCount].x = x;
@@ -531,7 +1193,7 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
             shapeClickCount++;
             if (shapeClickCount < 2) return 0;
             int algoSel = (int)SendMessageW(hComboAlgo, CB_GETCURSEL, 0, 0);
-            Curve curve(hMemDC);
+            COLORREF fill = g_FillColor, color = g_LineColor;
             if (currentShape == SHAPE_SQUARE) {
                 // First click: bottom-left, second click: top-right
                 int x0 = shapePoints[0].x;
@@ -546,41 +1208,22 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
                 int y_sign = (y1 >= y0) ? 1 : -1;
                 int x2 = x0 + side * x_sign;
                 int y2 = y0 + side * y_sign;
-                int left = min(x0, x2);
-                int right = max(x0, x2);
-                int bottom = min(y0, y2);
-                int top = max(y0, y2);
-                curve.FillWithHermite(left, bottom, right, top, g_FillColor);
-                Line line(hMemDC);
-                line.DrawLineDDA(left, bottom, right, bottom, g_LineColor);
-                line.DrawLineDDA(right, bottom, right, top, g_LineColor);
-                line.DrawLineDDA(right, top, left, top, g_LineColor);
-                line.DrawLineDDA(left, top, left, bottom, g_LineColor);
+                POINT corners[2] = { { min(x0, x2), min(y0, y2) }, { max(x0, x2), max(y0, y2) } };
+                DrawRecord record = { DL_SQUARE, (BYTE)algoSel, 2, color, fill, 0, 0 };
+                SubmitRecord(record, corners);
             } else if (currentShape == SHAPE_RECTANGLE) {
-                int minX = min(shapePoints[0].x, shapePoints[1].x);
-                int maxX = max(shapePoints[0].x, shapePoints[1].x);
-                int minY = min(shapePoints[0].y, shapePoints[1].y);
-                int maxY = max(shapePoints[0].y, shapePoints[1].y);
-                curve.FillWithBezier(minX, minY, maxX, maxY, g_FillColor);
-                Line line(hMemDC);
-                line.DrawLineDDA(minX, minY, maxX, minY, g_LineColor); 
-                line.DrawLineDDA(maxX, minY, maxX, maxY, g_LineColor); 
-                line.DrawLineDDA(maxX, maxY, minX, maxY, g_LineColor); 
-                line.DrawLineDDA(minX, maxY, minX, minY, g_LineColor); 
+                POINT corners[2] = { { min(shapePoints[0].x, shapePoints[1].x), min(shapePoints[0].y, shapePoints[1].y) },
+                                     { max(shapePoints[0].x, shapePoints[1].x), max(shapePoints[0].y, shapePoints[1].y) } };
+                DrawRecord record = { DL_RECTANGLE, (BYTE)algoSel, 2, color, fill, 0, 0 };
+                SubmitRecord(record, corners);
             }
-            InvalidateRect(hWnd, NULL, FALSE);
             shapeClickCount = 0;
             return 0;
         }
         if (currentShape == SHAPE_FLOODFILL) {
             int algoSel = (int)SendMessageW(hComboAlgo, CB_GETCURSEL, 0, 0);
-            COLORREF boundaryColor = g_LineColor; 
-            if (algoSel == 0) {
-                myFloodFill(hMemDC, x, y, boundaryColor, g_FillColor);
-            } else {
-                myFloodFillqueue(hMemDC, x, y, boundaryColor, g_FillColor);
-            }
-            InvalidateRect(hWnd, NULL, FALSE);
+            DrawRecord record = { DL_FLOOD_FILL, (BYTE)algoSel, 1, g_LineColor, g_FillColor, 0, 0 };
+            SubmitRecord(record, &at);
             return 0;
         }
         if (currentShape == SHAPE_CARDINAL_SPLINE) {
@@ -589,9 +1232,9 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
                 splinePoints[splinePointCount].y = y;
                 splinePointCount++;
                 if (splinePointCount == splinePointTarget) {
-                    Curve curve(hMemDC);
-                    curve.DrawCardinalSpline(splinePoints, splinePointTarget, 0.0, g_LineColor);
-                    InvalidateRect(hWnd, NULL, FALSE);
+                    int algoSel = (int)SendMessageW(hComboAlgo, CB_GETCURSEL, 0, 0);
+                    DrawRecord record = { DL_SPLINE, (BYTE)algoSel, (WORD)splinePointTarget, g_LineColor, g_FillColor, (int)round(g_StrokeWidth * 256), 0 };
+                    SubmitRecord(record, splinePoints);
                     splinePointCount = 0;
                     splinePointTarget = 0;
                 }
@@ -610,9 +1253,18 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
             clipWindowPoints[shapeClickCount].x = x;
             clipWindowPoints[shapeClickCount].y = y;
             shapeClickCount++;
+            int algoSel = (int)SendMessageW(hComboAlgo, CB_GETCURSEL, 0, 0);
+            if (algoSel >= 2) {
+                if (shapeClickCount < 2) return 0;
+                int xc = clipWindowPoints[0].x, yc = clipWindowPoints[0].y;
+                int R = (int)round(hypot((double)(x - xc), (double)(y - yc)));
+                DrawRecord record = { DL_CLIP_CIRCLE, (BYTE)(algoSel - 2), 1, g_LineColor, g_FillColor, R, 0 };
+                SubmitRecord(record, clipWindowPoints);
+                shapeClickCount = 0;
+                return 0;
+            }
             if (shapeClickCount < 4) return 0;
             
-            int algoSel = (int)SendMessageW(hComboAlgo, CB_GETCURSEL, 0, 0);
             bool newWindowIsSquare = (algoSel == 1);
 
             int new_clipMinX = min(min(clipWindowPoints[0].x, clipWindowPoints[1].x), min(clipWindowPoints[2].x, clipWindowPoints[3].x));
@@ -626,33 +1278,12 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
                 new_clipMaxY = new_clipMinY + side;
             }
 
-            if (!clipWindowSet) {
-                clipMinX = new_clipMinX;
-                clipMaxX = new_clipMaxX;
-                clipMinY = new_clipMinY;
-                clipMaxY = new_clipMaxY;
-                clipWindowSet = true;
-            }
-            else {
-                clipMinX = max(clipMinX, new_clipMinX);
-                clipMaxX = min(clipMaxX, new_clipMaxX);
-                clipMinY = max(clipMinY, new_clipMinY);
-                clipMaxY = min(clipMaxY, new_clipMaxY);
-            }
-            
-            if (clipMinX >= clipMaxX || clipMinY >= clipMaxY) {
-                clipWindowSet = false;
-            }
-
-            if(clipWindowSet){
-                Line line(hMemDC);
-                line.DrawLineDDA(clipMinX, clipMinY, clipMaxX, clipMinY, RGB(255,0,0));
-                line.DrawLineDDA(clipMaxX, clipMinY, clipMaxX, clipMaxY, RGB(255,0,0));
-                line.DrawLineDDA(clipMaxX, clipMaxY, clipMinX, clipMaxY, RGB(255,0,0));
-                line.DrawLineDDA(clipMinX, clipMaxY, clipMinX, clipMinY, RGB(255,0,0));
-            }
+            // The clip window belongs to the render thread, which reads it
+            // while drawing, so it is narrowed there too.
+            POINT corners[2] = { { new_clipMinX, new_clipMinY }, { new_clipMaxX, new_clipMaxY } };
+            DrawRecord record = { DL_CLIP_WINDOW, (BYTE)algoSel, 2, g_LineColor, g_FillColor, 0, 0 };
+            SubmitRecord(record, corners);
 
-            InvalidateRect(hWnd, NULL, FALSE);
             shapeClickCount = 0;
             return 0;
         }
@@ -662,15 +1293,10 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
             shapeClickCount++;
             if (shapeClickCount < 3) { return 0; }
             int xc = shapePoints[0].x, yc = shapePoints[0].y;
-            int a = abs(shapePoints[1].x - xc);
-            int b = abs(shapePoints[2].y - yc);
+            POINT axes[2] = { { xc, yc }, { abs(shapePoints[1].x - xc), abs(shapePoints[2].y - yc) } };
             int algoSel = (int)SendMessageW(hComboAlgo, CB_GETCURSEL, 0, 0);
-            switch (algoSel) {
-            case 0: DrawEllipseDirect(hMemDC, xc, yc, a, b, g_LineColor); break;
-            case 1: DrawEllipsePolar(hMemDC, xc, yc, a, b, g_LineColor); break;
-            case 2: DrawEllipseMidpoint(hMemDC, xc, yc, a, b, g_LineColor); break;
-            }
-            InvalidateRect(hWnd, NULL, FALSE);
+            DrawRecord record = { DL_ELLIPSE, (BYTE)algoSel, 2, g_LineColor, g_FillColor, 0, 0 };
+            SubmitRecord(record, axes);
             shapeClickCount = 0;
             return 0;
         }
@@ -683,62 +1309,161 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
             lineEnd.x = x;
             lineEnd.y = y;
             int algoSel = (int)SendMessageW(hComboAlgo, CB_GETCURSEL, 0, 0);
+            DrawRecord record = { DL_LINE, (BYTE)algoSel, 2, g_LineColor, g_FillColor, 0, 0 };
             if (currentShape == SHAPE_LINE) {
-                Line line(hMemDC);
-                switch (algoSel) {
-                case 0: line.DrawLineDDA(lineStart.x, lineStart.y, lineEnd.x, lineEnd.y, g_LineColor); break;
-                case 1: line.DrawLineMidpoint(lineStart.x, lineStart.y, lineEnd.x, lineEnd.y, g_LineColor); break;
-                case 2: line.DrawLineParametric(lineStart.x, lineStart.y, lineEnd.x, lineEnd.y, g_LineColor); break;
-                }
-            } else if (currentShape == SHAPE_CIRCLE) {
+                POINT ends[2] = { lineStart, lineEnd };
+                SubmitRecord(record, ends);
+            } else if (currentShape == SHAPE_CIRCLE || currentShape == SHAPE_CIRCLE_QUARTER) {
                 int xc = lineStart.x, yc = lineStart.y;
-                int R = (int)round(sqrt((lineEnd.x - xc) * (lineEnd.x - xc) + (lineEnd.y - yc) * (lineEnd.y - yc)));
-                Circle circle(hMemDC);
-                switch (algoSel) {
-                case 0: circle.DrawCircleDirect(xc, yc, R, g_LineColor); break;
-                case 1: circle.DrawCirclePolar(xc, yc, R, g_LineColor); break;
-                case 2: circle.DrawCircleIterativePolar(xc, yc, R, g_LineColor); break;
-                case 3: circle.DrawCircleMidpoint(xc, yc, R, g_LineColor); break;
-                case 4: circle.DrawCircleModifiedMidpoint(xc, yc, R, g_LineColor); break;
-                }
-            } else if (currentShape == SHAPE_CIRCLE_QUARTER) {
-                int xc = lineStart.x, yc = lineStart.y;
-                int R = (int)round(sqrt((lineEnd.x - xc) * (lineEnd.x - xc) + (lineEnd.y - yc) * (lineEnd.y - yc)));
-                Circle circle(hMemDC);
-                circle.DrawCircleModifiedMidpoint(xc, yc, R, g_LineColor);
-                switch (algoSel) {
-                case 0: circle.FillQuarterWithCircles(xc, yc, R, 1); break;
-                case 1: circle.FillQuarterWithCircles(xc, yc, R, 2); break;
-                case 2: circle.FillQuarterWithCircles(xc, yc, R, 3); break;
-                case 3: circle.FillQuarterWithCircles(xc, yc, R, 4); break;
-                case 4: circle.FillQuarterWithLines(xc, yc, R, g_LineColor, 1); break;
-                case 5: circle.FillQuarterWithLines(xc, yc, R, g_LineColor, 2); break;
-                case 6: circle.FillQuarterWithLines(xc, yc, R, g_LineColor, 3); break;
-                case 7: circle.FillQuarterWithLines(xc, yc, R, g_LineColor, 4); break;
-                }
+                record.op = currentShape == SHAPE_CIRCLE ? DL_CIRCLE : DL_CIRCLE_QUARTER;
+                record.count = 1;
+                record.param = (int)round(hypot((double)(lineEnd.x - xc), (double)(lineEnd.y - yc)));
+                // Rings are drawn progressively on the render thread, so
+                // their colors come from a generator seeded here rather
+                // than the CRT's per-thread rand() state.
+                if (record.op == DL_CIRCLE_QUARTER)
+                    record.seed = (unsigned)rand();
+                SubmitRecord(record, &lineStart);
             }
-            InvalidateRect(hWnd, NULL, FALSE);
             waitingForSecondClick = false;
         }
     }
     break;
 
+    // Right-dragging pans the view, the wheel zooms about the cursor and
+    // Home returns to 1:1 at the canvas origin.
+    case WM_RBUTTONDOWN:
+        panning = true;
+        panFrom.x = (short)LOWORD(lParam);
+        panFrom.y = (short)HIWORD(lParam);
+        SetCapture(hWnd);
+        return 0;
+
+    case WM_MOUSEMOVE:
+        if (panning) {
+            int px = (short)LOWORD(lParam), py = (short)HIWORD(lParam);
+            view.Pan(px - panFrom.x, py - panFrom.y);
+            panFrom.x = px;
+            panFrom.y = py;
+            InvalidateView(hWnd);
+        }
+        return 0;
+
+    case WM_RBUTTONUP:
+        if (panning) {
+            panning = false;
+            ReleaseCapture();
+        }
+        return 0;
+
+    case WM_MOUSEWHEEL:
+    {
+        POINT at = { (short)LOWORD(lParam), (short)HIWORD(lParam) };
+        ScreenToClient(hWnd, &at);
+        double notches = GET_WHEEL_DELTA_WPARAM(wParam) / (double)WHEEL_DELTA;
+        view.ZoomAbout(at.x, at.y - topOffset, pow(2.0, notches / 2), ldexp(1.0, -mips.Levels()), 32.0);
+        InvalidateView(hWnd);
+        return 0;
+    }
+
+    case WM_KEYDOWN:
+        // Ctrl+Z and Ctrl+Y undo and redo; F5 redraws everything recorded
+        // since the last Load.
+        if ((wParam == 'Z' || wParam == 'Y') && (GetKeyState(VK_CONTROL) & 0x8000)) {
+            if (wParam == 'Z')
+                renderQueue.Submit([] { history.Undo(); });
+            else
+                renderQueue.Submit([] { history.Redo(); });
+            return 0;
+        }
+        if (wParam == VK_F5) {
+            renderQueue.Submit(ReplayDisplayList);
+            return 0;
+        }
+        if (wParam == VK_HOME) {
+            view = Viewport();
+            InvalidateView(hWnd);
+            return 0;
+        }
+        if (g_LayerCount > 1 && (wParam == VK_PRIOR || wParam == VK_NEXT || wParam == VK_OEM_4 || wParam == VK_OEM_6 || wParam == 'B')) {
+            LayerBlend& blend = g_LayerBlends[g_Layer];
+            if (wParam == VK_PRIOR)
+                g_Layer = min(g_Layer + 1, g_LayerCount - 1);
+            else if (wParam == VK_NEXT)
+                g_Layer = max(g_Layer - 1, 0);
+            else if (wParam == VK_OEM_4)
+                blend.opacity = (BYTE)max(blend.opacity - 32, 0);
+            else if (wParam == VK_OEM_6)
+                blend.opacity = (BYTE)min(blend.opacity + 32, 255);
+            else
+                blend.mode = (BYTE)((blend.mode + 1) % LAYER_MODES);
+            SubmitLayer(hWnd);
+            return 0;
+        }
+        return DefWindowProc(hWnd, message, wParam, lParam);
+
+    case WM_SIZE:
+        if (hViewDC)
+            ResizeView(hWnd);
+        break;
+
+    case WM_APP_PRESENT:
+        PresentPublished(hWnd);
+        return 0;
+
+    case WM_APP_COLORS:
+        g_LineColor = (COLORREF)wParam;
+        g_FillColor = (COLORREF)lParam;
+        return 0;
+
     case WM_PAINT:
     {
         PAINTSTRUCT ps;
         HDC hdc = BeginPaint(hWnd, &ps);
-        RECT rc = { 0, 0, canvasWidth, topOffset };
-        FillRect(hdc, &rc, (HBRUSH)(COLOR_WINDOW + 1));
-        BitBlt(hdc, 0, topOffset, canvasWidth, canvasHeight, hMemDC, 0, 0, SRCCOPY);
+        RECT client;
+        GetClientRect(hWnd, &client);
+        RECT rc = { 0, 0, client.right, topOffset };
+        RECT bar;
+        if (IntersectRect(&bar, &rc, &ps.rcPaint))
+            FillRect(hdc, &bar, (HBRUSH)(COLOR_WINDOW + 1));
+        RECT canvas = { 0, topOffset, client.right, client.bottom };
+        RECT area;
+        if (IntersectRect(&area, &canvas, &ps.rcPaint)) {
+            std::lock_guard<std::mutex> lock(presentLock);
+            if (viewSurface.IsValid() && dibSurface.IsValid()) {
+                RECT r = area, shown = { 0, 0, viewSurface.width, viewSurface.height };
+                OffsetRect(&r, 0, -topOffset);
+                IntersectRect(&r, &r, &shown);
+                mips.Render(viewSurface, r, view, FormatBgra32::FromColor(GetSysColor(COLOR_APPWORKSPACE)));
+                BitBlt(hdc, area.left, area.top, area.right - area.left, area.bottom - area.top, hViewDC, area.left, area.top - topOffset, SRCCOPY);
+            }
+            else {
+                BitBlt(hdc, area.left, area.top, area.right - area.left, area.bottom - area.top, hMemDC, area.left, area.top - topOffset, SRCCOPY);
+            }
+        }
         EndPaint(hWnd, &ps);
     }
     break;
 
     case WM_DESTROY:
+        renderQueue.Cancel();
+        renderQueue.Stop();
+        autosave.Stop();
+        renderer.Detach();
+        delete tiledCanvas;
+        tiledCanvas = NULL;
+        delete paletteCanvas;
+        paletteCanvas = NULL;
+        delete sparseCanvas;
+        sparseCanvas = NULL;
         if (hBitmap)
             DeleteObject(hBitmap);
         if (hMemDC)
             DeleteDC(hMemDC);
+        if (hViewDC)
+            DeleteDC(hViewDC);
+        if (hViewBitmap)
+            DeleteObject(hViewBitmap);
         PostQuitMessage(0);
         break;
 
@@ -752,10 +1477,8 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
     case WM_GETMINMAXINFO:
     {
         MINMAXINFO* mmi = (MINMAXINFO*)lParam;
-        mmi->ptMinTrackSize.x = canvasWidth + 16;
-        mmi->ptMinTrackSize.y = canvasHeight + 39;
-        mmi->ptMaxTrackSize.x = canvasWidth + 16;
-        mmi->ptMaxTrackSize.y = canvasHeight + 39;
+        mmi->ptMinTrackSize.x = 320;
+        mmi->ptMinTrackSize.y = topOffset + 200;
         return 0;
     }
 
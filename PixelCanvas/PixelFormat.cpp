@@ -0,0 +1,62 @@
+#include "PixelFormat.h"
+#include <algorithm>
+using namespace std;
+
+int PixelFormatBytes(PixelFormat format) {
+    switch (format) {
+    case FORMAT_RGB565: return sizeof(FormatRgb565::Pixel);
+    case FORMAT_A8: return sizeof(FormatA8::Pixel);
+    case FORMAT_RGBA16: return sizeof(FormatRgba16::Pixel);
+    default: return 4;
+    }
+}
+
+template <class Format>
+static void RowToBgra(const BYTE* row, DWORD* out, int n) {
+    const typename Format::Pixel* in = (const typename Format::Pixel*)row;
+    for (int i = 0; i < n; i++)
+        out[i] = Format::ToBgra(in[i]);
+}
+
+template <class Format>
+static void RowFromBgra(const DWORD* in, BYTE* row, int n) {
+    typename Format::Pixel* out = (typename Format::Pixel*)row;
+    for (int i = 0; i < n; i++)
+        out[i] = Format::FromBgra(in[i]);
+}
+
+static void ToBgra(PixelFormat f, const BYTE* row, DWORD* out, int n) {
+    switch (f) {
+    case FORMAT_BGRA32: RowToBgra<FormatBgra32>(row, out, n); break;
+    case FORMAT_RGBA32: RowToBgra<FormatRgba32>(row, out, n); break;
+    case FORMAT_RGB565: RowToBgra<FormatRgb565>(row, out, n); break;
+    case FORMAT_A8: RowToBgra<FormatA8>(row, out, n); break;
+    case FORMAT_RGBA16: RowToBgra<FormatRgba16>(row, out, n); break;
+    }
+}
+
+static void FromBgra(PixelFormat f, const DWORD* in, BYTE* row, int n) {
+    switch (f) {
+    case FORMAT_BGRA32: RowFromBgra<FormatBgra32>(in, row, n); break;
+    case FORMAT_RGBA32: RowFromBgra<FormatRgba32>(in, row, n); break;
+    case FORMAT_RGB565: RowFromBgra<FormatRgb565>(in, row, n); break;
+    case FORMAT_A8: RowFromBgra<FormatA8>(in, row, n); break;
+    case FORMAT_RGBA16: RowFromBgra<FormatRgba16>(in, row, n); break;
+    }
+}
+
+// Rows go through a small BGRA buffer so every pair of formats shares the
+// same two per-format loops.
+void ConvertPixels(const Surface& src, PixelFormat from, const Surface& dst, PixelFormat to, const RECT& r) {
+    int left = max((int)r.left, 0), right = min((int)r.right, min(src.width, dst.width));
+    int top = max((int)r.top, 0), bottom = min((int)r.bottom, min(src.height, dst.height));
+    int fromBytes = PixelFormatBytes(from), toBytes = PixelFormatBytes(to);
+    DWORD buffer[256];
+    for (int y = top; y < bottom; y++) {
+        for (int x = left; x < right; x += 256) {
+            int n = min(256, right - x);
+            ToBgra(from, src.Row(y) + x * fromBytes, buffer, n);
+            FromBgra(to, buffer, dst.Row(y) + x * toBytes, n);
+        }
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef PIXELFORMAT_H
+#define PIXELFORMAT_H
+
+#include <windows.h>
+#include "Surface.h"
+
+enum PixelFormat { FORMAT_BGRA32, FORMAT_RGBA32, FORMAT_RGB565, FORMAT_A8, FORMAT_RGBA16 };
+
+// Compile-time description of a stored pixel. Targets are instantiated per
+// format, so a COLORREF is converted to the native value once per primitive
+// and inner loops only store Pixel values. ToBgra/FromBgra bridge to the
+// 0xAARRGGBB values produced by gradients and blending.
+struct FormatBgra32 {
+    typedef DWORD Pixel;
+    static const PixelFormat Id = FORMAT_BGRA32;
+    static Pixel FromColor(COLORREF c) { return 0xFF000000 | (GetRValue(c) << 16) | (GetGValue(c) << 8) | GetBValue(c); }
+    static Pixel FromBgra(DWORD v) { return v; }
+    static DWORD ToBgra(Pixel p) { return p; }
+};
+
+// Byte order R, G, B, A, which is COLORREF with alpha added.
+struct FormatRgba32 {
+    typedef DWORD Pixel;
+    static const PixelFormat Id = FORMAT_RGBA32;
+    static Pixel FromColor(COLORREF c) { return 0xFF000000 | (c & 0x00FFFFFF); }
+    static Pixel FromBgra(DWORD v) { return (v & 0xFF00FF00) | ((v >> 16) & 0xFF) | ((v & 0xFF) << 16); }
+    static DWORD ToBgra(Pixel p) { return FromBgra(p); }
+};
+
+struct FormatRgb565 {
+    typedef WORD Pixel;
+    static const PixelFormat Id = FORMAT_RGB565;
+    static Pixel FromColor(COLORREF c) { return (WORD)(((GetRValue(c) >> 3) << 11) | ((GetGValue(c) >> 2) << 5) | (GetBValue(c) >> 3)); }
+    static Pixel FromBgra(DWORD v) { return (WORD)(((v >> 8) & 0xF800) | ((v >> 5) & 0x07E0) | ((v >> 3) & 0x001F)); }
+    static DWORD ToBgra(Pixel p) {
+        DWORD r = (p >> 11) & 0x1F, g = (p >> 5) & 0x3F, b = p & 0x1F;
+        r = (r << 3) | (r >> 2);
+        g = (g << 2) | (g >> 4);
+        b = (b << 3) | (b >> 2);
+        return 0xFF000000 | (r << 16) | (g << 8) | b;
+    }
+};
+
+// Single-channel mask; colors are stored as their luma, so black and white
+// map to 0 and 255.
+struct FormatA8 {
+    typedef BYTE Pixel;
+    static const PixelFormat Id = FORMAT_A8;
+    static Pixel FromColor(COLORREF c) { return (BYTE)((GetRValue(c) * 77 + GetGValue(c) * 150 + GetBValue(c) * 29) >> 8); }
+    static Pixel FromBgra(DWORD v) { return (BYTE)((((v >> 16) & 0xFF) * 77 + ((v >> 8) & 0xFF) * 150 + (v & 0xFF) * 29) >> 8); }
+    static DWORD ToBgra(Pixel p) { return 0xFF000000 | (p << 16) | (p << 8) | p; }
+};
+
+struct Rgba16 {
+    WORD r, g, b, a;
+};
+
+// 16 bits per channel; 8-bit inputs are widened by replication (v * 257).
+struct FormatRgba16 {
+    typedef Rgba16 Pixel;
+    static const PixelFormat Id = FORMAT_RGBA16;
+    static Pixel FromColor(COLORREF c) {
+        Pixel p = { (WORD)(GetRValue(c) * 257), (WORD)(GetGValue(c) * 257), (WORD)(GetBValue(c) * 257), 0xFFFF };
+        return p;
+    }
+    static Pixel FromBgra(DWORD v) {
+        Pixel p = { (WORD)(((v >> 16) & 0xFF) * 257), (WORD)(((v >> 8) & 0xFF) * 257), (WORD)((v & 0xFF) * 257), (WORD)((v >> 24) * 257) };
+        return p;
+    }
+    static DWORD ToBgra(Pixel p) { return ((DWORD)(p.a >> 8) << 24) | ((p.r >> 8) << 16) | ((p.g >> 8) << 8) | (p.b >> 8); }
+};
+
+int PixelFormatBytes(PixelFormat format);
+
+// Converts the rectangle (right/bottom exclusive) between two surfaces of the
+// same size, e.g. to present a 565 or mask canvas through a BGRA DIB.
+void ConvertPixels(const Surface& src, PixelFormat from, const Surface& dst, PixelFormat to, const RECT& r);
+
+#endif
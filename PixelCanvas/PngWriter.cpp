@@ -0,0 +1,358 @@
+#include "PngWriter.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+static const size_t StripBytes = 256 * 1024;
+static const int WindowSize = 32768;
+static const int HashBits = 15;
+static const int MinMatch = 4, MaxMatch = 258;
+
+// Fixed Huffman tables, with codes bit-reversed for LSB-first output.
+struct DeflateTables {
+    WORD litCode[288];
+    BYTE litBits[288];
+    BYTE distCode[30];
+    BYTE lengthSymbol[MaxMatch + 1];
+    WORD lengthBase[29];
+    BYTE lengthExtra[29];
+    DWORD crc[256];
+
+    static WORD Reverse(int code, int bits) {
+        int r = 0;
+        for (int i = 0; i < bits; i++)
+            r |= ((code >> i) & 1) << (bits - 1 - i);
+        return (WORD)r;
+    }
+
+    DeflateTables() {
+        for (int s = 0; s < 288; s++) {
+            int code, bits;
+            if (s < 144) { code = 0x30 + s; bits = 8; }
+            else if (s < 256) { code = 0x190 + s - 144; bits = 9; }
+            else if (s < 280) { code = s - 256; bits = 7; }
+            else { code = 0xC0 + s - 280; bits = 8; }
+            litCode[s] = Reverse(code, bits);
+            litBits[s] = (BYTE)bits;
+        }
+        for (int d = 0; d < 30; d++)
+            distCode[d] = (BYTE)Reverse(d, 5);
+        static const WORD base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+        static const BYTE extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+        for (int i = 0; i < 29; i++) {
+            lengthBase[i] = base[i];
+            lengthExtra[i] = extra[i];
+            for (int len = base[i]; len < base[i] + (1 << extra[i]) && len <= MaxMatch; len++)
+                lengthSymbol[len] = (BYTE)i;
+        }
+        for (DWORD n = 0; n < 256; n++) {
+            DWORD c = n;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            crc[n] = c;
+        }
+    }
+};
+static const DeflateTables tables;
+
+static DWORD Crc(DWORD crc, const BYTE* p, size_t n) {
+    crc = ~crc;
+    while (n--)
+        crc = tables.crc[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+DWORD Crc32(DWORD crc, const void* data, size_t size) {
+    return Crc(crc, (const BYTE*)data, size);
+}
+
+static DWORD Adler(const BYTE* p, size_t n) {
+    DWORD a = 1, b = 0;
+    while (n) {
+        size_t block = min(n, (size_t)5552);
+        n -= block;
+        while (block--) {
+            a += *p++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+// Checksum of two pieces from theirs and the second one's length.
+static DWORD AdlerCombine(DWORD adler1, DWORD adler2, size_t length2) {
+    const DWORD Base = 65521;
+    DWORD rem = (DWORD)(length2 % Base);
+    DWORD sum1 = adler1 & 0xFFFF;
+    DWORD sum2 = (DWORD)(((unsigned long long)rem * sum1) % Base);
+    sum1 += (adler2 & 0xFFFF) + Base - 1;
+    sum2 += (adler1 >> 16) + (adler2 >> 16) + Base - rem;
+    if (sum1 >= Base) sum1 -= Base;
+    if (sum1 >= Base) sum1 -= Base;
+    if (sum2 >= 2 * Base) sum2 -= 2 * Base;
+    if (sum2 >= Base) sum2 -= Base;
+    return sum1 | (sum2 << 16);
+}
+
+class BitWriter {
+public:
+    explicit BitWriter(vector<BYTE>& out) : out(out), bits(0), count(0) {}
+    void Put(DWORD value, int n) {
+        bits |= (unsigned long long)value << count;
+        count += n;
+        while (count >= 8) {
+            out.push_back((BYTE)bits);
+            bits >>= 8;
+            count -= 8;
+        }
+    }
+    void Align() {
+        if (count)
+            Put(0, 8 - count);
+    }
+
+private:
+    vector<BYTE>& out;
+    unsigned long long bits;
+    int count;
+};
+
+static DWORD Read32(const BYTE* p) {
+    DWORD v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static void PutMatch(BitWriter& w, int length, int distance) {
+    int ls = tables.lengthSymbol[length];
+    w.Put(tables.litCode[257 + ls], tables.litBits[257 + ls]);
+    if (tables.lengthExtra[ls])
+        w.Put(length - tables.lengthBase[ls], tables.lengthExtra[ls]);
+    int v = distance - 1, code, extra = 0;
+    if (v < 4) {
+        code = v;
+    }
+    else {
+        int n = 31;
+        while (!(v >> n))
+            n--;
+        code = 2 * n + ((v >> (n - 1)) & 1);
+        extra = n - 1;
+    }
+    w.Put(tables.distCode[code], 5);
+    if (extra)
+        w.Put(v - ((2 + (code & 1)) << extra), extra);
+}
+
+// One fixed-Huffman block over the whole strip. A strip that is not the
+// last is followed by an empty stored block so the next starts on a byte.
+static void Deflate(const BYTE* data, size_t n, bool last, vector<int>& head, vector<BYTE>& out) {
+    BitWriter w(out);
+    w.Put(last ? 1 : 0, 1);
+    w.Put(1, 2);
+    fill(head.begin(), head.end(), -1);
+    size_t i = 0;
+    while (i + MinMatch <= n) {
+        DWORD v = Read32(data + i);
+        DWORD h = (v * 2654435761u) >> (32 - HashBits);
+        int candidate = head[h];
+        head[h] = (int)i;
+        if (candidate >= 0 && i - candidate <= WindowSize && Read32(data + candidate) == v) {
+            size_t limit = min((size_t)MaxMatch, n - i), len = MinMatch;
+            while (len < limit && data[candidate + len] == data[i + len])
+                len++;
+            PutMatch(w, (int)len, (int)(i - candidate));
+            // Only the end of a match is hashed; its tail is what the next
+            // bytes are most likely to repeat.
+            for (size_t k = max(i + 1, i + len - 3); k < i + len && k + MinMatch <= n; k++)
+                head[(Read32(data + k) * 2654435761u) >> (32 - HashBits)] = (int)k;
+            i += len;
+        }
+        else {
+            w.Put(tables.litCode[data[i]], tables.litBits[data[i]]);
+            i++;
+        }
+    }
+    for (; i < n; i++)
+        w.Put(tables.litCode[data[i]], tables.litBits[data[i]]);
+    w.Put(tables.litCode[256], tables.litBits[256]);
+    if (!last) {
+        w.Put(0, 3);
+        w.Align();
+        static const BYTE empty[4] = { 0, 0, 0xFF, 0xFF };
+        out.insert(out.end(), empty, empty + 4);
+    }
+    else {
+        w.Align();
+    }
+}
+
+// Picks, per row, whichever of the None, Sub and Up filters gives the
+// smallest sum of absolute values.
+static void FilterRow(const Surface& src, int y, BYTE* out, vector<BYTE>& rgb, vector<BYTE>& above) {
+    int n = src.width * 3;
+    const BYTE* in = src.Row(y);
+    for (int x = 0; x < src.width; x++) {
+        rgb[x * 3] = in[x * 4 + 2];
+        rgb[x * 3 + 1] = in[x * 4 + 1];
+        rgb[x * 3 + 2] = in[x * 4];
+    }
+    if (y > 0) {
+        const BYTE* prev = src.Row(y - 1);
+        for (int x = 0; x < src.width; x++) {
+            above[x * 3] = prev[x * 4 + 2];
+            above[x * 3 + 1] = prev[x * 4 + 1];
+            above[x * 3 + 2] = prev[x * 4];
+        }
+    }
+    else {
+        fill(above.begin(), above.end(), (BYTE)0);
+    }
+    long long none = 0, sub = 0, up = 0;
+    for (int i = 0; i < n; i++) {
+        none += rgb[i] < 128 ? rgb[i] : 256 - rgb[i];
+        BYTE s = (BYTE)(rgb[i] - (i >= 3 ? rgb[i - 3] : 0));
+        BYTE u = (BYTE)(rgb[i] - above[i]);
+        sub += s < 128 ? s : 256 - s;
+        up += u < 128 ? u : 256 - u;
+    }
+    if (up <= sub && up <= none) {
+        out[0] = 2;
+        for (int i = 0; i < n; i++)
+            out[1 + i] = (BYTE)(rgb[i] - above[i]);
+    }
+    else if (sub <= none) {
+        out[0] = 1;
+        for (int i = 0; i < n; i++)
+            out[1 + i] = (BYTE)(rgb[i] - (i >= 3 ? rgb[i - 3] : 0));
+    }
+    else {
+        out[0] = 0;
+        memcpy(out + 1, rgb.data(), n);
+    }
+}
+
+struct Strip {
+    vector<BYTE> data;
+    DWORD adler;
+    size_t rawSize;
+    bool done;
+};
+
+static void PutBE(BYTE* p, DWORD v) {
+    p[0] = (BYTE)(v >> 24);
+    p[1] = (BYTE)(v >> 16);
+    p[2] = (BYTE)(v >> 8);
+    p[3] = (BYTE)v;
+}
+
+static bool WriteChunk(const ByteSink& sink, const char* type, const BYTE* data, size_t n) {
+    BYTE head[8];
+    PutBE(head, (DWORD)n);
+    memcpy(head + 4, type, 4);
+    DWORD crc = Crc(Crc(0, head + 4, 4), data, n);
+    BYTE tail[4];
+    PutBE(tail, crc);
+    return sink(head, 8) && (n == 0 || sink(data, n)) && sink(tail, 4);
+}
+
+bool WritePng(const Surface& src, const ByteSink& sink, int threads) {
+    if (!src.IsValid() || src.width <= 0 || src.height <= 0)
+        return false;
+    static const BYTE signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    BYTE header[13];
+    PutBE(header, src.width);
+    PutBE(header + 4, src.height);
+    header[8] = 8;
+    header[9] = 2;
+    header[10] = header[11] = header[12] = 0;
+    if (!sink(signature, 8) || !WriteChunk(sink, "IHDR", header, 13))
+        return false;
+
+    size_t rowBytes = (size_t)src.width * 3 + 1;
+    int rowsPerStrip = (int)max((size_t)1, StripBytes / rowBytes);
+    int stripCount = (src.height + rowsPerStrip - 1) / rowsPerStrip;
+    if (threads <= 0)
+        threads = (int)thread::hardware_concurrency();
+    threads = max(1, min(threads, stripCount));
+    int window = 2 * threads;
+
+    vector<Strip> strips(stripCount);
+    mutex lock;
+    condition_variable ready, room;
+    atomic<int> next(0);
+    int written = 0;
+    atomic<bool> failed(false);
+
+    auto work = [&] {
+        vector<BYTE> raw, rgb(src.width * 3), above(src.width * 3);
+        vector<int> head(1 << HashBits);
+        for (;;) {
+            int s = next++;
+            if (s >= stripCount)
+                return;
+            {
+                unique_lock<mutex> guard(lock);
+                room.wait(guard, [&] { return s < written + window || failed; });
+                if (failed)
+                    return;
+            }
+            int y0 = s * rowsPerStrip, y1 = min(src.height, y0 + rowsPerStrip);
+            raw.resize((y1 - y0) * rowBytes);
+            for (int y = y0; y < y1; y++)
+                FilterRow(src, y, &raw[(y - y0) * rowBytes], rgb, above);
+            Strip& strip = strips[s];
+            strip.data.reserve(raw.size() / 8 + 64);
+            Deflate(raw.data(), raw.size(), s == stripCount - 1, head, strip.data);
+            strip.adler = Adler(raw.data(), raw.size());
+            strip.rawSize = raw.size();
+            {
+                lock_guard<mutex> guard(lock);
+                strip.done = true;
+            }
+            ready.notify_all();
+        }
+    };
+    vector<thread> workers;
+    for (int i = 0; i < threads; i++)
+        workers.emplace_back(work);
+
+    // This thread writes strips in order as they finish.
+    static const BYTE zlibHeader[2] = { 0x78, 0x01 };
+    bool ok = true;
+    DWORD adler = 1;
+    for (int s = 0; s < stripCount && ok; s++) {
+        {
+            unique_lock<mutex> guard(lock);
+            ready.wait(guard, [&] { return strips[s].done; });
+        }
+        Strip& strip = strips[s];
+        if (s == 0)
+            strip.data.insert(strip.data.begin(), zlibHeader, zlibHeader + 2);
+        ok = WriteChunk(sink, "IDAT", strip.data.data(), strip.data.size());
+        adler = AdlerCombine(adler, strip.adler, strip.rawSize);
+        vector<BYTE>().swap(strip.data);
+        {
+            lock_guard<mutex> guard(lock);
+            written = s + 1;
+            if (!ok)
+                failed = true;
+        }
+        room.notify_all();
+    }
+    for (thread& t : workers)
+        t.join();
+    if (!ok)
+        return false;
+    BYTE trailer[4];
+    PutBE(trailer, adler);
+    return WriteChunk(sink, "IDAT", trailer, 4) && WriteChunk(sink, "IEND", NULL, 0);
+}
@@ -0,0 +1,26 @@
+#ifndef PNGWRITER_H
+#define PNGWRITER_H
+
+#include <windows.h>
+#include <functional>
+#include "Surface.h"
+
+// Receives encoded bytes in file order; returning false aborts the export.
+typedef std::function<bool(const void* data, size_t size)> ByteSink;
+
+// Writes the BGRA surface as a 24-bit RGB PNG. Rows are cut into strips of
+// about 256 KB that worker threads filter and deflate independently; each
+// strip ends on a byte boundary with an empty stored block, so the strips
+// concatenate into one zlib stream and each becomes an IDAT chunk as soon as
+// it and the strips before it are done. At most two strips per thread are
+// held in memory at once. threads <= 0 uses every core.
+//
+// Deflate uses greedy LZ77 matching and the fixed Huffman codes, which is
+// fast and compresses the long flat runs of drawings well. It is not meant
+// to match zlib on photographs.
+bool WritePng(const Surface& src, const ByteSink& sink, int threads = 0);
+
+// The CRC-32 PNG chunks use, continued from crc (0 to start).
+DWORD Crc32(DWORD crc, const void* data, size_t size);
+
+#endif
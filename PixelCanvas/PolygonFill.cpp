@@ -1,14 +1,20 @@
 #include "PolygonFill.h"
 #include <cmath>
 #include <vector>
-
-extern bool clipWindowSet;
-extern int clipMinX, clipMaxX, clipMinY, clipMaxY;
+#include "ClipRegion.h"
+#include "RenderContext.h"
+#include "Gradient.h"
 
 int Round(double x) { return (int)(x + 0.5); }
 
-void DrawLineDDA(HDC hdc, int x1, int y1, int x2, int y2, COLORREF c)
+void DrawLineDDA(RenderContext& ctx, int x1, int y1, int x2, int y2, COLORREF c)
 {
+    if (!ClipLine(ctx.canvas->clipWindow, x1, y1, x2, y2))
+        return;
+    ClipResult r = ClassifyClip(ctx, min(x1, x2), min(y1, y2), max(x1, x2), max(y1, y2));
+    if (r == CLIP_OUTSIDE)
+        return;
+    MarkDrawn(ctx, min(x1, x2), min(y1, y2), max(x1, x2), max(y1, y2));
     int dx = x2 - x1;
     int dy = y2 - y1;
     int steps;
@@ -20,45 +26,93 @@ void DrawLineDDA(HDC hdc, int x1, int y1, int x2, int y2, COLORREF c)
         y_increment = (double)dy / steps,
         x = x1,
         y = y1;
-    int xi = Round(x);
-    int yi = Round(y);
-    if (!clipWindowSet || (xi >= clipMinX && xi <= clipMaxX && yi >= clipMinY && yi <= clipMaxY))
-        SetPixel(hdc, xi, yi, c);
-    for (int i = 0; i < steps; i++) {
-        x += x_increment;
-        y += y_increment;
-        xi = Round(x);
-        yi = Round(y);
-        if (!clipWindowSet || (xi >= clipMinX && xi <= clipMaxX && yi >= clipMinY && yi <= clipMaxY))
-            SetPixel(hdc, xi, yi, c);
+    WithTarget(ctx, [&](auto& target) {
+        auto plot = MakePlotter(ctx, target, c, r != CLIP_INSIDE);
+        plot(Round(x), Round(y));
+        for (int i = 0; i < steps; i++) {
+            x += x_increment;
+            y += y_increment;
+            plot(Round(x), Round(y));
+        }
+    });
+}
+
+void FillSpan(RenderContext& ctx, int y, int x0, int x1, COLORREF c)
+{
+    const ClipRect& window = ctx.ClipWindow();
+    if (window.enabled) {
+        if (y < window.minY || y > window.maxY)
+            return;
+        x0 = max(x0, window.minX);
+        x1 = min(x1, window.maxX);
     }
+    WithTarget(ctx, [&](auto& target) {
+        if (y < 0 || y >= target.Height())
+            return;
+        x0 = max(x0, 0);
+        x1 = min(x1, target.Width() - 1);
+        if (x0 > x1)
+            return;
+        auto value = target.Convert(c);
+        ctx.canvas->clipRegion.ClipSpan(y, x0, x1, [&](int row, int from, int to) {
+            ctx.canvas->dirty.Mark(from, row, to, row);
+            target.Fill(row, from, to, value);
+        });
+    });
 }
 
-struct EdgeNode {
-    double x;
-    double dx;
-    int ymax;
-    EdgeNode* next;
-    EdgeNode(double x = 0, double dx = 0, int ymax = 0)
-        : x(x), dx(dx), ymax(ymax), next(nullptr) {}
+// Spans are computed for the polygon moved to an integer origin at its left
+// edge and shifted back on output, so edge positions keep their fractional
+// precision far from (0, 0).
+class OffsetSpanSink : public SpanSink {
+public:
+    OffsetSpanSink(SpanSink& sink, int dx) : sink(sink), dx(dx) {}
+    void AddSpan(int y, int x0, int x1) override { sink.AddSpan(y, x0 + dx, x1 + dx); }
+
+private:
+    SpanSink& sink;
+    int dx;
 };
 
-EdgeNode* edgeTable[800];
+static int shiftToOrigin(const point p[], int n, std::vector<point>& out) {
+    double minX = p[0].x;
+    for (int i = 1; i < n; i++)
+        minX = min(minX, p[i].x);
+    int origin = (int)floor(minX);
+    out.resize(n);
+    for (int i = 0; i < n; i++)
+        out[i] = point(p[i].x - origin, p[i].y);
+    return origin;
+}
+
+// Edge tables hold one bucket per scanline the polygon covers, starting at
+// row `top`, so their size follows the polygon rather than the canvas.
+static bool polygonRows(const point p[], int n, int& top, int& rows) {
+    double minY = p[0].y, maxY = p[0].y;
+    for (int i = 1; i < n; i++) {
+        minY = min(minY, p[i].y);
+        maxY = max(maxY, p[i].y);
+    }
+    top = (int)max(ceil(minY), 0.0);
+    rows = (int)ceil(maxY) - top;
+    return rows > 0;
+}
 
-void initEdgeTable(EdgeNode* tbl[]) {
-    for (int i = 0; i < 800; i++) {
+void initEdgeTable(EdgeNode* tbl[], int rows) {
+    for (int i = 0; i < rows; i++) {
         tbl[i] = nullptr;
     }
 }
 
-void insertEdgeToTable(EdgeNode* tbl[], int ymin, double x, double dx, int ymax) {
-    EdgeNode* newNode = new EdgeNode(x, dx, ymax);
-    if (tbl[ymin] == nullptr || tbl[ymin]->x > x) {
-        newNode->next = tbl[ymin];
-        tbl[ymin] = newNode;
+void insertEdgeToTable(EdgeNode* tbl[], std::vector<EdgeNode>& nodes, int row, double x, double dx, int ymax) {
+    nodes.push_back(EdgeNode(x, dx, ymax));
+    EdgeNode* newNode = &nodes.back();
+    if (tbl[row] == nullptr || tbl[row]->x > x) {
+        newNode->next = tbl[row];
+        tbl[row] = newNode;
     }
     else {
-        EdgeNode* current = tbl[ymin];
+        EdgeNode* current = tbl[row];
         while (current->next != nullptr && current->next->x < x) {
             current = current->next;
         }
@@ -67,31 +121,32 @@ void insertEdgeToTable(EdgeNode* tbl[], int ymin, double x, double dx, int ymax)
     }
 }
 
-void processEdgeToTable(EdgeNode* tbl[], point v1, point v2) {
+void processEdgeToTable(EdgeNode* tbl[], std::vector<EdgeNode>& nodes, int top, int rows, point v1, point v2) {
     if (v1.y == v2.y)
         return;
     if (v1.y > v2.y)
         std::swap(v1, v2);
-    int ymin = (int)ceil(v1.y);
-    int ymax = (int)floor(v2.y);
-    if (ymin >= ymax)
+    int ymin = max((int)ceil(v1.y), top);
+    int ymax = (int)ceil(v2.y);
+    if (ymin >= ymax || ymin - top >= rows)
         return;
     double dx = (v2.x - v1.x) / (v2.y - v1.y);
     double x = v1.x + dx * (ymin - v1.y);
-    insertEdgeToTable(tbl, ymin, x, dx, ymax);
+    insertEdgeToTable(tbl, nodes, ymin - top, x, dx, ymax);
 }
 
-void buildPolygonEdgeTable(EdgeNode* tbl[], point p[], int n) {
+void buildPolygonEdgeTable(EdgeNode* tbl[], std::vector<EdgeNode>& nodes, int top, int rows, const point p[], int n) {
     point v1 = p[n - 1];
     for (int i = 0; i < n; i++) {
         point v2 = p[i];
-        processEdgeToTable(tbl, v1, v2);
+        processEdgeToTable(tbl, nodes, top, rows, v1, v2);
         v1 = p[i];
     }
 }
 
-void addEdgeToActiveList(EdgeNode*& aet, EdgeNode* edge) {
-    EdgeNode* newNode = new EdgeNode(edge->x, edge->dx, edge->ymax);
+void addEdgeToActiveList(EdgeNode*& aet, std::vector<EdgeNode>& nodes, EdgeNode* edge) {
+    nodes.push_back(EdgeNode(edge->x, edge->dx, edge->ymax));
+    EdgeNode* newNode = &nodes.back();
     if (aet == nullptr || aet->x > newNode->x) {
         newNode->next = aet;
         aet = newNode;
@@ -113,12 +168,10 @@ void updateAndRemoveActiveEdges(EdgeNode*& aet, int scanline) {
         if (current->ymax <= scanline) {
             if (prev == nullptr) {
                 aet = current->next;
-                delete current;
                 current = aet;
             }
             else {
                 prev->next = current->next;
-                delete current;
                 current = prev->next;
             }
         }
@@ -160,199 +213,425 @@ void sortActiveEdgesByX(EdgeNode*& aet) {
     } while (swapped);
 }
 
-void drawScanlinePairs(HDC hdc, EdgeNode* aet, int y, COLORREF c) {
+void emitScanlinePairs(EdgeNode* aet, int y, SpanSink& sink) {
     EdgeNode* current = aet;
     while (current != nullptr && current->next != nullptr) {
         int x1 = (int)ceil(current->x);
         int x2 = (int)floor(current->next->x);
         if (x1 <= x2) {
-            DrawLineDDA(hdc, x1, (int)y, x2, (int)y, c);
+            sink.AddSpan(y, x1, x2);
         }
         current = current->next->next;
     }
 }
 
-void renderPolygonFromTable(HDC hdc, EdgeNode* tbl[], COLORREF c) {
+void renderPolygonFromTable(EdgeNode* tbl[], std::vector<EdgeNode>& nodes, int top, int rows, SpanSink& sink) {
     EdgeNode* aet = nullptr;
-    for (int y = 0; y < 800; y++) {
-        EdgeNode* current = tbl[y];
+    for (int y = top; y - top < rows; y++) {
+        EdgeNode* current = tbl[y - top];
         while (current != nullptr) {
-            addEdgeToActiveList(aet, current);
+            addEdgeToActiveList(aet, nodes, current);
             current = current->next;
         }
         if (aet != nullptr) {
-            drawScanlinePairs(hdc, aet, y, c);
+            emitScanlinePairs(aet, y, sink);
         }
         updateAndRemoveActiveEdges(aet, y + 1);
         sortActiveEdgesByX(aet);
     }
 }
 
-void cleanupEdgeTable(EdgeNode* tbl[]) {
-    for (int i = 0; i < 800; i++) {
-        EdgeNode* current = tbl[i];
-        while (current != nullptr) {
-            EdgeNode* temp = current;
-            current = current->next;
-            delete temp;
-        }
-        tbl[i] = nullptr;
+static bool insideClipEdge(const ClipRect& clip, const point& p, int edge) {
+    switch (edge) {
+        case 0: return p.x >= clip.minX;
+        case 1: return p.x <= clip.maxX;
+        case 2: return p.y >= clip.minY;
+        case 3: return p.y <= clip.maxY;
     }
+    return false;
 }
 
-std::vector<point> ClipPolygonToRect(const point* poly, int n) {
-    std::vector<point> input(poly, poly + n);
-    std::vector<point> output;
-    if (!clipWindowSet) return input;
-    struct Edge { int x1, y1, x2, y2; };
-    Edge edges[4] = {
-        {clipMinX, clipMinY, clipMinX, clipMaxY}, 
-        {clipMaxX, clipMinY, clipMaxX, clipMaxY}, 
-        {clipMinX, clipMinY, clipMaxX, clipMinY}, 
-        {clipMinX, clipMaxY, clipMaxX, clipMaxY}  
-    };
-    auto inside = [](const point& p, int edge) {
-        switch (edge) {
-            case 0: return p.x >= clipMinX;
-            case 1: return p.x <= clipMaxX;
-            case 2: return p.y >= clipMinY;
-            case 3: return p.y <= clipMaxY;
-        }
-        return false;
-    };
-    auto intersect = [](const point& p1, const point& p2, int edge) -> point {
-        double x = 0, y = 0;
-        double dx = p2.x - p1.x, dy = p2.y - p1.y;
-        switch (edge) {
-            case 0: 
-                x = clipMinX;
-                y = p1.y + dy * (clipMinX - p1.x) / dx;
-                break;
-            case 1: 
-                x = clipMaxX;
-                y = p1.y + dy * (clipMaxX - p1.x) / dx;
-                break;
-            case 2: 
-                y = clipMinY;
-                x = p1.x + dx * (clipMinY - p1.y) / dy;
-                break;
-            case 3: 
-                y = clipMaxY;
-                x = p1.x + dx * (clipMaxY - p1.y) / dy;
-                break;
-        }
-        return point(x, y);
-    };
-    for (int e = 0; e < 4; ++e) {
-        output.clear();
-        if (input.empty()) break;
-        point p1 = input.back();
-        for (const auto& p2 : input) {
-            bool p1_inside = inside(p1, e);
-            bool p2_inside = inside(p2, e);
+static point intersectClipEdge(const ClipRect& clip, const point& p1, const point& p2, int edge) {
+    double dx = p2.x - p1.x, dy = p2.y - p1.y;
+    switch (edge) {
+        case 0: return point(clip.minX, p1.y + dy * (clip.minX - p1.x) / dx);
+        case 1: return point(clip.maxX, p1.y + dy * (clip.maxX - p1.x) / dx);
+        case 2: return point(p1.x + dx * (clip.minY - p1.y) / dy, clip.minY);
+        case 3: return point(p1.x + dx * (clip.maxY - p1.y) / dy, clip.maxY);
+    }
+    return p1;
+}
+
+// Sutherland-Hodgman against the clip rectangle. Polygons whose bounding box is
+// entirely inside are returned as-is and ones entirely outside yield no vertices;
+// otherwise the four passes ping-pong between the scratch buffers, which keep
+// their capacity between calls.
+const point* ClipPolygonToRect(const ClipRect& clip, const point* poly, int n, PolygonScratch& scratch, int& outCount) {
+    outCount = n;
+    if (!clip.enabled || n == 0) return poly;
+    double minX = poly[0].x, maxX = poly[0].x, minY = poly[0].y, maxY = poly[0].y;
+    for (int i = 1; i < n; ++i) {
+        minX = min(minX, poly[i].x);
+        maxX = max(maxX, poly[i].x);
+        minY = min(minY, poly[i].y);
+        maxY = max(maxY, poly[i].y);
+    }
+    if (minX >= clip.minX && maxX <= clip.maxX && minY >= clip.minY && maxY <= clip.maxY) return poly;
+    outCount = 0;
+    if (maxX < clip.minX || minX > clip.maxX || maxY < clip.minY || minY > clip.maxY) return poly;
+
+    const point* input = poly;
+    int inputCount = n;
+    std::vector<point>* output = &scratch.a;
+    for (int e = 0; e < 4 && inputCount > 0; ++e) {
+        output->clear();
+        point p1 = input[inputCount - 1];
+        for (int i = 0; i < inputCount; ++i) {
+            const point& p2 = input[i];
+            bool p1_inside = insideClipEdge(clip, p1, e);
+            bool p2_inside = insideClipEdge(clip, p2, e);
             if (p1_inside && p2_inside) {
-                output.push_back(p2);
+                output->push_back(p2);
             }
             else if (p1_inside && !p2_inside) {
-                output.push_back(intersect(p1, p2, e));
+                output->push_back(intersectClipEdge(clip, p1, p2, e));
             }
             else if (!p1_inside && p2_inside) {
-                output.push_back(intersect(p1, p2, e));
-                output.push_back(p2);
+                output->push_back(intersectClipEdge(clip, p1, p2, e));
+                output->push_back(p2);
             }
             p1 = p2;
         }
-        input = output;
+        input = output->data();
+        inputCount = (int)output->size();
+        output = (output == &scratch.a) ? &scratch.b : &scratch.a;
     }
-    return output;
+    outCount = inputCount;
+    return input;
 }
 
-void fillGeneralPolygon(HDC hdc, point p[], int n, COLORREF c) {
-    std::vector<point> clippedPoly = ClipPolygonToRect(p, n);
-    if (clippedPoly.size() < 3) return;
-    initEdgeTable(edgeTable);
-    buildPolygonEdgeTable(edgeTable, clippedPoly.data(), clippedPoly.size());
-    renderPolygonFromTable(hdc, edgeTable, c);
-    cleanupEdgeTable(edgeTable);
+// Every edge enters the table once and the active list once, so 2n nodes
+// are enough.
+static void generalPolygonSpans(const point p[], int n, PolygonScratch& scratch, SpanSink& sink) {
+    int top, rows;
+    if (!polygonRows(p, n, top, rows))
+        return;
+    OffsetSpanSink out(sink, shiftToOrigin(p, n, scratch.shifted));
+    std::vector<EdgeNode*>& edgeTable = scratch.edgeTable;
+    edgeTable.resize(rows);
+    initEdgeTable(edgeTable.data(), rows);
+    scratch.nodes.clear();
+    scratch.nodes.reserve(2 * n);
+    buildPolygonEdgeTable(edgeTable.data(), scratch.nodes, top, rows, scratch.shifted.data(), n);
+    renderPolygonFromTable(edgeTable.data(), scratch.nodes, top, rows, out);
 }
 
-struct EdgeTableEntry {
-    int left, right;
-};
-
-void init(EdgeTableEntry tbl[800]) {
-    for (int i = 0; i < 800; i++) {
+void init(EdgeTableEntry tbl[], int rows) {
+    for (int i = 0; i < rows; i++) {
         tbl[i].left = INT_MAX;
         tbl[i].right = INT_MIN;
     }
 }
-void edge2table(EdgeTableEntry tbl[800], point v1, point v2){
+void edge2table(EdgeTableEntry tbl[], int top, int rows, point v1, point v2){
     if (v1.y == v2.y)
         return;
     if (v1.y > v2.y)
         std::swap(v1, v2);
-    int ymin = (int)ceil(v1.y);
-    int ymax = (int)floor(v2.y);
+    int ymin = max((int)ceil(v1.y), top);
+    int ymax = min((int)ceil(v2.y), top + rows);
     if (ymin >= ymax)
         return;
     double dx = (v2.x - v1.x) / (v2.y - v1.y);
     double x = v1.x + dx * (ymin - v1.y);
-    for (int y = ymin; y < ymax; y++)
+    for (int y = ymin - top; y < ymax - top; y++)
     {
         if (x < tbl[y].left) tbl[y].left = (int)ceil(x);
         if (x > tbl[y].right) tbl[y].right = (int)floor(x);
         x += dx;
     }
 }
-void polygon2table(EdgeTableEntry tbl[800], point p[], int n) {
+void polygon2table(EdgeTableEntry tbl[], int top, int rows, const point p[], int n) {
     point v1 = p[n - 1];
     for (int i = 0; i < n; i++) {
         point v2 = p[i];
-        edge2table(tbl, v1, v2);
+        edge2table(tbl, top, rows, v1, v2);
         v1 = p[i];
     }
 }
-void table2screen(HDC hdc, EdgeTableEntry tbl[800], COLORREF c) {
-    for (int y = 0; y < 800; y++) {
+void table2spans(EdgeTableEntry tbl[], int top, int rows, SpanSink& sink) {
+    for (int y = 0; y < rows; y++) {
         if (tbl[y].left < tbl[y].right)
-            DrawLineDDA(hdc, tbl[y].left, y, tbl[y].right, y, c);
+            sink.AddSpan(top + y, tbl[y].left, tbl[y].right);
     }
 }
-void convexfill(HDC hdc, point p[], int n, COLORREF c) {
-    std::vector<point> clippedPoly = ClipPolygonToRect(p, n);
-    if (clippedPoly.size() < 3) return;
-    EdgeTableEntry tbl[800];
-    init(tbl);
-    polygon2table(tbl, clippedPoly.data(), clippedPoly.size());
-    table2screen(hdc, tbl, c);
+static void convexPolygonSpans(const point p[], int n, PolygonScratch& scratch, SpanSink& sink) {
+    int top, rows;
+    if (!polygonRows(p, n, top, rows))
+        return;
+    OffsetSpanSink out(sink, shiftToOrigin(p, n, scratch.shifted));
+    std::vector<EdgeTableEntry>& tbl = scratch.rows;
+    tbl.resize(rows);
+    init(tbl.data(), rows);
+    polygon2table(tbl.data(), top, rows, scratch.shifted.data(), n);
+    table2spans(tbl.data(), top, rows, out);
 }
 
-void myFloodFill(HDC hdc, int x, int y, COLORREF bc, COLORREF fc)
-{
-    COLORREF c = GetPixel(hdc, x, y);
-    if (c == bc || c == fc)
+void polygonToSpans(const point p[], int n, bool convex, PolygonScratch& scratch, SpanSink& sink) {
+    if (n < 3) return;
+    if (convex)
+        convexPolygonSpans(p, n, scratch, sink);
+    else
+        generalPolygonSpans(p, n, scratch, sink);
+}
+
+struct WindingEdge {
+    double ytop, ybottom;
+    double x0, dxdy;
+    int dir;
+};
+
+struct WindingCrossing {
+    double x;
+    int dir;
+    bool operator<(const WindingCrossing& o) const { return x < o.x; }
+};
+
+// Nonzero-winding scanline fill of several contours at once. Rows sample pixel
+// centres against half-open edges, so shapes that overlap or abut are emitted
+// as a single span per covered run and no pixel is produced twice.
+void contoursToSpans(const point p[], const int counts[], int contours, SpanSink& sink) {
+    int total = 0;
+    for (int k = 0; k < contours; k++)
+        total += counts[k];
+    if (total == 0)
+        return;
+    std::vector<point> shifted;
+    OffsetSpanSink out(sink, shiftToOrigin(p, total, shifted));
+    p = shifted.data();
+    std::vector<WindingEdge> edges;
+    int first = 0;
+    for (int k = 0; k < contours; first += counts[k], k++) {
+        for (int i = 0; i < counts[k]; i++) {
+            point v1 = p[first + (i + counts[k] - 1) % counts[k]], v2 = p[first + i];
+            if (v1.y == v2.y)
+                continue;
+            int dir = 1;
+            if (v1.y > v2.y) {
+                std::swap(v1, v2);
+                dir = -1;
+            }
+            edges.push_back(WindingEdge{ v1.y, v2.y, v1.x, (v2.x - v1.x) / (v2.y - v1.y), dir });
+        }
+    }
+    if (edges.empty())
         return;
-    SetPixel(hdc, x, y, fc);
-    myFloodFill(hdc, x + 1, y, bc, fc);
-    myFloodFill(hdc, x - 1, y, bc, fc);
-    myFloodFill(hdc, x, y + 1, bc, fc);
-    myFloodFill(hdc, x, y - 1, bc, fc);
+    std::sort(edges.begin(), edges.end(), [](const WindingEdge& a, const WindingEdge& b) { return a.ytop < b.ytop; });
+    double bottom = edges[0].ybottom;
+    for (const WindingEdge& e : edges)
+        bottom = max(bottom, e.ybottom);
+
+    std::vector<const WindingEdge*> active;
+    std::vector<WindingCrossing> crossings;
+    size_t next = 0;
+    for (int y = (int)ceil(edges[0].ytop); y < bottom; y++) {
+        while (next < edges.size() && edges[next].ytop <= y)
+            active.push_back(&edges[next++]);
+        crossings.clear();
+        size_t kept = 0;
+        for (size_t i = 0; i < active.size(); i++) {
+            const WindingEdge* e = active[i];
+            if (e->ybottom <= y)
+                continue;
+            active[kept++] = e;
+            crossings.push_back(WindingCrossing{ e->x0 + (y - e->ytop) * e->dxdy, e->dir });
+        }
+        active.resize(kept);
+        std::sort(crossings.begin(), crossings.end());
+        // Pieces that merely touch leave a zero-width gap in the winding; runs
+        // are merged across it so the sink sees one span.
+        int winding = 0;
+        double start = 0;
+        int runStart = 0, runEnd = INT_MIN;
+        for (const WindingCrossing& c : crossings) {
+            int before = winding;
+            winding += c.dir;
+            if (before == 0 && winding != 0) {
+                start = c.x;
+            }
+            else if (before != 0 && winding == 0) {
+                int x0 = (int)ceil(start), x1 = (int)ceil(c.x) - 1;
+                if (x0 > x1)
+                    continue;
+                if (runEnd != INT_MIN && x0 <= runEnd + 1) {
+                    runEnd = max(runEnd, x1);
+                    continue;
+                }
+                if (runEnd != INT_MIN)
+                    sink.AddSpan(y, runStart, runEnd);
+                runStart = x0;
+                runEnd = x1;
+            }
+        }
+        if (runEnd != INT_MIN)
+            sink.AddSpan(y, runStart, runEnd);
+    }
 }
 
-void myFloodFillqueue(HDC hdc, int x, int y, COLORREF bc, COLORREF fc)
-{
-    std::queue<point> q;
-    q.push(point(x, y));
-    while (!q.empty()) {
-        point p = q.front();
-        q.pop();
-        COLORREF c = GetPixel(hdc, p.x, p.y);
-        if (c == bc || c == fc)
+struct GouraudEdge {
+    int ymin, ymax;
+    double x, dx;
+    double b, g, r;
+    double db, dg, dr;
+};
+
+struct GouraudCrossing {
+    double x;
+    double b, g, r;
+    bool operator<(const GouraudCrossing& o) const { return x < o.x; }
+};
+
+template <class Target>
+static void gouraudSpan(const RenderContext& ctx, const Target& target, int y, const GouraudCrossing& l, const GouraudCrossing& r) {
+    int x0 = (int)ceil(l.x);
+    int x1 = (int)floor(r.x);
+    if (x0 > x1)
+        return;
+    double w = r.x - l.x;
+    double skip = x0 - l.x;
+    ColorRamp ramp((int)(l.b * 65536.0), (int)(l.g * 65536.0), (int)(l.r * 65536.0),
+                   w > 0 ? (int)((r.b - l.b) * 65536.0 / w) : 0,
+                   w > 0 ? (int)((r.g - l.g) * 65536.0 / w) : 0,
+                   w > 0 ? (int)((r.r - l.r) * 65536.0 / w) : 0);
+    ramp.b += (int)(ramp.db * skip);
+    ramp.g += (int)(ramp.dg * skip);
+    ramp.r += (int)(ramp.dr * skip);
+    const ClipRect& window = ctx.ClipWindow();
+    if (window.enabled) {
+        if (y < window.minY || y > window.maxY)
+            return;
+        x0 = max(x0, window.minX);
+        x1 = min(x1, window.maxX);
+    }
+    if (y < 0 || y >= target.Height())
+        return;
+    x0 = max(x0, 0);
+    x1 = min(x1, target.Width() - 1);
+    int xStart = (int)ceil(l.x);
+    ctx.canvas->clipRegion.ClipSpan(y, x0, x1, [&](int row, int from, int to) {
+        ctx.canvas->dirty.Mark(from, row, to, row);
+        ColorRamp run = ramp;
+        run.Advance(from - xStart);
+        DWORD colors[64];
+        for (int x = from; x <= to;) {
+            int chunk = min(64, to - x + 1);
+            run.Generate(colors, chunk);
+            target.StoreBgra(x, row, colors, chunk);
+            x += chunk;
+        }
+    });
+}
+
+// Scanline fill with colors interpolated along the edges and then across each
+// span in fixed point. Works for triangles and general (even-odd) polygons.
+void fillGouraudPolygon(RenderContext& ctx, point p[], const COLORREF colors[], int n) {
+    if (n < 3)
+        return;
+    std::vector<GouraudEdge> edges;
+    edges.reserve(n);
+    int top = INT_MAX, bottom = INT_MIN;
+    for (int i = 0; i < n; i++) {
+        point v1 = p[(i + n - 1) % n], v2 = p[i];
+        COLORREF c1 = colors[(i + n - 1) % n], c2 = colors[i];
+        if (v1.y == v2.y)
+            continue;
+        if (v1.y > v2.y) {
+            std::swap(v1, v2);
+            std::swap(c1, c2);
+        }
+        GouraudEdge e;
+        e.ymin = (int)ceil(v1.y);
+        e.ymax = (int)floor(v2.y);
+        if (e.ymin >= e.ymax)
             continue;
-        SetPixel(hdc, p.x, p.y, fc);
-        q.push(point(p.x + 1, p.y));
-        q.push(point(p.x - 1, p.y));
-        q.push(point(p.x, p.y + 1));
-        q.push(point(p.x, p.y - 1));
+        double h = v2.y - v1.y, skip = e.ymin - v1.y;
+        e.dx = (v2.x - v1.x) / h;
+        e.db = (GetBValue(c2) - GetBValue(c1)) / h;
+        e.dg = (GetGValue(c2) - GetGValue(c1)) / h;
+        e.dr = (GetRValue(c2) - GetRValue(c1)) / h;
+        e.x = v1.x + e.dx * skip;
+        e.b = GetBValue(c1) + 0.5 + e.db * skip;
+        e.g = GetGValue(c1) + 0.5 + e.dg * skip;
+        e.r = GetRValue(c1) + 0.5 + e.dr * skip;
+        edges.push_back(e);
+        top = min(top, e.ymin);
+        bottom = max(bottom, e.ymax);
     }
+    const ClipRect& window = ctx.ClipWindow();
+    if (window.enabled) {
+        top = max(top, window.minY);
+        bottom = min(bottom, window.maxY + 1);
+    }
+    std::vector<GouraudCrossing> crossings;
+    crossings.reserve(edges.size());
+    WithTarget(ctx, [&](auto& target) {
+        for (int y = top; y < bottom; y++) {
+            crossings.clear();
+            for (const GouraudEdge& e : edges) {
+                if (y < e.ymin || y >= e.ymax)
+                    continue;
+                double t = y - e.ymin;
+                crossings.push_back(GouraudCrossing{ e.x + e.dx * t, e.b + e.db * t, e.g + e.dg * t, e.r + e.dr * t });
+            }
+            std::sort(crossings.begin(), crossings.end());
+            for (size_t i = 0; i + 1 < crossings.size(); i += 2)
+                gouraudSpan(ctx, target, y, crossings[i], crossings[i + 1]);
+        }
+    });
+}
+
+template <class Target>
+static void floodFill(const RenderContext& ctx, const Target& target, int x, int y, COLORREF bc, COLORREF fc, typename Target::Pixel value)
+{
+    if (ctx.Cancelled())
+        return;
+    COLORREF c = target.Get(x, y);
+    if (c == bc || c == fc || c == CLR_INVALID)
+        return;
+    target.Put(x, y, value);
+    ctx.canvas->dirty.Mark(x, y, x, y);
+    floodFill(ctx, target, x + 1, y, bc, fc, value);
+    floodFill(ctx, target, x - 1, y, bc, fc, value);
+    floodFill(ctx, target, x, y + 1, bc, fc, value);
+    floodFill(ctx, target, x, y - 1, bc, fc, value);
+}
+
+void myFloodFill(RenderContext& ctx, int x, int y, COLORREF bc, COLORREF fc)
+{
+    WithTarget(ctx, [&](auto& target) {
+        floodFill(ctx, target, x, y, target.Stored(bc), target.Stored(fc), target.Convert(fc));
+    });
+}
+
+void myFloodFillqueue(RenderContext& ctx, int x, int y, COLORREF bc, COLORREF fc)
+{
+    WithTarget(ctx, [&](auto& target) {
+        auto value = target.Convert(fc);
+        bc = target.Stored(bc);
+        fc = target.Stored(fc);
+        std::queue<point> q;
+        q.push(point(x, y));
+        while (!q.empty() && !ctx.Cancelled()) {
+            point p = q.front();
+            q.pop();
+            COLORREF c = target.Get((int)p.x, (int)p.y);
+            if (c == bc || c == fc || c == CLR_INVALID)
+                continue;
+            target.Put((int)p.x, (int)p.y, value);
+            ctx.canvas->dirty.Mark((int)p.x, (int)p.y, (int)p.x, (int)p.y);
+            q.push(point(p.x + 1, p.y));
+            q.push(point(p.x - 1, p.y));
+            q.push(point(p.x, p.y + 1));
+            q.push(point(p.x, p.y - 1));
+        }
+    });
 }
\ No newline at end of file
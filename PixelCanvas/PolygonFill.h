@@ -3,18 +3,63 @@
 
 #include <windows.h>
 #include <queue>
+#include <vector>
 #include <climits>
 #include <algorithm>
+#include "ClipRegion.h"
 
 struct point {
     double x, y;
     point(double x = 0, double y = 0) : x(x), y(y) {}
 };
 
-void DrawLineDDA(HDC hdc, int x1, int y1, int x2, int y2, COLORREF c);
-void fillGeneralPolygon(HDC hdc, point p[], int n, COLORREF c);
-void convexfill(HDC hdc, point p[], int n, COLORREF c);
-void myFloodFill(HDC hdc, int x, int y, COLORREF bc, COLORREF fc);
-void myFloodFillqueue(HDC hdc, int x, int y, COLORREF bc, COLORREF fc);
+struct EdgeNode {
+    double x;
+    double dx;
+    int ymax;
+    EdgeNode* next;
+    EdgeNode(double x = 0, double dx = 0, int ymax = 0)
+        : x(x), dx(dx), ymax(ymax), next(nullptr) {}
+};
+
+struct EdgeTableEntry {
+    int left, right;
+};
+
+// Buffers for polygon clipping and edge tables, reused across fills. The edge
+// nodes of one fill live in `nodes`, which is reserved up front so the links
+// between them stay valid.
+struct PolygonScratch {
+    std::vector<point> a, b;
+    std::vector<point> shifted;
+    std::vector<EdgeNode*> edgeTable;
+    std::vector<EdgeNode> nodes;
+    std::vector<EdgeTableEntry> rows;
+};
+
+// RenderContext.h includes this header for the scratch buffers.
+class RenderContext;
+
+void DrawLineDDA(RenderContext& ctx, int x1, int y1, int x2, int y2, COLORREF c);
+void FillSpan(RenderContext& ctx, int y, int x0, int x1, COLORREF c);
+
+class FillSpanSink : public SpanSink {
+public:
+    FillSpanSink(RenderContext& ctx, COLORREF c) : ctx(ctx), c(c) {}
+    void AddSpan(int y, int x0, int x1) override { FillSpan(ctx, y, x0, x1, c); }
+
+private:
+    RenderContext& ctx;
+    COLORREF c;
+};
+
+// Clips a polygon to the rectangle, returning poly itself, no vertices or the
+// clipped vertices held in scratch.
+const point* ClipPolygonToRect(const ClipRect& clip, const point* poly, int n, PolygonScratch& scratch, int& outCount);
+void polygonToSpans(const point p[], int n, bool convex, PolygonScratch& scratch, SpanSink& sink);
+void contoursToSpans(const point p[], const int counts[], int contours, SpanSink& sink);
+void fillGouraudPolygon(RenderContext& ctx, point p[], const COLORREF colors[], int n);
+void myFloodFill(RenderContext& ctx, int x, int y, COLORREF bc, COLORREF fc);
+void myFloodFillqueue(RenderContext& ctx, int x, int y, COLORREF bc, COLORREF fc);
 
 #endif 
\ No newline at end of file
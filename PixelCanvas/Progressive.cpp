@@ -0,0 +1,132 @@
+#include "Progressive.h"
+#include <algorithm>
+#include "Circle.h"
+#include "Curve.h"
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+bool ProgressiveOp::Step(const StepBudget& budget) {
+    pixelLimit = budget.pixels > 0 ? drawn + budget.pixels : 0;
+    timed = budget.milliseconds > 0;
+    if (timed)
+        deadline = Clock::now() + chrono::microseconds((long long)(budget.milliseconds * 1000));
+    return Resume();
+}
+
+bool ProgressiveOp::Spent(long long pixels) {
+    drawn += pixels;
+    if (pixelLimit && drawn >= pixelLimit)
+        return true;
+    if (timed && Clock::now() >= deadline)
+        return true;
+    return ctx.Cancelled();
+}
+
+FloodFillOp::FloodFillOp(RenderContext& ctx, int x, int y, COLORREF bc, COLORREF fc)
+    : ProgressiveOp(ctx), bc(bc), fc(fc) {
+    seeds.push_back(POINT{ x, y });
+}
+
+// Each seed fills the whole run it lies in, then pushes one seed per run of
+// open pixels in the rows above and below it.
+bool FloodFillOp::Resume() {
+    WithTarget(ctx, [&](auto& target) {
+        auto value = target.Convert(fc);
+        COLORREF bound = target.Stored(bc), fill = target.Stored(fc);
+        auto open = [&](int x, int y) {
+            COLORREF c = target.Get(x, y);
+            return c != bound && c != fill && c != CLR_INVALID;
+        };
+        while (!seeds.empty()) {
+            POINT p = seeds.back();
+            seeds.pop_back();
+            int y = (int)p.y;
+            if (!open((int)p.x, y))
+                continue;
+            int x0 = (int)p.x, x1 = (int)p.x;
+            while (open(x0 - 1, y))
+                x0--;
+            while (open(x1 + 1, y))
+                x1++;
+            target.Fill(y, x0, x1, value);
+            ctx.canvas->dirty.Mark(x0, y, x1, y);
+            for (int ny = y - 1; ny <= y + 1; ny += 2) {
+                bool inRun = false;
+                for (int x = x0; x <= x1; x++) {
+                    bool o = open(x, ny);
+                    if (o && !inRun)
+                        seeds.push_back(POINT{ x, ny });
+                    inRun = o;
+                }
+            }
+            if (Spent(x1 - x0 + 1))
+                break;
+        }
+    });
+    return !seeds.empty();
+}
+
+HermiteFillOp::HermiteFillOp(RenderContext& ctx, int x1, int y1, int x2, int y2, COLORREF color)
+    : ProgressiveOp(ctx), x(min(x1, x2)), right(max(x1, x2)), top(min(y1, y2)), bottom(max(y1, y2)), color(color) {
+}
+
+bool HermiteFillOp::Resume() {
+    Curve curve(ctx);
+    while (x <= right) {
+        curve.DrawHermite2((double)x, (double)top, (double)x, (double)bottom, 0.0, 1.0, 0.0, -1.0, color);
+        x++;
+        if (Spent(bottom - top + 1))
+            break;
+    }
+    return x <= right;
+}
+
+BezierFillOp::BezierFillOp(RenderContext& ctx, int x1, int y1, int x2, int y2, COLORREF color)
+    : ProgressiveOp(ctx), y(min(y1, y2)), left(min(x1, x2)), right(max(x1, x2)), bottom(max(y1, y2)), color(color) {
+}
+
+bool BezierFillOp::Resume() {
+    Curve curve(ctx);
+    while (y <= bottom) {
+        curve.DrawBezier(left, y, left + (right - left) / 3, y, right - (right - left) / 3, y, right, y, color);
+        y++;
+        if (Spent(right - left + 1))
+            break;
+    }
+    return y <= bottom;
+}
+
+CircleRingsOp::CircleRingsOp(RenderContext& ctx, int xc, int yc, int R, int quarter, unsigned seed)
+    : ProgressiveOp(ctx), xc(xc), yc(yc), R(R), dec(max(R / 100, 1)), quarter(quarter), state(seed) {
+}
+
+int CircleRingsOp::Random() {
+    state = state * 214013 + 2531011;
+    return (state >> 16) & 0x7FFF;
+}
+
+// A ring costs about its circumference; quarter rings a quarter of that.
+bool CircleRingsOp::Resume() {
+    Circle circle(ctx);
+    while (R > 0) {
+        R -= dec;
+        int r = Random() % 256, g = Random() % 256, b = Random() % 256;
+        COLORREF color = RGB(r, g, b);
+        if (quarter)
+            circle.DrawQuarterCircleModifiedMidpoint(xc, yc, R, color, quarter);
+        else
+            circle.DrawCircleModifiedMidpoint(xc, yc, R, color);
+        if (Spent(quarter ? 2 * R + 1 : 6 * R + 1))
+            break;
+    }
+    return R > 0;
+}
+
+void RunProgressive(ProgressiveOp& op, const function<void()>& present) {
+    StepBudget budget = { 2.0, 0 };
+    while (op.Step(budget) && !op.Cancelled()) {
+        present();
+        budget.milliseconds = 16.0;
+    }
+}
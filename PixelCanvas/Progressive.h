@@ -0,0 +1,113 @@
+#ifndef PROGRESSIVE_H
+#define PROGRESSIVE_H
+
+#include <windows.h>
+#include <chrono>
+#include <functional>
+#include <vector>
+#include "RenderContext.h"
+
+// Limits on one Step; zero means no limit of that kind.
+struct StepBudget {
+    double milliseconds;
+    long long pixels;
+};
+
+// An expensive fill that can stop part way and resume where it left off, so
+// a caller can show partial results at a steady rate. Its state lives in the
+// object (span stack, current column, current ring) rather than on the stack.
+// Drawing goes through the op's context like the plain rasterizers, and the
+// budget is checked between spans, columns or rings.
+class ProgressiveOp {
+public:
+    virtual ~ProgressiveOp() {}
+
+    // Draws until the budget is spent, the render job is cancelled or the
+    // fill is done; returns true while there is more to draw.
+    bool Step(const StepBudget& budget);
+    long long PixelsDrawn() const { return drawn; }
+    bool Cancelled() const { return ctx.Cancelled(); }
+
+protected:
+    explicit ProgressiveOp(RenderContext& ctx) : ctx(ctx), drawn(0), pixelLimit(0), timed(false) {}
+    // Draws until Spent says to stop; returns true if work remains.
+    virtual bool Resume() = 0;
+    // Counts pixels just drawn and reports whether the step should end.
+    bool Spent(long long pixels);
+
+    RenderContext& ctx;
+
+private:
+    long long drawn, pixelLimit;
+    bool timed;
+    std::chrono::steady_clock::time_point deadline;
+};
+
+// Scanline flood fill bounded by pixels of color bc or fc. The stack holds
+// seed points of spans still to fill.
+class FloodFillOp : public ProgressiveOp {
+public:
+    FloodFillOp(RenderContext& ctx, int x, int y, COLORREF bc, COLORREF fc);
+    size_t PendingSeeds() const { return seeds.size(); }
+
+protected:
+    bool Resume() override;
+
+private:
+    COLORREF bc, fc;
+    std::vector<POINT> seeds;
+};
+
+// Curve::FillWithHermite one column at a time.
+class HermiteFillOp : public ProgressiveOp {
+public:
+    HermiteFillOp(RenderContext& ctx, int x1, int y1, int x2, int y2, COLORREF color);
+    int Column() const { return x; }
+
+protected:
+    bool Resume() override;
+
+private:
+    int x, right, top, bottom;
+    COLORREF color;
+};
+
+// Curve::FillWithBezier one row at a time.
+class BezierFillOp : public ProgressiveOp {
+public:
+    BezierFillOp(RenderContext& ctx, int x1, int y1, int x2, int y2, COLORREF color);
+    int Row() const { return y; }
+
+protected:
+    bool Resume() override;
+
+private:
+    int y, left, right, bottom;
+    COLORREF color;
+};
+
+// Circle::FillWithCircles (quarter 0) or FillQuarterWithCircles one ring at a
+// time. Ring colors come from the op's own copy of the CRT rand() generator,
+// seeded like srand(seed), since other work can run on the thread between
+// steps.
+class CircleRingsOp : public ProgressiveOp {
+public:
+    CircleRingsOp(RenderContext& ctx, int xc, int yc, int R, int quarter, unsigned seed);
+    int Radius() const { return R; }
+
+protected:
+    bool Resume() override;
+
+private:
+    int Random();
+
+    int xc, yc, R, dec, quarter;
+    unsigned state;
+};
+
+// Runs op to completion in slices of about a frame, calling present after
+// each one. The first slice is kept to a couple of milliseconds so the first
+// pixels show almost at once. Returns early if the render job is cancelled.
+void RunProgressive(ProgressiveOp& op, const std::function<void()>& present);
+
+#endif
@@ -0,0 +1,52 @@
+#include "RenderContext.h"
+
+void RenderContext::SetScissor(const ClipRect* scissor) {
+    scissored = scissor != nullptr;
+    if (scissored)
+        scissorWindow = canvas->clipWindow.Intersect(*scissor);
+}
+
+int RenderContext::Random() {
+    random = random * 214013 + 2531011;
+    return (random >> 16) & 0x7FFF;
+}
+
+ClipResult ClassifyClip(const RenderContext& ctx, int left, int top, int right, int bottom) {
+    const ClipRect& window = ctx.ClipWindow();
+    ClipResult r = window.Classify(left, top, right, bottom);
+    const ClipRegion& region = ctx.canvas->clipRegion;
+    if (r == CLIP_OUTSIDE || !region.enabled) return r;
+    // Only the part of the box inside the window, such as a tile, needs to be
+    // inside the region for its pixels to skip the region test.
+    if (window.enabled) {
+        left = max(left, window.minX);
+        top = max(top, window.minY);
+        right = min(right, window.maxX);
+        bottom = min(bottom, window.maxY);
+    }
+    ClipResult inRegion = region.Classify(left, top, right, bottom);
+    return inRegion == CLIP_INSIDE ? r : inRegion;
+}
+
+bool ClipContains(const RenderContext& ctx, int x, int y) {
+    return ctx.ClipWindow().Contains(x, y) && ctx.canvas->clipRegion.Contains(x, y);
+}
+
+void MarkDrawn(const RenderContext& ctx, int left, int top, int right, int bottom) {
+    const ClipRect& window = ctx.ClipWindow();
+    if (window.enabled) {
+        left = max(left, window.minX);
+        top = max(top, window.minY);
+        right = min(right, window.maxX);
+        bottom = min(bottom, window.maxY);
+    }
+    const ClipRegion& region = ctx.canvas->clipRegion;
+    if (region.enabled) {
+        RECT b = region.Bounds();
+        left = max(left, (int)b.left);
+        top = max(top, (int)b.top);
+        right = min(right, (int)b.right);
+        bottom = min(bottom, (int)b.bottom);
+    }
+    ctx.canvas->dirty.Mark(left, top, right, bottom);
+}
@@ -0,0 +1,95 @@
+#ifndef RENDERCONTEXT_H
+#define RENDERCONTEXT_H
+
+#include <windows.h>
+#include "Clip.h"
+#include "ClipRegion.h"
+#include "Dirty.h"
+#include "RenderQueue.h"
+#include "Stroke.h"
+#include "Target.h"
+
+// The clip window, clip region and dirty tiles of one canvas.
+struct CanvasState {
+    ClipRect clipWindow;
+    ClipRegion clipRegion;
+    DirtyTracker dirty;
+};
+
+// Everything a rasterizer uses besides its arguments: the target it draws
+// into (GDI calls on hdc when there is none), the canvas state it clips
+// against and marks, the queue whose cancellation it polls, buffers reused
+// between primitives and the generator behind FillWithCircles. A context
+// belongs to one thread. Threads drawing the same canvas each have their own
+// over the same CanvasState; threads drawing different canvases share
+// nothing, so they never wait on each other.
+class RenderContext {
+public:
+    explicit RenderContext(HDC hdc = NULL, const RenderTarget* target = nullptr, CanvasState* canvas = nullptr, const RenderQueue* queue = nullptr)
+        : hdc(hdc), target(target), canvas(canvas), queue(queue), scissored(false), random(1) {}
+
+    HDC hdc;
+    const RenderTarget* target;
+    CanvasState* canvas;
+    // Null for work that cannot be cancelled.
+    const RenderQueue* queue;
+    PolygonScratch polygonScratch;
+    StrokeScratch strokeScratch;
+
+    // Narrows the canvas clip window for this context only, e.g. to the tile
+    // a worker is rendering; null restores the plain clip window.
+    void SetScissor(const ClipRect* scissor);
+    // The clip window narrowed by the scissor.
+    const ClipRect& ClipWindow() const { return scissored ? scissorWindow : canvas->clipWindow; }
+    bool Cancelled() const { return queue && queue->Cancelled(); }
+    // The CRT rand() sequence, starting where srand(1) would.
+    int Random();
+
+private:
+    bool scissored;
+    ClipRect scissorWindow;
+    unsigned random;
+};
+
+// Clip window and clip region together; the single test every rasterizer runs
+// on its bounding box before entering its inner loop.
+ClipResult ClassifyClip(const RenderContext& ctx, int left, int top, int right, int bottom);
+bool ClipContains(const RenderContext& ctx, int x, int y);
+// Marks a primitive's bounding box, trimmed to the clip window and region.
+void MarkDrawn(const RenderContext& ctx, int left, int top, int right, int bottom);
+
+// Calls fn with the concrete type of the context's target.
+template <class Fn>
+void WithTarget(const RenderContext& ctx, Fn&& fn) {
+    if (ctx.target) {
+        WithTarget(*ctx.target, fn);
+        return;
+    }
+    GdiTarget gdi(ctx.hdc);
+    fn(gdi);
+}
+
+// Per-pixel store of one color, with the clip test only when the primitive's
+// bounding box straddles the clip.
+template <class Target>
+class Plotter {
+public:
+    Plotter(const RenderContext& ctx, const Target& target, COLORREF c, bool clipPixels)
+        : ctx(ctx), target(target), value(target.Convert(c)), clipPixels(clipPixels) {}
+    void operator()(int x, int y) const {
+        if (!clipPixels || ClipContains(ctx, x, y)) target.Put(x, y, value);
+    }
+
+private:
+    const RenderContext& ctx;
+    const Target& target;
+    typename Target::Pixel value;
+    bool clipPixels;
+};
+
+template <class Target>
+Plotter<Target> MakePlotter(const RenderContext& ctx, const Target& target, COLORREF c, bool clipPixels) {
+    return Plotter<Target>(ctx, target, c, clipPixels);
+}
+
+#endif
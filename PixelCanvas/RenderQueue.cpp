@@ -0,0 +1,83 @@
+#include "RenderQueue.h"
+
+RenderQueue::RenderQueue(int capacity)
+    : ring(capacity), head(0), tail(0), submitted(0), completed(0), running(0), cancelledThrough(0), sleeping(false), quit(false) {
+    thread = std::thread(&RenderQueue::Run, this);
+}
+
+RenderQueue::~RenderQueue() {
+    Stop();
+}
+
+// Slot i % capacity belongs to the producer until tail passes it and to the
+// consumer until head passes it, so each side only ever publishes its own
+// counter.
+RenderQueue::Ticket RenderQueue::Submit(Job job) {
+    Ticket t = tail.load(std::memory_order_relaxed);
+    while (t - head.load(std::memory_order_acquire) == ring.size())
+        std::this_thread::yield();
+    ring[t % ring.size()] = std::move(job);
+    tail.store(t + 1);
+    submitted = t + 1;
+    // Pairs with the consumer raising `sleeping` before it rechecks tail, so
+    // either it sees the job or this sees it asleep.
+    if (sleeping.load()) {
+        std::lock_guard<std::mutex> lock(mutex);
+        wake.notify_one();
+    }
+    return t + 1;
+}
+
+void RenderQueue::Cancel() {
+    cancelledThrough.store(submitted);
+}
+
+bool RenderQueue::Cancelled() const {
+    Ticket t = running.load(std::memory_order_relaxed);
+    return t != 0 && t <= cancelledThrough.load(std::memory_order_relaxed);
+}
+
+void RenderQueue::Wait(Ticket ticket) {
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return completed.load() >= ticket; });
+}
+
+void RenderQueue::Stop() {
+    if (!thread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wake.notify_one();
+    thread.join();
+}
+
+void RenderQueue::Run() {
+    for (;;) {
+        Ticket h = head.load(std::memory_order_relaxed);
+        if (tail.load() == h) {
+            std::unique_lock<std::mutex> lock(mutex);
+            sleeping = true;
+            wake.wait(lock, [&] { return quit || tail.load() != h; });
+            sleeping = false;
+            if (tail.load() == h)
+                return;
+        }
+        Job job = std::move(ring[h % ring.size()]);
+        ring[h % ring.size()] = Job();
+        head.store(h + 1, std::memory_order_release);
+        if (h + 1 > cancelledThrough.load()) {
+            running.store(h + 1);
+            job();
+            running.store(0);
+            if (publish)
+                publish();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            completed = h + 1;
+        }
+        done.notify_all();
+    }
+}
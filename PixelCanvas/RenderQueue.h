@@ -0,0 +1,61 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <windows.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs drawing jobs on a render thread that owns the canvas, so the thread
+// submitting them never waits for a primitive to finish. Jobs pass through a
+// fixed-size lock-free ring with a single producer (only one thread may
+// Submit) and the render thread as its single consumer. The render thread
+// runs them in order, calls the publish hook after each one to hand finished
+// regions back, and sleeps on a condition variable only when the ring is
+// empty.
+//
+// Cancel supersedes everything submitted so far: queued jobs are skipped and
+// the running one sees Cancelled() and stops early, keeping whatever it has
+// drawn.
+class RenderQueue {
+public:
+    typedef std::function<void()> Job;
+    typedef unsigned long long Ticket;
+
+    explicit RenderQueue(int capacity = 256);
+    ~RenderQueue();
+
+    // Set before the first Submit.
+    void SetPublish(Job hook) { publish = hook; }
+    // Waits for room while the ring is full.
+    Ticket Submit(Job job);
+    void Cancel();
+    // True while the running job has been cancelled; long loops in the
+    // rasterizers poll it through their RenderContext.
+    bool Cancelled() const;
+    // Blocks until the job with this ticket and every one before it are done
+    // or skipped. Must not be called from a job.
+    void Wait(Ticket ticket);
+    void Finish() { Wait(submitted); }
+    // Runs what is still queued and joins the render thread.
+    void Stop();
+
+private:
+    void Run();
+
+    std::vector<Job> ring;
+    std::atomic<Ticket> head, tail;
+    Ticket submitted;
+    std::atomic<Ticket> completed;
+    std::atomic<Ticket> running, cancelledThrough;
+    std::atomic<bool> sleeping, quit;
+    Job publish;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    std::thread thread;
+};
+
+#endif
@@ -0,0 +1,362 @@
+#include <winsock2.h>
+#include <afunix.h>
+#include "RenderServer.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include "RenderContext.h"
+#include "Replay.h"
+#include "Script.h"
+#include "TileRenderer.h"
+
+#pragma comment(lib, "ws2_32.lib")
+
+using namespace std;
+using namespace std::chrono;
+
+struct RenderServer::Job {
+    JobRequest request;
+    vector<BYTE> commands;
+    JobReply reply;
+    HANDLE mapping;
+    steady_clock::time_point queued;
+    unsigned long long id;
+    bool finished;
+};
+
+static bool SocketAddress(const char* path, sockaddr_un& address) {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path))
+        return false;
+    strcpy_s(address.sun_path, sizeof(address.sun_path), path);
+    return true;
+}
+
+static bool SendAll(SOCKET s, const void* data, size_t size) {
+    const char* p = (const char*)data;
+    while (size > 0) {
+        int n = send(s, p, (int)min(size, (size_t)1 << 20), 0);
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool ReceiveAll(SOCKET s, void* data, size_t size) {
+    char* p = (char*)data;
+    while (size > 0) {
+        int n = recv(s, p, (int)min(size, (size_t)1 << 20), 0);
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static double Milliseconds(steady_clock::duration d) {
+    return duration<double, milli>(d).count();
+}
+
+RenderServer::RenderServer(int workers)
+    : workerCount(workers > 0 ? workers : max((int)thread::hardware_concurrency(), 1)), listener(INVALID_SOCKET),
+      clients(0), running(false), quit(false), jobs(0), done(0) {}
+
+RenderServer::~RenderServer() {
+    Stop();
+}
+
+bool RenderServer::Start(const char* socketPath, Log logLine) {
+    sockaddr_un address;
+    if (running || !SocketAddress(socketPath, address))
+        return false;
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+        return false;
+    SOCKET s = socket(AF_UNIX, SOCK_STREAM, 0);
+    DeleteFileA(socketPath);
+    if (s == INVALID_SOCKET || bind(s, (const sockaddr*)&address, sizeof(address)) != 0 || listen(s, SOMAXCONN) != 0) {
+        if (s != INVALID_SOCKET)
+            closesocket(s);
+        WSACleanup();
+        return false;
+    }
+    path = socketPath;
+    log = logLine;
+    listener = s;
+    quit = false;
+    running = true;
+    for (int i = 0; i < workerCount; i++)
+        workers.emplace_back(&RenderServer::WorkerLoop, this);
+    acceptor = thread(&RenderServer::AcceptLoop, this);
+    return true;
+}
+
+void RenderServer::Stop() {
+    {
+        lock_guard<std::mutex> lock(mutex);
+        if (!running)
+            return;
+        quit = true;
+    }
+    // accept does not return when another thread closes the socket on every
+    // platform, so wake it with a connection of our own.
+    RenderClient wakeUp;
+    wakeUp.Connect(path.c_str());
+    acceptor.join();
+    wakeUp.Close();
+    closesocket((SOCKET)listener);
+    listener = INVALID_SOCKET;
+    {
+        // Connections blocked waiting for a request drop out; ones waiting
+        // for a job get it once the workers drain the queue.
+        lock_guard<std::mutex> lock(mutex);
+        for (UINT_PTR c : connections)
+            shutdown((SOCKET)c, SD_BOTH);
+    }
+    wake.notify_all();
+    for (thread& t : workers)
+        t.join();
+    workers.clear();
+    unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [this] { return clients == 0; });
+    running = false;
+    lock.unlock();
+    DeleteFileA(path.c_str());
+    WSACleanup();
+}
+
+size_t RenderServer::QueueDepth() const {
+    lock_guard<std::mutex> lock(mutex);
+    return queue.size();
+}
+
+unsigned long long RenderServer::JobsDone() const {
+    lock_guard<std::mutex> lock(mutex);
+    return done;
+}
+
+void RenderServer::AcceptLoop() {
+    for (;;) {
+        SOCKET c = accept((SOCKET)listener, NULL, NULL);
+        lock_guard<std::mutex> lock(mutex);
+        if (quit || c == INVALID_SOCKET) {
+            if (c != INVALID_SOCKET)
+                closesocket(c);
+            return;
+        }
+        connections.insert(c);
+        clients++;
+        thread(&RenderServer::ClientLoop, this, (UINT_PTR)c).detach();
+    }
+}
+
+void RenderServer::ClientLoop(UINT_PTR client) {
+    SOCKET s = (SOCKET)client;
+    HANDLE frame = NULL;
+    JobRequest request;
+    while (ReceiveAll(s, &request, sizeof(request))) {
+        if (frame)
+            CloseHandle(frame);
+        frame = NULL;
+        Job job;
+        job.request = request;
+        memset(&job.reply, 0, sizeof(job.reply));
+        job.reply.magic = JobReplyMagic;
+        job.reply.width = request.width;
+        job.reply.height = request.height;
+        job.mapping = NULL;
+        job.finished = false;
+        // A request that cannot be trusted leaves the stream out of step, so
+        // the connection ends after the reply.
+        if (request.magic != JobRequestMagic || request.width <= 0 || request.height <= 0 || request.width > MaxJobSide
+            || request.height > MaxJobSide || request.bytes > MaxJobBytes) {
+            job.reply.status = JOB_BAD_REQUEST;
+            SendAll(s, &job.reply, sizeof(job.reply));
+            break;
+        }
+        job.commands.resize((size_t)request.bytes);
+        if (!ReceiveAll(s, job.commands.data(), job.commands.size()))
+            break;
+        {
+            unique_lock<std::mutex> lock(mutex);
+            job.id = ++jobs;
+            job.queued = steady_clock::now();
+            queue.push_back(&job);
+            job.reply.queueDepth = (unsigned)queue.size();
+            wake.notify_one();
+            finished.wait(lock, [&job] { return job.finished; });
+        }
+        frame = job.mapping;
+        if (!SendAll(s, &job.reply, sizeof(job.reply)))
+            break;
+    }
+    if (frame)
+        CloseHandle(frame);
+    closesocket(s);
+    lock_guard<std::mutex> lock(mutex);
+    connections.erase(client);
+    clients--;
+    finished.notify_all();
+}
+
+// Draws the job into a new file mapping with the same rasterizers and replay
+// the window uses, through a context over the job's own canvas state on this
+// thread's tile renderer.
+static void RenderJob(const JobRequest& request, const vector<BYTE>& commands, unsigned long long id, TileRenderer& renderer,
+                      JobReply& reply, HANDLE& mapping) {
+    int w = request.width, h = request.height;
+    unsigned long long size = (unsigned long long)w * h * 4;
+    swprintf(reply.frame, 64, L"Local\\PixelCanvas-%lu-%llu", (unsigned long)GetCurrentProcessId(), id);
+    mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)size, reply.frame);
+    BYTE* bits = mapping ? (BYTE*)MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, (SIZE_T)size) : nullptr;
+    if (!bits) {
+        if (mapping)
+            CloseHandle(mapping);
+        mapping = NULL;
+        reply.status = JOB_NO_MEMORY;
+        reply.frame[0] = 0;
+        return;
+    }
+    CanvasState state;
+    state.dirty.Reset(w, h);
+    RenderTarget target(Surface(bits, w, h, w * 4));
+    auto clear = [&] {
+        fill((DWORD*)bits, (DWORD*)bits + (size_t)w * h, request.background);
+        state.clipWindow = ClipRect();
+        state.clipRegion = ClipRegion();
+        state.dirty.MarkAll();
+    };
+    clear();
+    RenderContext context(NULL, &target, &state);
+    ReplayCanvas canvas;
+    canvas.context = &context;
+    canvas.renderer = &renderer;
+    canvas.publish = [] {};
+    canvas.clear = clear;
+    renderer.Attach(context);
+
+    size_t at = 0;
+    ScriptReader reader([&](void* buffer, size_t n) {
+        n = min(n, commands.size() - at);
+        memcpy(buffer, commands.data() + at, n);
+        at += n;
+        return n;
+    });
+    const DrawRecord* record;
+    vector<BYTE> copy;
+    while (reader.Next(record)) {
+        // The recursive fill nests a call per pixel it fills, more than a
+        // worker's stack holds on a large canvas, so jobs get the queue fill,
+        // which paints the same pixels.
+        if (record->op == DL_FLOOD_FILL && record->algo == 0) {
+            copy.assign((const BYTE*)record, (const BYTE*)record + record->Size());
+            ((DrawRecord*)copy.data())->algo = 1;
+            record = (const DrawRecord*)copy.data();
+        }
+        DrawRecorded(canvas, *record);
+        reply.commands++;
+    }
+    renderer.Detach();
+    UnmapViewOfFile(bits);
+    reply.errors = reader.Errors();
+    reply.status = JOB_DONE;
+}
+
+void RenderServer::WorkerLoop() {
+    // Jobs on this worker rasterize here rather than on another pool.
+    TileRenderer renderer(1);
+    for (;;) {
+        Job* job;
+        {
+            unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return quit || !queue.empty(); });
+            if (queue.empty())
+                return;
+            job = queue.front();
+            queue.pop_front();
+        }
+        steady_clock::time_point start = steady_clock::now();
+        RenderJob(job->request, job->commands, job->id, renderer, job->reply, job->mapping);
+        steady_clock::time_point end = steady_clock::now();
+        job->reply.waitMs = Milliseconds(start - job->queued);
+        job->reply.renderMs = Milliseconds(end - start);
+        if (log) {
+            const JobReply& r = job->reply;
+            char line[256];
+            snprintf(line, sizeof(line), "job %llu %dx%d: %llu commands (%d skipped), waited %.2f ms, rendered %.2f ms, queue depth %u%s",
+                job->id, r.width, r.height, r.commands, r.errors, r.waitMs, r.renderMs, r.queueDepth,
+                r.status == JOB_DONE ? "" : ", out of memory");
+            lock_guard<std::mutex> lock(logLock);
+            log(line);
+        }
+        lock_guard<std::mutex> lock(mutex);
+        job->finished = true;
+        done++;
+        finished.notify_all();
+    }
+}
+
+RenderClient::RenderClient() : socket(INVALID_SOCKET), mapping(NULL) {}
+
+RenderClient::~RenderClient() {
+    Close();
+}
+
+bool RenderClient::Connect(const char* path) {
+    Close();
+    sockaddr_un address;
+    WSADATA wsa;
+    if (!SocketAddress(path, address) || WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+        return false;
+    SOCKET s = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s == INVALID_SOCKET || connect(s, (const sockaddr*)&address, sizeof(address)) != 0) {
+        if (s != INVALID_SOCKET)
+            closesocket(s);
+        WSACleanup();
+        return false;
+    }
+    socket = s;
+    return true;
+}
+
+void RenderClient::Release() {
+    if (frame.bits)
+        UnmapViewOfFile(frame.bits);
+    if (mapping)
+        CloseHandle(mapping);
+    frame = Surface();
+    mapping = NULL;
+}
+
+void RenderClient::Close() {
+    Release();
+    if (socket == INVALID_SOCKET)
+        return;
+    closesocket((SOCKET)socket);
+    socket = INVALID_SOCKET;
+    WSACleanup();
+}
+
+bool RenderClient::Render(const JobRequest& request, const void* commands, JobReply& reply) {
+    Release();
+    SOCKET s = (SOCKET)socket;
+    if (s == INVALID_SOCKET || !SendAll(s, &request, sizeof(request)) || !SendAll(s, commands, (size_t)request.bytes)
+        || !ReceiveAll(s, &reply, sizeof(reply)) || reply.magic != JobReplyMagic)
+        return false;
+    if (reply.status != JOB_DONE)
+        return true;
+    reply.frame[63] = 0;
+    mapping = OpenFileMappingW(FILE_MAP_READ, FALSE, reply.frame);
+    BYTE* bits = mapping ? (BYTE*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, (SIZE_T)reply.width * reply.height * 4) : nullptr;
+    if (!bits) {
+        Release();
+        return false;
+    }
+    frame = Surface(bits, reply.width, reply.height, reply.width * 4);
+    return true;
+}
@@ -0,0 +1,114 @@
+#ifndef RENDERSERVER_H
+#define RENDERSERVER_H
+
+#include <windows.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Surface.h"
+
+// Wire format of the render server, in native byte order. A client sends a
+// JobRequest followed by request.bytes of commands in any form ScriptReader
+// reads, normally RecordStreamMagic and recorded operations, and gets back a
+// JobReply. The pixels do not come through the socket: the reply names a file
+// mapping holding width * height BGRA pixels, rows top down, which stays open
+// until the client sends its next request or disconnects.
+const DWORD JobRequestMagic = 0x4A435850;   // "PXCJ"
+const DWORD JobReplyMagic = 0x52435850;     // "PXCR"
+const int MaxJobSide = 16384;
+const unsigned long long MaxJobBytes = 256ull << 20;
+
+struct JobRequest {
+    DWORD magic;
+    int width, height;
+    DWORD background;   // BGRA the canvas starts as
+    unsigned long long bytes;
+};
+
+enum JobStatus { JOB_DONE, JOB_BAD_REQUEST, JOB_NO_MEMORY };
+
+struct JobReply {
+    DWORD magic;
+    int status;
+    int width, height;
+    unsigned long long commands;
+    int errors;             // commands that could not be read and were skipped
+    unsigned queueDepth;    // jobs waiting when this one was queued, itself included
+    double waitMs;          // from queued until a worker took it
+    double renderMs;
+    WCHAR frame[64];
+};
+
+// Renders jobs from any number of clients over a Unix domain socket (Windows
+// 10 1803 and later). One thread per connection reads requests; a pool of
+// workers takes queued jobs in order and draws each on a canvas of its own,
+// with its own clip state, straight into the file mapping the reply names.
+class RenderServer {
+public:
+    // Receives one line per finished job; called from the worker threads.
+    typedef std::function<void(const std::string& line)> Log;
+
+    // workers <= 0 uses one per core.
+    explicit RenderServer(int workers = 0);
+    ~RenderServer();
+
+    // Listens at path, replacing a socket file left by an earlier run.
+    bool Start(const char* path, Log log = Log());
+    // Stops accepting and disconnects clients once the queued jobs are done.
+    void Stop();
+
+    size_t QueueDepth() const;
+    unsigned long long JobsDone() const;
+
+private:
+    struct Job;
+
+    void AcceptLoop();
+    void ClientLoop(UINT_PTR client);
+    void WorkerLoop();
+
+    int workerCount;
+    Log log;
+    std::string path;
+    UINT_PTR listener;      // SOCKET
+    std::thread acceptor;
+    std::vector<std::thread> workers;
+    std::set<UINT_PTR> connections;
+    std::deque<Job*> queue;
+    mutable std::mutex mutex;
+    std::mutex logLock;
+    std::condition_variable wake, finished;
+    int clients;
+    bool running, quit;
+    unsigned long long jobs, done;
+};
+
+// One connection to a render server. Frames are mapped read-only; each stays
+// valid until the next Render or Close.
+class RenderClient {
+public:
+    RenderClient();
+    ~RenderClient();
+
+    bool Connect(const char* path);
+    // Sends request, with request.bytes of commands, and waits for the reply.
+    // False if the connection failed or the frame could not be mapped; the
+    // reply's status tells whether the server rendered it.
+    bool Render(const JobRequest& request, const void* commands, JobReply& reply);
+    const Surface& Frame() const { return frame; }
+    void Close();
+
+private:
+    void Release();
+
+    UINT_PTR socket;
+    HANDLE mapping;
+    Surface frame;
+};
+
+#endif
@@ -0,0 +1,225 @@
+#include "Replay.h"
+#include <algorithm>
+#include <climits>
+#include <memory>
+#include "Circle.h"
+#include "Curve.h"
+#include "Ellipse.h"
+#include "Line.h"
+#include "PolygonFill.h"
+#include "Progressive.h"
+using namespace std;
+
+// Fills are clipped to the clip window and the canvas before their spans are
+// built, so an edge table covers only rows that can be drawn. The rectangle is
+// grown by a pixel so the edges the clipper adds along it fall outside.
+static void SubmitPolygon(ReplayCanvas& canvas, const point pts[], int n, bool convex, COLORREF c)
+{
+    RenderContext& ctx = *canvas.context;
+    ClipRect window = ctx.ClipWindow();
+    if (ctx.target)
+        window = window.Intersect(ClipRect(0, 0, ctx.target->Width() - 1, ctx.target->Height() - 1));
+    if (window.enabled)
+        window = ClipRect(window.minX - 1, window.minY - 1, window.maxX + 1, window.maxY + 1);
+    int count;
+    const point* clipped = ClipPolygonToRect(window, pts, n, ctx.polygonScratch, count);
+    if (count < 3)
+        return;
+    auto spans = std::make_shared<SpanList>();
+    polygonToSpans(clipped, count, convex, ctx.polygonScratch, *spans);
+    canvas.renderer->SubmitSpans(spans, c);
+}
+
+static void SubmitStroke(ReplayCanvas& canvas, const point pts[], int n, bool closed, const StrokeStyle& style, COLORREF c)
+{
+    auto spans = std::make_shared<SpanList>();
+    strokeToSpans(pts, n, closed, style, canvas.context->strokeScratch, *spans);
+    canvas.renderer->SubmitSpans(spans, c);
+}
+
+static void ApplyClipMask(ReplayCanvas& canvas, ClipRegionBuilder& shape, int op)
+{
+    ClipRegion& clipRegion = canvas.context->canvas->clipRegion;
+    ClipRegion region = shape.Finish();
+    if (op == MASK_INTERSECT) {
+        clipRegion = clipRegion.Intersect(region);
+    }
+    else if (op == MASK_UNION) {
+        clipRegion = clipRegion.enabled ? clipRegion.Union(region) : region;
+    }
+    else {
+        clipRegion = clipRegion.Subtract(region);
+    }
+}
+
+void DrawRecorded(ReplayCanvas& canvas, const DrawRecord& r)
+{
+    TileRenderer& renderer = *canvas.renderer;
+    RenderContext& ctx = *canvas.context;
+    const POINT* p = r.Points();
+    int algo = r.algo;
+    COLORREF color = r.color, fill = r.fill;
+    switch (r.op) {
+    case DL_LINE: {
+        int x1 = p[0].x, y1 = p[0].y, x2 = p[1].x, y2 = p[1].y;
+        renderer.Submit(min(x1, x2), min(y1, y2), max(x1, x2) + 1, max(y1, y2) + 1, [=](RenderContext& tile) {
+            Line line(tile);
+            switch (algo) {
+            case 0: line.DrawLineDDA(x1, y1, x2, y2, color); break;
+            case 1: line.DrawLineMidpoint(x1, y1, x2, y2, color); break;
+            case 2: line.DrawLineParametric(x1, y1, x2, y2, color); break;
+            case 3: line.DrawLineWu(x1, y1, x2, y2, color); break;
+            case 4: line.DrawLineInterpolated(x1, y1, x2, y2, color, fill); break;
+            }
+        });
+        break;
+    }
+    case DL_CIRCLE: {
+        int xc = p[0].x, yc = p[0].y, R = r.param;
+        renderer.Submit(xc - R, yc - R, xc + R, yc + R, [=](RenderContext& tile) {
+            Circle circle(tile);
+            switch (algo) {
+            case 0: circle.DrawCircleDirect(xc, yc, R, color); break;
+            case 1: circle.DrawCirclePolar(xc, yc, R, color); break;
+            case 2: circle.DrawCircleIterativePolar(xc, yc, R, color); break;
+            case 3: circle.DrawCircleMidpoint(xc, yc, R, color); break;
+            case 4: circle.DrawCircleModifiedMidpoint(xc, yc, R, color); break;
+            }
+        });
+        break;
+    }
+    case DL_CIRCLE_QUARTER: {
+        int xc = p[0].x, yc = p[0].y, R = r.param;
+        if (algo < 4) {
+            renderer.Flush();
+            Circle(ctx).DrawCircleModifiedMidpoint(xc, yc, R, color);
+            CircleRingsOp op(ctx, xc, yc, R, algo + 1, r.seed);
+            RunProgressive(op, canvas.publish);
+        } else {
+            renderer.Submit(xc - R, yc - R, xc + R, yc + R, [=](RenderContext& tile) {
+                Circle(tile).FillQuarterWithLines(xc, yc, R, color, algo - 3);
+            });
+        }
+        break;
+    }
+    case DL_SQUARE: {
+        int left = p[0].x, bottom = p[0].y, right = p[1].x, top = p[1].y;
+        renderer.Flush();
+        HermiteFillOp op(ctx, left, bottom, right, top, fill);
+        RunProgressive(op, canvas.publish);
+        point outline[4] = { point(left, bottom), point(right, bottom), point(right, top), point(left, top) };
+        SubmitStroke(canvas, outline, 4, true, StrokeStyle(), color);
+        break;
+    }
+    case DL_RECTANGLE: {
+        int minX = p[0].x, minY = p[0].y, maxX = p[1].x, maxY = p[1].y;
+        renderer.Flush();
+        BezierFillOp op(ctx, minX, minY, maxX, maxY, fill);
+        RunProgressive(op, canvas.publish);
+        point outline[4] = { point(minX, minY), point(maxX, minY), point(maxX, maxY), point(minX, maxY) };
+        SubmitStroke(canvas, outline, 4, true, StrokeStyle(), color);
+        break;
+    }
+    case DL_FLOOD_FILL: {
+        int x = p[0].x, y = p[0].y;
+        renderer.Flush();
+        if (algo == 0) {
+            myFloodFill(ctx, x, y, color, fill);
+        } else if (algo == 1) {
+            myFloodFillqueue(ctx, x, y, color, fill);
+        } else {
+            FloodFillOp op(ctx, x, y, color, fill);
+            RunProgressive(op, canvas.publish);
+        }
+        break;
+    }
+    case DL_SPLINE: {
+        std::vector<POINT> controls(p, p + r.count);
+        if (algo == 1) {
+            StrokeStyle style(r.param / 256.0, JOIN_ROUND, CAP_ROUND);
+            std::vector<point> path;
+            Curve::FlattenCardinalSpline(controls.data(), (int)controls.size(), 0.0, path);
+            SubmitStroke(canvas, path.data(), (int)path.size(), false, style, color);
+        } else {
+            RECT box = Curve::CardinalSplineBounds(p, r.count, 0.0);
+            renderer.Submit(box.left, box.top, box.right, box.bottom, [controls, color](RenderContext& tile) mutable {
+                Curve(tile).DrawCardinalSpline(controls.data(), (int)controls.size(), 0.0, color);
+            });
+        }
+        break;
+    }
+    case DL_POLYGON: {
+        // A fill whose vertices all lie beyond one edge of the clip window
+        // cannot reach it, so its spans are never built. Masks still apply.
+        bool isFill = algo <= 1 || algo == 5;
+        if (isFill && ComputeOutCodes(ctx.canvas->clipWindow, p, r.count, nullptr) == CLIP_OUTSIDE)
+            break;
+        std::vector<point> pts(r.count);
+        for (int i = 0; i < r.count; ++i)
+            pts[i] = point(p[i].x, p[i].y);
+        if (algo == 0 || algo == 1) {
+            SubmitPolygon(canvas, pts.data(), r.count, algo == 0, fill);
+        } else if (algo == 5) {
+            std::vector<COLORREF> colors(r.count);
+            RECT box = { INT_MAX, INT_MAX, INT_MIN, INT_MIN };
+            for (int i = 0; i < r.count; ++i) {
+                colors[i] = (i % 2 == 0) ? color : fill;
+                box.left = min(box.left, p[i].x);
+                box.top = min(box.top, p[i].y);
+                box.right = max(box.right, p[i].x);
+                box.bottom = max(box.bottom, p[i].y);
+            }
+            renderer.Submit(box.left, box.top, box.right, box.bottom, [pts, colors](RenderContext& tile) mutable {
+                fillGouraudPolygon(tile, pts.data(), colors.data(), (int)pts.size());
+            });
+        } else {
+            renderer.Flush();
+            ClipRegionBuilder shape;
+            polygonToSpans(pts.data(), r.count, false, ctx.polygonScratch, shape);
+            ApplyClipMask(canvas, shape, algo - 2);
+        }
+        break;
+    }
+    case DL_CLIP_WINDOW: {
+        renderer.Flush();
+        ClipRect& clipWindow = ctx.canvas->clipWindow;
+        clipWindow = clipWindow.Intersect(ClipRect(p[0].x, p[0].y, p[1].x, p[1].y));
+        if (clipWindow.minX >= clipWindow.maxX || clipWindow.minY >= clipWindow.maxY) {
+            clipWindow = ClipRect();
+        }
+        if (clipWindow.enabled) {
+            const ClipRect& cw = clipWindow;
+            point outline[4] = { point(cw.minX, cw.minY), point(cw.maxX, cw.minY), point(cw.maxX, cw.maxY), point(cw.minX, cw.maxY) };
+            SubmitStroke(canvas, outline, 4, true, StrokeStyle(), RGB(255, 0, 0));
+        }
+        break;
+    }
+    case DL_CLIP_CIRCLE: {
+        renderer.Flush();
+        ClipRegionBuilder shape;
+        CircleSpans(p[0].x, p[0].y, r.param, shape);
+        ApplyClipMask(canvas, shape, algo);
+        break;
+    }
+    case DL_CLEAR:
+        renderer.Flush();
+        canvas.clear();
+        break;
+    case DL_LAYER:
+        renderer.Flush();
+        if (canvas.layer)
+            canvas.layer(algo, LayerBlend{ (BYTE)r.param, (BYTE)r.seed });
+        break;
+    case DL_ELLIPSE: {
+        int xc = p[0].x, yc = p[0].y, a = p[1].x, b = p[1].y;
+        renderer.Submit(xc - a, yc - b, xc + a, yc + b, [=](RenderContext& tile) {
+            switch (algo) {
+            case 0: DrawEllipseDirect(tile, xc, yc, a, b, color); break;
+            case 1: DrawEllipsePolar(tile, xc, yc, a, b, color); break;
+            case 2: DrawEllipseMidpoint(tile, xc, yc, a, b, color); break;
+            }
+        });
+        break;
+    }
+    }
+}
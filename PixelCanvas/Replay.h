@@ -0,0 +1,30 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <windows.h>
+#include <functional>
+#include "DisplayList.h"
+#include "Layers.h"
+#include "RenderContext.h"
+#include "TileRenderer.h"
+
+// A canvas recorded operations can be drawn on: the calling thread's context
+// over it and the tile renderer attached to that context, and what to do for
+// long fills, DL_CLEAR and DL_LAYER.
+struct ReplayCanvas {
+    RenderContext* context;
+    TileRenderer* renderer;
+    // Shows what long fills have drawn so far.
+    std::function<void()> publish;
+    std::function<void()> clear;
+    // Unset where the canvas has a single layer.
+    std::function<void(int layer, const LayerBlend& blend)> layer;
+
+    ReplayCanvas() : context(nullptr), renderer(nullptr) {}
+};
+
+// Records that draw straight to the canvas or change clip state first
+// rasterize whatever earlier records queued on the tile renderer.
+void DrawRecorded(ReplayCanvas& canvas, const DrawRecord& r);
+
+#endif
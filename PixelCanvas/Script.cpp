@@ -0,0 +1,340 @@
+#include "Script.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+using namespace std;
+
+const BYTE RecordStreamMagic[8] = { 'P', 'X', 'C', 'R', 'E', 'C', '\r', '\n' };
+
+struct Command {
+    const char* name;
+    DrawOpcode op;
+    // Algorithm names in the order of the window's algorithm box.
+    const char* algos[9];
+};
+
+static const int MaxStrokeWidth = 4096;
+
+static const Command commands[] = {
+    { "line", DL_LINE, { "dda", "midpoint", "parametric", "wu", "gradient" } },
+    { "circle", DL_CIRCLE, { "direct", "polar", "iterative-polar", "midpoint", "modified-midpoint" } },
+    { "quarter", DL_CIRCLE_QUARTER, { "circles1", "circles2", "circles3", "circles4", "lines1", "lines2", "lines3", "lines4" } },
+    { "square", DL_SQUARE, { nullptr } },
+    { "rectangle", DL_RECTANGLE, { nullptr } },
+    { "floodfill", DL_FLOOD_FILL, { "recursive", "queue", "scanline" } },
+    { "spline", DL_SPLINE, { "cardinal", "thick" } },
+    { "polygon", DL_POLYGON, { "convex", "general", "mask", "add-mask", "exclude-mask", "gouraud" } },
+    { "clip", DL_CLIP_WINDOW, { "rectangle", "square", "circle", "add-circle", "exclude-circle" } },
+    { "ellipse", DL_ELLIPSE, { "direct", "polar", "midpoint" } },
+    { "clear", DL_CLEAR, { nullptr } },
+};
+
+// Normalizes two corners the way the window does when dragging; a square
+// grows to its longer side.
+static void Corners(const vector<long long>& v, bool square, vector<POINT>& points) {
+    LONG minX = (LONG)min(v[0], v[2]), maxX = (LONG)max(v[0], v[2]);
+    LONG minY = (LONG)min(v[1], v[3]), maxY = (LONG)max(v[1], v[3]);
+    if (square) {
+        LONG side = max(maxX - minX, maxY - minY);
+        maxX = minX + side;
+        maxY = minY + side;
+    }
+    POINT corners[2] = { { minX, minY }, { maxX, maxY } };
+    points.assign(corners, corners + 2);
+}
+
+ScriptReader::ScriptReader(HANDLE input)
+    : ScriptReader([input](void* buffer, size_t size) {
+          DWORD got = 0;
+          return ReadFile(input, buffer, (DWORD)size, &got, NULL) ? (size_t)got : 0;
+      }) {}
+
+ScriptReader::ScriptReader(ByteSource source)
+    : source(source), buffer(64 * 1024), pos(0), end(0), started(false), binary(false), bytesRead(0), lineNumber(0), errors(0),
+      color(RGB(0, 0, 0)), fill(RGB(255, 0, 0)), width(256), seed(1) {}
+
+bool ScriptReader::Fill() {
+    if (pos < end)
+        return true;
+    size_t got = source(buffer.data(), buffer.size());
+    if (got == 0)
+        return false;
+    pos = 0;
+    end = got;
+    bytesRead += got;
+    return true;
+}
+
+bool ScriptReader::Read(void* out, size_t size) {
+    BYTE* p = (BYTE*)out;
+    while (size > 0) {
+        if (!Fill())
+            return false;
+        size_t n = min(size, end - pos);
+        memcpy(p, &buffer[pos], n);
+        pos += n;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool ScriptReader::ReadLine(string& line) {
+    line.clear();
+    while (Fill()) {
+        const BYTE* start = &buffer[pos];
+        const BYTE* newline = (const BYTE*)memchr(start, '\n', end - pos);
+        size_t n = newline ? newline - start : end - pos;
+        line.append((const char*)start, n);
+        pos += n;
+        if (newline) {
+            pos++;
+            break;
+        }
+    }
+    if (line.empty() && pos >= end && !Fill())
+        return false;
+    if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+    lineNumber++;
+    return true;
+}
+
+void ScriptReader::Fail(const string& message) {
+    errors++;
+    lastError = (binary ? "record " : "line ") + to_string(lineNumber) + ": " + message;
+}
+
+// Splits off the next whitespace-separated word; false at the end of the
+// line.
+static bool NextWord(const char*& p, const char* end, string& word) {
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    const char* start = p;
+    while (p < end && *p != ' ' && *p != '\t')
+        p++;
+    word.assign(start, p);
+    return p > start;
+}
+
+bool ScriptReader::Next(const DrawRecord*& record) {
+    if (!started) {
+        started = true;
+        if (Fill() && end - pos >= sizeof(RecordStreamMagic) && memcmp(&buffer[pos], RecordStreamMagic, sizeof(RecordStreamMagic)) == 0) {
+            binary = true;
+            pos += sizeof(RecordStreamMagic);
+        }
+    }
+    // Invalid binary records are skipped in a loop rather than by recursing,
+    // so a long run of them cannot exhaust the stack.
+    while (binary) {
+        DrawRecord head;
+        if (!Fill())
+            return false;
+        lineNumber++;
+        if (!Read(&head, sizeof(head))) {
+            Fail("stream ends inside a record");
+            return false;
+        }
+        current.resize(head.Size());
+        memcpy(current.data(), &head, sizeof(head));
+        if (!Read(current.data() + sizeof(head), head.count * sizeof(POINT))) {
+            Fail("stream ends inside a record");
+            return false;
+        }
+        // Records from a file are not trusted to carry the points and
+        // algorithm the rasterizers index without checking.
+        static const int minPoints[] = { 2, 1, 1, 2, 2, 1, 4, 3, 2, 1, 2, 0 };
+        static const int algoCount[] = { 5, 5, 8, 256, 256, 3, 2, 6, 256, 3, 3, 256 };
+        if (head.op > DL_CLEAR || head.count < minPoints[head.op] || head.algo >= algoCount[head.op]) {
+            Fail("invalid record");
+            continue;
+        }
+        record = (const DrawRecord*)current.data();
+        return true;
+    }
+    string line;
+    while (ReadLine(line)) {
+        if (ParseLine(line)) {
+            record = (const DrawRecord*)current.data();
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns false for settings, comments and lines that fail, which are
+// counted.
+bool ScriptReader::ParseLine(const string& line) {
+    const char* p = line.data();
+    const char* end = p + line.size();
+    string word, name;
+    if (!NextWord(p, end, word) || word[0] == '#')
+        return false;
+    if (word == "color" || word == "fill") {
+        int rgb[3], n = 0;
+        bool valid = true;
+        for (; NextWord(p, end, name); n++) {
+            char* stop;
+            long x = strtol(name.c_str(), &stop, 10);
+            valid = valid && n < 3 && !*stop && x >= 0 && x <= 255;
+            if (valid)
+                rgb[n] = (int)x;
+        }
+        if (!valid || n != 3) {
+            Fail("expected three color components from 0 to 255");
+            return false;
+        }
+        (word == "color" ? color : fill) = RGB(rgb[0], rgb[1], rgb[2]);
+        return false;
+    }
+    if (word == "width" || word == "seed") {
+        char* stop;
+        double x = NextWord(p, end, name) ? strtod(name.c_str(), &stop) : -1;
+        if (x < 0 || x > UINT_MAX || *stop || NextWord(p, end, name)) {
+            Fail("expected a number after " + word);
+            return false;
+        }
+        if (word == "width" && x > MaxStrokeWidth) {
+            Fail("width is more than " + to_string(MaxStrokeWidth));
+            return false;
+        }
+        if (word == "width")
+            width = (int)round(x * 256);
+        else
+            seed = (unsigned)x;
+        return false;
+    }
+
+    const Command* command = nullptr;
+    for (const Command& c : commands) {
+        if (word == c.name)
+            command = &c;
+    }
+    if (!command) {
+        Fail("unknown command '" + word + "'");
+        return false;
+    }
+    int algo = 0;
+    if (command->algos[0]) {
+        if (!NextWord(p, end, name)) {
+            Fail("missing algorithm");
+            return false;
+        }
+        algo = -1;
+        char* stop = nullptr;
+        long index = strtol(name.c_str(), &stop, 10);
+        int count = 0;
+        while (count < 9 && command->algos[count])
+            count++;
+        if (*stop == 0 && index >= 0 && index < count)
+            algo = (int)index;
+        for (int i = 0; i < count; i++) {
+            if (name == command->algos[i])
+                algo = i;
+        }
+        if (algo < 0) {
+            Fail("unknown algorithm '" + name + "' for " + word);
+            return false;
+        }
+    }
+    vector<long long>& v = values;
+    v.clear();
+    while (NextWord(p, end, name)) {
+        char* stop;
+        errno = 0;
+        long long x = strtoll(name.c_str(), &stop, 10);
+        if (*stop) {
+            Fail("expected numbers");
+            return false;
+        }
+        if (errno || x < INT_MIN || x > INT_MAX) {
+            Fail("number out of range");
+            return false;
+        }
+        v.push_back(x);
+    }
+
+    DrawRecord head = { (BYTE)command->op, (BYTE)algo, 0, color, fill, 0, 0 };
+    vector<POINT> points;
+    auto expect = [&](size_t count) {
+        if (v.size() == count)
+            return true;
+        Fail(string("expected ") + to_string(count) + " numbers after " + word);
+        return false;
+    };
+    auto pairs = [&](size_t from) {
+        for (size_t i = from; i + 1 < v.size(); i += 2) {
+            POINT p = { (LONG)v[i], (LONG)v[i + 1] };
+            points.push_back(p);
+        }
+    };
+    switch (command->op) {
+    case DL_CIRCLE:
+    case DL_CIRCLE_QUARTER:
+        if (!expect(3))
+            return false;
+        pairs(0);
+        head.param = (int)v[2];
+        head.seed = seed;
+        break;
+    case DL_FLOOD_FILL:
+        if (!expect(2))
+            return false;
+        pairs(0);
+        break;
+    case DL_SPLINE:
+    case DL_POLYGON:
+        if (v.size() % 2 || v.size() / 2 > 0xFFFF) {
+            Fail("expected x y pairs");
+            return false;
+        }
+        // A cardinal spline needs four control points to draw anything.
+        if (v.size() < (command->op == DL_SPLINE ? 8u : 6u)) {
+            Fail(string("too few points for ") + word);
+            return false;
+        }
+        pairs(0);
+        head.param = width;
+        break;
+    case DL_CLIP_WINDOW:
+        if (algo >= 2) {
+            if (!expect(3))
+                return false;
+            head.op = DL_CLIP_CIRCLE;
+            head.algo = (BYTE)(algo - 2);
+            head.param = (int)v[2];
+            pairs(0);
+            points.resize(1);
+            break;
+        }
+        if (!expect(4))
+            return false;
+        Corners(v, algo == 1, points);
+        break;
+    case DL_CLEAR:
+        if (!expect(0))
+            return false;
+        break;
+    case DL_SQUARE:
+    case DL_RECTANGLE:
+        if (!expect(4))
+            return false;
+        Corners(v, command->op == DL_SQUARE, points);
+        break;
+    default:
+        if (!expect(4))
+            return false;
+        pairs(0);
+        break;
+    }
+    head.count = (WORD)points.size();
+    current.resize(head.Size());
+    memcpy(current.data(), &head, sizeof(head));
+    if (!points.empty())
+        memcpy(current.data() + sizeof(head), points.data(), points.size() * sizeof(POINT));
+    return true;
+}
@@ -0,0 +1,81 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include <windows.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include "DisplayList.h"
+
+// First bytes of a binary command stream: records back to back exactly as
+// the display list holds them.
+extern const BYTE RecordStreamMagic[8];
+
+// Copies up to size bytes of input into buffer and returns how many; 0 at the
+// end of the input.
+typedef std::function<size_t(void* buffer, size_t size)> ByteSource;
+
+// Reads drawing commands from a file or pipe one at a time, so a script of
+// any length runs in constant memory. A stream that starts with
+// RecordStreamMagic is binary; anything else is text, one command per line:
+//
+//   color R G B             outline color, and the boundary of floodfill
+//   fill R G B              fill color for what follows
+//   width W                 stroke width of thick splines, in pixels, up to 4096
+//   seed N                  ring colors of quarter circles
+//   line ALGO x1 y1 x2 y2
+//   circle ALGO xc yc r
+//   quarter ALGO xc yc r
+//   square x0 y0 x1 y1      grows to the longer side like a dragged one
+//   rectangle x0 y0 x1 y1
+//   floodfill ALGO x y
+//   spline ALGO x y x y ...  four points or more
+//   polygon ALGO x y x y ...
+//   clip rectangle|square x0 y0 x1 y1
+//   clip circle|add-circle|exclude-circle xc yc r
+//   ellipse ALGO xc yc a b
+//   clear
+//
+// ALGO is the position in the window's algorithm box for that shape, or its
+// name: line dda, midpoint, parametric, wu, gradient; circle direct, polar,
+// iterative-polar, midpoint, modified-midpoint; quarter circles1..4,
+// lines1..4; floodfill recursive, queue, scanline; spline cardinal, thick;
+// polygon convex, general, mask, add-mask, exclude-mask, gouraud; ellipse
+// direct, polar, midpoint. Blank lines and lines starting with # are
+// ignored; lines that cannot be read are counted and skipped.
+class ScriptReader {
+public:
+    explicit ScriptReader(HANDLE input);
+    explicit ScriptReader(ByteSource source);
+
+    // The next record, followed in memory by its points and valid until the
+    // next call. False at the end of the input.
+    bool Next(const DrawRecord*& record);
+
+    int Errors() const { return errors; }
+    const std::string& LastError() const { return lastError; }
+    unsigned long long BytesRead() const { return bytesRead; }
+
+private:
+    bool Fill();
+    bool Read(void* out, size_t size);
+    bool ReadLine(std::string& line);
+    bool ParseLine(const std::string& line);
+    void Fail(const std::string& message);
+
+    ByteSource source;
+    std::vector<BYTE> buffer;
+    size_t pos, end;
+    bool started, binary;
+    unsigned long long bytesRead;
+    size_t lineNumber;
+    int errors;
+    std::string lastError;
+    std::vector<BYTE> current;
+    std::vector<long long> values;
+    COLORREF color, fill;
+    int width;
+    unsigned seed;
+};
+
+#endif
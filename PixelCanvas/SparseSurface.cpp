@@ -0,0 +1,104 @@
+#include "SparseSurface.h"
+#include <algorithm>
+#include <cstring>
+using namespace std;
+
+static const int TileMask = SparseSurface::TileSize - 1;
+static const int TilePixels = SparseSurface::TileSize * SparseSurface::TileSize;
+
+SparseSurface::SparseSurface(int width, int height, DWORD background)
+    : width(width), height(height), background(background), sentinel(new DWORD[TilePixels]) {
+    std::fill(sentinel.get(), sentinel.get() + TilePixels, background);
+}
+
+// Called with the lock held.
+std::unique_ptr<DWORD[]> SparseSurface::Load(int tx, int ty) const {
+    if (!source)
+        return nullptr;
+    std::unique_ptr<DWORD[]> tile(new DWORD[TilePixels]);
+    if (!source->ReadTile(tx, ty, tile.get()))
+        return nullptr;
+    return tile;
+}
+
+const DWORD* SparseSurface::TileForRead(int tx, int ty) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = tiles.find(Key(tx, ty));
+    if (it != tiles.end())
+        return it->second.get();
+    std::unique_ptr<DWORD[]> tile = Load(tx, ty);
+    if (!tile)
+        return sentinel.get();
+    return (tiles[Key(tx, ty)] = std::move(tile)).get();
+}
+
+DWORD* SparseSurface::TileForWrite(int tx, int ty) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unique_ptr<DWORD[]>& tile = tiles[Key(tx, ty)];
+    if (!tile) {
+        tile = Load(tx, ty);
+        if (!tile) {
+            tile.reset(new DWORD[TilePixels]);
+            memcpy(tile.get(), sentinel.get(), TilePixels * sizeof(DWORD));
+        }
+    }
+    return tile.get();
+}
+
+void SparseSurface::SetSource(std::shared_ptr<const TileSource> s) {
+    std::lock_guard<std::mutex> lock(mutex);
+    source = std::move(s);
+}
+
+void SparseSurface::Clear(DWORD bgra) {
+    std::lock_guard<std::mutex> lock(mutex);
+    tiles.clear();
+    source.reset();
+    background = bgra;
+    std::fill(sentinel.get(), sentinel.get() + TilePixels, bgra);
+}
+
+void SparseSurface::TileList(std::vector<POINT>& out) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    out.clear();
+    out.reserve(tiles.size());
+    for (const auto& tile : tiles) {
+        POINT p = { (LONG)(unsigned)tile.first, (LONG)(unsigned)(tile.first >> 32) };
+        out.push_back(p);
+    }
+}
+
+size_t SparseSurface::TileCount() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return tiles.size();
+}
+
+// Offsets are formed in 64 bits; only positions within one tile or one row
+// of the linear surface are ever held in an int.
+void SparseSurface::CopyTo(const Surface& dst, const RECT& r, int dx, int dy) const {
+    int left = max((int)r.left, 0), right = min((int)r.right, width);
+    int top = max((int)r.top, 0), bottom = min((int)r.bottom, height);
+    for (int y = top; y < bottom; y++) {
+        DWORD* out = (DWORD*)dst.Row(dy + (y - top)) + dx;
+        for (int x = left; x < right;) {
+            int end = (int)min((long long)(x | TileMask) + 1, (long long)right);
+            const DWORD* tile = TileForRead(x >> TileShift, y >> TileShift);
+            memcpy(out + (x - left), tile + ((y & TileMask) << TileShift) + (x & TileMask), (end - x) * sizeof(DWORD));
+            x = end;
+        }
+    }
+}
+
+void SparseSurface::CopyFrom(const Surface& src, const RECT& r, int sx, int sy) {
+    int left = max((int)r.left, 0), right = min((int)r.right, width);
+    int top = max((int)r.top, 0), bottom = min((int)r.bottom, height);
+    for (int y = top; y < bottom; y++) {
+        const DWORD* in = (const DWORD*)src.Row(sy + (y - top)) + sx;
+        for (int x = left; x < right;) {
+            int end = (int)min((long long)(x | TileMask) + 1, (long long)right);
+            DWORD* tile = TileForWrite(x >> TileShift, y >> TileShift);
+            memcpy(tile + ((y & TileMask) << TileShift) + (x & TileMask), in + (x - left), (end - x) * sizeof(DWORD));
+            x = end;
+        }
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef SPARSESURFACE_H
+#define SPARSESURFACE_H
+
+#include <windows.h>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "Surface.h"
+
+// Supplies the contents of tiles that were never drawn on, e.g. from a
+// document opened without decoding it. ReadTile fills a whole tile and
+// returns false for tiles it does not hold; TileList lists every tile it
+// may hold. Both may be called from any thread.
+class TileSource {
+public:
+    virtual ~TileSource() {}
+    virtual bool ReadTile(int tx, int ty, DWORD* out) const = 0;
+    virtual void TileList(std::vector<POINT>& out) const = 0;
+};
+
+// Very large BGRA canvas (up to INT_MAX pixels on a side) stored as 64x64
+// tiles that exist only once drawn on. Every other tile reads as one shared
+// sentinel tile filled with the background color, so memory follows the
+// drawn area rather than the canvas size.
+//
+// Tiles are created under a lock; callers cache the tile they are working on
+// (see SparseTarget). Tiles line up with the tile renderer's bins, so two
+// workers never write the same tile.
+class SparseSurface {
+public:
+    static const int TileShift = 6;
+    static const int TileSize = 1 << TileShift;
+
+    SparseSurface(int width, int height, DWORD background = 0xFFFFFFFF);
+
+    int Width() const { return width; }
+    int Height() const { return height; }
+    DWORD Background() const { return background; }
+
+    // Read access allocates only for tiles the source holds; other untouched
+    // tiles return the sentinel.
+    const DWORD* TileForRead(int tx, int ty) const;
+    // Materializes the tile from the source or the background on first write.
+    DWORD* TileForWrite(int tx, int ty);
+    // True for the shared tile that stands in for every untouched one.
+    bool IsSentinel(const DWORD* tile) const { return tile == sentinel.get(); }
+
+    // Tiles missing from the surface are taken from the source the first time
+    // they are accessed.
+    void SetSource(std::shared_ptr<const TileSource> source);
+    // Drops every tile and the source.
+    void Clear(DWORD bgra);
+    // Tiles materialized so far.
+    void TileList(std::vector<POINT>& out) const;
+    // Copies the canvas rectangle r (right/bottom exclusive) to or from a
+    // linear surface, where the rectangle's top-left corner sits at the given
+    // position. The rectangle must fit on the linear surface.
+    void CopyTo(const Surface& dst, const RECT& r, int dx, int dy) const;
+    void CopyFrom(const Surface& src, const RECT& r, int sx, int sy);
+
+    size_t TileCount() const;
+    size_t MemoryUsage() const { return TileCount() * TileSize * TileSize * sizeof(DWORD); }
+
+private:
+    static unsigned long long Key(int tx, int ty) { return ((unsigned long long)(unsigned)ty << 32) | (unsigned)tx; }
+
+    std::unique_ptr<DWORD[]> Load(int tx, int ty) const;
+
+    int width, height;
+    DWORD background;
+    std::unique_ptr<DWORD[]> sentinel;
+    std::shared_ptr<const TileSource> source;
+    // Tiles read from the source are cached here, so reads can add to it.
+    mutable std::unordered_map<unsigned long long, std::unique_ptr<DWORD[]>> tiles;
+    mutable std::mutex mutex;
+};
+
+#endif
@@ -0,0 +1,128 @@
+#include "Stroke.h"
+#include "RenderContext.h"
+#include <cmath>
+
+static const double PI = 3.14159265358979323846;
+
+// Appends a contour to the outline with positive orientation. All pieces share
+// the same winding sign, so where they overlap the winding never cancels out.
+static void AddPiece(StrokeScratch& s, const point* v, int n) {
+    double area = 0;
+    for (int i = 0; i < n; i++) {
+        const point& a = v[i];
+        const point& b = v[(i + 1) % n];
+        area += a.x * b.y - b.x * a.y;
+    }
+    if (fabs(area) < 1e-9)
+        return;
+    if (area > 0) {
+        for (int i = 0; i < n; i++) s.outline.push_back(v[i]);
+    }
+    else {
+        for (int i = n - 1; i >= 0; i--) s.outline.push_back(v[i]);
+    }
+    s.counts.push_back(n);
+}
+
+static void AddDisc(StrokeScratch& s, point c, double r) {
+    // Enough sides that the chord error stays under a quarter pixel.
+    int sides = 8;
+    if (r > 0.25)
+        sides = max(8, (int)ceil(PI / acos(1 - 0.25 / r)));
+    point v[256];
+    sides = min(sides, 256);
+    for (int i = 0; i < sides; i++) {
+        double a = 2 * PI * i / sides;
+        v[i] = point(c.x + r * cos(a), c.y + r * sin(a));
+    }
+    AddPiece(s, v, sides);
+}
+
+static void AddJoin(StrokeScratch& s, point p, point d0, point d1, double hw, const StrokeStyle& style) {
+    double cross = d0.x * d1.y - d0.y * d1.x;
+    double dot = d0.x * d1.x + d0.y * d1.y;
+    if (fabs(cross) < 1e-9 && dot > 0)
+        return;
+    if (style.join == JOIN_ROUND) {
+        AddDisc(s, p, hw);
+        return;
+    }
+    // The outer side of the turn is opposite to the turn direction.
+    double side = cross > 0 ? -1 : 1;
+    point n0(-d0.y * side, d0.x * side), n1(-d1.y * side, d1.x * side);
+    point a(p.x + n0.x * hw, p.y + n0.y * hw), b(p.x + n1.x * hw, p.y + n1.y * hw);
+    if (style.join == JOIN_MITER && 1 + dot > 1e-9) {
+        double ratio = sqrt(2 / (1 + dot));
+        if (ratio <= style.miterLimit) {
+            double k = hw / (1 + dot);
+            point v[4] = { p, a, point(p.x + (n0.x + n1.x) * k, p.y + (n0.y + n1.y) * k), b };
+            AddPiece(s, v, 4);
+            return;
+        }
+    }
+    point v[3] = { p, a, b };
+    AddPiece(s, v, 3);
+}
+
+void strokeToSpans(const point pts[], int n, bool closed, const StrokeStyle& style, StrokeScratch& scratch, SpanSink& sink) {
+    if (n <= 0 || style.width <= 0)
+        return;
+    double hw = style.width / 2;
+    std::vector<point>& path = scratch.path;
+    path.clear();
+    scratch.outline.clear();
+    scratch.counts.clear();
+    for (int i = 0; i < n; i++) {
+        if (path.empty() || pts[i].x != path.back().x || pts[i].y != path.back().y)
+            path.push_back(pts[i]);
+    }
+    if (closed && path.size() > 1 && path.front().x == path.back().x && path.front().y == path.back().y)
+        path.pop_back();
+    int count = (int)path.size();
+
+    if (count == 1) {
+        if (style.cap == CAP_ROUND) {
+            AddDisc(scratch, path[0], hw);
+        }
+        else if (style.cap == CAP_SQUARE) {
+            point p = path[0];
+            point v[4] = { point(p.x - hw, p.y - hw), point(p.x + hw, p.y - hw), point(p.x + hw, p.y + hw), point(p.x - hw, p.y + hw) };
+            AddPiece(scratch, v, 4);
+        }
+    }
+    else {
+        if (count == 2)
+            closed = false;
+        int segments = closed ? count : count - 1;
+        for (int i = 0; i < segments; i++) {
+            point p0 = path[i], p1 = path[(i + 1) % count];
+            double len = hypot(p1.x - p0.x, p1.y - p0.y);
+            point d((p1.x - p0.x) / len, (p1.y - p0.y) / len);
+            if (!closed && style.cap == CAP_SQUARE) {
+                if (i == 0) p0 = point(p0.x - d.x * hw, p0.y - d.y * hw);
+                if (i == segments - 1) p1 = point(p1.x + d.x * hw, p1.y + d.y * hw);
+            }
+            point nrm(-d.y * hw, d.x * hw);
+            point v[4] = { point(p0.x + nrm.x, p0.y + nrm.y), point(p1.x + nrm.x, p1.y + nrm.y),
+                           point(p1.x - nrm.x, p1.y - nrm.y), point(p0.x - nrm.x, p0.y - nrm.y) };
+            AddPiece(scratch, v, 4);
+
+            if (i + 1 < segments || closed) {
+                point q = path[(i + 1) % count], q1 = path[(i + 2) % count];
+                double len1 = hypot(q1.x - q.x, q1.y - q.y);
+                AddJoin(scratch, q, d, point((q1.x - q.x) / len1, (q1.y - q.y) / len1), hw, style);
+            }
+        }
+        if (!closed && style.cap == CAP_ROUND) {
+            AddDisc(scratch, path[0], hw);
+            AddDisc(scratch, path[count - 1], hw);
+        }
+    }
+    if (!scratch.counts.empty())
+        contoursToSpans(scratch.outline.data(), scratch.counts.data(), (int)scratch.counts.size(), sink);
+}
+
+void StrokePolyline(RenderContext& ctx, const point pts[], int n, bool closed, const StrokeStyle& style, COLORREF c) {
+    FillSpanSink sink(ctx, c);
+    strokeToSpans(pts, n, closed, style, ctx.strokeScratch, sink);
+}
@@ -0,0 +1,34 @@
+#ifndef STROKE_H
+#define STROKE_H
+
+#include <windows.h>
+#include <vector>
+#include "PolygonFill.h"
+
+enum StrokeJoin { JOIN_MITER, JOIN_ROUND, JOIN_BEVEL };
+enum StrokeCap { CAP_BUTT, CAP_ROUND, CAP_SQUARE };
+
+struct StrokeStyle {
+    double width;
+    StrokeJoin join;
+    StrokeCap cap;
+    // Longest miter allowed, in half-widths, before a join falls back to a bevel.
+    double miterLimit;
+    StrokeStyle(double width = 1.0, StrokeJoin join = JOIN_MITER, StrokeCap cap = CAP_BUTT, double miterLimit = 4.0)
+        : width(width), join(join), cap(cap), miterLimit(miterLimit) {}
+};
+
+// Buffers for stroke outlines, reused across strokes.
+struct StrokeScratch {
+    std::vector<point> path;
+    std::vector<point> outline;
+    std::vector<int> counts;
+};
+
+// Pixel centres lie on integer coordinates, so a width-1 stroke through integer
+// points covers exactly one pixel across. The whole outline (segments, joins
+// and caps) is filled in one nonzero-winding pass, so every pixel is written once.
+void strokeToSpans(const point pts[], int n, bool closed, const StrokeStyle& style, StrokeScratch& scratch, SpanSink& sink);
+void StrokePolyline(RenderContext& ctx, const point pts[], int n, bool closed, const StrokeStyle& style, COLORREF c);
+
+#endif
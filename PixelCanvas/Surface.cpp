@@ -0,0 +1,17 @@
+#include "Surface.h"
+
+bool SurfaceFromDC(HDC hdc, Surface& surface) {
+    HGDIOBJ bitmap = GetCurrentObject(hdc, OBJ_BITMAP);
+    DIBSECTION ds;
+    if (!bitmap || GetObject(bitmap, sizeof(ds), &ds) != sizeof(ds)) return false;
+    if (ds.dsBm.bmBitsPixel != 32 || ds.dsBm.bmBits == nullptr) return false;
+    GdiFlush();
+    int stride = ds.dsBm.bmWidthBytes;
+    BYTE* bits = (BYTE*)ds.dsBm.bmBits;
+    if (ds.dsBmih.biHeight > 0) {
+        bits += (ptrdiff_t)(ds.dsBm.bmHeight - 1) * stride;
+        stride = -stride;
+    }
+    surface = Surface(bits, ds.dsBm.bmWidth, ds.dsBm.bmHeight, stride);
+    return true;
+}
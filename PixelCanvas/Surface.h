@@ -0,0 +1,24 @@
+#ifndef SURFACE_H
+#define SURFACE_H
+
+#include <windows.h>
+
+// Direct view of a 32-bpp BGRA DIB. Rows are addressed top-down; for
+// bottom-up bitmaps bits points at the top row and stride is negative.
+struct Surface {
+    BYTE* bits;
+    int width, height;
+    int stride;
+
+    Surface() : bits(nullptr), width(0), height(0), stride(0) {}
+    Surface(BYTE* bits, int width, int height, int stride) : bits(bits), width(width), height(height), stride(stride) {}
+
+    bool IsValid() const { return bits != nullptr; }
+    BYTE* Row(int y) const { return bits + (ptrdiff_t)y * stride; }
+    BYTE* Pixel(int x, int y) const { return Row(y) + x * 4; }
+};
+
+// Succeeds when the bitmap selected into hdc is a 32-bpp DIB section.
+bool SurfaceFromDC(HDC hdc, Surface& surface);
+
+#endif
@@ -0,0 +1,324 @@
+#ifndef TARGET_H
+#define TARGET_H
+
+#include <windows.h>
+#include <climits>
+#include <cstring>
+#include "Surface.h"
+#include "PixelFormat.h"
+#include "TiledSurface.h"
+#include "PaletteSurface.h"
+#include "SparseSurface.h"
+#include "Blend.h"
+
+enum TargetLayout { TARGET_LINEAR, TARGET_TILED, TARGET_PALETTE, TARGET_SPARSE };
+
+// Opaque pixels read back as plain COLORREFs. Others carry 255 - alpha in the
+// high byte, so a transparent layer pixel never matches the black boundary
+// or any other color a fill compares it with.
+inline COLORREF BgraToColor(DWORD v) {
+    return ((~v >> 24) << 24) | RGB((v >> 16) & 0xFF, (v >> 8) & 0xFF, v & 0xFF);
+}
+
+// The storage rasterizers draw into: a linear surface in any pixel format, a
+// tiled BGRA canvas, a palette-compressed canvas or a sparse unbounded one.
+struct RenderTarget {
+    TargetLayout layout;
+    PixelFormat format;
+    Surface linear;
+    TiledSurface* tiled;
+    PaletteSurface* palette;
+    SparseSurface* sparse;
+
+    RenderTarget() : layout(TARGET_LINEAR), format(FORMAT_BGRA32), tiled(nullptr), palette(nullptr), sparse(nullptr) {}
+    explicit RenderTarget(const Surface& s, PixelFormat format = FORMAT_BGRA32)
+        : layout(TARGET_LINEAR), format(format), linear(s), tiled(nullptr), palette(nullptr), sparse(nullptr) {}
+    explicit RenderTarget(TiledSurface* t) : layout(TARGET_TILED), format(FORMAT_BGRA32), tiled(t), palette(nullptr), sparse(nullptr) {}
+    explicit RenderTarget(PaletteSurface* p) : layout(TARGET_PALETTE), format(FORMAT_BGRA32), tiled(nullptr), palette(p), sparse(nullptr) {}
+    explicit RenderTarget(SparseSurface* s) : layout(TARGET_SPARSE), format(FORMAT_BGRA32), tiled(nullptr), palette(nullptr), sparse(s) {}
+
+    bool IsValid() const {
+        if (layout == TARGET_TILED) return tiled != nullptr;
+        if (layout == TARGET_PALETTE) return palette != nullptr;
+        if (layout == TARGET_SPARSE) return sparse != nullptr;
+        return linear.IsValid();
+    }
+    int Width() const {
+        if (layout == TARGET_TILED) return tiled->Width();
+        if (layout == TARGET_PALETTE) return palette->Width();
+        if (layout == TARGET_SPARSE) return sparse->Width();
+        return linear.width;
+    }
+    int Height() const {
+        if (layout == TARGET_TILED) return tiled->Height();
+        if (layout == TARGET_PALETTE) return palette->Height();
+        if (layout == TARGET_SPARSE) return sparse->Height();
+        return linear.height;
+    }
+};
+
+// Every target type offers the same static interface, so rasterizer loops are
+// instantiated per storage layout and pixel format and both the addressing
+// and the color conversion are resolved at compile time:
+//   Pixel Convert(COLORREF)            once per primitive
+//   Put(x, y, Pixel)                   pixels off the target are ignored
+//   Fill(y, x0, x1, Pixel)             span already clipped to the target
+//   StoreBgra(x, y, bgra, n)           run of packed colors, clipped
+//   Blend(batch, x, y, coverage)       coverage blend of the batch color
+//   COLORREF Get(x, y)                 see BgraToColor; CLR_INVALID off the target
+//   COLORREF Stored(COLORREF)          what Get returns after storing a color
+//   Width(), Height()
+template <class Format>
+class LinearTarget {
+public:
+    typedef typename Format::Pixel Pixel;
+    explicit LinearTarget(const Surface& s) : s(s) {}
+
+    int Width() const { return s.width; }
+    int Height() const { return s.height; }
+    static Pixel Convert(COLORREF c) { return Format::FromColor(c); }
+    Pixel* At(int x, int y) const { return (Pixel*)s.Row(y) + x; }
+
+    void Put(int x, int y, Pixel v) const {
+        if ((unsigned)x < (unsigned)s.width && (unsigned)y < (unsigned)s.height) *At(x, y) = v;
+    }
+    void Fill(int y, int x0, int x1, Pixel v) const {
+        Pixel* p = At(x0, y);
+        for (int n = x1 - x0 + 1; n > 0; n--) *p++ = v;
+    }
+    void StoreBgra(int x, int y, const DWORD* bgra, int n) const {
+        Pixel* p = At(x, y);
+        if (Format::Id == FORMAT_BGRA32) {
+            memcpy(p, bgra, n * 4);
+            return;
+        }
+        for (int i = 0; i < n; i++) p[i] = Format::FromBgra(bgra[i]);
+    }
+    // BGRA pixels go through the SSE2 batch; other formats are widened,
+    // blended and narrowed one at a time.
+    void Blend(BlendBatch& batch, int x, int y, int coverage) const {
+        if ((unsigned)x >= (unsigned)s.width || (unsigned)y >= (unsigned)s.height) return;
+        Pixel* p = At(x, y);
+        if (Format::Id == FORMAT_BGRA32) {
+            batch.Add((BYTE*)p, coverage);
+            return;
+        }
+        DWORD v = Format::ToBgra(*p);
+        BlendPixel((BYTE*)&v, batch.Color(), coverage);
+        *p = Format::FromBgra(v);
+    }
+    COLORREF Get(int x, int y) const {
+        if ((unsigned)x >= (unsigned)s.width || (unsigned)y >= (unsigned)s.height) return CLR_INVALID;
+        return BgraToColor(Format::ToBgra(*At(x, y)));
+    }
+    static COLORREF Stored(COLORREF c) {
+        return BgraToColor(Format::ToBgra(Format::FromColor(c)));
+    }
+
+private:
+    Surface s;
+};
+
+// The tiled canvas is the presentation store and is always BGRA32.
+template <bool Morton>
+class TiledTarget {
+public:
+    typedef DWORD Pixel;
+    explicit TiledTarget(TiledSurface& t) : t(t), shift(t.TileShift()), mask((1 << t.TileShift()) - 1) {}
+
+    int Width() const { return t.Width(); }
+    int Height() const { return t.Height(); }
+    static Pixel Convert(COLORREF c) { return FormatBgra32::FromColor(c); }
+    DWORD* At(int x, int y) const {
+        DWORD* tile = t.Tile(x >> shift, y >> shift);
+        if (Morton) return tile + TiledSurface::MortonOffset(x & mask, y & mask);
+        return tile + ((y & mask) << shift) + (x & mask);
+    }
+
+    void Put(int x, int y, Pixel v) const {
+        if ((unsigned)x < (unsigned)t.Width() && (unsigned)y < (unsigned)t.Height()) *At(x, y) = v;
+    }
+    void Fill(int y, int x0, int x1, Pixel v) const {
+        if (Morton) {
+            for (int x = x0; x <= x1; x++) *At(x, y) = v;
+            return;
+        }
+        // One contiguous run per tile the span crosses.
+        while (x0 <= x1) {
+            int end = min(x1, x0 | mask);
+            DWORD* p = At(x0, y);
+            for (int n = end - x0 + 1; n > 0; n--) *p++ = v;
+            x0 = end + 1;
+        }
+    }
+    void StoreBgra(int x, int y, const DWORD* bgra, int n) const {
+        for (int i = 0; i < n; i++) *At(x + i, y) = bgra[i];
+    }
+    void Blend(BlendBatch& batch, int x, int y, int coverage) const {
+        if ((unsigned)x < (unsigned)t.Width() && (unsigned)y < (unsigned)t.Height()) batch.Add((BYTE*)At(x, y), coverage);
+    }
+    COLORREF Get(int x, int y) const {
+        if ((unsigned)x >= (unsigned)t.Width() || (unsigned)y >= (unsigned)t.Height()) return CLR_INVALID;
+        return BgraToColor(*At(x, y));
+    }
+    static COLORREF Stored(COLORREF c) { return c; }
+
+private:
+    TiledSurface& t;
+    int shift, mask;
+};
+
+// Pixels are BGRA values; the surface maps them to tile palette indices,
+// once per span for fills.
+class PaletteTarget {
+public:
+    typedef DWORD Pixel;
+    explicit PaletteTarget(PaletteSurface& p) : p(p) {}
+
+    int Width() const { return p.Width(); }
+    int Height() const { return p.Height(); }
+    static Pixel Convert(COLORREF c) { return FormatBgra32::FromColor(c); }
+    void Put(int x, int y, Pixel v) const { p.Put(x, y, v); }
+    void Fill(int y, int x0, int x1, Pixel v) const { p.Fill(y, x0, x1, v); }
+    void StoreBgra(int x, int y, const DWORD* bgra, int n) const {
+        for (int i = 0; i < n; i++) p.Put(x + i, y, bgra[i]);
+    }
+    void Blend(BlendBatch& batch, int x, int y, int coverage) const {
+        if ((unsigned)x >= (unsigned)p.Width() || (unsigned)y >= (unsigned)p.Height()) return;
+        DWORD v = p.Get(x, y);
+        BlendPixel((BYTE*)&v, batch.Color(), coverage);
+        p.Put(x, y, v);
+    }
+    COLORREF Get(int x, int y) const {
+        if ((unsigned)x >= (unsigned)p.Width() || (unsigned)y >= (unsigned)p.Height()) return CLR_INVALID;
+        return BgraToColor(p.Get(x, y));
+    }
+    static COLORREF Stored(COLORREF c) { return c; }
+
+private:
+    PaletteSurface& p;
+};
+
+// Keeps the tile it last touched, so runs within a tile take the surface's
+// lock once. Reads of untouched tiles see the sentinel and allocate nothing.
+class SparseTarget {
+public:
+    typedef DWORD Pixel;
+    explicit SparseTarget(SparseSurface& s) : s(s), tileX(-1), tileY(-1), tile(nullptr), writable(false) {}
+
+    int Width() const { return s.Width(); }
+    int Height() const { return s.Height(); }
+    static Pixel Convert(COLORREF c) { return FormatBgra32::FromColor(c); }
+    DWORD* At(int x, int y) const {
+        int tx = x >> SparseSurface::TileShift, ty = y >> SparseSurface::TileShift;
+        if (tx != tileX || ty != tileY || !writable) {
+            tile = s.TileForWrite(tx, ty);
+            tileX = tx;
+            tileY = ty;
+            writable = true;
+        }
+        return tile + Offset(x, y);
+    }
+
+    void Put(int x, int y, Pixel v) const {
+        if ((unsigned)x < (unsigned)s.Width() && (unsigned)y < (unsigned)s.Height()) *At(x, y) = v;
+    }
+    void Fill(int y, int x0, int x1, Pixel v) const {
+        while (x0 <= x1) {
+            int end = min(x1, x0 | (SparseSurface::TileSize - 1));
+            DWORD* p = At(x0, y);
+            for (int n = end - x0 + 1; n > 0; n--) *p++ = v;
+            if (end == x1) break;
+            x0 = end + 1;
+        }
+    }
+    void StoreBgra(int x, int y, const DWORD* bgra, int n) const {
+        for (int i = 0; i < n; i++) *At(x + i, y) = bgra[i];
+    }
+    void Blend(BlendBatch& batch, int x, int y, int coverage) const {
+        if ((unsigned)x < (unsigned)s.Width() && (unsigned)y < (unsigned)s.Height()) batch.Add((BYTE*)At(x, y), coverage);
+    }
+    COLORREF Get(int x, int y) const {
+        if ((unsigned)x >= (unsigned)s.Width() || (unsigned)y >= (unsigned)s.Height()) return CLR_INVALID;
+        int tx = x >> SparseSurface::TileShift, ty = y >> SparseSurface::TileShift;
+        if (tx != tileX || ty != tileY) {
+            tile = (DWORD*)s.TileForRead(tx, ty);
+            tileX = tx;
+            tileY = ty;
+            writable = false;
+        }
+        return BgraToColor(tile[Offset(x, y)]);
+    }
+    static COLORREF Stored(COLORREF c) { return c; }
+
+private:
+    static int Offset(int x, int y) {
+        return ((y & (SparseSurface::TileSize - 1)) << SparseSurface::TileShift) | (x & (SparseSurface::TileSize - 1));
+    }
+
+    SparseSurface& s;
+    mutable int tileX, tileY;
+    mutable DWORD* tile;
+    mutable bool writable;
+};
+
+class GdiTarget {
+public:
+    typedef COLORREF Pixel;
+    explicit GdiTarget(HDC hdc) : hdc(hdc) {}
+
+    int Width() const { return INT_MAX; }
+    int Height() const { return INT_MAX; }
+    static Pixel Convert(COLORREF c) { return c; }
+    void Put(int x, int y, Pixel v) const { SetPixel(hdc, x, y, v); }
+    void Fill(int y, int x0, int x1, Pixel v) const {
+        for (int x = x0; x <= x1; x++) SetPixel(hdc, x, y, v);
+    }
+    void StoreBgra(int x, int y, const DWORD* bgra, int n) const {
+        for (int i = 0; i < n; i++) SetPixel(hdc, x + i, y, RGB((bgra[i] >> 16) & 0xFF, (bgra[i] >> 8) & 0xFF, bgra[i] & 0xFF));
+    }
+    void Blend(BlendBatch& batch, int x, int y, int coverage) const {
+        COLORREF old = GetPixel(hdc, x, y);
+        if (old == CLR_INVALID) return;
+        BYTE px[4] = { GetBValue(old), GetGValue(old), GetRValue(old), 255 };
+        BlendPixel(px, batch.Color(), coverage);
+        SetPixel(hdc, x, y, RGB(px[2], px[1], px[0]));
+    }
+    COLORREF Get(int x, int y) const { return GetPixel(hdc, x, y); }
+    static COLORREF Stored(COLORREF c) { return c; }
+
+private:
+    HDC hdc;
+};
+
+// Calls fn with the concrete type of the target.
+template <class Fn>
+void WithTarget(const RenderTarget& t, Fn&& fn) {
+    if (t.layout == TARGET_LINEAR) {
+        switch (t.format) {
+        case FORMAT_BGRA32: { LinearTarget<FormatBgra32> linear(t.linear); fn(linear); break; }
+        case FORMAT_RGBA32: { LinearTarget<FormatRgba32> linear(t.linear); fn(linear); break; }
+        case FORMAT_RGB565: { LinearTarget<FormatRgb565> linear(t.linear); fn(linear); break; }
+        case FORMAT_A8: { LinearTarget<FormatA8> linear(t.linear); fn(linear); break; }
+        case FORMAT_RGBA16: { LinearTarget<FormatRgba16> linear(t.linear); fn(linear); break; }
+        }
+    }
+    else if (t.layout == TARGET_SPARSE) {
+        SparseTarget sparse(*t.sparse);
+        fn(sparse);
+    }
+    else if (t.layout == TARGET_PALETTE) {
+        PaletteTarget palette(*t.palette);
+        fn(palette);
+    }
+    else if (t.tiled->IsMorton()) {
+        TiledTarget<true> tiled(*t.tiled);
+        fn(tiled);
+    }
+    else {
+        TiledTarget<false> tiled(*t.tiled);
+        fn(tiled);
+    }
+}
+
+#endif
@@ -0,0 +1,168 @@
+#include "TileRenderer.h"
+#include <algorithm>
+#include "Dirty.h"
+#include "PolygonFill.h"
+
+void SpanList::AddSpan(int y, int x0, int x1) {
+    if (!spans.empty() && y < spans.back().y)
+        sorted = false;
+    spans.push_back(Row{ y, x0, x1 });
+}
+
+void SpanList::Sort() {
+    if (!sorted)
+        std::stable_sort(spans.begin(), spans.end(), [](const Row& a, const Row& b) { return a.y < b.y; });
+    sorted = true;
+}
+
+RECT SpanList::Bounds() const {
+    RECT r = { INT_MAX, INT_MAX, INT_MIN, INT_MIN };
+    for (const Row& s : spans) {
+        r.left = min(r.left, (LONG)s.x0);
+        r.right = max(r.right, (LONG)s.x1);
+        r.top = min(r.top, (LONG)s.y);
+        r.bottom = max(r.bottom, (LONG)s.y);
+    }
+    return r;
+}
+
+void SpanList::Fill(RenderContext& ctx, COLORREF c) const {
+    const ClipRect& window = ctx.ClipWindow();
+    auto first = spans.begin(), last = spans.end();
+    if (window.enabled) {
+        first = std::lower_bound(spans.begin(), spans.end(), window.minY, [](const Row& s, int y) { return s.y < y; });
+        last = std::upper_bound(first, spans.end(), window.maxY, [](int y, const Row& s) { return y < s.y; });
+    }
+    for (auto it = first; it != last; ++it)
+        FillSpan(ctx, it->y, it->x0, it->x1, c);
+}
+
+TileRenderer::TileRenderer(int threads)
+    : owner(nullptr), nextTile(0), generation(0), busy(0), quit(false) {
+    if (threads <= 0)
+        threads = (int)std::thread::hardware_concurrency();
+    for (int i = 1; i < threads; i++)
+        workers.emplace_back(&TileRenderer::WorkerLoop, this);
+}
+
+TileRenderer::~TileRenderer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wake.notify_all();
+    for (std::thread& t : workers)
+        t.join();
+}
+
+void TileRenderer::Attach(RenderContext& context) {
+    Flush();
+    owner = &context;
+    target = context.target ? *context.target : RenderTarget();
+}
+
+void TileRenderer::Detach() {
+    Flush();
+    owner = nullptr;
+    target = RenderTarget();
+}
+
+void TileRenderer::Submit(int left, int top, int right, int bottom, DrawFn draw) {
+    if (!target.IsValid()) {
+        if (owner)
+            draw(*owner);
+        return;
+    }
+    left = max(left, 0);
+    top = max(top, 0);
+    right = min(right, target.Width() - 1);
+    bottom = min(bottom, target.Height() - 1);
+    if (left > right || top > bottom)
+        return;
+    int index = (int)commands.size();
+    commands.push_back(std::move(draw));
+    for (int ty = top >> DirtyTracker::TileShift; ty <= bottom >> DirtyTracker::TileShift; ty++) {
+        for (int tx = left >> DirtyTracker::TileShift; tx <= right >> DirtyTracker::TileShift; tx++) {
+            auto slot = binIndex.emplace(((unsigned long long)ty << 32) | (unsigned)tx, (int)bins.size());
+            if (slot.second)
+                bins.push_back(Bin{ tx, ty, std::vector<int>() });
+            bins[slot.first->second].commands.push_back(index);
+        }
+    }
+}
+
+void TileRenderer::SubmitSpans(std::shared_ptr<SpanList> spans, COLORREF c) {
+    if (spans->IsEmpty())
+        return;
+    spans->Sort();
+    RECT b = spans->Bounds();
+    Submit(b.left, b.top, b.right, b.bottom, [spans, c](RenderContext& ctx) { spans->Fill(ctx, c); });
+}
+
+void TileRenderer::Flush() {
+    if (bins.empty()) {
+        commands.clear();
+        return;
+    }
+    GdiFlush();
+    nextTile = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        generation++;
+        busy = (int)workers.size();
+    }
+    wake.notify_all();
+    RenderTiles(local);
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return busy == 0; });
+    }
+    bins.clear();
+    binIndex.clear();
+    commands.clear();
+}
+
+void TileRenderer::WorkerLoop() {
+    RenderContext ctx;
+    unsigned seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return quit || generation != seen; });
+            if (quit)
+                return;
+            seen = generation;
+        }
+        RenderTiles(ctx);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busy == 0)
+                done.notify_one();
+        }
+    }
+}
+
+// Tiles are handed out one at a time so uneven tiles balance across threads.
+// Each tile lines up with a dirty-tracker tile, so the marks a worker makes
+// never touch another worker's tile. A cancelled render job stops handing
+// out tiles.
+void TileRenderer::RenderTiles(RenderContext& ctx) {
+    ctx.hdc = owner->hdc;
+    ctx.target = &target;
+    ctx.canvas = owner->canvas;
+    ctx.queue = owner->queue;
+    for (;;) {
+        int i = nextTile++;
+        if (i >= (int)bins.size() || ctx.Cancelled())
+            break;
+        const Bin& bin = bins[i];
+        int x0 = bin.tx << DirtyTracker::TileShift, y0 = bin.ty << DirtyTracker::TileShift;
+        ClipRect tile(x0, y0, min(x0 + (DirtyTracker::TileSize - 1), target.Width() - 1), min(y0 + (DirtyTracker::TileSize - 1), target.Height() - 1));
+        ctx.SetScissor(&tile);
+        if (ctx.ClipWindow().IsEmpty())
+            continue;
+        for (int index : bin.commands)
+            commands[index](ctx);
+    }
+    ctx.SetScissor(nullptr);
+}
@@ -0,0 +1,88 @@
+#ifndef TILERENDERER_H
+#define TILERENDERER_H
+
+#include <windows.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "ClipRegion.h"
+#include "RenderContext.h"
+
+// Spans captured from a scanline rasterizer so a fill can be replayed tile by
+// tile without rebuilding its edge table.
+class SpanList : public SpanSink {
+public:
+    void AddSpan(int y, int x0, int x1) override;
+    bool IsEmpty() const { return spans.empty(); }
+    RECT Bounds() const;
+    // Orders the spans by row, which Fill relies on. Spans from the scanline
+    // fillers mostly arrive in order already.
+    void Sort();
+    // Fills the spans that fall inside the context's clip window.
+    void Fill(RenderContext& ctx, COLORREF c) const;
+
+private:
+    struct Row {
+        int y, x0, x1;
+    };
+    std::vector<Row> spans;
+    bool sorted = true;
+};
+
+// Deferred drawing over 64x64 tiles. Submitted primitives are binned by their
+// bounding box, with bins created only for tiles that receive work; Flush rasterizes every tile that received work on a thread
+// pool, replaying its primitives in submission order with the clip window
+// narrowed to the tile, so overlaps still composite in painter's order. Each
+// thread draws through its own context over the attached context's canvas
+// state, which is read at Flush time. Without a valid target (a DC that is
+// not a DIB section) the renderer draws immediately through the attached
+// context on the calling thread.
+class TileRenderer {
+public:
+    typedef std::function<void(RenderContext&)> DrawFn;
+
+    explicit TileRenderer(int threads = 0);
+    ~TileRenderer();
+
+    // The context must outlive the attachment; Detach ends it.
+    void Attach(RenderContext& context);
+    void Detach();
+    // Inclusive bounds; the primitive may be run once per tile it overlaps and
+    // must only draw through the clip-aware rasterizers.
+    void Submit(int left, int top, int right, int bottom, DrawFn draw);
+    void SubmitSpans(std::shared_ptr<SpanList> spans, COLORREF c);
+    void Flush();
+
+    int ThreadCount() const { return (int)workers.size() + 1; }
+
+private:
+    void WorkerLoop();
+    void RenderTiles(RenderContext& ctx);
+
+    struct Bin {
+        int tx, ty;
+        std::vector<int> commands;
+    };
+
+    RenderContext* owner;
+    RenderTarget target;
+    RenderContext local;
+    std::vector<DrawFn> commands;
+    std::vector<Bin> bins;
+    std::unordered_map<unsigned long long, int> binIndex;
+    std::atomic<int> nextTile;
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    unsigned generation;
+    int busy;
+    bool quit;
+};
+
+#endif
@@ -0,0 +1,77 @@
+#include "TiledSurface.h"
+#include <algorithm>
+#include <cstring>
+#include <emmintrin.h>
+
+// Bits of a 5-bit coordinate spread out to the even bit positions.
+const WORD TiledSurface::mortonSpread[32] = {
+    0x000, 0x001, 0x004, 0x005, 0x010, 0x011, 0x014, 0x015,
+    0x040, 0x041, 0x044, 0x045, 0x050, 0x051, 0x054, 0x055,
+    0x100, 0x101, 0x104, 0x105, 0x110, 0x111, 0x114, 0x115,
+    0x140, 0x141, 0x144, 0x145, 0x150, 0x151, 0x154, 0x155,
+};
+
+TiledSurface::TiledSurface(int width, int height, int tileShift, bool morton)
+    : width(width), height(height), tileShift(tileShift), morton(morton) {
+    int size = 1 << tileShift;
+    tilesX = (width + size - 1) >> tileShift;
+    tilesY = (height + size - 1) >> tileShift;
+    pixels.assign((size_t)tilesX * tilesY << (2 * tileShift), 0xFFFFFFFF);
+}
+
+void TiledSurface::Clear(DWORD bgra) {
+    std::fill(pixels.begin(), pixels.end(), bgra);
+}
+
+// Row-major tiles copy one memcpy per tile row. In Morton order each even/odd
+// pair of pixels in a row is adjacent, so two pairs are gathered with 64-bit
+// loads and stored as one 128-bit write.
+void TiledSurface::CopyTo(const Surface& dst, const RECT& r) const {
+    int mask = (1 << tileShift) - 1;
+    for (int y = max((int)r.top, 0); y < min((int)r.bottom, height); y++) {
+        DWORD* out = (DWORD*)dst.Row(y);
+        int ty = y >> tileShift, iy = y & mask;
+        for (int x = max((int)r.left, 0); x < min((int)r.right, width);) {
+            int tx = x >> tileShift;
+            int end = min(min((tx + 1) << tileShift, (int)r.right), width);
+            const DWORD* tile = Tile(tx, ty);
+            if (!morton) {
+                memcpy(out + x, tile + (iy << tileShift) + (x & mask), (end - x) * 4);
+                x = end;
+                continue;
+            }
+            unsigned rowBits = mortonSpread[iy] << 1;
+            if (x & 1) {
+                out[x] = tile[mortonSpread[x & mask] | rowBits];
+                x++;
+            }
+            for (; x + 4 <= end; x += 4) {
+                __m128i lo = _mm_loadl_epi64((const __m128i*)(tile + (mortonSpread[x & mask] | rowBits)));
+                __m128i hi = _mm_loadl_epi64((const __m128i*)(tile + (mortonSpread[(x + 2) & mask] | rowBits)));
+                _mm_storeu_si128((__m128i*)(out + x), _mm_unpacklo_epi64(lo, hi));
+            }
+            for (; x < end; x++)
+                out[x] = tile[mortonSpread[x & mask] | rowBits];
+        }
+    }
+}
+
+void TiledSurface::CopyFrom(const Surface& src, const RECT& r) {
+    int mask = (1 << tileShift) - 1;
+    for (int y = max((int)r.top, 0); y < min((int)r.bottom, height); y++) {
+        const DWORD* in = (const DWORD*)src.Row(y);
+        int ty = y >> tileShift, iy = y & mask;
+        for (int x = max((int)r.left, 0); x < min((int)r.right, width);) {
+            int tx = x >> tileShift;
+            int end = min(min((tx + 1) << tileShift, (int)r.right), width);
+            DWORD* tile = Tile(tx, ty);
+            if (!morton) {
+                memcpy(tile + (iy << tileShift) + (x & mask), in + x, (end - x) * 4);
+                x = end;
+                continue;
+            }
+            for (; x < end; x++)
+                tile[MortonOffset(x & mask, iy)] = in[x];
+        }
+    }
+}
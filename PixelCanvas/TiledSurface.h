@@ -0,0 +1,43 @@
+#ifndef TILEDSURFACE_H
+#define TILEDSURFACE_H
+
+#include <windows.h>
+#include <vector>
+#include "Surface.h"
+
+// Canvas storage split into square tiles of 8x8 or 32x32 BGRA pixels, each
+// tile contiguous in memory. Inside a tile pixels are row-major, or in Morton
+// (Z) order, where vertical neighbours are also close together. A steep line
+// or a column of a fill then stays within a few cache lines and one page per
+// tile instead of touching a new row of the whole canvas for every pixel.
+class TiledSurface {
+public:
+    TiledSurface(int width, int height, int tileShift, bool morton);
+
+    int Width() const { return width; }
+    int Height() const { return height; }
+    int TileShift() const { return tileShift; }
+    bool IsMorton() const { return morton; }
+
+    // Pixel offset of (x, y) within the tile that holds it.
+    static unsigned MortonOffset(int x, int y) { return mortonSpread[x] | (mortonSpread[y] << 1); }
+    DWORD* Tile(int tx, int ty) { return &pixels[((size_t)ty * tilesX + tx) << (2 * tileShift)]; }
+    const DWORD* Tile(int tx, int ty) const { return &pixels[((size_t)ty * tilesX + tx) << (2 * tileShift)]; }
+
+    void Clear(DWORD bgra);
+    // De-tiles the rectangle (right/bottom exclusive) into a linear surface of
+    // the same size, e.g. the window's DIB for presentation or export.
+    void CopyTo(const Surface& dst, const RECT& r) const;
+    void CopyFrom(const Surface& src, const RECT& r);
+
+private:
+    static const WORD mortonSpread[32];
+
+    int width, height;
+    int tileShift;
+    bool morton;
+    int tilesX, tilesY;
+    std::vector<DWORD> pixels;
+};
+
+#endif
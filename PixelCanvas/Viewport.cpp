@@ -0,0 +1,48 @@
+#include "Viewport.h"
+#include <cmath>
+
+// Window coordinates are clamped before they are narrowed to int, since a
+// canvas rectangle can lie far outside the window.
+static int ClampToWindow(double v) {
+    return (int)max(-1e9, min(1e9, v));
+}
+
+POINT Viewport::ToCanvas(int x, int y) const {
+    POINT p;
+    p.x = ClampToWindow(floor(originX + (x + 0.5) / scale));
+    p.y = ClampToWindow(floor(originY + (y + 0.5) / scale));
+    return p;
+}
+
+// Canvas edges are rounded out to the level's pixels first; the window pixels
+// whose centers sample inside then lie within the rounded-out span.
+RECT Viewport::ToWindow(const RECT& canvas, int level) const {
+    double size = (double)(1LL << level);
+    double left = floor(canvas.left / size) * size, right = ceil(canvas.right / size) * size;
+    double top = floor(canvas.top / size) * size, bottom = ceil(canvas.bottom / size) * size;
+    RECT r;
+    r.left = ClampToWindow(floor((left - originX) * scale));
+    r.top = ClampToWindow(floor((top - originY) * scale));
+    r.right = ClampToWindow(ceil((right - originX) * scale));
+    r.bottom = ClampToWindow(ceil((bottom - originY) * scale));
+    return r;
+}
+
+void Viewport::ZoomAbout(int x, int y, double factor, double minScale, double maxScale) {
+    double cx = originX + x / scale, cy = originY + y / scale;
+    scale = max(minScale, min(maxScale, scale * factor));
+    originX = cx - x / scale;
+    originY = cy - y / scale;
+}
+
+void Viewport::Pan(int dx, int dy) {
+    originX -= dx / scale;
+    originY -= dy / scale;
+}
+
+int Viewport::Level(int levels) const {
+    int level = 0;
+    while (level + 1 < levels && scale * (double)(2LL << level) <= 1.0)
+        level++;
+    return level;
+}
@@ -0,0 +1,28 @@
+#ifndef VIEWPORT_H
+#define VIEWPORT_H
+
+#include <windows.h>
+
+// Maps the canvas area of the window to canvas pixels. scale is window pixels
+// per canvas pixel and (originX, originY) the canvas position at the area's
+// top-left corner.
+struct Viewport {
+    double scale;
+    double originX, originY;
+
+    Viewport() : scale(1), originX(0), originY(0) {}
+
+    // Canvas pixel sampled for the window pixel (x, y).
+    POINT ToCanvas(int x, int y) const;
+    // Window pixels that show the canvas rectangle (right/bottom exclusive)
+    // when drawn from the given mip level.
+    RECT ToWindow(const RECT& canvas, int level) const;
+    // Multiplies the scale within [minScale, maxScale], keeping the canvas
+    // point under (x, y) in place.
+    void ZoomAbout(int x, int y, double factor, double minScale, double maxScale);
+    void Pan(int dx, int dy);
+    // Coarsest of the given levels whose pixels are no smaller than a window pixel.
+    int Level(int levels) const;
+};
+
+#endif